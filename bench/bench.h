@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Small helpers shared by the benchmark programs in this directory.
+//
+// Every benchmark prints one JSON object per line to stdout, so the output of
+// `make bench` can be collected and compared between releases.
+//
+
+#ifndef SST_BENCH_H
+#define SST_BENCH_H
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+typedef struct sbench_stats {
+    size_t count;
+    double min_us;
+    double p50_us;
+    double p90_us;
+    double p99_us;
+    double max_us;
+    double mean_us;
+} bench_stats;
+
+static inline void bench_fatal(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "bench: error: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+
+    exit(1);
+}
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Where the `sst` binary under test is. $SST overrides the default.
+static inline const char* bench_sst_path(void) {
+    const char* sst = getenv("SST");
+    return (sst && sst[0]) ? sst : "./sst";
+}
+
+// How many iterations to run; $BENCH_ITERATIONS overrides `dflt`.
+static inline size_t bench_iterations(size_t dflt) {
+    const char* iters = getenv("BENCH_ITERATIONS");
+    if (!iters || !iters[0]) {
+        return dflt;
+    }
+    const long n = strtol(iters, NULL, 10);
+    return n > 0 ? (size_t)n : dflt;
+}
+
+// fork()s, exec()s `argv` with stdout/stderr sent to /dev/null, waits for it
+// and returns the elapsed wall time in nanoseconds. Returns 0 if the command
+// did not exit successfully.
+static inline uint64_t bench_run_command(char *const *argv) {
+    const uint64_t start = bench_now_ns();
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        bench_fatal("fork failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        const int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, 1);
+            dup2(devnull, 2);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            bench_fatal("waitpid failed: %s", strerror(errno));
+        }
+    }
+
+    const uint64_t elapsed = bench_now_ns() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return 0;
+    }
+    return elapsed;
+}
+
+static inline int bench_cmp_u64(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts `samples` in place.
+static inline bench_stats bench_compute_stats(uint64_t* samples, size_t count) {
+    bench_stats st = {0};
+    if (count == 0) {
+        return st;
+    }
+
+    qsort(samples, count, sizeof(uint64_t), bench_cmp_u64);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        sum += (double)samples[i];
+    }
+
+    st.count = count;
+    st.min_us = samples[0] / 1000.0;
+    st.p50_us = samples[(count - 1) * 50 / 100] / 1000.0;
+    st.p90_us = samples[(count - 1) * 90 / 100] / 1000.0;
+    st.p99_us = samples[(count - 1) * 99 / 100] / 1000.0;
+    st.max_us = samples[count - 1] / 1000.0;
+    st.mean_us = sum / count / 1000.0;
+    return st;
+}
+
+// Prints the tail of a JSON object that the caller has opened with its own
+// identifying fields, e.g.:
+//
+//   printf("{\"bench\":\"foo\",\"rules\":%zu,", n);
+//   bench_print_stats(&st);
+static inline void bench_print_stats(const bench_stats* st) {
+    printf("\"iterations\":%zu,\"min_us\":%.2f,\"p50_us\":%.2f,\"p90_us\":%.2f,"
+           "\"p99_us\":%.2f,\"max_us\":%.2f,\"mean_us\":%.2f}\n",
+           st->count, st->min_us, st->p50_us, st->p90_us,
+           st->p99_us, st->max_us, st->mean_us);
+    fflush(stdout);
+}
+
+// Creates a fresh temporary directory and returns its path (malloc()ed).
+static inline char* bench_make_tmpdir(const char* tag) {
+    const char* base = getenv("TMPDIR");
+    if (!base || !base[0]) {
+        base = "/tmp";
+    }
+    char* path = NULL;
+    if (asprintf(&path, "%s/sst-bench-%s-XXXXXX", base, tag) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    if (!mkdtemp(path)) {
+        bench_fatal("mkdtemp(%s) failed: %s", path, strerror(errno));
+    }
+    return path;
+}
+
+static inline void bench_remove_tree(const char* path) {
+    char* cmd = NULL;
+    if (asprintf(&cmd, "rm -rf '%s'", path) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    if (system(cmd) != 0) {
+        fprintf(stderr, "bench: warning: could not remove '%s'\n", path);
+    }
+    free(cmd);
+}
+
+#endif
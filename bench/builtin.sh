@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: GPL-3.0-only
+#
+# Commands/sec of a bash loop running `sst <policy> -- /bin/true` with the
+# `sst` executable vs. the loadable builtin (sst_builtin.so), and of plain
+# `/bin/true` for reference.
+#
+# Usage: SST=./sst SST_BUILTIN=./sst_builtin.so bench/builtin.sh
+#
+# Prints one JSON object per line, like the other benchmarks.
+#
+
+set -euo pipefail
+
+SST=${SST:-./sst}
+SST_BUILTIN=${SST_BUILTIN:-./sst_builtin.so}
+ITERATIONS=${BENCH_ITERATIONS:-2000}
+
+POLICY=(ENABLE_FILESYSTEM_SANDBOXING PATH_BENEATH_EXEC:/)
+
+now_ns() {
+    date +%s%N
+}
+
+report() {
+    local mode=$1 start=$2 end=$3
+    local elapsed_ns=$((end - start))
+    awk -v mode="$mode" -v n="$ITERATIONS" -v ns="$elapsed_ns" 'BEGIN {
+        printf("{\"bench\":\"builtin\",\"mode\":\"%s\",\"commands\":%d,\"commands_per_sec\":%.1f,\"mean_us\":%.2f}\n",
+               mode, n, n / (ns / 1e9), ns / n / 1000.0)
+    }'
+}
+
+if [[ ! -x "$SST" ]]; then
+    echo "bench: error: '$SST' is not executable" >&2
+    exit 1
+fi
+if [[ ! -f "$SST_BUILTIN" ]]; then
+    echo "bench: error: '$SST_BUILTIN' not found (make builtin)" >&2
+    exit 1
+fi
+
+start=$(now_ns)
+for ((i = 0; i < ITERATIONS; i++)); do
+    /bin/true
+done
+report unsandboxed "$start" "$(now_ns)"
+
+start=$(now_ns)
+for ((i = 0; i < ITERATIONS; i++)); do
+    "$SST" "${POLICY[@]}" -- /bin/true
+done
+report external "$start" "$(now_ns)"
+
+enable -f "$SST_BUILTIN" sst
+start=$(now_ns)
+for ((i = 0; i < ITERATIONS; i++)); do
+    sst "${POLICY[@]}" -- /bin/true
+done
+report builtin "$start" "$(now_ns)"
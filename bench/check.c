@@ -0,0 +1,509 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// `sst --check` against the kernel, and how fast it goes.
+//
+// - differential: the same policy and queries through `sst --check` and
+//   through the kernel, by running this program under `sst`
+//   (`bench/check --probe <queries>`) to actually try every query: open()
+//   for reading, writing and listing, execve() of a file that isn't an
+//   executable (EACCES is Landlock, ENOEXEC means it would have run),
+//   truncate(), creating and removing entries. The queries are every path of
+//   a small tree built here, with rules of every kind on it and symlinks to
+//   a file and a directory in it, plus a sample of what's in /etc and
+//   /usr/share, read and listed. Queries that fail without any sandbox
+//   (say, unreadable files when not root) are skipped.
+//   Any disagreement is printed and fails the bench.
+// - check: the wall time of `sst --check` on $BENCH_CHECK_QUERIES
+//   (default 2000000) made-up queries under 500 rules, on one thread and on
+//   one per CPU, and with --no-resolve.
+//
+// Usage: SST=./sst bench/check
+//
+
+#include "bench.h"
+
+#include <dirent.h>
+#include <limits.h>
+
+#define TREE_DIRS (sizeof(tree_dirs) / sizeof(tree_dirs[0]))
+#define SYSTEM_SAMPLES 200
+#define MANY_DIRS 500
+
+static const char* const tree_dirs[] = {
+    "ro", "ro/sub", "ro/deep", "ro/deep/er", "rw", "rw/sub", "rx", "xw", "none", "none/sub", "mixed", "mixed/in",
+};
+
+// The policy on the tree, relative to it, and on the rest of the system.
+static const char* const tree_rules[] = {
+    "PATH_BENEATH_READ:ro",
+    "PATH_BENEATH_WRITE:ro/sub",
+    "PATH_BENEATH_WRITE:rw",
+    "PATH_BENEATH_EXEC:rx",
+    "PATH_BENEATH_EXEC_WRITE:xw",
+    "FILE_WRITE:none/f0",
+    "FILE_READ:link",
+    "FILE_EXEC:mixed/f0",
+    "PATH_BENEATH_READ:mixed/in",
+};
+static const char* const system_rules[] = {
+    "FILE_READ:/etc/passwd",
+    "PATH_BENEATH_READ:/usr/share",
+};
+
+// The probe: tries every query, prints the ones the kernel denies.
+static int probe_main(const char* queries) {
+    FILE* in = fopen(queries, "r");
+    if (!in) {
+        return 1;
+    }
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, in)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        char* path = strchr(line, ' ');
+        if (!path) {
+            continue;
+        }
+        *path++ = '\0';
+        int fd = -1;
+        int ok = 0;
+        errno = 0;
+        if (strcmp(line, "read_file") == 0) {
+            ok = (fd = open(path, O_RDONLY)) >= 0;
+        } else if (strcmp(line, "write_file") == 0) {
+            ok = (fd = open(path, O_WRONLY)) >= 0;
+        } else if (strcmp(line, "read_dir") == 0) {
+            ok = (fd = open(path, O_RDONLY | O_DIRECTORY)) >= 0;
+        } else if (strcmp(line, "execute") == 0) {
+            char* argv[] = { path, NULL };
+            execve(path, argv, NULL);
+        } else if (strcmp(line, "truncate") == 0) {
+            struct stat sb;
+            ok = stat(path, &sb) == 0 && truncate(path, sb.st_size) == 0;
+        } else if (strcmp(line, "make_reg") == 0) {
+            ok = (fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644)) >= 0;
+        } else if (strcmp(line, "make_dir") == 0) {
+            ok = mkdir(path, 0755) == 0;
+        } else if (strcmp(line, "make_sym") == 0) {
+            ok = symlink("target", path) == 0;
+        } else if (strcmp(line, "remove_file") == 0) {
+            ok = unlink(path) == 0;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!ok && errno == EACCES) {
+            printf("%s %s\n", line, path);
+        }
+    }
+    free(line);
+    fclose(in);
+    return fflush(stdout) != 0;
+}
+
+static void write_file(const char* path, const char* content, mode_t mode) {
+    FILE* f = fopen(path, "w");
+    if (!f || fputs(content, f) < 0 || fclose(f) != 0 || chmod(path, mode) != 0) {
+        bench_fatal("cannot write '%s': %s", path, strerror(errno));
+    }
+}
+
+// Runs `argv` with stdout to `out_path`; returns the exit status.
+static int run_to_file(char** argv, const char* out_path) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        bench_fatal("fork failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        const int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const int devnull = open("/dev/null", O_WRONLY);
+        if (out < 0 || devnull < 0) {
+            _exit(127);
+        }
+        dup2(out, 1);
+        dup2(devnull, 2);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        bench_fatal("'%s' did not exit", argv[0]);
+    }
+    return WEXITSTATUS(status);
+}
+
+typedef struct slines {
+    char** lines;
+    size_t count;
+} lines;
+
+static int cmp_str(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// The lines of `path`, sorted.
+static lines read_lines(const char* path) {
+    lines ls = {0};
+    size_t capacity = 0;
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        bench_fatal("cannot open '%s': %s", path, strerror(errno));
+    }
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (ls.count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            ls.lines = realloc(ls.lines, capacity * sizeof(char*));
+            if (!ls.lines) {
+                bench_fatal("out of memory");
+            }
+        }
+        ls.lines[ls.count++] = strdup(line);
+    }
+    free(line);
+    fclose(f);
+    qsort(ls.lines, ls.count, sizeof(char*), cmp_str);
+    return ls;
+}
+
+static int has_line(const lines* ls, const char* line) {
+    return bsearch(&line, ls->lines, ls->count, sizeof(char*), cmp_str) != NULL;
+}
+
+static void free_lines(lines* ls) {
+    for (size_t i = 0; i < ls->count; i++) {
+        free(ls->lines[i]);
+    }
+    free(ls->lines);
+}
+
+// Read or list queries for up to `max` entries of `dir`.
+static size_t sample_dir(FILE* out, const char* dir, size_t max) {
+    DIR* d = opendir(dir);
+    if (!d) {
+        return 0;
+    }
+    size_t count = 0;
+    struct dirent* de;
+    while (count < max && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char path[PATH_MAX];
+        struct stat sb;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (lstat(path, &sb) != 0 || !(S_ISREG(sb.st_mode) || S_ISDIR(sb.st_mode))) {
+            continue;
+        }
+        fprintf(out, "%s %s\n", S_ISDIR(sb.st_mode) ? "read_dir" : "read_file", path);
+        count++;
+    }
+    closedir(d);
+    return count;
+}
+
+// `sst` + the policy + `extra` (NULL-terminated) + "--" + `command`.
+static char** policy_argv(const char* sst, char** rules, size_t rule_count, char** extra, char** command) {
+    char** argv = calloc(rule_count + 16, sizeof(char*));
+    if (!argv) {
+        bench_fatal("out of memory");
+    }
+    size_t n = 0;
+    argv[n++] = (char*)sst;
+    while (extra && *extra) {
+        argv[n++] = *extra++;
+    }
+    argv[n++] = "ENABLE_FILESYSTEM_SANDBOXING";
+    for (size_t i = 0; i < rule_count; i++) {
+        argv[n++] = rules[i];
+    }
+    if (command) {
+        argv[n++] = "--";
+        while (*command) {
+            argv[n++] = *command++;
+        }
+    }
+    return argv;
+}
+
+static char* path_join(const char* a, const char* b) {
+    char* path = NULL;
+    if (asprintf(&path, "%s/%s", a, b) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    return path;
+}
+
+static void differential(const char* sst, const char* self, const char* dir) {
+    char* tree = path_join(dir, "tree");
+    char* queries = path_join(dir, "queries");
+    char* system_queries = path_join(dir, "system_queries");
+    char* check_out = path_join(dir, "check.out");
+    char* probe_out = path_join(dir, "probe.out");
+    char* baseline_out = path_join(dir, "baseline.out");
+
+    if (mkdir(tree, 0755) != 0) {
+        bench_fatal("cannot create '%s': %s", tree, strerror(errno));
+    }
+    FILE* q = fopen(queries, "w");
+    if (!q) {
+        bench_fatal("cannot write '%s': %s", queries, strerror(errno));
+    }
+    for (size_t i = 0; i < TREE_DIRS; i++) {
+        char* d = path_join(tree, tree_dirs[i]);
+        if (mkdir(d, 0755) != 0) {
+            bench_fatal("cannot create '%s': %s", d, strerror(errno));
+        }
+        fprintf(q, "read_dir %s\nmake_reg %s/new\nmake_dir %s/newdir\nmake_sym %s/newsym\nremove_file %s/victim\n",
+                d, d, d, d, d);
+        char* victim = path_join(d, "victim");
+        write_file(victim, "", 0644);
+        free(victim);
+        for (int f = 0; f < 2; f++) {
+            char* file = NULL;
+            if (asprintf(&file, "%s/f%d", d, f) < 0) {
+                bench_fatal("asprintf failed");
+            }
+            // Not an executable, so execve() only gets as far as Landlock.
+            write_file(file, "not an executable\n", 0755);
+            fprintf(q, "read_file %s\nwrite_file %s\nexecute %s\ntruncate %s\n", file, file, file, file);
+            free(file);
+        }
+        free(d);
+    }
+    char* link = path_join(tree, "link");
+    char* link_target = path_join(tree, "none/f1");
+    if (symlink(link_target, link) != 0) {
+        bench_fatal("cannot create '%s': %s", link, strerror(errno));
+    }
+    fprintf(q, "read_file %s\nwrite_file %s\n", link, link);
+    // Through a symlinked directory, to something that exists and to
+    // something that doesn't yet.
+    char* dir_link = path_join(tree, "linkdir");
+    char* dir_link_target = path_join(tree, "ro");
+    if (symlink(dir_link_target, dir_link) != 0) {
+        bench_fatal("cannot create '%s': %s", dir_link, strerror(errno));
+    }
+    fprintf(q, "read_file %s/f0\nwrite_file %s/f0\nmake_reg %s/new2\nread_dir %s/sub\nmake_reg %s/sub/new2\n",
+            dir_link, dir_link, dir_link, dir_link, dir_link);
+
+    FILE* sq = fopen(system_queries, "w");
+    if (!sq) {
+        bench_fatal("cannot write '%s': %s", system_queries, strerror(errno));
+    }
+    sample_dir(sq, "/etc", SYSTEM_SAMPLES / 2);
+    sample_dir(sq, "/usr/share", SYSTEM_SAMPLES / 2);
+    fclose(sq);
+    // The system samples are the same in both query files.
+    lines system = read_lines(system_queries);
+    for (size_t i = 0; i < system.count; i++) {
+        fprintf(q, "%s\n", system.lines[i]);
+    }
+    free_lines(&system);
+    fclose(q);
+
+    // What fails anyway.
+    char* baseline_argv[] = { (char*)self, "--probe", system_queries, NULL };
+    if (run_to_file(baseline_argv, baseline_out) != 0) {
+        bench_fatal("the probe failed without a sandbox");
+    }
+
+    const size_t tree_rule_count = sizeof(tree_rules) / sizeof(tree_rules[0]);
+    const size_t system_rule_count = sizeof(system_rules) / sizeof(system_rules[0]);
+    char** rules = calloc(tree_rule_count + system_rule_count + 2, sizeof(char*));
+    if (!rules) {
+        bench_fatal("out of memory");
+    }
+    size_t rule_count = 0;
+    for (size_t i = 0; i < tree_rule_count; i++) {
+        const char* colon = strchr(tree_rules[i], ':');
+        if (asprintf(&rules[rule_count++], "%.*s:%s/%s", (int)(colon - tree_rules[i]), tree_rules[i], tree,
+                     colon + 1) < 0) {
+            bench_fatal("asprintf failed");
+        }
+    }
+    for (size_t i = 0; i < system_rule_count; i++) {
+        rules[rule_count++] = strdup(system_rules[i]);
+    }
+    // What the probe needs to run at all. It's static.
+    if (asprintf(&rules[rule_count++], "FILE_EXEC:%s", self) < 0 ||
+        asprintf(&rules[rule_count++], "FILE_READ:%s", queries) < 0) {
+        bench_fatal("asprintf failed");
+    }
+
+    // `sst --check` first: the probe creates and removes things.
+    char* check_extra[] = { "--check", queries, NULL };
+    char** check_argv = policy_argv(sst, rules, rule_count, check_extra, NULL);
+    const int check_status = run_to_file(check_argv, check_out);
+    if (check_status != 0 && check_status != 2) {
+        bench_fatal("sst --check failed (exit status %d)", check_status);
+    }
+    char* probe_command[] = { (char*)self, "--probe", queries, NULL };
+    char** probe_argv = policy_argv(sst, rules, rule_count, NULL, probe_command);
+    if (run_to_file(probe_argv, probe_out) != 0) {
+        bench_fatal("the probe failed under sst");
+    }
+
+    lines all = read_lines(queries);
+    lines checked = read_lines(check_out);
+    lines kernel = read_lines(probe_out);
+    lines baseline = read_lines(baseline_out);
+    size_t skipped = 0;
+    size_t denied = 0;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < all.count; i++) {
+        const char* query = all.lines[i];
+        if (has_line(&baseline, query)) {
+            skipped++;
+            continue;
+        }
+        const int by_check = has_line(&checked, query);
+        const int by_kernel = has_line(&kernel, query);
+        denied += by_kernel;
+        if (by_check != by_kernel) {
+            fprintf(stderr, "bench: mismatch: %s: sst --check %s, the kernel %s\n", query,
+                    by_check ? "denies" : "allows", by_kernel ? "denies" : "allows");
+            mismatches++;
+        }
+    }
+    printf("{\"bench\":\"check\",\"measure\":\"differential\",\"queries\":%zu,\"skipped\":%zu,\"denied\":%zu,"
+           "\"mismatches\":%zu}\n", all.count, skipped, denied, mismatches);
+    fflush(stdout);
+    if (mismatches > 0) {
+        bench_fatal("sst --check and the kernel disagree on %zu queries", mismatches);
+    }
+
+    free_lines(&all);
+    free_lines(&checked);
+    free_lines(&kernel);
+    free_lines(&baseline);
+    free(probe_argv);
+    free(check_argv);
+    for (size_t i = 0; i < rule_count; i++) {
+        free(rules[i]);
+    }
+    free(rules);
+    free(link);
+    free(link_target);
+    free(dir_link);
+    free(dir_link_target);
+    free(tree);
+    free(queries);
+    free(system_queries);
+    free(check_out);
+    free(probe_out);
+    free(baseline_out);
+}
+
+static void throughput(const char* sst, const char* dir) {
+    const char* count_env = getenv("BENCH_CHECK_QUERIES");
+    const size_t query_count = count_env && atol(count_env) > 0 ? (size_t)atol(count_env) : 2000000;
+    char* many = path_join(dir, "many");
+    char* queries = path_join(dir, "many_queries");
+    char* out = path_join(dir, "many.out");
+    if (mkdir(many, 0755) != 0) {
+        bench_fatal("cannot create '%s': %s", many, strerror(errno));
+    }
+
+    char** rules = calloc(MANY_DIRS, sizeof(char*));
+    if (!rules) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < MANY_DIRS; i++) {
+        char* d = NULL;
+        if (asprintf(&d, "%s/d%zu", many, i) < 0 || mkdir(d, 0755) != 0 ||
+            asprintf(&rules[i], "%s:%s", i % 3 == 0 ? "PATH_BENEATH_WRITE" : "PATH_BENEATH_READ", d) < 0) {
+            bench_fatal("cannot create '%s'", d ? d : many);
+        }
+        free(d);
+    }
+
+    static const char* const accesses[] = { "read", "write", "exec", "list", "make_reg" };
+    FILE* q = fopen(queries, "w");
+    if (!q) {
+        bench_fatal("cannot write '%s': %s", queries, strerror(errno));
+    }
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < query_count; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        // A few paths outside of every rule, too.
+        fprintf(q, "%s %s/d%u/lib%u/file%u.so\n", accesses[x % 5], x % 50 == 0 ? "/var/tmp" : many,
+                (unsigned)((x >> 8) % (MANY_DIRS + 20)), (unsigned)((x >> 20) % 64), (unsigned)((x >> 32) % 1000));
+    }
+    fclose(q);
+
+    static const char* const modes[][3] = {
+        { "threads_1", "1", NULL },
+        { "threads_all", "0", NULL },
+        { "no_resolve_threads_1", "1", "--no-resolve" },
+        { "no_resolve_threads_all", "0", "--no-resolve" },
+    };
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        char* extra[] = { "--check", queries, "--threads", (char*)modes[m][1], (char*)modes[m][2], NULL };
+        char** argv = policy_argv(sst, rules, MANY_DIRS, extra, NULL);
+        const size_t iterations = bench_iterations(5);
+        uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+        if (!samples) {
+            bench_fatal("out of memory");
+        }
+        for (size_t i = 0; i < iterations; i++) {
+            const uint64_t start = bench_now_ns();
+            const int status = run_to_file(argv, out);
+            samples[i] = bench_now_ns() - start;
+            if (status != 0 && status != 2) {
+                bench_fatal("sst --check failed (exit status %d) in mode %s", status, modes[m][0]);
+            }
+        }
+        printf("{\"bench\":\"check\",\"mode\":\"%s\",\"queries\":%zu,\"rules\":%d,\"measure\":\"check\",", modes[m][0],
+               query_count, MANY_DIRS);
+        const bench_stats st = bench_compute_stats(samples, iterations);
+        bench_print_stats(&st);
+        free(samples);
+        free(argv);
+    }
+
+    for (size_t i = 0; i < MANY_DIRS; i++) {
+        free(rules[i]);
+    }
+    free(rules);
+    free(many);
+    free(queries);
+    free(out);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], "--probe") == 0) {
+        return probe_main(argv[2]);
+    }
+
+    const char* sst = bench_sst_path();
+    char self[PATH_MAX];
+    const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        bench_fatal("readlink(/proc/self/exe) failed: %s", strerror(errno));
+    }
+    self[self_len] = '\0';
+
+    char* tmp = bench_make_tmpdir("check");
+    // Query paths are compared as they are, so no symlinks in them.
+    char* dir = realpath(tmp, NULL);
+    if (!dir) {
+        bench_fatal("realpath(%s) failed: %s", tmp, strerror(errno));
+    }
+    differential(sst, self, dir);
+    throughput(sst, dir);
+    bench_remove_tree(dir);
+    free(dir);
+    free(tmp);
+    return 0;
+}
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// What EXEC_DEPS costs at every launch of a program with hundreds of shared
+// libraries: the wall time of `sst ENABLE_FILESYSTEM_SANDBOXING EXEC_DEPS --
+// prog` with the dependency walk done every time (SST_CACHE_DIR=), with the
+// cached result, and with a single PATH_BENEATH_EXEC rule over everything
+// for reference.
+//
+// For the EXEC_DEPS modes, the time `sst` itself spends on it (its
+// --timing "exec_deps" phase) is reported too, as measure "exec_deps".
+//
+// The program is built here: $BENCH_EXEC_DEPS_LIBS shared libraries (default
+// 300) in a temporary directory, found through DT_RUNPATH=$ORIGIN, and an
+// executable that needs all of them. That needs `cc`.
+//
+// Usage: SST=./sst bench/exec_deps
+//
+
+#include "bench.h"
+
+#include <limits.h>
+
+static void run_cc(char** argv) {
+    if (bench_run_command(argv) == 0) {
+        bench_fatal("'%s' failed; bench/exec_deps needs a working cc", argv[0]);
+    }
+}
+
+static void write_file(const char* path, const char* content) {
+    FILE* f = fopen(path, "w");
+    if (!f || fputs(content, f) < 0 || fclose(f) != 0) {
+        bench_fatal("cannot write '%s': %s", path, strerror(errno));
+    }
+}
+
+// The "exec_deps" phase in the --timing JSON in `fd`, in ns; 0 if none.
+static uint64_t read_exec_deps_ns(int fd) {
+    char buf[16384];
+    const ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0 || ftruncate(fd, 0) != 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    const char* phase = strstr(buf, "{\"name\":\"exec_deps\"");
+    const char* dur = phase ? strstr(phase, "\"dur_us\":") : NULL;
+    return dur ? (uint64_t)(strtod(dur + 9, NULL) * 1000.0) : 0;
+}
+
+// With --timing=3 in `argv`, `timing_fd` is 3 for the command.
+static void run(const char* mode, char** argv, const char* cache_dir, size_t libs, int timing_fd) {
+    setenv("SST_CACHE_DIR", cache_dir, 1);
+    // The first run fills the cache.
+    if (bench_run_command(argv) == 0) {
+        bench_fatal("'%s' failed in mode %s", argv[0], mode);
+    }
+    if (timing_fd >= 0) {
+        read_exec_deps_ns(timing_fd);
+    }
+    const size_t iterations = bench_iterations(200);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    uint64_t* phase_samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples || !phase_samples) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        samples[i] = bench_run_command(argv);
+        if (samples[i] == 0) {
+            bench_fatal("'%s' failed in mode %s", argv[0], mode);
+        }
+        if (timing_fd >= 0) {
+            phase_samples[i] = read_exec_deps_ns(timing_fd);
+        }
+    }
+    printf("{\"bench\":\"exec_deps\",\"mode\":\"%s\",\"libraries\":%zu,\"measure\":\"launch\",", mode, libs);
+    bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    if (timing_fd >= 0) {
+        printf("{\"bench\":\"exec_deps\",\"mode\":\"%s\",\"libraries\":%zu,\"measure\":\"exec_deps\",", mode,
+               libs);
+        st = bench_compute_stats(phase_samples, iterations);
+        bench_print_stats(&st);
+    }
+    free(phase_samples);
+    free(samples);
+}
+
+int main(void) {
+    const char* sst = bench_sst_path();
+    const char* libs_env = getenv("BENCH_EXEC_DEPS_LIBS");
+    const size_t libs = libs_env && atoi(libs_env) > 0 ? (size_t)atoi(libs_env) : 300;
+
+    char* dir = bench_make_tmpdir("exec_deps");
+    char* lib_src = NULL;
+    char* lib_obj = NULL;
+    char* main_src = NULL;
+    char* prog = NULL;
+    char* cache_dir = NULL;
+    if (asprintf(&lib_src, "%s/lib.c", dir) < 0 || asprintf(&lib_obj, "%s/lib.o", dir) < 0 ||
+        asprintf(&main_src, "%s/main.c", dir) < 0 || asprintf(&prog, "%s/prog", dir) < 0 ||
+        asprintf(&cache_dir, "%s/cache", dir) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    write_file(lib_src, "int bench_lib_function(void) { return 42; }\n");
+    write_file(main_src, "int main(void) { return 0; }\n");
+
+    char* compile_argv[] = { "cc", "-c", "-fPIC", "-o", lib_obj, lib_src, NULL };
+    char* cc = getenv("CC");
+    compile_argv[0] = cc && cc[0] ? cc : "/usr/bin/cc";
+    run_cc(compile_argv);
+
+    // One object, linked into libraries with different sonames.
+    char** link_argv = calloc(libs + 16, sizeof(char*));
+    if (!link_argv) {
+        bench_fatal("out of memory");
+    }
+    size_t n = 0;
+    link_argv[n++] = compile_argv[0];
+    link_argv[n++] = "-o";
+    link_argv[n++] = prog;
+    link_argv[n++] = main_src;
+    link_argv[n++] = "-Wl,--no-as-needed,--enable-new-dtags,-rpath,$ORIGIN";
+    for (size_t i = 0; i < libs; i++) {
+        char* name = NULL;
+        char* path = NULL;
+        char* soname = NULL;
+        if (asprintf(&name, "libbench%zu.so", i) < 0 || asprintf(&path, "%s/%s", dir, name) < 0 ||
+            asprintf(&soname, "-Wl,-soname,%s", name) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        char* shared_argv[] = { compile_argv[0], "-shared", soname, "-o", path, lib_obj, NULL };
+        run_cc(shared_argv);
+        link_argv[n++] = path;
+        free(name);
+        free(soname);
+    }
+    run_cc(link_argv);
+
+    // Where --timing=3 goes; O_APPEND, as it is truncated after every run.
+    char* timing_path = NULL;
+    if (asprintf(&timing_path, "%s/timing", dir) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    const int timing_fd = open(timing_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (timing_fd < 0 || dup2(timing_fd, 3) != 3) {
+        bench_fatal("cannot open '%s': %s", timing_path, strerror(errno));
+    }
+    char* exec_deps_argv[] = {
+        (char*)sst, "--timing=3,json", "ENABLE_FILESYSTEM_SANDBOXING", "EXEC_DEPS", "--", prog, NULL
+    };
+    char* path_beneath_argv[] = { (char*)sst, "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/", "--", prog, NULL };
+    run("path_beneath", path_beneath_argv, "", libs, -1);
+    run("walk", exec_deps_argv, "", libs, 3);
+    run("cached", exec_deps_argv, cache_dir, libs, 3);
+    free(timing_path);
+
+    for (size_t i = 0; i < libs; i++) {
+        free(link_argv[5 + i]);
+    }
+    free(link_argv);
+    bench_remove_tree(dir);
+    free(lib_src);
+    free(lib_obj);
+    free(main_src);
+    free(prog);
+    free(cache_dir);
+    free(dir);
+    return 0;
+}
@@ -0,0 +1,150 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Throughput of a fan-out of sandboxed /bin/true jobs: `sst --jobs <n>`
+// (one ruleset for all of them) vs. <n> `sst <policy> -- /bin/true`
+// processes at a time (each building its own), for a small policy and for
+// one with a rule per file in /usr/bin.
+//
+// Usage: SST=./sst bench/jobs
+//
+// $BENCH_ITERATIONS is the number of jobs per run (default 2000); the
+// number of workers is the number of CPUs.
+//
+
+#include "bench.h"
+
+#include <dirent.h>
+
+// Runs `count` copies of `argv` with up to `workers` of them at a time and
+// returns the wall time.
+static uint64_t run_separate(char** argv, size_t count, long workers) {
+    const uint64_t start = bench_now_ns();
+    size_t started = 0;
+    long running = 0;
+    while (started < count || running > 0) {
+        while (running < workers && started < count) {
+            const pid_t pid = fork();
+            if (pid < 0) {
+                bench_fatal("fork failed: %s", strerror(errno));
+            }
+            if (pid == 0) {
+                execv(argv[0], argv);
+                _exit(127);
+            }
+            started++;
+            running++;
+        }
+        int status;
+        if (wait(&status) < 0) {
+            bench_fatal("wait failed: %s", strerror(errno));
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            bench_fatal("'%s' failed", argv[0]);
+        }
+        running--;
+    }
+    return bench_now_ns() - start;
+}
+
+static void report(const char* policy, const char* mode, size_t rules, size_t count, long workers, uint64_t ns) {
+    printf("{\"bench\":\"jobs\",\"policy\":\"%s\",\"mode\":\"%s\",\"rules\":%zu,\"jobs\":%zu,\"workers\":%ld,"
+           "\"wall_ms\":%.2f,\"jobs_per_sec\":%.1f}\n",
+           policy, mode, rules, count, workers, ns / 1e6, count / (ns / 1e9));
+    fflush(stdout);
+}
+
+static void run(const char* policy, char** options, size_t option_count, size_t rules,
+                const char* manifest, size_t count, long workers) {
+    const char* sst = bench_sst_path();
+
+    char** argv = calloc(option_count + 4, sizeof(char*));
+    if (!argv) {
+        bench_fatal("out of memory");
+    }
+    size_t argc = 0;
+    argv[argc++] = (char*)sst;
+    for (size_t i = 0; i < option_count; i++) {
+        argv[argc++] = options[i];
+    }
+    argv[argc++] = "--";
+    argv[argc++] = "/bin/true";
+    report(policy, "separate", rules, count, workers, run_separate(argv, count, workers));
+
+    char workers_str[32];
+    snprintf(workers_str, sizeof(workers_str), "%ld", workers);
+    argc = 0;
+    argv[argc++] = (char*)sst;
+    argv[argc++] = "--jobs";
+    argv[argc++] = workers_str;
+    argv[argc++] = "--manifest";
+    argv[argc++] = (char*)manifest;
+    argv = realloc(argv, sizeof(char*) * (option_count + 6));
+    if (!argv) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < option_count; i++) {
+        argv[argc++] = options[i];
+    }
+    argv[argc] = NULL;
+    // The summary goes to stderr, which bench_run_command() discards.
+    const uint64_t ns = bench_run_command(argv);
+    if (ns == 0) {
+        bench_fatal("sst --jobs failed");
+    }
+    report(policy, "sst_jobs", rules, count, workers, ns);
+    free(argv);
+}
+
+int main(void) {
+    const size_t count = bench_iterations(2000);
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const long workers = cpus > 0 ? cpus : 1;
+
+    char* dir = bench_make_tmpdir("jobs");
+    char* manifest = NULL;
+    char* list = NULL;
+    if (asprintf(&manifest, "%s/manifest", dir) < 0 || asprintf(&list, "%s/list", dir) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    FILE* f = fopen(manifest, "w");
+    if (!f) {
+        bench_fatal("cannot create '%s': %s", manifest, strerror(errno));
+    }
+    for (size_t i = 0; i < count; i++) {
+        fprintf(f, "/bin/true\n");
+    }
+    fclose(f);
+
+    char* small[] = { "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/" };
+    run("small", small, 2, 1, manifest, count, workers);
+
+    // One FILE_READ rule per file in /usr/bin, on top of the above.
+    f = fopen(list, "w");
+    DIR* d = opendir("/usr/bin");
+    if (!f || !d) {
+        bench_fatal("cannot list /usr/bin into '%s': %s", list, strerror(errno));
+    }
+    size_t rules = 1;
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        if (de->d_type == DT_REG) {
+            fprintf(f, "/usr/bin/%s\n", de->d_name);
+            rules++;
+        }
+    }
+    closedir(d);
+    fclose(f);
+    char* list_option = NULL;
+    if (asprintf(&list_option, "FILE_READ_LIST:%s", list) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    char* large[] = { "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/", list_option };
+    run("usr_bin", large, 3, rules, manifest, count, workers);
+
+    bench_remove_tree(dir);
+    free(list_option);
+    free(manifest);
+    free(list);
+    free(dir);
+    return 0;
+}
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// What `sst --learn` costs the command it watches: the wall time of a few
+// workloads run directly and under `sst --learn /dev/null --`.
+//
+// - open: open() and close() the same few files over and over. Every open
+//   is a seccomp stop plus a syscall-exit stop in the tracer.
+// - syscall: getppid() in a loop. Not traced at all; this is what the
+//   seccomp filter costs everything the tracer doesn't care about.
+// - exec: fork() and exec() /bin/true, the loader's opens included.
+//
+// The workloads are this program (`bench/learn --child <workload>`).
+//
+// Usage: SST=./sst bench/learn
+//
+
+#include "bench.h"
+
+#include <limits.h>
+#include <sys/syscall.h>
+
+#define OPEN_COUNT 20000
+#define SYSCALL_COUNT 2000000
+#define EXEC_COUNT 100
+
+static int child_main(const char* workload) {
+    if (strcmp(workload, "open") == 0) {
+        static const char* const files[] = { "/etc/passwd", "/etc/hostname", "/etc/hosts", "/etc/ld.so.cache" };
+        for (size_t i = 0; i < OPEN_COUNT; i++) {
+            const int fd = open(files[i % 4], O_RDONLY);
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        return 0;
+    }
+    if (strcmp(workload, "syscall") == 0) {
+        long sum = 0;
+        for (size_t i = 0; i < SYSCALL_COUNT; i++) {
+            sum += syscall(SYS_getppid);
+        }
+        return sum == 0;
+    }
+    if (strcmp(workload, "exec") == 0) {
+        for (size_t i = 0; i < EXEC_COUNT; i++) {
+            const pid_t pid = fork();
+            if (pid == 0) {
+                execl("/bin/true", "true", (char*)NULL);
+                _exit(127);
+            }
+            int status;
+            if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static void run(const char* workload, const char* mode, char** argv, size_t ops) {
+    printf("{\"bench\":\"learn\",\"workload\":\"%s\",\"mode\":\"%s\",\"ops\":%zu,", workload, mode, ops);
+
+    const size_t iterations = bench_iterations(10);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        samples[i] = bench_run_command(argv);
+        if (samples[i] == 0) {
+            bench_fatal("'%s' failed in mode %s", argv[0], mode);
+        }
+    }
+    const bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], "--child") == 0) {
+        return child_main(argv[2]);
+    }
+
+    const char* sst = bench_sst_path();
+    char self[PATH_MAX];
+    const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        bench_fatal("readlink(/proc/self/exe) failed: %s", strerror(errno));
+    }
+    self[self_len] = '\0';
+
+    static const struct {
+        const char* name;
+        size_t ops;
+    } workloads[] = {
+        { "open", OPEN_COUNT },
+        { "syscall", SYSCALL_COUNT },
+        { "exec", EXEC_COUNT },
+    };
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        char* plain_argv[] = { self, "--child", (char*)workloads[i].name, NULL };
+        char* learn_argv[] = { (char*)sst, "--learn", "/dev/null", "--", self, "--child", (char*)workloads[i].name, NULL };
+        run(workloads[i].name, "plain", plain_argv, workloads[i].ops);
+        run(workloads[i].name, "learn", learn_argv, workloads[i].ops);
+    }
+    return 0;
+}
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Restarting a sandboxed TCP server under load: how many requests fail, and
+// how long until a new server process answers. A few client threads connect
+// to the server in a loop (each request is a connection; the server answers
+// with its pid and closes it) while the server is restarted every so often:
+//
+// - rebind: the server binds the port itself (ALLOW_INCOMING_TCP_PORT) and
+//   a restart is SIGTERM, wait, start a new one. Connections that come in
+//   between are refused.
+// - listen_tcp_hup: `sst --restart=always LISTEN_TCP:...`, restarted with
+//   SIGHUP to `sst`. The socket stays open in `sst` and the old server only
+//   gets SIGTERM once the new one has exec()ed.
+// - listen_tcp_crash: the same, but the server is SIGKILLed and `sst`
+//   starts it again.
+//
+// The server is this program (`bench/listen --server [<port>]`).
+//
+// Usage: SST=./sst bench/listen
+//
+// $BENCH_ITERATIONS is the number of restarts per mode (default 5).
+//
+
+#include "bench.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define CLIENT_THREADS 4
+#define RESTART_INTERVAL_MS 1200
+
+static int server_main(int argc, char** argv) {
+    int fd = 3;
+    const char* listen_fds = getenv("LISTEN_FDS");
+    if (!listen_fds || atoi(listen_fds) < 1) {
+        if (argc < 3) {
+            return 1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons((uint16_t)atoi(argv[2])) };
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) != 0 || listen(fd, SOMAXCONN) != 0) {
+            return 1;
+        }
+    }
+    const int32_t pid = (int32_t)getpid();
+    for (;;) {
+        const int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            continue;
+        }
+        if (write(conn, &pid, sizeof(pid)) != sizeof(pid)) {
+            // The client gave up; nothing to do about it.
+        }
+        close(conn);
+    }
+}
+
+typedef struct sload {
+    int port;
+    int stop;
+    size_t requests;
+    size_t failed;
+    // The pid of the server that answered last.
+    int32_t last_pid;
+} load;
+
+static void* client_thread(void* arg) {
+    load* ld = arg;
+    struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons((uint16_t)ld->port) };
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    while (!__atomic_load_n(&ld->stop, __ATOMIC_RELAXED)) {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            bench_fatal("socket failed: %s", strerror(errno));
+        }
+        int32_t pid = 0;
+        int ok = connect(fd, (struct sockaddr*)&sin, sizeof(sin)) == 0;
+        if (ok) {
+            size_t got = 0;
+            while (got < sizeof(pid)) {
+                const ssize_t n = read(fd, (char*)&pid + got, sizeof(pid) - got);
+                if (n <= 0) {
+                    break;
+                }
+                got += (size_t)n;
+            }
+            ok = got == sizeof(pid);
+        }
+        close(fd);
+        __atomic_fetch_add(&ld->requests, 1, __ATOMIC_RELAXED);
+        if (ok) {
+            __atomic_store_n(&ld->last_pid, pid, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&ld->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+static pid_t spawn(char** argv) {
+    const pid_t pid = fork();
+    if (pid < 0) {
+        bench_fatal("fork failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        const int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, 1);
+            dup2(devnull, 2);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Waits for an answer from a server other than `old_pid`.
+static void wait_for_new_server(load* ld, int32_t old_pid) {
+    const uint64_t deadline = bench_now_ns() + 10000000000ULL;
+    while (__atomic_load_n(&ld->last_pid, __ATOMIC_RELAXED) == old_pid) {
+        if (bench_now_ns() > deadline) {
+            bench_fatal("the server did not come back");
+        }
+        usleep(100);
+    }
+}
+
+static int free_port(void) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in sin = { .sin_family = AF_INET };
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sin);
+    if (bind(fd, (struct sockaddr*)&sin, sizeof(sin)) != 0 || getsockname(fd, (struct sockaddr*)&sin, &len) != 0) {
+        bench_fatal("cannot find a free port: %s", strerror(errno));
+    }
+    close(fd);
+    return ntohs(sin.sin_port);
+}
+
+// `mode` is one of the above; `argv` starts the server.
+static void run(const char* mode, char** argv, int port) {
+    load ld = { .port = port };
+    pid_t pid = spawn(argv);
+
+    pthread_t threads[CLIENT_THREADS];
+    for (int i = 0; i < CLIENT_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, client_thread, &ld) != 0) {
+            bench_fatal("pthread_create failed");
+        }
+    }
+    wait_for_new_server(&ld, 0);
+    // Only count what happens from the first restart on.
+    __atomic_store_n(&ld.requests, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ld.failed, 0, __ATOMIC_RELAXED);
+
+    const size_t restarts = bench_iterations(5);
+    uint64_t* samples = calloc(restarts, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < restarts; i++) {
+        usleep(RESTART_INTERVAL_MS * 1000);
+        const int32_t old_pid = __atomic_load_n(&ld.last_pid, __ATOMIC_RELAXED);
+        const uint64_t start = bench_now_ns();
+        if (strcmp(mode, "rebind") == 0) {
+            kill(pid, SIGTERM);
+            waitpid(pid, NULL, 0);
+            pid = spawn(argv);
+        } else if (strcmp(mode, "listen_tcp_hup") == 0) {
+            kill(pid, SIGHUP);
+        } else {
+            kill(old_pid, SIGKILL);
+        }
+        wait_for_new_server(&ld, old_pid);
+        samples[i] = bench_now_ns() - start;
+    }
+
+    __atomic_store_n(&ld.stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < CLIENT_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    printf("{\"bench\":\"listen\",\"mode\":\"%s\",\"clients\":%d,\"requests\":%zu,\"failed\":%zu,\"measure\":\"restart\",",
+           mode, CLIENT_THREADS, ld.requests, ld.failed);
+    const bench_stats st = bench_compute_stats(samples, restarts);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && strcmp(argv[1], "--server") == 0) {
+        return server_main(argc, argv);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    const char* sst = bench_sst_path();
+    char self[PATH_MAX];
+    const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        bench_fatal("readlink(/proc/self/exe) failed: %s", strerror(errno));
+    }
+    self[self_len] = '\0';
+
+    const int port = free_port();
+    char port_str[16];
+    char* allow = NULL;
+    char* listen_tcp = NULL;
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if (asprintf(&allow, "ALLOW_INCOMING_TCP_PORT:%d", port) < 0 ||
+        asprintf(&listen_tcp, "LISTEN_TCP:127.0.0.1:%d", port) < 0) {
+        bench_fatal("asprintf failed");
+    }
+
+    char* rebind_argv[] = { (char*)sst, "ENABLE_NETWORK_SANDBOXING", allow, "--", self, "--server", port_str, NULL };
+    char* listen_argv[] = {
+        (char*)sst, "--restart=always", "ENABLE_NETWORK_SANDBOXING", listen_tcp, "--", self, "--server", NULL
+    };
+    run("rebind", rebind_argv, port);
+    run("listen_tcp_hup", listen_argv, port);
+    run("listen_tcp_crash", listen_argv, port);
+
+    free(allow);
+    free(listen_tcp);
+    return 0;
+}
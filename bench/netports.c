@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Wall time of building a ruleset with large port ranges: the Linux
+// ephemeral port range given as one ALLOW_OUTGOING_TCP_PORTS: range vs. one
+// ALLOW_OUTGOING_TCP_PORT: word per port, and the full range allowed in both
+// directions (which still is one rule per port).
+//
+// Usage: SST=./sst bench/netports
+//
+
+#include "bench.h"
+
+// Default net.ipv4.ip_local_port_range.
+#define EPHEMERAL_FIRST 32768
+#define EPHEMERAL_LAST 60999
+
+static void run(const char* mode, size_t rules, char** argv) {
+    printf("{\"bench\":\"netports\",\"mode\":\"%s\",\"rules\":%zu,", mode, rules);
+
+    const size_t iterations = bench_iterations(50);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    // Warm up (or make sure it works at all).
+    if (bench_run_command(argv) == 0) {
+        bench_fatal("'%s' failed in mode %s", argv[0], mode);
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        samples[i] = bench_run_command(argv);
+    }
+    const bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+int main(void) {
+    const char* sst = bench_sst_path();
+    const size_t ephemeral = EPHEMERAL_LAST - EPHEMERAL_FIRST + 1;
+
+    char* range_option = NULL;
+    if (asprintf(&range_option, "ALLOW_OUTGOING_TCP_PORTS:%d-%d", EPHEMERAL_FIRST, EPHEMERAL_LAST) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    char* range_argv[] = {
+        (char*)sst, "ENABLE_NETWORK_SANDBOXING", range_option, "--", "/bin/true", NULL
+    };
+    run("range", ephemeral, range_argv);
+
+    char** words_argv = calloc(ephemeral + 5, sizeof(char*));
+    if (!words_argv) {
+        bench_fatal("out of memory");
+    }
+    size_t argc = 0;
+    words_argv[argc++] = (char*)sst;
+    words_argv[argc++] = "ENABLE_NETWORK_SANDBOXING";
+    for (long port = EPHEMERAL_FIRST; port <= EPHEMERAL_LAST; port++) {
+        if (asprintf(&words_argv[argc++], "ALLOW_OUTGOING_TCP_PORT:%ld", port) < 0) {
+            bench_fatal("asprintf failed");
+        }
+    }
+    words_argv[argc++] = "--";
+    words_argv[argc++] = "/bin/true";
+    run("word_per_port", ephemeral, words_argv);
+
+    char* full_argv[] = {
+        (char*)sst, "ENABLE_NETWORK_SANDBOXING",
+        "ALLOW_OUTGOING_TCP_PORTS:0-65535", "ALLOW_INCOMING_TCP_PORTS:0-65535",
+        "--", "/bin/true", NULL
+    };
+    run("full_range_both_directions", 65536, full_argv);
+
+    // Baseline: what the command costs without any network rules.
+    char* none_argv[] = {
+        (char*)sst, "ENABLE_NETWORK_SANDBOXING", "--", "/bin/true", NULL
+    };
+    run("no_rules", 0, none_argv);
+
+    for (size_t i = 2; i < argc - 2; i++) {
+        free(words_argv[i]);
+    }
+    free(words_argv);
+    free(range_option);
+    return 0;
+}
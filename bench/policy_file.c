@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Compares the wall time of `sst <options> -- /bin/true`,
+// `sst FILE_READ_LIST:<list> -- /bin/true` and
+// `sst POLICY_FILE:<compiled> -- /bin/true` for policies of different sizes.
+//
+// Usage: SST=./sst bench/policy_file
+//
+
+#include "bench.h"
+
+static const size_t RULE_COUNTS[] = { 10, 1000, 100000 };
+
+static void report(const char* mode, size_t rules, uint64_t* samples, size_t n) {
+    printf("{\"bench\":\"policy_file\",\"mode\":\"%s\",\"rules\":%zu,", mode, rules);
+    if (n == 0) {
+        printf("\"skipped\":true}\n");
+        fflush(stdout);
+        return;
+    }
+    const bench_stats st = bench_compute_stats(samples, n);
+    bench_print_stats(&st);
+}
+
+// Runs `argv` `iterations` times. Gives up (returning 0) if the first run
+// fails, which is what happens when the policy does not fit on a command
+// line.
+static size_t sample(char *const *argv, uint64_t* samples, size_t iterations) {
+    for (size_t i = 0; i < iterations; i++) {
+        samples[i] = bench_run_command(argv);
+        if (samples[i] == 0) {
+            return 0;
+        }
+    }
+    return iterations;
+}
+
+static void bench_rule_count(const char* sst, size_t rules) {
+    const size_t iterations = bench_iterations(rules >= 100000 ? 10 : rules >= 1000 ? 100 : 500);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    char* dir = bench_make_tmpdir("policy-file");
+
+    // sst ENABLE_FILESYSTEM_SANDBOXING PATH_BENEATH_EXEC:/ FILE_READ:... -- /bin/true
+    const size_t argc = rules + 6;
+    char** argv = calloc(argc + 1, sizeof(char*));
+    if (!samples || !argv) {
+        bench_fatal("out of memory");
+    }
+
+    char *policy_path = NULL, *list_path = NULL, *list_option = NULL;
+    if (asprintf(&policy_path, "%s/policy.sst", dir) < 0 ||
+        asprintf(&list_path, "%s/list", dir) < 0 ||
+        asprintf(&list_option, "FILE_READ_LIST:%s", list_path) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    FILE* list = fopen(list_path, "w");
+    if (!list) {
+        bench_fatal("cannot create '%s': %s", list_path, strerror(errno));
+    }
+
+    size_t a = 0;
+    argv[a++] = (char*)sst;
+    argv[a++] = "ENABLE_FILESYSTEM_SANDBOXING";
+    argv[a++] = "PATH_BENEATH_EXEC:/";
+    for (size_t i = 0; i < rules; i++) {
+        char* file = NULL;
+        if (asprintf(&file, "%s/f%zu", dir, i) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        const int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            bench_fatal("cannot create '%s': %s", file, strerror(errno));
+        }
+        close(fd);
+        fprintf(list, "%s\n", file);
+
+        if (asprintf(&argv[a++], "FILE_READ:%s", file) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        free(file);
+    }
+    const size_t options_end = a;
+    argv[a++] = "--";
+    argv[a++] = "/bin/true";
+    argv[a] = NULL;
+    fclose(list);
+
+    // sst --compile <policy> <same options, from the list>
+    char* compile_argv[] = {
+        (char*)sst, "--compile", policy_path,
+        "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/", list_option, NULL
+    };
+    char* list_argv[] = {
+        (char*)sst, "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/", list_option,
+        "--", "/bin/true", NULL
+    };
+
+    // Too many rules for ARG_MAX makes this one report as skipped.
+    report("argv", rules, samples, sample(argv, samples, iterations));
+    report("list", rules, samples, sample(list_argv, samples, iterations));
+
+    if (bench_run_command(compile_argv) == 0) {
+        report("policy_file", rules, samples, 0);
+    } else {
+        char* policy_option = NULL;
+        if (asprintf(&policy_option, "POLICY_FILE:%s", policy_path) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        char* policy_argv[] = { (char*)sst, policy_option, "--", "/bin/true", NULL };
+        report("policy_file", rules, samples, sample(policy_argv, samples, iterations));
+        free(policy_option);
+    }
+
+    for (size_t i = 3; i < options_end; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+    free(policy_path);
+    free(list_path);
+    free(list_option);
+    free(samples);
+    bench_remove_tree(dir);
+    free(dir);
+}
+
+int main(void) {
+    const char* sst = bench_sst_path();
+
+    for (size_t i = 0; i < sizeof(RULE_COUNTS) / sizeof(RULE_COUNTS[0]); i++) {
+        bench_rule_count(sst, RULE_COUNTS[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// What PREWARM buys on a cold start: a sandboxed command that mmap()s a
+// data file and touches its pages in random order, with the file evicted
+// from the page cache before each run, without and with PREWARM:<file>
+// (and with the file left cached, for reference).
+//
+// The command is this program (`bench/prewarm --child <file>`). Random
+// order is the worst case for the kernel's own readahead, and roughly what
+// loading a big binary or model file looks like.
+//
+// Usage: SST=./sst bench/prewarm
+//
+// $BENCH_PREWARM_MB sets the size of the file (default 64). It is created in
+// $TMPDIR, which has to be on a real disk: tmpfs can't evict it, and then
+// every mode is the cached one ("resident" says how much was left in the
+// cache at the start of a run).
+//
+
+#include "bench.h"
+
+#include <limits.h>
+#include <sys/mman.h>
+
+static int child_main(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        return 1;
+    }
+    const size_t size = (size_t)sb.st_size;
+    const unsigned char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return 1;
+    }
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t pages = size / page;
+    // A stride that is coprime with the number of pages visits all of them.
+    size_t stride = pages / 2 + 1;
+    while (pages > 1) {
+        size_t a = stride, b = pages;
+        while (b) {
+            const size_t t = a % b;
+            a = b;
+            b = t;
+        }
+        if (a == 1) {
+            break;
+        }
+        stride++;
+    }
+    unsigned sum = 0;
+    size_t p = 0;
+    for (size_t i = 0; i < pages; i++) {
+        sum += data[p * page];
+        p = (p + stride) % pages;
+    }
+    return sum == 0xffffffff;
+}
+
+static void evict(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        bench_fatal("cannot open '%s': %s", path, strerror(errno));
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// The fraction of `path` that is in the page cache.
+static double resident(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        bench_fatal("cannot open '%s': %s", path, strerror(errno));
+    }
+    void* map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        bench_fatal("mmap failed: %s", strerror(errno));
+    }
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t pages = ((size_t)sb.st_size + page - 1) / page;
+    unsigned char* vec = malloc(pages);
+    if (!vec || mincore(map, (size_t)sb.st_size, vec) != 0) {
+        bench_fatal("mincore failed: %s", strerror(errno));
+    }
+    size_t in = 0;
+    for (size_t i = 0; i < pages; i++) {
+        in += vec[i] & 1;
+    }
+    free(vec);
+    munmap(map, (size_t)sb.st_size);
+    return pages ? (double)in / pages : 0.0;
+}
+
+static void run(const char* mode, char** argv, const char* data, int cold, size_t mb) {
+    const size_t iterations = bench_iterations(20);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    double resident_sum = 0.0;
+    for (size_t i = 0; i < iterations; i++) {
+        if (cold) {
+            evict(data);
+        }
+        resident_sum += resident(data);
+        samples[i] = bench_run_command(argv);
+        if (samples[i] == 0) {
+            bench_fatal("'%s' failed in mode %s", argv[0], mode);
+        }
+    }
+    printf("{\"bench\":\"prewarm\",\"mode\":\"%s\",\"file_mb\":%zu,\"resident\":%.3f,", mode, mb,
+           resident_sum / iterations);
+    const bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], "--child") == 0) {
+        return child_main(argv[2]);
+    }
+
+    const char* sst = bench_sst_path();
+    char self[PATH_MAX];
+    const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        bench_fatal("readlink(/proc/self/exe) failed: %s", strerror(errno));
+    }
+    self[self_len] = '\0';
+
+    const char* mb_env = getenv("BENCH_PREWARM_MB");
+    const size_t mb = mb_env && atoi(mb_env) > 0 ? (size_t)atoi(mb_env) : 64;
+    char* dir = bench_make_tmpdir("prewarm");
+    char* data = NULL;
+    char* prewarm_option = NULL;
+    if (asprintf(&data, "%s/data", dir) < 0 || asprintf(&prewarm_option, "PREWARM:%s", data) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    const int fd = open(data, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        bench_fatal("cannot create '%s': %s", data, strerror(errno));
+    }
+    char block[1 << 16];
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = (char)(i * 131 + 7);
+    }
+    for (size_t i = 0; i < mb * 16; i++) {
+        if (write(fd, block, sizeof(block)) != (ssize_t)sizeof(block)) {
+            bench_fatal("write failed: %s", strerror(errno));
+        }
+    }
+    close(fd);
+
+    char* plain_argv[] = { (char*)sst, "ENABLE_NETWORK_SANDBOXING", "--", self, "--child", data, NULL };
+    char* prewarm_argv[] = {
+        (char*)sst, prewarm_option, "ENABLE_NETWORK_SANDBOXING", "--", self, "--child", data, NULL
+    };
+    run("cold", plain_argv, data, 1, mb);
+    run("cold_prewarm", prewarm_argv, data, 1, mb);
+    run("cached", plain_argv, data, 0, mb);
+
+    bench_remove_tree(dir);
+    free(prewarm_option);
+    free(data);
+    free(dir);
+    return 0;
+}
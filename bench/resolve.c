@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Wall time of building a ruleset vs. rule count, with the rule paths opened
+// serially (RESOLVE_THREADS:1) or in parallel, with warm and cold dentry
+// caches.
+//
+// Usage: SST=./sst bench/resolve
+//
+// The cold cache runs need to be able to write to /proc/sys/vm/drop_caches
+// (i.e. root) and are reported as skipped otherwise. Note that dropping
+// caches does nothing for tmpfs; point $TMPDIR at the filesystem you care
+// about (e.g. an NFS mount).
+//
+
+#include "bench.h"
+
+static const size_t RULE_COUNTS[] = { 100, 1000, 10000, 50000 };
+
+// RESOLVE_THREADS values to compare; 0 is sst's own choice.
+static const char* THREADS[] = { "1", "0", "16" };
+
+static int drop_caches(void) {
+    sync();
+    const int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    const int ret = write(fd, "2", 1) == 1 ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+// Writes `rules` empty files spread over subdirectories, and a list of them.
+static void make_files(const char* dir, const char* list_path, size_t rules) {
+    FILE* list = fopen(list_path, "w");
+    if (!list) {
+        bench_fatal("cannot create '%s': %s", list_path, strerror(errno));
+    }
+    for (size_t i = 0; i < rules; i++) {
+        char* path = NULL;
+        if (i % 100 == 0) {
+            if (asprintf(&path, "%s/d%zu", dir, i / 100) < 0) {
+                bench_fatal("asprintf failed");
+            }
+            if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                bench_fatal("cannot create '%s': %s", path, strerror(errno));
+            }
+            free(path);
+        }
+        if (asprintf(&path, "%s/d%zu/f%zu", dir, i / 100, i) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            bench_fatal("cannot create '%s': %s", path, strerror(errno));
+        }
+        close(fd);
+        fprintf(list, "%s\n", path);
+        free(path);
+    }
+    fclose(list);
+}
+
+int main(void) {
+    const char* sst = bench_sst_path();
+    const int can_drop = drop_caches() == 0;
+
+    for (size_t r = 0; r < sizeof(RULE_COUNTS) / sizeof(RULE_COUNTS[0]); r++) {
+        const size_t rules = RULE_COUNTS[r];
+        char* dir = bench_make_tmpdir("resolve");
+        char *list_path = NULL, *list_option = NULL;
+        if (asprintf(&list_path, "%s/list", dir) < 0 ||
+            asprintf(&list_option, "FILE_READ_LIST:%s", list_path) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        make_files(dir, list_path, rules);
+
+        for (size_t t = 0; t < sizeof(THREADS) / sizeof(THREADS[0]); t++) {
+            char* threads_option = NULL;
+            if (asprintf(&threads_option, "RESOLVE_THREADS:%s", THREADS[t]) < 0) {
+                bench_fatal("asprintf failed");
+            }
+            char* argv[] = {
+                (char*)sst, threads_option, "ENABLE_FILESYSTEM_SANDBOXING",
+                "PATH_BENEATH_EXEC:/", list_option, "--", "/bin/true", NULL
+            };
+
+            for (int cold = 0; cold <= 1; cold++) {
+                printf("{\"bench\":\"resolve\",\"rules\":%zu,\"threads\":%s,\"cache\":\"%s\",",
+                       rules, THREADS[t], cold ? "cold" : "warm");
+                if (cold && !can_drop) {
+                    printf("\"skipped\":true}\n");
+                    fflush(stdout);
+                    continue;
+                }
+
+                const size_t iterations = bench_iterations(cold ? 5 : rules >= 10000 ? 10 : 50);
+                uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+                if (!samples) {
+                    bench_fatal("out of memory");
+                }
+                // Warm up (or make sure it works at all).
+                if (bench_run_command(argv) == 0) {
+                    bench_fatal("'%s' failed with %zu rules", sst, rules);
+                }
+                for (size_t i = 0; i < iterations; i++) {
+                    if (cold) {
+                        drop_caches();
+                    }
+                    samples[i] = bench_run_command(argv);
+                }
+                const bench_stats st = bench_compute_stats(samples, iterations);
+                bench_print_stats(&st);
+                free(samples);
+            }
+            free(threads_option);
+        }
+
+        bench_remove_tree(dir);
+        free(list_path);
+        free(list_option);
+        free(dir);
+    }
+
+    return 0;
+}
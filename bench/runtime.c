@@ -0,0 +1,360 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// What the sandbox costs inside the sandboxed program: ns per open(),
+// stat() and connect() under various `sst` policies, against the same loop
+// run without `sst`.
+//
+//  - depth: open/stat of a file N directories below the temporary directory,
+//    under a single PATH_BENEATH_EXEC:/ (Landlock walks up to the root for
+//    every access, so depth is what that one broad rule costs).
+//  - rules: open/stat of a file under one of N sibling directories that
+//    each have a PATH_BENEATH_READ rule, vs. PATH_BENEATH_EXEC:/.
+//  - layers: open/stat/connect under N nested `sst` invocations, each its
+//    own Landlock layer (NO_COALESCE); layers_coalesced is the same command
+//    line with sst merging it into a single layer.
+//  - connect: connect() to a closed local port that is allowed, so only
+//    the refusal and the Landlock check are measured.
+//
+// Usage: SST=./sst bench/runtime
+//
+// Each configuration runs `$BENCH_ITERATIONS` (default 7) times; the
+// reported numbers are the median, min and max ns/op of those runs.
+//
+// The policies are plain `sst` command lines, and the program runs itself
+// under them (`bench/runtime --worker ...`), so it is linked statically and
+// only needs a FILE_EXEC rule on itself.
+//
+
+#include "bench.h"
+
+#include <limits.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define OPS_PER_RUN 20000
+#define MAX_ARGS 64
+
+static const size_t DEPTHS[] = { 1, 8, 32, 128 };
+static const size_t RULE_COUNTS[] = { 1, 10, 100, 1000 };
+static const size_t LAYERS[] = { 1, 2, 4, 8 };
+
+static int cmp_double(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// bench/runtime --worker <open|stat|connect> <path|port>
+// Prints ns/op of OPS_PER_RUN operations.
+static int worker_main(const char* op, const char* target) {
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)atoi(target));
+
+    uint64_t start = 0;
+    // The first tenth is warm-up.
+    const size_t warmup = OPS_PER_RUN / 10;
+    for (size_t i = 0; i < warmup + OPS_PER_RUN; i++) {
+        if (i == warmup) {
+            start = bench_now_ns();
+        }
+        if (strcmp(op, "open") == 0) {
+            const int fd = open(target, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                bench_fatal("worker: open(%s) failed: %s", target, strerror(errno));
+            }
+            close(fd);
+        } else if (strcmp(op, "stat") == 0) {
+            struct stat sb;
+            if (stat(target, &sb) != 0) {
+                bench_fatal("worker: stat(%s) failed: %s", target, strerror(errno));
+            }
+        } else if (strcmp(op, "connect") == 0) {
+            const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                bench_fatal("worker: socket failed: %s", strerror(errno));
+            }
+            if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 || errno != ECONNREFUSED) {
+                bench_fatal("worker: connect to port %s: expected ECONNREFUSED, got %s", target, strerror(errno));
+            }
+            close(fd);
+        } else {
+            bench_fatal("worker: unknown op '%s'", op);
+        }
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+    printf("%f\n", (double)elapsed / OPS_PER_RUN);
+    return 0;
+}
+
+// Runs `argv` and returns the ns/op it printed.
+static double run_worker(char** argv) {
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        bench_fatal("pipe failed: %s", strerror(errno));
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        bench_fatal("fork failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        dup2(pipefd[1], 1);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(pipefd[1]);
+    char buf[64] = {0};
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(buf) - 1 && (n = read(pipefd[0], buf + len, sizeof(buf) - 1 - len)) > 0) {
+        len += (size_t)n;
+    }
+    close(pipefd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || len == 0) {
+        bench_fatal("worker '%s' failed", argv[0]);
+    }
+    return strtod(buf, NULL);
+}
+
+typedef struct sruntime_result {
+    double median;
+    double min;
+    double max;
+} runtime_result;
+
+static runtime_result measure(char** argv) {
+    const size_t runs = bench_iterations(7);
+    double* ns = calloc(runs, sizeof(double));
+    if (!ns) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < runs; i++) {
+        ns[i] = run_worker(argv);
+    }
+    qsort(ns, runs, sizeof(double), cmp_double);
+    const runtime_result res = { ns[(runs - 1) / 2], ns[0], ns[runs - 1] };
+    free(ns);
+    return res;
+}
+
+// A command line under construction: `layers` copies of the sst policy, then
+// the worker.
+typedef struct scmdline {
+    char* argv[MAX_ARGS];
+    size_t argc;
+} cmdline;
+
+static void cmd_push(cmdline* cmd, const char* arg) {
+    if (cmd->argc + 1 >= MAX_ARGS) {
+        bench_fatal("command line too long");
+    }
+    cmd->argv[cmd->argc++] = (char*)arg;
+    cmd->argv[cmd->argc] = NULL;
+}
+
+// Measures `op` on `target` without sst and under `layers` nested sst
+// invocations with `policy` (NULL-terminated), and prints the result.
+static void bench_op(const char* self, const char* sst, const char* dimension, size_t value,
+                     const char* policy_name, const char* const* policy, size_t layers,
+                     const char* op, const char* target, const runtime_result* baseline_in) {
+    cmdline cmd = {0};
+    for (size_t l = 0; l < layers; l++) {
+        cmd_push(&cmd, sst);
+        for (size_t i = 0; policy[i]; i++) {
+            cmd_push(&cmd, policy[i]);
+        }
+        cmd_push(&cmd, "--");
+    }
+    cmd_push(&cmd, self);
+    cmd_push(&cmd, "--worker");
+    cmd_push(&cmd, op);
+    cmd_push(&cmd, target);
+
+    runtime_result baseline;
+    if (baseline_in) {
+        baseline = *baseline_in;
+    } else {
+        char* plain[] = { (char*)self, "--worker", (char*)op, (char*)target, NULL };
+        baseline = measure(plain);
+    }
+    const runtime_result res = measure(cmd.argv);
+
+    printf("{\"bench\":\"runtime\",\"dimension\":\"%s\",\"value\":%zu,\"policy\":\"%s\",\"op\":\"%s\","
+           "\"runs\":%zu,\"ns_per_op\":%.1f,\"min_ns_per_op\":%.1f,\"max_ns_per_op\":%.1f,"
+           "\"baseline_ns_per_op\":%.1f,\"delta_ns_per_op\":%.1f}\n",
+           dimension, value, policy_name, op, bench_iterations(7), res.median, res.min, res.max,
+           baseline.median, res.median - baseline.median);
+    fflush(stdout);
+}
+
+static char* make_file(const char* dir) {
+    char* path = NULL;
+    if (asprintf(&path, "%s/file", dir) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        bench_fatal("cannot create '%s': %s", path, strerror(errno));
+    }
+    close(fd);
+    return path;
+}
+
+// A port nothing listens on, for connect() to be refused.
+static int closed_port(void) {
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        getsockname(fd, (struct sockaddr*)&addr, &len) != 0) {
+        bench_fatal("cannot find a free port: %s", strerror(errno));
+    }
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 4 && strcmp(argv[1], "--worker") == 0) {
+        return worker_main(argv[2], argv[3]);
+    }
+
+    const char* sst = bench_sst_path();
+    char self[PATH_MAX];
+    const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        bench_fatal("readlink(/proc/self/exe) failed: %s", strerror(errno));
+    }
+    self[self_len] = '\0';
+
+    char* self_exec = NULL;
+    if (asprintf(&self_exec, "FILE_EXEC:%s", self) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    static const char* const broad[] = { "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/", NULL };
+
+    char* dir = bench_make_tmpdir("runtime");
+
+    // Path depth, under one broad rule.
+    for (size_t d = 0; d < sizeof(DEPTHS) / sizeof(DEPTHS[0]); d++) {
+        char* sub = strdup(dir);
+        for (size_t i = 0; i < DEPTHS[d]; i++) {
+            char* next = NULL;
+            if (asprintf(&next, "%s/d", sub) < 0) {
+                bench_fatal("asprintf failed");
+            }
+            if (mkdir(next, 0755) != 0 && errno != EEXIST) {
+                bench_fatal("cannot create '%s': %s", next, strerror(errno));
+            }
+            free(sub);
+            sub = next;
+        }
+        char* file = make_file(sub);
+        bench_op(self, sst, "depth", DEPTHS[d], "PATH_BENEATH_EXEC:/", broad, 1, "open", file, NULL);
+        bench_op(self, sst, "depth", DEPTHS[d], "PATH_BENEATH_EXEC:/", broad, 1, "stat", file, NULL);
+        free(file);
+        free(sub);
+    }
+
+    // Number of narrow rules vs. one broad rule; the file is in the first
+    // of the directories.
+    const size_t max_rules = RULE_COUNTS[sizeof(RULE_COUNTS) / sizeof(RULE_COUNTS[0]) - 1];
+    char** rule_args = calloc(max_rules, sizeof(char*));
+    if (!rule_args) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < max_rules; i++) {
+        char* sub = NULL;
+        if (asprintf(&sub, "%s/r%zu", dir, i) < 0 ||
+            asprintf(&rule_args[i], "PATH_BENEATH_READ:%s", sub) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        if (mkdir(sub, 0755) != 0) {
+            bench_fatal("cannot create '%s': %s", sub, strerror(errno));
+        }
+        free(sub);
+    }
+    char* rules_dir = NULL;
+    if (asprintf(&rules_dir, "%s/r0", dir) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    char* rules_file = make_file(rules_dir);
+    char* rules_list = NULL;
+    char* rules_list_arg = NULL;
+    if (asprintf(&rules_list, "%s/rules", dir) < 0) {
+        bench_fatal("asprintf failed");
+    }
+
+    const char* const ops[] = { "open", "stat" };
+    for (size_t o = 0; o < 2; o++) {
+        char* plain[] = { self, "--worker", (char*)ops[o], rules_file, NULL };
+        const runtime_result baseline = measure(plain);
+        bench_op(self, sst, "rules", 1, "PATH_BENEATH_EXEC:/", broad, 1, ops[o], rules_file, &baseline);
+        for (size_t r = 0; r < sizeof(RULE_COUNTS) / sizeof(RULE_COUNTS[0]); r++) {
+            // Given as a list, as 1000 words don't fit in MAX_ARGS.
+            FILE* list = fopen(rules_list, "w");
+            if (!list) {
+                bench_fatal("cannot create '%s': %s", rules_list, strerror(errno));
+            }
+            for (size_t i = 0; i < RULE_COUNTS[r]; i++) {
+                fprintf(list, "%s\n", rule_args[i] + strlen("PATH_BENEATH_READ:"));
+            }
+            fclose(list);
+            free(rules_list_arg);
+            if (asprintf(&rules_list_arg, "PATH_BENEATH_READ_LIST:%s", rules_list) < 0) {
+                bench_fatal("asprintf failed");
+            }
+            const char* const narrow[] = {
+                "ENABLE_FILESYSTEM_SANDBOXING", self_exec, rules_list_arg, NULL
+            };
+            bench_op(self, sst, "rules", RULE_COUNTS[r], "PATH_BENEATH_READ", narrow, 1,
+                     ops[o], rules_file, &baseline);
+        }
+    }
+
+    // Nested sst layers.
+    char port[16];
+    snprintf(port, sizeof(port), "%d", closed_port());
+    char* port_arg = NULL;
+    if (asprintf(&port_arg, "ALLOW_OUTGOING_TCP_PORT:%s", port) < 0) {
+        bench_fatal("asprintf failed");
+    }
+    // NO_COALESCE, or sst would merge the layers into one.
+    const char* const both[] = {
+        "ENABLE_FILESYSTEM_SANDBOXING", "ENABLE_NETWORK_SANDBOXING", "PATH_BENEATH_EXEC:/", port_arg, "NO_COALESCE", NULL
+    };
+    const char* const both_coalesced[] = {
+        "ENABLE_FILESYSTEM_SANDBOXING", "ENABLE_NETWORK_SANDBOXING", "PATH_BENEATH_EXEC:/", port_arg, NULL
+    };
+    char* layers_file = make_file(dir);
+    for (size_t o = 0; o < 3; o++) {
+        const char* op = o == 2 ? "connect" : ops[o];
+        const char* target = o == 2 ? port : layers_file;
+        char* plain[] = { self, "--worker", (char*)op, (char*)target, NULL };
+        const runtime_result baseline = measure(plain);
+        for (size_t l = 0; l < sizeof(LAYERS) / sizeof(LAYERS[0]); l++) {
+            bench_op(self, sst, "layers", LAYERS[l], "PATH_BENEATH_EXEC:/+ALLOW_OUTGOING_TCP_PORT", both,
+                     LAYERS[l], op, target, &baseline);
+            bench_op(self, sst, "layers_coalesced", LAYERS[l], "PATH_BENEATH_EXEC:/+ALLOW_OUTGOING_TCP_PORT",
+                     both_coalesced, LAYERS[l], op, target, &baseline);
+        }
+    }
+
+    for (size_t i = 0; i < max_rules; i++) {
+        free(rule_args[i]);
+    }
+    free(rule_args);
+    free(rules_dir);
+    free(rules_file);
+    free(rules_list);
+    free(rules_list_arg);
+    free(port_arg);
+    free(layers_file);
+    free(self_exec);
+    bench_remove_tree(dir);
+    free(dir);
+    return 0;
+}
@@ -0,0 +1,215 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Throughput, in jobs/sec, of running `/bin/true` under a policy with plain
+// `sst POLICY_FILE:<policy> -- /bin/true` invocations vs. through an
+// `sst --serve` daemon.
+//
+// Usage: SST=./sst bench/serve
+//
+// $BENCH_CONCURRENCY sets how many clients submit jobs at the same time
+// (default: number of online CPUs).
+//
+
+#include "bench.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <linux/types.h>
+
+// Must match serve_request/serve_response in sst.c.
+#define SERVE_PROTOCOL_MAGIC 0x53535401
+#define SERVE_POLICY_NAME_MAX 64
+
+typedef struct sserve_request {
+    __u32 magic;
+    __u32 payload_size;
+    __u32 argc;
+    __u32 envc;
+    char policy_name[SERVE_POLICY_NAME_MAX];
+} serve_request;
+
+typedef struct sserve_response {
+    __u32 magic;
+    __s32 error;
+    __s32 wait_status;
+    __u32 reserved;
+    __u64 utime_us;
+    __u64 stime_us;
+    __u64 maxrss_kb;
+    __u64 minflt;
+    __u64 majflt;
+    __u64 nvcsw;
+    __u64 nivcsw;
+} serve_response;
+
+static const char PAYLOAD[] = "/\0/bin/true\0PATH=/usr/bin:/bin";
+
+static int submit_job(const char* socket_path, int devnull) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (sock >= 0) {
+            close(sock);
+        }
+        return -1;
+    }
+
+    serve_request req = {0};
+    req.magic = SERVE_PROTOCOL_MAGIC;
+    req.payload_size = sizeof(PAYLOAD);
+    req.argc = 1;
+    req.envc = 1;
+    strcpy(req.policy_name, "bench");
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * 3)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+    const int fds[3] = { devnull, devnull, devnull };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    serve_response resp;
+    int ret = -1;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(req) &&
+        send(sock, PAYLOAD, sizeof(PAYLOAD), MSG_NOSIGNAL) == sizeof(PAYLOAD) &&
+        recv(sock, &resp, sizeof(resp), MSG_WAITALL) == sizeof(resp) &&
+        resp.error == 0 && resp.wait_status == 0) {
+        ret = 0;
+    }
+    close(sock);
+    return ret;
+}
+
+// Runs `jobs` jobs spread over `concurrency` client processes and returns
+// the elapsed wall time in nanoseconds, or 0 if any job failed.
+static uint64_t run_clients(size_t jobs, size_t concurrency, const char* socket_path, char *const *argv) {
+    const uint64_t start = bench_now_ns();
+
+    for (size_t c = 0; c < concurrency; c++) {
+        const pid_t pid = fork();
+        if (pid < 0) {
+            bench_fatal("fork failed: %s", strerror(errno));
+        }
+        if (pid > 0) {
+            continue;
+        }
+
+        const int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+        const size_t my_jobs = jobs / concurrency + (c < jobs % concurrency ? 1 : 0);
+        for (size_t i = 0; i < my_jobs; i++) {
+            if (socket_path) {
+                if (submit_job(socket_path, devnull) != 0) {
+                    _exit(1);
+                }
+            } else if (bench_run_command(argv) == 0) {
+                _exit(1);
+            }
+        }
+        _exit(0);
+    }
+
+    int failed = 0;
+    for (size_t c = 0; c < concurrency; c++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed = 1;
+        }
+    }
+
+    return failed ? 0 : bench_now_ns() - start;
+}
+
+static void report(const char* mode, size_t jobs, size_t concurrency, uint64_t elapsed) {
+    printf("{\"bench\":\"serve\",\"mode\":\"%s\",\"jobs\":%zu,\"concurrency\":%zu,", mode, jobs, concurrency);
+    if (elapsed == 0) {
+        printf("\"failed\":true}\n");
+    } else {
+        printf("\"elapsed_ms\":%.2f,\"jobs_per_sec\":%.1f}\n",
+               elapsed / 1e6, jobs / (elapsed / 1e9));
+    }
+    fflush(stdout);
+}
+
+int main(void) {
+    const char* sst = bench_sst_path();
+    const size_t jobs = bench_iterations(2000);
+
+    size_t concurrency = 0;
+    const char* conc = getenv("BENCH_CONCURRENCY");
+    if (conc && conc[0]) {
+        concurrency = (size_t)strtol(conc, NULL, 10);
+    }
+    if (concurrency == 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        concurrency = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    char* dir = bench_make_tmpdir("serve");
+    char *policy_path = NULL, *policy_option = NULL, *socket_path = NULL, *policy_spec = NULL;
+    if (asprintf(&policy_path, "%s/policy.sst", dir) < 0 ||
+        asprintf(&policy_option, "POLICY_FILE:%s", policy_path) < 0 ||
+        asprintf(&socket_path, "%s/sock", dir) < 0 ||
+        asprintf(&policy_spec, "bench=%s", policy_path) < 0) {
+        bench_fatal("asprintf failed");
+    }
+
+    char* compile_argv[] = {
+        (char*)sst, "--compile", policy_path,
+        "ENABLE_FILESYSTEM_SANDBOXING", "ENABLE_NETWORK_SANDBOXING",
+        "PATH_BENEATH_EXEC:/", NULL
+    };
+    if (bench_run_command(compile_argv) == 0) {
+        bench_fatal("'%s --compile' failed", sst);
+    }
+
+    char* sst_argv[] = { (char*)sst, policy_option, "--", "/bin/true", NULL };
+    report("sst", jobs, concurrency, run_clients(jobs, concurrency, NULL, sst_argv));
+
+    const pid_t server = fork();
+    if (server < 0) {
+        bench_fatal("fork failed: %s", strerror(errno));
+    }
+    if (server == 0) {
+        execl(sst, sst, "--serve", socket_path, policy_spec, (char*)NULL);
+        _exit(127);
+    }
+
+    // Wait for the daemon to come up.
+    int up = 0;
+    const int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    for (int i = 0; i < 200 && !up; i++) {
+        up = submit_job(socket_path, devnull) == 0;
+        if (!up) {
+            usleep(10000);
+        }
+    }
+    close(devnull);
+
+    report("serve", jobs, concurrency, up ? run_clients(jobs, concurrency, socket_path, NULL) : 0);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    bench_remove_tree(dir);
+
+    free(policy_path);
+    free(policy_option);
+    free(socket_path);
+    free(policy_spec);
+    free(dir);
+    return 0;
+}
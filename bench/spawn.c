@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// Launch latency of a sandboxed /bin/true against the size of the parent:
+// sst_spawn() (clone() with CLONE_VM | CLONE_VFORK) vs. fork(), then
+// restrict and exec in the child (what you'd do without sst_spawn()). Both
+// use the same prebuilt ruleset; the parent's RSS is grown by touching
+// anonymous memory between rounds.
+//
+// Launch latency is the time until the child has exec()ed: sst_spawn()
+// returns then, and for fork() it's when the child's end of a close-on-exec
+// pipe goes away.
+//
+// Usage: bench/spawn (built against libsst.a)
+//
+// $BENCH_SPAWN_MAX_MB caps the parent's RSS (default 2048).
+//
+
+#include "bench.h"
+
+#include <sys/mman.h>
+
+#include "../sst.h"
+
+static const size_t RSS_MB[] = { 0, 64, 256, 1024, 2048, 4096, 16384 };
+
+static char* const CHILD_ARGV[] = { "/bin/true", NULL };
+static char* const CHILD_ENVP[] = { NULL };
+
+static uint64_t launch_sst_spawn(const sst_ruleset* ruleset) {
+    const uint64_t start = bench_now_ns();
+    pid_t pid;
+    if (sst_spawn(&pid, CHILD_ARGV[0], ruleset, CHILD_ARGV, CHILD_ENVP) != 0) {
+        bench_fatal("sst_spawn failed: %s", sst_error());
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+    waitpid(pid, NULL, 0);
+    return elapsed;
+}
+
+static uint64_t launch_fork(const sst_ruleset* ruleset) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0) {
+        bench_fatal("pipe2 failed: %s", strerror(errno));
+    }
+    const uint64_t start = bench_now_ns();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        bench_fatal("fork failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        if (sst_ruleset_apply_thread(ruleset) != 0) {
+            _exit(126);
+        }
+        execve(CHILD_ARGV[0], CHILD_ARGV, CHILD_ENVP);
+        _exit(127);
+    }
+    close(pipefd[1]);
+    char c;
+    while (read(pipefd[0], &c, 1) < 0 && errno == EINTR) {
+    }
+    const uint64_t elapsed = bench_now_ns() - start;
+    close(pipefd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        bench_fatal("forked child failed");
+    }
+    return elapsed;
+}
+
+// A ruleset that still lets /bin/true run.
+static sst_ruleset* make_ruleset(void) {
+    sst_policy* pol = sst_policy_new();
+    if (!pol ||
+        sst_policy_enable(pol, SST_FILESYSTEM) != 0 ||
+        sst_policy_add_path_beneath(pol, "/", SST_EXEC) != 0) {
+        bench_fatal("cannot build policy: %s", sst_error());
+    }
+    sst_ruleset* ruleset = sst_ruleset_new(pol);
+    if (!ruleset) {
+        bench_fatal("cannot build ruleset: %s", sst_error());
+    }
+    sst_policy_free(pol);
+    return ruleset;
+}
+
+static void report(const char* method, size_t rss_mb, uint64_t* samples, size_t count) {
+    printf("{\"bench\":\"spawn\",\"method\":\"%s\",\"parent_rss_mb\":%zu,", method, rss_mb);
+    const bench_stats st = bench_compute_stats(samples, count);
+    bench_print_stats(&st);
+}
+
+int main(void) {
+    size_t max_mb = 2048;
+    const char* max_env = getenv("BENCH_SPAWN_MAX_MB");
+    if (max_env && max_env[0]) {
+        max_mb = (size_t)strtoull(max_env, NULL, 10);
+    }
+
+    sst_ruleset* ruleset = make_ruleset();
+
+    const size_t iterations = bench_iterations(100);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+
+    size_t mapped_mb = 0;
+    for (size_t r = 0; r < sizeof(RSS_MB) / sizeof(RSS_MB[0]) && RSS_MB[r] <= max_mb; r++) {
+        // Grow the parent to the next size; the memory stays mapped and
+        // touched for the rest of the run.
+        const size_t grow_mb = RSS_MB[r] - mapped_mb;
+        if (grow_mb > 0) {
+            char* mem = mmap(NULL, grow_mb << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                bench_fatal("cannot map %zu MB: %s", grow_mb, strerror(errno));
+            }
+            for (size_t off = 0; off < grow_mb << 20; off += 4096) {
+                mem[off] = 1;
+            }
+            mapped_mb = RSS_MB[r];
+        }
+
+        for (size_t i = 0; i < iterations; i++) {
+            samples[i] = launch_sst_spawn(ruleset);
+        }
+        report("sst_spawn", RSS_MB[r], samples, iterations);
+
+        for (size_t i = 0; i < iterations; i++) {
+            samples[i] = launch_fork(ruleset);
+        }
+        report("fork", RSS_MB[r], samples, iterations);
+    }
+
+    free(samples);
+    sst_ruleset_free(ruleset);
+    return 0;
+}
@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// What `sst` adds to process start:
+//
+//  - exec_to_child: time from execve() of the command (or of `sst` wrapping
+//    it) to the start of the command's main(), with and without `sst`.
+//  - add_rule: cost per rule of opening its path and landlock_add_rule(),
+//    for FILE_* (regular files) and PATH_BENEATH_* (directories) rules.
+//  - restrict_self: cost of landlock_restrict_self() itself.
+//  - command: wall time of running /bin/true to completion, with and
+//    without `sst`.
+//
+// Usage: SST=./sst bench/startup
+//
+// add_rule and restrict_self make the syscalls directly rather than going
+// through `sst`, so that nothing else is in the numbers.
+//
+
+#include "bench.h"
+
+#include <limits.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/landlock.h>
+
+#define RULE_COUNT 1000
+
+// Every filesystem access right of Landlock ABI 1.
+#define HANDLED_FS_ACCESS ((1ULL << 13) - 1)
+
+#define FILE_ACCESS (LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_EXECUTE)
+#define DIR_ACCESS (FILE_ACCESS | LANDLOCK_ACCESS_FS_READ_DIR)
+
+// Child end of the exec_to_child measurement: this is the first thing the
+// command does. Writes how long it took to get here from the execve().
+static int child_main(const char* start_ns) {
+    const uint64_t now = bench_now_ns();
+    const uint64_t elapsed = now - strtoull(start_ns, NULL, 10);
+    return write(3, &elapsed, sizeof(elapsed)) == sizeof(elapsed) ? 0 : 1;
+}
+
+static int create_ruleset(void) {
+    const struct landlock_ruleset_attr attr = { .handled_access_fs = HANDLED_FS_ACCESS };
+    const int fd = (int)syscall(__NR_landlock_create_ruleset, &attr, sizeof(attr), 0);
+    if (fd < 0) {
+        bench_fatal("landlock_create_ruleset failed: %s", strerror(errno));
+    }
+    return fd;
+}
+
+// Adds a rule for `path` the way `sst` does: O_PATH open, fstat, add_rule.
+static void add_rule(int ruleset_fd, const char* path, __u64 access) {
+    const int fd = open(path, O_PATH | O_CLOEXEC);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        bench_fatal("cannot open '%s': %s", path, strerror(errno));
+    }
+    const struct landlock_path_beneath_attr attr = { .allowed_access = access, .parent_fd = fd };
+    if (syscall(__NR_landlock_add_rule, ruleset_fd, LANDLOCK_RULE_PATH_BENEATH, &attr, 0) != 0) {
+        bench_fatal("landlock_add_rule failed: %s", strerror(errno));
+    }
+    close(fd);
+}
+
+static void bench_exec_to_child(const char* self, const char* mode, char** sst_prefix, size_t prefix_len) {
+    printf("{\"bench\":\"startup\",\"measure\":\"exec_to_child\",\"mode\":\"%s\",", mode);
+
+    const size_t iterations = bench_iterations(200);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    char** argv = calloc(prefix_len + 4, sizeof(char*));
+    if (!samples || !argv) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < prefix_len; i++) {
+        argv[i] = sst_prefix[i];
+    }
+    argv[prefix_len] = (char*)self;
+    argv[prefix_len + 1] = "--child";
+
+    for (size_t i = 0; i < iterations; i++) {
+        int pipefd[2];
+        if (pipe(pipefd) != 0) {
+            bench_fatal("pipe failed: %s", strerror(errno));
+        }
+        const pid_t pid = fork();
+        if (pid < 0) {
+            bench_fatal("fork failed: %s", strerror(errno));
+        }
+        if (pid == 0) {
+            dup2(pipefd[1], 3);
+            char start_ns[32];
+            snprintf(start_ns, sizeof(start_ns), "%llu", (unsigned long long)bench_now_ns());
+            argv[prefix_len + 2] = start_ns;
+            execv(argv[0], argv);
+            _exit(127);
+        }
+        close(pipefd[1]);
+        uint64_t elapsed = 0;
+        const ssize_t n = read(pipefd[0], &elapsed, sizeof(elapsed));
+        close(pipefd[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        if (n != sizeof(elapsed) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            bench_fatal("exec_to_child (%s) failed", mode);
+        }
+        samples[i] = elapsed;
+    }
+
+    const bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    free(argv);
+    free(samples);
+}
+
+static void bench_add_rule(const char* kind, char** paths, __u64 access) {
+    printf("{\"bench\":\"startup\",\"measure\":\"add_rule\",\"kind\":\"%s\",", kind);
+
+    // Each pass adds every path to a fresh ruleset; every rule is a sample.
+    const size_t passes = bench_iterations(5);
+    const size_t count = passes * RULE_COUNT;
+    uint64_t* samples = calloc(count, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    for (size_t pass = 0; pass < passes; pass++) {
+        const int ruleset_fd = create_ruleset();
+        for (size_t i = 0; i < RULE_COUNT; i++) {
+            const uint64_t start = bench_now_ns();
+            add_rule(ruleset_fd, paths[i], access);
+            samples[pass * RULE_COUNT + i] = bench_now_ns() - start;
+        }
+        close(ruleset_fd);
+    }
+
+    const bench_stats st = bench_compute_stats(samples, count);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+// restrict_self can't be undone, so every sample is a fresh child.
+static void bench_restrict_self(char** dirs, size_t rules) {
+    printf("{\"bench\":\"startup\",\"measure\":\"restrict_self\",\"rules\":%zu,", rules);
+
+    const size_t iterations = bench_iterations(200);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        int pipefd[2];
+        if (pipe(pipefd) != 0) {
+            bench_fatal("pipe failed: %s", strerror(errno));
+        }
+        const pid_t pid = fork();
+        if (pid < 0) {
+            bench_fatal("fork failed: %s", strerror(errno));
+        }
+        if (pid == 0) {
+            const int ruleset_fd = create_ruleset();
+            for (size_t r = 0; r < rules; r++) {
+                add_rule(ruleset_fd, dirs[r], DIR_ACCESS);
+            }
+            if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
+                _exit(1);
+            }
+            const uint64_t start = bench_now_ns();
+            if (syscall(__NR_landlock_restrict_self, ruleset_fd, 0) != 0) {
+                _exit(1);
+            }
+            const uint64_t elapsed = bench_now_ns() - start;
+            _exit(write(pipefd[1], &elapsed, sizeof(elapsed)) == sizeof(elapsed) ? 0 : 1);
+        }
+        close(pipefd[1]);
+        uint64_t elapsed = 0;
+        const ssize_t n = read(pipefd[0], &elapsed, sizeof(elapsed));
+        close(pipefd[0]);
+        int status;
+        waitpid(pid, &status, 0);
+        if (n != sizeof(elapsed) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            bench_fatal("restrict_self child failed");
+        }
+        samples[i] = elapsed;
+    }
+
+    const bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+static void bench_command(const char* mode, char** argv) {
+    printf("{\"bench\":\"startup\",\"measure\":\"command\",\"mode\":\"%s\",", mode);
+
+    const size_t iterations = bench_iterations(200);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        samples[i] = bench_run_command(argv);
+        if (samples[i] == 0) {
+            bench_fatal("command (%s) failed", mode);
+        }
+    }
+    const bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && strcmp(argv[1], "--child") == 0) {
+        return child_main(argv[2]);
+    }
+
+    const char* sst = bench_sst_path();
+    char self[PATH_MAX];
+    const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        bench_fatal("readlink(/proc/self/exe) failed: %s", strerror(errno));
+    }
+    self[self_len] = '\0';
+
+    char* dir = bench_make_tmpdir("startup");
+    char** files = calloc(RULE_COUNT, sizeof(char*));
+    char** dirs = calloc(RULE_COUNT, sizeof(char*));
+    if (!files || !dirs) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < RULE_COUNT; i++) {
+        if (asprintf(&files[i], "%s/f%zu", dir, i) < 0 ||
+            asprintf(&dirs[i], "%s/d%zu", dir, i) < 0) {
+            bench_fatal("asprintf failed");
+        }
+        const int fd = open(files[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || mkdir(dirs[i], 0755) != 0) {
+            bench_fatal("cannot create files in '%s': %s", dir, strerror(errno));
+        }
+        close(fd);
+    }
+
+    bench_exec_to_child(self, "unsandboxed", NULL, 0);
+    char* fs_prefix[] = {
+        (char*)sst, "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/", "--"
+    };
+    bench_exec_to_child(self, "filesystem", fs_prefix, sizeof(fs_prefix) / sizeof(fs_prefix[0]));
+    char* net_prefix[] = {
+        (char*)sst, "ENABLE_NETWORK_SANDBOXING", "ALLOW_OUTGOING_TCP_PORT:443", "--"
+    };
+    bench_exec_to_child(self, "network", net_prefix, sizeof(net_prefix) / sizeof(net_prefix[0]));
+
+    bench_add_rule("FILE", files, FILE_ACCESS);
+    bench_add_rule("PATH_BENEATH", dirs, DIR_ACCESS);
+
+    bench_restrict_self(dirs, 1);
+    bench_restrict_self(dirs, RULE_COUNT);
+
+    char* plain_argv[] = { "/bin/true", NULL };
+    bench_command("unsandboxed", plain_argv);
+    char* sst_argv[] = {
+        (char*)sst, "ENABLE_FILESYSTEM_SANDBOXING", "PATH_BENEATH_EXEC:/", "--", "/bin/true", NULL
+    };
+    bench_command("filesystem", sst_argv);
+
+    for (size_t i = 0; i < RULE_COUNT; i++) {
+        free(files[i]);
+        free(dirs[i]);
+    }
+    free(files);
+    free(dirs);
+    bench_remove_tree(dir);
+    free(dir);
+    return 0;
+}
@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// What `sst --supervise=<fd>` costs: the wall time of a sandboxed
+// /bin/true with and without it, and how long a SIGUSR1 sent to `sst`
+// takes to reach the command (without --supervise, `sst` *is* the command,
+// so that's the baseline).
+//
+// For the signal, the program runs itself under `sst` (`bench/supervise
+// --child`): the child says it's ready on stdout, waits for SIGUSR1 and
+// writes back the CLOCK_MONOTONIC time it got it.
+//
+// Usage: SST=./sst bench/supervise
+//
+
+#include "bench.h"
+
+#include <limits.h>
+#include <signal.h>
+
+static int child_main(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    if (write(1, "r", 1) != 1) {
+        return 1;
+    }
+    int sig;
+    sigwait(&mask, &sig);
+    const uint64_t now = bench_now_ns();
+    return write(1, &now, sizeof(now)) == sizeof(now) ? 0 : 1;
+}
+
+static int read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        const ssize_t got = read(fd, p, len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return -1;
+        }
+        p += got;
+        len -= (size_t)got;
+    }
+    return 0;
+}
+
+// Sends SIGUSR1 to `sst` running the child and returns the time it took to
+// get there.
+static uint64_t signal_latency(char** argv) {
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        bench_fatal("pipe failed: %s", strerror(errno));
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        bench_fatal("fork failed: %s", strerror(errno));
+    }
+    if (pid == 0) {
+        dup2(pipefd[1], 1);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        const int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, 3);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(pipefd[1]);
+
+    char ready;
+    if (read_full(pipefd[0], &ready, 1) != 0) {
+        bench_fatal("child did not start");
+    }
+    const uint64_t sent = bench_now_ns();
+    kill(pid, SIGUSR1);
+    uint64_t received;
+    if (read_full(pipefd[0], &received, sizeof(received)) != 0) {
+        bench_fatal("child did not get the signal");
+    }
+    close(pipefd[0]);
+    waitpid(pid, NULL, 0);
+    return received - sent;
+}
+
+static void run(const char* measure, const char* mode, char** argv, int signal) {
+    printf("{\"bench\":\"supervise\",\"measure\":\"%s\",\"mode\":\"%s\",", measure, mode);
+
+    const size_t iterations = bench_iterations(signal ? 500 : 1000);
+    uint64_t* samples = calloc(iterations, sizeof(uint64_t));
+    if (!samples) {
+        bench_fatal("out of memory");
+    }
+    for (size_t i = 0; i < iterations; i++) {
+        samples[i] = signal ? signal_latency(argv) : bench_run_command(argv);
+        if (samples[i] == 0 && !signal) {
+            bench_fatal("'%s' failed in mode %s", argv[0], mode);
+        }
+    }
+    const bench_stats st = bench_compute_stats(samples, iterations);
+    bench_print_stats(&st);
+    free(samples);
+}
+
+int main(int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "--child") == 0) {
+        return child_main();
+    }
+
+    const char* sst = bench_sst_path();
+    char self[PATH_MAX];
+    const ssize_t self_len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (self_len < 0) {
+        bench_fatal("readlink(/proc/self/exe) failed: %s", strerror(errno));
+    }
+    self[self_len] = '\0';
+
+    // bench_run_command() leaves fd 2 at /dev/null, which is where the
+    // report goes.
+    char* true_argv[] = { (char*)sst, "ENABLE_NETWORK_SANDBOXING", "--", "/bin/true", NULL };
+    char* true_supervised_argv[] = {
+        (char*)sst, "--supervise=2", "ENABLE_NETWORK_SANDBOXING", "--", "/bin/true", NULL
+    };
+    run("command", "exec", true_argv, 0);
+    run("command", "supervise", true_supervised_argv, 0);
+
+    char* child_argv[] = { (char*)sst, "ENABLE_NETWORK_SANDBOXING", "--", self, "--child", NULL };
+    char* child_supervised_argv[] = {
+        (char*)sst, "--supervise=3", "ENABLE_NETWORK_SANDBOXING", "--", self, "--child", NULL
+    };
+    run("signal", "exec", child_argv, 1);
+    run("signal", "supervise", child_supervised_argv, 1);
+    return 0;
+}
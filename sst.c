@@ -20,36 +20,110 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <elf.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
 #include <linux/landlock.h>
+#include <linux/seccomp.h>
+
+#include "sst.h"
 
 // I've ad-hoc added any #defines here when I hit a situation of
 // linux/landlock.h not having the latest definitions.
 #ifndef LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON
 #define LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON 2
 #endif
-
-// How many rules we accept on command-line.
-#define MAX_FS_RULES 1024
-#define MAX_NET_RULES 1024
+#ifndef LANDLOCK_RESTRICT_SELF_TSYNC
+#define LANDLOCK_RESTRICT_SELF_TSYNC (1U << 3)
+#endif
 
 typedef struct sfs_rule {
-    char* path;
+    // Points into argv, a *_LIST file's contents or a mmap()ed policy
+    // file; rules don't own their paths.
+    const char* path;
     int is_directory;
     __u32 access;
 } fs_rule;
 
-typedef struct snet_rule {
-    long port;
-    int allow_incoming;
-    int allow_outgoing;
-} net_rule;
+#define PORT_COUNT 65536
+#define PORT_BITMAP_WORDS (PORT_COUNT / 64)
+
+typedef struct spolicy_buffer {
+    void* base;
+    // 0 if malloc()ed, otherwise the size of the mmap()ing.
+    size_t mmap_size;
+} policy_buffer;
+
+typedef struct spolicy {
+    int fs_sandboxing_enabled;
+    int net_sandboxing_enabled;
+
+    size_t fs_rule_count;
+    size_t fs_rule_capacity;
+    fs_rule* fs_rules;
+
+    // One bit per port and direction. A port with either bit set becomes
+    // one network rule; net_rule_count is the number of such ports.
+    __u64 incoming_ports[PORT_BITMAP_WORDS];
+    __u64 outgoing_ports[PORT_BITMAP_WORDS];
+    size_t net_rule_count;
+
+    // RULESET_CACHE:<socket>, or NULL.
+    const char* ruleset_cache;
+
+    // RESOLVE_THREADS:<n>; 0 means pick automatically.
+    int resolve_threads;
+
+    // OPTIMIZE_RULES was given.
+    int optimize_rules;
+
+    // NO_COALESCE was given: a nested `sst` gets a Landlock layer of its own.
+    int no_coalesce;
+
+    // Memory that rule paths point into: *_LIST contents, policy file
+    // mappings and libsst's copies of its arguments. `sst` never frees any
+    // of it, as it execs or exits; libsst does in sst_policy_free().
+    policy_buffer* buffers;
+    size_t buffer_count;
+    size_t buffer_capacity;
+} policy;
+
+#define RESOLVE_MAX_THREADS 64
+
+typedef struct sinode_id {
+    __u64 dev;
+    __u64 ino;
+} inode_id;
 
 #ifndef landlock_create_ruleset
 static inline int landlock_create_ruleset(
@@ -81,9 +155,22 @@ static inline int landlock_restrict_self(
 }
 #endif
 
+// While a libsst function is running, fatal errors end that function
+// instead of the process: the message is kept for sst_error() and we
+// longjmp() back to it.
+static __thread jmp_buf* sst_error_jmp = NULL;
+static __thread char sst_error_message[1024];
+static __thread int sst_error_errno;
+
 static void fatal_error(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
+    if (sst_error_jmp) {
+        vsnprintf(sst_error_message, sizeof(sst_error_message), fmt, args);
+        va_end(args);
+        sst_error_errno = EINVAL;
+        longjmp(*sst_error_jmp, 1);
+    }
     fprintf(stderr, "sst: error: ");
     vfprintf(stderr, fmt, args);
     fprintf(stderr, "\n");
@@ -97,6 +184,16 @@ static void fatal_error_errno(const char *fmt, ...) {
 
     va_list args;
     va_start(args, fmt);
+    if (sst_error_jmp) {
+        const int len = vsnprintf(sst_error_message, sizeof(sst_error_message), fmt, args);
+        va_end(args);
+        if (len >= 0 && (size_t)len < sizeof(sst_error_message)) {
+            snprintf(sst_error_message + len, sizeof(sst_error_message) - (size_t)len,
+                     ": %s", strerror(errno_captured));
+        }
+        sst_error_errno = errno_captured;
+        longjmp(*sst_error_jmp, 1);
+    }
     fprintf(stderr, "sst: error: ");
     vfprintf(stderr, fmt, args);
     va_end(args);
@@ -141,20 +238,12 @@ static int parse_port(const char *str, long *port_out) {
     return 0;
 }
 
-static int is_filelike(int fd) {
-    struct stat sb;
-    if (fstat(fd, &sb) != 0) {
-        return -1;
-    }
-    return S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode);
+static int is_filelike(mode_t mode) {
+    return S_ISREG(mode) || S_ISBLK(mode) || S_ISCHR(mode);
 }
 
-static int is_directory(int fd) {
-    struct stat sb;
-    if (fstat(fd, &sb) != 0) {
-        return -1;
-    }
-    return S_ISDIR(sb.st_mode);
+static int is_directory(mode_t mode) {
+    return S_ISDIR(mode);
 }
 
 static const __u32 FULL_FS_ACCESS =
@@ -262,14 +351,96 @@ static void show_help(FILE* out) {
     fprintf(out, "    PATH_BENEATH_EXEC_WRITE:<dir>\n");
     fprintf(out, "    PATH_BENEATH_WRITE_EXEC:<dir>\n");
     fprintf(out, "\n");
+    fprintf(out, "Every filesystem option also has a _LIST variant (e.g. FILE_READ_LIST:<list>)\n");
+    fprintf(out, "that reads newline- or NUL-separated paths from the file <list>, or from an\n");
+    fprintf(out, "inherited file descriptor if <list> is fd:<N>.\n");
+    fprintf(out, "\n");
     fprintf(out, "FILE_* must be used with 'file-like' files (currently this means: regular\n");
     fprintf(out, "files, block devices or character devices). PATH_BENEATH_* must be used with\n");
     fprintf(out, "directories.\n");
     fprintf(out, "\n");
+    fprintf(out, "EXEC_DEPS adds FILE_EXEC rules for the command, its ELF interpreter and the\n");
+    fprintf(out, "shared libraries it needs (EXEC_DEPS:<path> for another executable; the result is\n");
+    fprintf(out, "cached). `sst --exec-deps <command>` prints them.\n");
+    fprintf(out, "\n");
+    fprintf(out, "OPTIMIZE_RULES merges duplicate rules and drops rules that parent directories'\n");
+    fprintf(out, "rules already cover, without changing what is allowed.\n");
+    fprintf(out, "\n");
+    fprintf(out, "A nested `sst ... -- sst ... -- command` is merged into a single Landlock layer\n");
+    fprintf(out, "when that allows exactly the same; NO_COALESCE (on either) keeps both layers.\n");
+    fprintf(out, "\n");
+    fprintf(out, "Large rule sets open their paths in parallel; RESOLVE_THREADS:<n> overrides\n");
+    fprintf(out, "the number of threads used for that (1 = no threads).\n");
+    fprintf(out, "\n");
     fprintf(out, "Networking-related permissions:\n");
     fprintf(out, "\n");
     fprintf(out, "    ALLOW_INCOMING_TCP_PORT:<port>\n");
     fprintf(out, "    ALLOW_OUTGOING_TCP_PORT:<port>\n");
+    fprintf(out, "    ALLOW_INCOMING_TCP_PORTS:<ports>\n");
+    fprintf(out, "    ALLOW_OUTGOING_TCP_PORTS:<ports>\n");
+    fprintf(out, "    (<ports> is a comma-separated list of ports and ranges, e.g. 1024-65535,80)\n");
+    fprintf(out, "\n");
+    fprintf(out, "Placement of the command (applied just before exec):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    CPU_AFFINITY:<cpus>            (e.g. 0-7,16)\n");
+    fprintf(out, "    NUMA_MEMBIND:<nodes>           (e.g. 0)\n");
+    fprintf(out, "    SCHED_POLICY:<policy>[:<prio>] (other, batch, idle, fifo:<prio>, rr:<prio>)\n");
+    fprintf(out, "    NICE:<n>                       (-20 to 19)\n");
+    fprintf(out, "    IOPRIO:<class>[:<level>]       (rt, be with level 0-7; idle)\n");
+    fprintf(out, "\n");
+    fprintf(out, "Page cache prewarming (in the background, before exec):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    PREWARM                        (the command, its ELF interpreter and libraries)\n");
+    fprintf(out, "    PREWARM:<path>                 (a file, or the files under a directory)\n");
+    fprintf(out, "\n");
+    fprintf(out, "Listening sockets (bound by sst, passed as fds 3... with LISTEN_FDS/LISTEN_PID):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    LISTEN_TCP:<addr>:<port>       (e.g. 127.0.0.1:8080, [::1]:8080, *:8080)\n");
+    fprintf(out, "\n");
+    fprintf(out, "Timing (written to <fd> just before running the command):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --timing=<fd>[,json|,chrome][,rules=<n>] option1 ... -- command\n");
+    fprintf(out, "    SST_TIMING=<fd>[,json|,chrome][,rules=<n>] sst option1 ... -- command\n");
+    fprintf(out, "\n");
+    fprintf(out, "Supervisor (sst stays around and writes the command's rusage as JSON to <fd>):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --supervise=<fd> option1 ... -- command\n");
+    fprintf(out, "    sst [--supervise=<fd>] --restart=always|on-failure[,max=<n>] option1 ... -- command\n");
+    fprintf(out, "    (with --restart, SIGHUP to sst starts a new command and then stops the old one)\n");
+    fprintf(out, "\n");
+    fprintf(out, "Learning a policy (runs the command unsandboxed, writes the options that allow\n");
+    fprintf(out, "what it did to <output>, one per line):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --learn <output> -- command arg1 arg2 argN\n");
+    fprintf(out, "\n");
+    fprintf(out, "Checking a policy (prints the queries in <queries>, '<access> <path>' per line,\n");
+    fprintf(out, "that the options would deny; e.g. read_file, write_file, execute, make_reg):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --check <queries> [--threads <n>] [--no-resolve] option1 option2 optionN\n");
+    fprintf(out, "\n");
+    fprintf(out, "Precompiled policies:\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --compile <policy-file> option1 option2 optionN\n");
+    fprintf(out, "    POLICY_FILE:<policy-file>\n");
+    fprintf(out, "\n");
+    fprintf(out, "A compiled policy as C, for a binary with the policy built in\n");
+    fprintf(out, "(make POLICY=<policy-file> sst-<name>):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --bake <policy-file> <header>\n");
+    fprintf(out, "\n");
+    fprintf(out, "Launcher daemon (forks jobs from pre-sandboxed zygotes):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --serve <socket> name=<policy-file> [name=<policy-file> ...]\n");
+    fprintf(out, "    sst --submit <socket> <name> -- command arg1 arg2 argN\n");
+    fprintf(out, "\n");
+    fprintf(out, "Ruleset cache (reuses already built rulesets across invocations):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --ruleset-cache <socket> [pool-size]\n");
+    fprintf(out, "    RULESET_CACHE:<socket>\n");
+    fprintf(out, "\n");
+    fprintf(out, "Job runner (every command of <file>, <n> at a time, one ruleset for all):\n");
+    fprintf(out, "\n");
+    fprintf(out, "    sst --jobs <n> --manifest <file> [--output-dir <dir>] option1 ... optionN\n");
     fprintf(out, "\n");
     fprintf(out, "Example that stops TCP networking for a shell (and anything ran in it):\n");
     fprintf(out, "\n");
@@ -277,69 +448,531 @@ static void show_help(FILE* out) {
     fprintf(out, "\n");
 }
 
-int main(int argc, char **argv, char *const *const envp) {
-    restrict_privileges_for_landlock();
+typedef struct sfs_option {
+    const char* prefix;
+    const char* list_prefix;
+    const char* name;
+    int is_directory;
+    __u32 access;
+} fs_option;
 
-    // Is the user looking for help from their untimely demise? Or just
-    // wanting to figure out wtf is 'sst' because they saw it in a shell
-    // script somewhere. If yes, then print help, exit.
-    if ((argc == 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)) ||
-         argc == 1) {
-        show_help(stdout);
-        exit(0);
+typedef struct snet_option {
+    const char* prefix;
+    const char* name;
+    // Takes a list of ports and port ranges rather than a single port.
+    int is_list;
+    int allow_incoming;
+    int allow_outgoing;
+} net_option;
+
+static void push_fs_rule(policy* pol, const char* path, int is_directory, __u32 access) {
+    if (pol->fs_rule_count == pol->fs_rule_capacity) {
+        pol->fs_rule_capacity = pol->fs_rule_capacity ? pol->fs_rule_capacity * 2 : 64;
+        const size_t realloc_sz = sizeof(fs_rule) * pol->fs_rule_capacity;
+        pol->fs_rules = realloc(pol->fs_rules, realloc_sz);
+        if (!pol->fs_rules) {
+            fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+        }
     }
+    pol->fs_rules[pol->fs_rule_count].path = path;
+    pol->fs_rules[pol->fs_rule_count].is_directory = is_directory;
+    pol->fs_rules[pol->fs_rule_count].access = access;
+    pol->fs_rule_count++;
+}
 
-    // Find the -- separator.
-    int sep_idx = -1;
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--") == 0) {
-            sep_idx = i;
-            break;
+static void policy_keep_buffer(policy* pol, void* base, size_t mmap_size) {
+    if (pol->buffer_count == pol->buffer_capacity) {
+        pol->buffer_capacity = pol->buffer_capacity ? pol->buffer_capacity * 2 : 8;
+        const size_t realloc_sz = sizeof(policy_buffer) * pol->buffer_capacity;
+        pol->buffers = realloc(pol->buffers, realloc_sz);
+        if (!pol->buffers) {
+            fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
         }
     }
+    pol->buffers[pol->buffer_count].base = base;
+    pol->buffers[pol->buffer_count].mmap_size = mmap_size;
+    pol->buffer_count++;
+}
 
-    for (int i1 = 1; i1 < sep_idx; i1++) {
-        if (strcmp(argv[i1], "--help") == 0 ||
-            strcmp(argv[i1], "-h") == 0) {
-            show_help(stderr);
-            exit(1);
+static void free_policy(policy* pol) {
+    for (size_t i = 0; i < pol->buffer_count; i++) {
+        if (pol->buffers[i].mmap_size) {
+            munmap(pol->buffers[i].base, pol->buffers[i].mmap_size);
+        } else {
+            free(pol->buffers[i].base);
         }
     }
+    free(pol->buffers);
+    free(pol->fs_rules);
+}
 
-    if (sep_idx == -1) {
-        fatal_error("missing '--' separator in arguments");
+// Allows ports first..last (inclusive).
+static void push_net_rule_range(policy* pol, long first, long last, int allow_incoming, int allow_outgoing) {
+    for (long port = first; port <= last; port++) {
+        const size_t word = (size_t)port / 64;
+        const __u64 bit = 1ULL << (port % 64);
+        if (!((pol->incoming_ports[word] | pol->outgoing_ports[word]) & bit)) {
+            pol->net_rule_count++;
+        }
+        if (allow_incoming) {
+            pol->incoming_ports[word] |= bit;
+        }
+        if (allow_outgoing) {
+            pol->outgoing_ports[word] |= bit;
+        }
     }
+}
 
-    if (sep_idx == argc - 1) {
-        fatal_error("no command specified after '--'");
+static void push_net_rule(policy* pol, long port, int allow_incoming, int allow_outgoing) {
+    push_net_rule_range(pol, port, port, allow_incoming, allow_outgoing);
+}
+
+// Returns the first port >= `from` that has a network rule, or -1.
+static long next_net_rule_port(const policy* pol, long from) {
+    size_t word = (size_t)from / 64;
+    if (word >= PORT_BITMAP_WORDS) {
+        return -1;
+    }
+    __u64 bits = (pol->incoming_ports[word] | pol->outgoing_ports[word]) & (~0ULL << (from % 64));
+    while (!bits) {
+        if (++word == PORT_BITMAP_WORDS) {
+            return -1;
+        }
+        bits = pol->incoming_ports[word] | pol->outgoing_ports[word];
+    }
+    return (long)(word * 64 + (size_t)__builtin_ctzll(bits));
+}
+
+static int port_allows_incoming(const policy* pol, long port) {
+    return (pol->incoming_ports[port / 64] >> (port % 64)) & 1;
+}
+
+static int port_allows_outgoing(const policy* pol, long port) {
+    return (pol->outgoing_ports[port / 64] >> (port % 64)) & 1;
+}
+
+// Parses "<port>[-<port>][,...]" into `pol`. Returns -1 if malformed.
+static int parse_port_list(policy* pol, const char* str, int allow_incoming, int allow_outgoing) {
+    const char* p = str;
+    do {
+        const size_t len = strcspn(p, ",");
+        // Longest valid item is "65535-65535".
+        char item[12];
+        if (len == 0 || len >= sizeof(item)) {
+            return -1;
+        }
+        memcpy(item, p, len);
+        item[len] = '\0';
+
+        long first, last;
+        char* dash = strchr(item, '-');
+        if (dash) {
+            *dash = '\0';
+            if (parse_port(item, &first) != 0 || parse_port(dash + 1, &last) != 0 || first > last) {
+                return -1;
+            }
+        } else {
+            if (parse_port(item, &first) != 0) {
+                return -1;
+            }
+            last = first;
+        }
+        push_net_rule_range(pol, first, last, allow_incoming, allow_outgoing);
+
+        p += len;
+    } while (*p++ == ',');
+    return 0;
+}
+
+/****
+ * POLICY FILES
+ *
+ * `sst --compile` writes the parsed rule tables into a file that
+ * `POLICY_FILE:<path>` can later mmap() and use as-is, without going through
+ * the option parser again. The layout is:
+ *
+ *   policy_file_header
+ *   policy_file_fs_rule  * fs_rule_count
+ *   policy_file_net_rule * net_rule_count
+ *   string table (NUL-terminated paths, fs rules point into it by offset)
+ *
+ * Everything is in native byte order; the files are meant to be compiled on
+ * the machine (or at least the architecture) that uses them. Bump
+ * POLICY_FILE_VERSION whenever the layout or meaning of a field changes.
+ ****/
+
+#define POLICY_FILE_MAGIC "SSTPOLCY"
+#define POLICY_FILE_VERSION 1
+
+#define POLICY_FILE_FLAG_FS_SANDBOXING  (1U << 0)
+#define POLICY_FILE_FLAG_NET_SANDBOXING (1U << 1)
+
+typedef struct spolicy_file_header {
+    char magic[8];
+    __u32 version;
+    __u32 flags;
+    __u32 fs_rule_count;
+    __u32 net_rule_count;
+    __u32 strings_size;
+    __u32 reserved;
+} policy_file_header;
+
+typedef struct spolicy_file_fs_rule {
+    __u64 access;
+    __u32 path_offset;
+    __u32 is_directory;
+} policy_file_fs_rule;
+
+typedef struct spolicy_file_net_rule {
+    __u32 port;
+    __u32 allow_incoming;
+    __u32 allow_outgoing;
+} policy_file_net_rule;
+
+static void load_policy_buffer(policy* pol, const char* base, size_t file_sz, const char* filepath);
+
+static void load_policy_file(policy* pol, const char* filepath) {
+    const int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fatal_error_errno("POLICY_FILE: cannot open '%s'", filepath);
     }
 
-    int fs_sandboxing_enabled = 0;
-    int net_sandboxing_enabled = 0;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        fatal_error_errno("POLICY_FILE: cannot invoke fstat on '%s'", filepath);
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        fatal_error("POLICY_FILE: '%s' is not a regular file", filepath);
+    }
+    if ((size_t)sb.st_size < sizeof(policy_file_header)) {
+        fatal_error("POLICY_FILE: '%s' is too small to be a policy file", filepath);
+    }
+
+    const size_t file_sz = (size_t)sb.st_size;
+    const char* base = mmap(NULL, file_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        fatal_error_errno("POLICY_FILE: cannot mmap '%s'", filepath);
+    }
+    close(fd);
+
+    // fs_rules[].path points into the mapping.
+    policy_keep_buffer(pol, (void*)base, file_sz);
+    load_policy_buffer(pol, base, file_sz, filepath);
+}
+
+// Adds the rules of an in-memory policy file image to `pol`. The paths in
+// `pol` point into `base`, so it has to stay around. `filepath` is only used
+// in error messages.
+static void load_policy_buffer(policy* pol, const char* base, size_t file_sz, const char* filepath) {
+    if (file_sz < sizeof(policy_file_header)) {
+        fatal_error("POLICY_FILE: '%s' is too small to be a policy file", filepath);
+    }
+
+    policy_file_header hdr;
+    memcpy(&hdr, base, sizeof(hdr));
+
+    if (memcmp(hdr.magic, POLICY_FILE_MAGIC, sizeof(hdr.magic)) != 0) {
+        fatal_error("POLICY_FILE: '%s' is not an sst policy file", filepath);
+    }
+    if (hdr.version != POLICY_FILE_VERSION) {
+        fatal_error("POLICY_FILE: '%s' has version %u; this sst understands version %d (recompile it with sst --compile)",
+                    filepath, hdr.version, POLICY_FILE_VERSION);
+    }
+
+    // Counts are 32-bit so none of this can overflow a 64-bit size_t.
+    const size_t fs_off = sizeof(policy_file_header);
+    const size_t net_off = fs_off + (size_t)hdr.fs_rule_count * sizeof(policy_file_fs_rule);
+    const size_t str_off = net_off + (size_t)hdr.net_rule_count * sizeof(policy_file_net_rule);
+    if (str_off + hdr.strings_size != file_sz) {
+        fatal_error("POLICY_FILE: '%s' is truncated or corrupt", filepath);
+    }
+    if (hdr.strings_size > 0 && base[file_sz - 1] != '\0') {
+        fatal_error("POLICY_FILE: '%s' is corrupt (unterminated string table)", filepath);
+    }
+
+    const policy_file_fs_rule* fs = (const policy_file_fs_rule*)(base + fs_off);
+    const policy_file_net_rule* net = (const policy_file_net_rule*)(base + net_off);
+    char* strings = (char*)(base + str_off);
+
+    if (hdr.flags & POLICY_FILE_FLAG_FS_SANDBOXING) {
+        pol->fs_sandboxing_enabled = 1;
+    }
+    if (hdr.flags & POLICY_FILE_FLAG_NET_SANDBOXING) {
+        pol->net_sandboxing_enabled = 1;
+    }
+
+    for (__u32 i = 0; i < hdr.fs_rule_count; i++) {
+        if (fs[i].path_offset >= hdr.strings_size ||
+            strings[fs[i].path_offset] == '\0' ||
+            fs[i].is_directory > 1 ||
+            (fs[i].access & ~(__u64)FULL_FS_ACCESS) != 0) {
+            fatal_error("POLICY_FILE: '%s' is corrupt (bad filesystem rule #%u)", filepath, i);
+        }
+        push_fs_rule(pol, strings + fs[i].path_offset, (int)fs[i].is_directory, (__u32)fs[i].access);
+    }
+
+    for (__u32 i = 0; i < hdr.net_rule_count; i++) {
+        if (net[i].port > 65535 ||
+            net[i].allow_incoming > 1 ||
+            net[i].allow_outgoing > 1) {
+            fatal_error("POLICY_FILE: '%s' is corrupt (bad network rule #%u)", filepath, i);
+        }
+        push_net_rule(pol, net[i].port, (int)net[i].allow_incoming, (int)net[i].allow_outgoing);
+    }
+}
+
+static int write_full(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        const ssize_t written = write(fd, p, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+static void write_all(int fd, const void* buf, size_t len, const char* filepath) {
+    if (write_full(fd, buf, len) != 0) {
+        fatal_error_errno("cannot write to '%s'", filepath);
+    }
+}
+
+// Returns a malloc()ed policy file image of `pol`; its size goes to
+// `size_out`.
+static char* serialize_policy(const policy* pol, size_t* size_out) {
+    if (pol->fs_rule_count > UINT32_MAX || pol->net_rule_count > UINT32_MAX) {
+        fatal_error("too many rules to fit in a policy file");
+    }
+
+    size_t strings_size = 0;
+    for (size_t i = 0; i < pol->fs_rule_count; i++) {
+        strings_size += strlen(pol->fs_rules[i].path) + 1;
+    }
+    if (strings_size > UINT32_MAX) {
+        fatal_error("paths are too long to fit in a policy file");
+    }
+
+    const size_t file_sz = sizeof(policy_file_header) +
+                           pol->fs_rule_count * sizeof(policy_file_fs_rule) +
+                           pol->net_rule_count * sizeof(policy_file_net_rule) +
+                           strings_size;
+    char* buf = calloc(1, file_sz);
+    if (!buf) {
+        fatal_error_errno("calloc(1, %zu) failed.", file_sz);
+    }
+
+    policy_file_header* hdr = (policy_file_header*)buf;
+    memcpy(hdr->magic, POLICY_FILE_MAGIC, sizeof(hdr->magic));
+    hdr->version = POLICY_FILE_VERSION;
+    hdr->flags = (pol->fs_sandboxing_enabled ? POLICY_FILE_FLAG_FS_SANDBOXING : 0) |
+                 (pol->net_sandboxing_enabled ? POLICY_FILE_FLAG_NET_SANDBOXING : 0);
+    hdr->fs_rule_count = (__u32)pol->fs_rule_count;
+    hdr->net_rule_count = (__u32)pol->net_rule_count;
+    hdr->strings_size = (__u32)strings_size;
+
+    policy_file_fs_rule* fs = (policy_file_fs_rule*)(buf + sizeof(policy_file_header));
+    policy_file_net_rule* net = (policy_file_net_rule*)(fs + pol->fs_rule_count);
+    char* strings = (char*)(net + pol->net_rule_count);
+
+    size_t str_pos = 0;
+    for (size_t i = 0; i < pol->fs_rule_count; i++) {
+        const size_t len = strlen(pol->fs_rules[i].path);
+        memcpy(strings + str_pos, pol->fs_rules[i].path, len + 1);
+        fs[i].access = pol->fs_rules[i].access;
+        fs[i].path_offset = (__u32)str_pos;
+        fs[i].is_directory = pol->fs_rules[i].is_directory ? 1 : 0;
+        str_pos += len + 1;
+    }
+
+    size_t i = 0;
+    for (long port = next_net_rule_port(pol, 0); port >= 0; port = next_net_rule_port(pol, port + 1)) {
+        net[i].port = (__u32)port;
+        net[i].allow_incoming = (__u32)port_allows_incoming(pol, port);
+        net[i].allow_outgoing = (__u32)port_allows_outgoing(pol, port);
+        i++;
+    }
+
+    *size_out = file_sz;
+    return buf;
+}
+
+static void write_policy_file(const policy* pol, const char* filepath) {
+    size_t file_sz;
+    char* buf = serialize_policy(pol, &file_sz);
+
+    // Write to a temporary file and rename() it over the target, so that
+    // an `sst` that has the old file mmap()ed never sees it half-written.
+    const size_t tmp_sz = strlen(filepath) + sizeof(".XXXXXX");
+    char* tmp_path = malloc(tmp_sz);
+    if (!tmp_path) {
+        fatal_error_errno("malloc(%zu) failed.", tmp_sz);
+    }
+    snprintf(tmp_path, tmp_sz, "%s.XXXXXX", filepath);
+
+    const int fd = mkostemp(tmp_path, O_CLOEXEC);
+    if (fd < 0) {
+        fatal_error_errno("cannot create temporary file '%s'", tmp_path);
+    }
+    if (fchmod(fd, 0644) != 0) {
+        unlink(tmp_path);
+        fatal_error_errno("cannot chmod '%s'", tmp_path);
+    }
+    write_all(fd, buf, file_sz, tmp_path);
+    if (close(fd) != 0) {
+        unlink(tmp_path);
+        fatal_error_errno("cannot close '%s'", tmp_path);
+    }
+    if (rename(tmp_path, filepath) != 0) {
+        unlink(tmp_path);
+        fatal_error_errno("cannot rename '%s' to '%s'", tmp_path, filepath);
+    }
+
+    free(tmp_path);
+    free(buf);
+}
 
-    size_t fs_rule_count = 0;
-    size_t net_rule_count = 0;
+// Reads all of a *_LIST source into a single buffer. `source` is a file path,
+// or `fd:<N>` for an already open file descriptor (which gets consumed and
+// closed). The buffer is NUL-terminated and its size (without the NUL) goes
+// to `size_out`.
+static char* read_path_list(const char* name, const char* source, size_t* size_out) {
+    int fd;
+    if (strncmp(source, "fd:", 3) == 0) {
+        char* endptr = NULL;
+        errno = 0;
+        const long n = strtol(source + 3, &endptr, 10);
+        if (source[3] == '\0' || *endptr != '\0' || errno != 0 || n < 0 || n > INT_MAX) {
+            fatal_error("%s_LIST: invalid file descriptor '%s'", name, source);
+        }
+        fd = (int)n;
+    } else {
+        fd = open(source, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fatal_error_errno("%s_LIST: cannot open '%s'", name, source);
+        }
+    }
+
+    // Works the same for regular files and pipes; the buffer grows
+    // geometrically, so this is linear in the size of the list.
+    size_t capacity = 64 * 1024;
+    size_t size = 0;
+    char* buf = malloc(capacity);
+    if (!buf) {
+        fatal_error_errno("malloc(%zu) failed.", capacity);
+    }
+    for (;;) {
+        if (capacity - size < 4096) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            if (!buf) {
+                fatal_error_errno("realloc(..., %zu) failed.", capacity);
+            }
+        }
+        const ssize_t got = read(fd, buf + size, capacity - size - 1);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal_error_errno("%s_LIST: cannot read '%s'", name, source);
+        }
+        if (got == 0) {
+            break;
+        }
+        size += (size_t)got;
+    }
+    close(fd);
+
+    buf[size] = '\0';
+    *size_out = size;
+    return buf;
+}
+
+// Adds a rule for every path listed in `source`. Paths are separated by
+// NUL bytes if there are any in the list, newlines otherwise. Empty entries
+// are skipped. The rules point into the list buffer.
+static void push_fs_rule_list(policy* pol, const fs_option* fs_opt, const char* source) {
+    size_t size;
+    char* buf = read_path_list(fs_opt->name, source, &size);
+    policy_keep_buffer(pol, buf, 0);
 
-    fs_rule* fs_rules = NULL;
-    net_rule* net_rules = NULL;
+    const char separator = memchr(buf, '\0', size) ? '\0' : '\n';
+    char* p = buf;
+    char* const end = buf + size;
+    while (p < end) {
+        char* sep = memchr(p, separator, (size_t)(end - p));
+        if (!sep) {
+            sep = end;
+        }
+        *sep = '\0';
+        if (sep > p) {
+            push_fs_rule(pol, p, fs_opt->is_directory, fs_opt->access);
+        }
+        p = sep + 1;
+    }
+}
+
+static void exec_deps_add_rules(policy* pol, const char* path, int search);
+
+// Parses argv[first..last) into `pol`. Every argument must be a sandboxing
+// option; the caller deals with `--` and the command.
+static void parse_policy_args(policy* pol, char** argv, int first, int last) {
+    const fs_option fs_options[] = {
+        { "FILE_READ:",               "FILE_READ_LIST:",               "FILE_READ",               0, READ_ACCESS_FILELIKE },
+        { "FILE_EXEC:",               "FILE_EXEC_LIST:",               "FILE_EXEC",               0, READ_EXEC_ACCESS_FILELIKE },
+        { "FILE_WRITE:",              "FILE_WRITE_LIST:",              "FILE_WRITE",              0, READ_WRITE_ACCESS_FILELIKE },
+        { "FILE_EXEC_WRITE:",         "FILE_EXEC_WRITE_LIST:",         "FILE_EXEC_WRITE",         0, EXEC_WRITE_FILE_ACCESS_FILELIKE },
+        { "FILE_WRITE_EXEC:",         "FILE_WRITE_EXEC_LIST:",         "FILE_EXEC_WRITE",         0, EXEC_WRITE_FILE_ACCESS_FILELIKE },
+        { "PATH_BENEATH_READ:",       "PATH_BENEATH_READ_LIST:",       "PATH_BENEATH_READ",       1, READ_ACCESS_DIR },
+        { "PATH_BENEATH_EXEC:",       "PATH_BENEATH_EXEC_LIST:",       "PATH_BENEATH_EXEC",       1, READ_EXEC_ACCESS_DIR },
+        { "PATH_BENEATH_WRITE:",      "PATH_BENEATH_WRITE_LIST:",      "PATH_BENEATH_WRITE",      1, READ_WRITE_ACCESS_DIR },
+        { "PATH_BENEATH_EXEC_WRITE:", "PATH_BENEATH_EXEC_WRITE_LIST:", "PATH_BENEATH_EXEC_WRITE", 1, EXEC_WRITE_FILE_ACCESS_DIR },
+        { "PATH_BENEATH_WRITE_EXEC:", "PATH_BENEATH_WRITE_EXEC_LIST:", "PATH_BENEATH_EXEC_WRITE", 1, EXEC_WRITE_FILE_ACCESS_DIR },
+    };
+    const size_t fs_option_count = sizeof(fs_options) / sizeof(fs_options[0]);
+
+    const net_option net_options[] = {
+        { "ALLOW_INCOMING_TCP_PORT:",  "ALLOW_INCOMING_TCP_PORT",  0, 1, 0 },
+        { "ALLOW_OUTGOING_TCP_PORT:",  "ALLOW_OUTGOING_TCP_PORT",  0, 0, 1 },
+        { "ALLOW_INCOMING_TCP_PORTS:", "ALLOW_INCOMING_TCP_PORTS", 1, 1, 0 },
+        { "ALLOW_OUTGOING_TCP_PORTS:", "ALLOW_OUTGOING_TCP_PORTS", 1, 0, 1 },
+    };
+    const size_t net_option_count = sizeof(net_options) / sizeof(net_options[0]);
 
     // Look for the trigger words first; we are tolerant even if they are
     // specified last or multiple times etc.
-    for (int i1 = 1; i1 < sep_idx; i1++) {
+    //
+    // POLICY_FILE is handled here too, because a policy file carries its
+    // own trigger words.
+    for (int i1 = first; i1 < last; i1++) {
         const char *arg = argv[i1];
 
         if (strcmp(arg, "ENABLE_FILESYSTEM_SANDBOXING") == 0) {
-            fs_sandboxing_enabled = 1;
+            pol->fs_sandboxing_enabled = 1;
             continue;
         }
 
         if (strcmp(arg, "ENABLE_NETWORK_SANDBOXING") == 0) {
-            net_sandboxing_enabled = 1;
+            pol->net_sandboxing_enabled = 1;
+            continue;
+        }
+
+        if (strncmp(arg, "POLICY_FILE:", 12) == 0) {
+            const char *path = arg + 12;
+            if (strlen(path) == 0) {
+                fatal_error("POLICY_FILE: missing path");
+            }
+            load_policy_file(pol, path);
             continue;
         }
     }
 
-    for (int i1 = 1; i1 < sep_idx; i1++) {
+    for (int i1 = first; i1 < last; i1++) {
         const char *arg = argv[i1];
         const size_t arg_len = strlen(arg);
 
@@ -350,301 +983,510 @@ int main(int argc, char **argv, char *const *const envp) {
         if (strcmp(arg, "ENABLE_NETWORK_SANDBOXING") == 0) {
             continue;
         }
+        if (strncmp(arg, "POLICY_FILE:", 12) == 0) {
+            continue;
+        }
         if (arg_len == 0) {
             fatal_error("There is an empty argument in argument list. strlen(argv[%d]) == 0", i1);
         }
 
-        /****
-         * FILESYSTEM
-         ****/
-
-        // TODO: a lot of repeated code here. The parts that vary are:
-        // the option name and its length (e.g. "FILE_READ:", 10) and
-        // what's put into the fs_rules[fs_rule_count].
-        if (strncmp(arg, "FILE_READ:", 10) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("FILE_READ requires ENABLE_FILESYSTEM_SANDBOXING");
-            }
-            const char *path = arg + 10;
-            if (strlen(path) == 0) {
-                fatal_error("FILE_READ: missing path");
-            }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
-            }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
-            }
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
-            }
-            fs_rules[fs_rule_count].is_directory = 0;
-            fs_rules[fs_rule_count].access = READ_ACCESS_FILELIKE;
-            fs_rule_count++;
+        if (strcmp(arg, "OPTIMIZE_RULES") == 0) {
+            pol->optimize_rules = 1;
             continue;
         }
 
-        if (strncmp(arg, "FILE_EXEC:", 10) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("FILE_EXEC requires ENABLE_FILESYSTEM_SANDBOXING");
-            }
-            const char *path = arg + 10;
-            if (strlen(path) == 0) {
-                fatal_error("FILE_EXEC: missing path");
-            }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
-            }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+        if (strncmp(arg, "EXEC_DEPS:", 10) == 0) {
+            if (strlen(arg + 10) == 0) {
+                fatal_error("EXEC_DEPS: missing path");
             }
+            exec_deps_add_rules(pol, arg + 10, 0);
+            continue;
+        }
+        if (strcmp(arg, "EXEC_DEPS") == 0) {
+            fatal_error("EXEC_DEPS without a path only goes before `-- command`; use EXEC_DEPS:<path> here");
+        }
 
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
-            }
-            fs_rules[fs_rule_count].is_directory = 0;
-            fs_rules[fs_rule_count].access = READ_EXEC_ACCESS_FILELIKE;
-            fs_rule_count++;
+        if (strcmp(arg, "NO_COALESCE") == 0) {
+            pol->no_coalesce = 1;
             continue;
         }
 
-        if (strncmp(arg, "FILE_WRITE:", 11) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("FILE_WRITE requires ENABLE_FILESYSTEM_SANDBOXING");
-            }
-            const char *path = arg + 11;
-            if (strlen(path) == 0) {
-                fatal_error("FILE_WRITE: missing path");
-            }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
-            }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+        if (strncmp(arg, "RESOLVE_THREADS:", 16) == 0) {
+            char* endptr = NULL;
+            errno = 0;
+            const long n = strtol(arg + 16, &endptr, 10);
+            if (arg[16] == '\0' || *endptr != '\0' || errno != 0 || n < 0 || n > RESOLVE_MAX_THREADS) {
+                fatal_error("RESOLVE_THREADS: invalid thread count '%s' (0-%d)", arg + 16, RESOLVE_MAX_THREADS);
             }
+            pol->resolve_threads = (int)n;
+            continue;
+        }
 
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
+        if (strncmp(arg, "RULESET_CACHE:", 14) == 0) {
+            if (strlen(arg + 14) == 0) {
+                fatal_error("RULESET_CACHE: missing socket path");
             }
-            fs_rules[fs_rule_count].is_directory = 0;
-            fs_rules[fs_rule_count].access = READ_WRITE_ACCESS_FILELIKE;
-            fs_rule_count++;
+            pol->ruleset_cache = arg + 14;
             continue;
         }
 
-        if (strncmp(arg, "FILE_EXEC_WRITE:", 16) == 0 ||
-            strncmp(arg, "FILE_WRITE_EXEC:", 16) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("FILE_EXEC_WRITE requires ENABLE_FILESYSTEM_SANDBOXING");
+        /****
+         * FILESYSTEM
+         ****/
+
+        const fs_option* fs_opt = NULL;
+        int is_list = 0;
+        for (size_t i2 = 0; i2 < fs_option_count; i2++) {
+            if (strncmp(arg, fs_options[i2].prefix, strlen(fs_options[i2].prefix)) == 0) {
+                fs_opt = &fs_options[i2];
+                break;
             }
-            const char *path = arg + 16;
-            if (strlen(path) == 0) {
-                fatal_error("FILE_EXEC_WRITE: missing path");
+            if (strncmp(arg, fs_options[i2].list_prefix, strlen(fs_options[i2].list_prefix)) == 0) {
+                fs_opt = &fs_options[i2];
+                is_list = 1;
+                break;
             }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
+        }
+
+        if (fs_opt) {
+            if (!pol->fs_sandboxing_enabled) {
+                fatal_error("%s requires ENABLE_FILESYSTEM_SANDBOXING", fs_opt->name);
             }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+            if (is_list) {
+                const char *source = arg + strlen(fs_opt->list_prefix);
+                if (strlen(source) == 0) {
+                    fatal_error("%s_LIST: missing list file", fs_opt->name);
+                }
+                push_fs_rule_list(pol, fs_opt, source);
+                continue;
             }
-
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
+            // argv outlives everything we do, so no need to copy.
+            const char *path = arg + strlen(fs_opt->prefix);
+            if (strlen(path) == 0) {
+                fatal_error("%s: missing path", fs_opt->name);
             }
-            fs_rules[fs_rule_count].is_directory = 0;
-            fs_rules[fs_rule_count].access = EXEC_WRITE_FILE_ACCESS_FILELIKE;
-            fs_rule_count++;
+            push_fs_rule(pol, path, fs_opt->is_directory, fs_opt->access);
             continue;
         }
 
-        if (strncmp(arg, "PATH_BENEATH_READ:", 18) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("PATH_BENEATH_READ requires ENABLE_FILESYSTEM_SANDBOXING");
-            }
-            const char *path = arg + 18;
-            if (strlen(path) == 0) {
-                fatal_error("PATH_BENEATH_READ: missing path");
-            }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
-            }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
-            }
+        /****
+         * NETWORKING
+         ****/
 
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
+        const net_option* net_opt = NULL;
+        for (size_t i2 = 0; i2 < net_option_count; i2++) {
+            if (strncmp(arg, net_options[i2].prefix, strlen(net_options[i2].prefix)) == 0) {
+                net_opt = &net_options[i2];
+                break;
             }
-            fs_rules[fs_rule_count].is_directory = 1;
-            fs_rules[fs_rule_count].access = READ_ACCESS_DIR;
-            fs_rule_count++;
-            continue;
         }
 
-        if (strncmp(arg, "PATH_BENEATH_EXEC:", 18) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("PATH_BENEATH_EXEC requires ENABLE_FILESYSTEM_SANDBOXING");
+        if (net_opt) {
+            if (!pol->net_sandboxing_enabled) {
+                fatal_error("%s requires ENABLE_NETWORK_SANDBOXING", net_opt->name);
             }
-            const char *path = arg + 18;
-            if (strlen(path) == 0) {
-                fatal_error("PATH_BENEATH_EXEC: missing path");
-            }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
-            }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+            const char *port_str = arg + strlen(net_opt->prefix);
+            if (net_opt->is_list) {
+                if (parse_port_list(pol, port_str, net_opt->allow_incoming, net_opt->allow_outgoing) != 0) {
+                    fatal_error("%s: invalid port list '%s'", net_opt->name, port_str);
+                }
+                continue;
             }
-
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
+            long port;
+            if (parse_port(port_str, &port) != 0) {
+                fatal_error("%s: invalid port '%s'", net_opt->name, port_str);
             }
-            fs_rules[fs_rule_count].is_directory = 1;
-            fs_rules[fs_rule_count].access = READ_EXEC_ACCESS_DIR;
-            fs_rule_count++;
+            push_net_rule(pol, port, net_opt->allow_incoming, net_opt->allow_outgoing);
             continue;
         }
 
-        if (strncmp(arg, "PATH_BENEATH_WRITE:", 19) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("PATH_BENEATH_WRITE requires ENABLE_FILESYSTEM_SANDBOXING");
-            }
-            const char *path = arg + 19;
-            if (strlen(path) == 0) {
-                fatal_error("PATH_BENEATH_WRITE: missing path");
-            }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
-            }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
-            }
+        fatal_error("unrecognized option: %s", arg);
+    }
+}
 
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
-            }
-            fs_rules[fs_rule_count].is_directory = 1;
-            fs_rules[fs_rule_count].access = READ_WRITE_ACCESS_DIR;
-            fs_rule_count++;
-            continue;
+/****
+ * TIMING
+ *
+ * `--timing=<spec>` (or SST_TIMING=<spec> in the environment) records how
+ * long each phase of setting up the sandbox took, and which rules were the
+ * slowest to open and add, and writes it all to a file descriptor just
+ * before exec()ing the command. <spec> is <fd>[,json|,chrome][,rules=<n>]:
+ * one JSON line, or one line in Chrome's trace event format (load it in
+ * chrome://tracing or Perfetto).
+ *
+ * When it is off, `sst_timing` is NULL and every probe is one predictable
+ * branch.
+ ****/
+
+#define TIMING_MAX_SPANS 32
+#define TIMING_DEFAULT_SLOWEST_RULES 10
+#define TIMING_MAX_SLOWEST_RULES 10000
+
+// A phase. Phases that happen more than once (opening paths and adding
+// rules alternate, a window of rules at a time) are added up.
+typedef struct stiming_span {
+    const char* name;
+    __u64 start_ns;
+    __u64 end_ns;
+    __u64 total_ns;
+    size_t count;
+} timing_span;
+
+typedef struct stiming_rule {
+    size_t index;
+    __u64 open_ns;
+    __u64 add_ns;
+} timing_rule;
+
+typedef struct stiming {
+    int fd;
+    int chrome;
+    __u64 start_ns;
+
+    timing_span spans[TIMING_MAX_SPANS];
+    size_t span_count;
+
+    // The slowest rules so far, slowest first.
+    timing_rule* slowest;
+    size_t slowest_count;
+    size_t slowest_max;
+} timing;
+
+static timing* sst_timing = NULL;
+
+static __u64 timing_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__u64)ts.tv_sec * 1000000000ULL + (__u64)ts.tv_nsec;
+}
+
+static __u64 timing_start(void) {
+    return sst_timing ? timing_now() : 0;
+}
+
+static void timing_end(const char* name, __u64 start_ns) {
+    if (!sst_timing) {
+        return;
+    }
+    const __u64 end_ns = timing_now();
+    timing_span* span = NULL;
+    for (size_t i = 0; i < sst_timing->span_count; i++) {
+        if (strcmp(sst_timing->spans[i].name, name) == 0) {
+            span = &sst_timing->spans[i];
+            break;
         }
+    }
+    if (!span) {
+        if (sst_timing->span_count == TIMING_MAX_SPANS) {
+            return;
+        }
+        span = &sst_timing->spans[sst_timing->span_count++];
+        span->name = name;
+        span->start_ns = start_ns;
+    }
+    span->end_ns = end_ns;
+    span->total_ns += end_ns - start_ns;
+    span->count++;
+}
 
-        if (strncmp(arg, "PATH_BENEATH_EXEC_WRITE:", 24) == 0 ||
-            strncmp(arg, "PATH_BENEATH_WRITE_EXEC:", 24) == 0) {
-            if (!fs_sandboxing_enabled) {
-                fatal_error("PATH_BENEATH_EXEC_WRITE requires ENABLE_FILESYSTEM_SANDBOXING");
-            }
-            const char *path = arg + 24;
-            if (strlen(path) == 0) {
-                fatal_error("PATH_BENEATH_EXEC_WRITE: missing path");
-            }
-            if (fs_rule_count >= MAX_FS_RULES) {
-                fatal_error("too many filesystem rules");
-            }
-            const size_t realloc_sz = sizeof(fs_rule) * (fs_rule_count+1);
-            fs_rules = realloc(fs_rules, realloc_sz);
-            if (!fs_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
-            }
-            fs_rules[fs_rule_count].path = strdup(path);
-            if (!fs_rules[fs_rule_count].path) {
-                fatal_error_errno("strdup(...) failed.");
+// Records the times of fs rule #`index`, if it's one of the slowest.
+static void timing_rule_done(size_t index, __u64 open_ns, __u64 add_ns) {
+    timing* t = sst_timing;
+    const __u64 total = open_ns + add_ns;
+    size_t pos = t->slowest_count;
+    if (pos == t->slowest_max) {
+        const timing_rule* last = &t->slowest[pos - 1];
+        if (total <= last->open_ns + last->add_ns) {
+            return;
+        }
+        pos--;
+    } else {
+        t->slowest_count++;
+    }
+    while (pos > 0 && t->slowest[pos - 1].open_ns + t->slowest[pos - 1].add_ns < total) {
+        t->slowest[pos] = t->slowest[pos - 1];
+        pos--;
+    }
+    t->slowest[pos].index = index;
+    t->slowest[pos].open_ns = open_ns;
+    t->slowest[pos].add_ns = add_ns;
+}
+
+static void timing_init(const char* spec, __u64 start_ns) {
+    timing* t = calloc(1, sizeof(timing));
+    if (!t) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    t->start_ns = start_ns;
+    t->slowest_max = TIMING_DEFAULT_SLOWEST_RULES;
+
+    char* copy = strdup(spec);
+    if (!copy) {
+        fatal_error_errno("strdup failed");
+    }
+    char* save = NULL;
+    char* fd_str = strtok_r(copy, ",", &save);
+    char* end = NULL;
+    const long fd = fd_str ? strtol(fd_str, &end, 10) : -1;
+    if (!fd_str || *end != '\0' || fd < 0 || fd > INT_MAX) {
+        fatal_error("--timing: expected <fd>[,json|,chrome][,rules=<n>], got '%s'", spec);
+    }
+    t->fd = (int)fd;
+    if (fcntl(t->fd, F_GETFD) < 0) {
+        fatal_error("--timing: file descriptor %d is not open", t->fd);
+    }
+
+    for (char* opt = strtok_r(NULL, ",", &save); opt; opt = strtok_r(NULL, ",", &save)) {
+        if (strcmp(opt, "json") == 0) {
+            t->chrome = 0;
+        } else if (strcmp(opt, "chrome") == 0) {
+            t->chrome = 1;
+        } else if (strncmp(opt, "rules=", 6) == 0) {
+            const long n = strtol(opt + 6, &end, 10);
+            if (opt[6] == '\0' || *end != '\0' || n < 0 || n > TIMING_MAX_SLOWEST_RULES) {
+                fatal_error("--timing: invalid rules=<n> in '%s' (max %d)", spec, TIMING_MAX_SLOWEST_RULES);
             }
+            t->slowest_max = (size_t)n;
+        } else {
+            fatal_error("--timing: unknown option '%s' in '%s'", opt, spec);
+        }
+    }
+    free(copy);
 
-            fs_rules[fs_rule_count].is_directory = 1;
-            fs_rules[fs_rule_count].access = EXEC_WRITE_FILE_ACCESS_DIR;
-            fs_rule_count++;
-            continue;
+    if (t->slowest_max > 0) {
+        t->slowest = calloc(t->slowest_max, sizeof(timing_rule));
+        if (!t->slowest) {
+            fatal_error_errno("calloc(...) failed.");
         }
+    }
+    sst_timing = t;
+}
 
-        /****
-         * NETWORKING
-         ****/
+static void timing_json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        const unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
 
-        if (strncmp(arg, "ALLOW_INCOMING_TCP_PORT:", 24) == 0) {
-            if (!net_sandboxing_enabled) {
-                fatal_error("ALLOW_INCOMING_TCP_PORT requires ENABLE_NETWORK_SANDBOXING");
-            }
-            const char *port_str = arg + 24;
-            long port;
-            if (parse_port(port_str, &port) != 0) {
-                fatal_error("ALLOW_INCOMING_TCP_PORT: invalid port '%s'", port_str);
-            }
-            if (net_rule_count >= MAX_NET_RULES) {
-                fatal_error("too many network rules");
-            }
-            const size_t realloc_sz = sizeof(net_rule) * (net_rule_count+1);
-            net_rules = realloc(net_rules, realloc_sz);
-            if (!net_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
-            }
-            net_rules[net_rule_count].port = port;
-            net_rules[net_rule_count].allow_incoming = 1;
-            net_rules[net_rule_count].allow_outgoing = 0;
-            net_rule_count++;
-            continue;
+// Writes everything recorded so far as one line to the timing fd.
+static void timing_write(const policy* pol) {
+    timing* t = sst_timing;
+    const __u64 end_ns = timing_now();
+    const long pid = (long)getpid();
+
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&buf, &size);
+    if (!out) {
+        fatal_error_errno("open_memstream failed");
+    }
+
+    if (t->chrome) {
+        fprintf(out, "{\"traceEvents\":[");
+        fprintf(out, "{\"name\":\"sst\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+                pid, pid, t->start_ns / 1000.0, (end_ns - t->start_ns) / 1000.0);
+        for (size_t i = 0; i < t->span_count; i++) {
+            const timing_span* span = &t->spans[i];
+            fprintf(out, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"busy_us\":%.3f,\"count\":%zu}}",
+                    span->name, pid, pid, span->start_ns / 1000.0, (span->end_ns - span->start_ns) / 1000.0,
+                    span->total_ns / 1000.0, span->count);
+        }
+        // Rules have no start time of their own; they show up as instant
+        // events carrying their times.
+        for (size_t i = 0; i < t->slowest_count; i++) {
+            const timing_rule* rule = &t->slowest[i];
+            fprintf(out, ",{\"name\":");
+            timing_json_string(out, pol->fs_rules[rule->index].path);
+            fprintf(out, ",\"cat\":\"slow_rule\",\"ph\":\"i\",\"s\":\"p\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,"
+                    "\"args\":{\"open_us\":%.3f,\"add_rule_us\":%.3f}}",
+                    pid, pid, end_ns / 1000.0, rule->open_ns / 1000.0, rule->add_ns / 1000.0);
+        }
+        fprintf(out, "],\"displayTimeUnit\":\"ns\"}\n");
+    } else {
+        fprintf(out, "{\"sst_timing\":1,\"pid\":%ld,\"fs_rules\":%zu,\"net_rules\":%zu,\"total_us\":%.3f,\"phases\":[",
+                pid, pol->fs_rule_count, pol->net_rule_count, (end_ns - t->start_ns) / 1000.0);
+        for (size_t i = 0; i < t->span_count; i++) {
+            const timing_span* span = &t->spans[i];
+            fprintf(out, "%s{\"name\":\"%s\",\"start_us\":%.3f,\"dur_us\":%.3f,\"count\":%zu}",
+                    i ? "," : "", span->name,
+                    (span->start_ns - t->start_ns) / 1000.0, span->total_ns / 1000.0, span->count);
+        }
+        fprintf(out, "],\"slowest_rules\":[");
+        for (size_t i = 0; i < t->slowest_count; i++) {
+            const timing_rule* rule = &t->slowest[i];
+            fprintf(out, "%s{\"path\":", i ? "," : "");
+            timing_json_string(out, pol->fs_rules[rule->index].path);
+            fprintf(out, ",\"open_us\":%.3f,\"add_rule_us\":%.3f}", rule->open_ns / 1000.0, rule->add_ns / 1000.0);
         }
+        fprintf(out, "]}\n");
+    }
 
-        if (strncmp(arg, "ALLOW_OUTGOING_TCP_PORT:", 24) == 0) {
-            if (!net_sandboxing_enabled) {
-                fatal_error("ALLOW_OUTGOING_TCP_PORT requires ENABLE_NETWORK_SANDBOXING");
-            }
-            const char *port_str = arg + 24;
-            long port;
-            if (parse_port(port_str, &port) != 0) {
-                fatal_error("ALLOW_OUTGOING_TCP_PORT: invalid port '%s'", port_str);
-            }
-            if (net_rule_count >= MAX_NET_RULES) {
-                fatal_error("too many network rules");
-            }
-            const size_t realloc_sz = sizeof(net_rule) * (net_rule_count+1);
-            net_rules = realloc(net_rules, realloc_sz);
-            if (!net_rules) {
-                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
-            }
-            net_rules[net_rule_count].port = port;
-            net_rules[net_rule_count].allow_incoming = 0;
-            net_rules[net_rule_count].allow_outgoing = 1;
-            net_rule_count++;
-            continue;
+    if (fclose(out) != 0) {
+        fatal_error_errno("open_memstream failed");
+    }
+    if (write_full(t->fd, buf, size) != 0) {
+        fprintf(stderr, "sst: warning: --timing: cannot write to file descriptor %d: %s\n", t->fd, strerror(errno));
+    }
+    free(buf);
+}
+
+/****
+ * PATH RESOLUTION
+ *
+ * Opening and fstat()ing every rule path is the slow part of building a big
+ * ruleset, especially on network filesystems or with cold caches, and the
+ * opens don't depend on each other. With enough rules we do them on a pool
+ * of threads, a window of rules at a time (so we don't run out of fds), and
+ * then add the rules to the ruleset in order on the calling thread.
+ ****/
+
+// Fewer rules than this are not worth starting threads for.
+#define RESOLVE_PARALLEL_MIN_RULES 128
+
+typedef struct sresolved_path {
+    int fd;
+    // errno of the failed open() or fstat(); 0 if neither failed.
+    int open_errno;
+    int fstat_errno;
+    struct stat sb;
+    // How long the open() and fstat() took; only set with --timing.
+    __u64 open_ns;
+} resolved_path;
+
+typedef struct sresolve_work {
+    const fs_rule* rules;
+    resolved_path* out;
+    size_t count;
+    size_t next;
+} resolve_work;
+
+static void resolve_path(const char* path, resolved_path* out) {
+    const __u64 start_ns = timing_start();
+    // O_PATH is all Landlock needs, and unlike actually opening the
+    // file it works on files we can't read or write ourselves.
+    out->fd = open(path, O_PATH | O_CLOEXEC);
+    out->open_errno = out->fd < 0 ? errno : 0;
+    out->fstat_errno = 0;
+    if (out->fd >= 0 && fstat(out->fd, &out->sb) != 0) {
+        out->fstat_errno = errno;
+    }
+    if (sst_timing) {
+        out->open_ns = timing_now() - start_ns;
+    }
+}
+
+static void* resolve_worker(void* arg) {
+    resolve_work* work = arg;
+    const size_t chunk = 16;
+    for (;;) {
+        const size_t start = __atomic_fetch_add(&work->next, chunk, __ATOMIC_RELAXED);
+        if (start >= work->count) {
+            return NULL;
         }
+        const size_t end = start + chunk < work->count ? start + chunk : work->count;
+        for (size_t i = start; i < end; i++) {
+            resolve_path(work->rules[i].path, &work->out[i]);
+        }
+    }
+}
 
-        fatal_error("unrecognized option: %s", arg);
+// Resolves rules[0..count) into out[0..count) using up to `threads` threads
+// (including the calling one).
+static void resolve_paths(const fs_rule* rules, resolved_path* out, size_t count, int threads) {
+    resolve_work work = { .rules = rules, .out = out, .count = count, .next = 0 };
+
+    pthread_t tids[RESOLVE_MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < threads; i++) {
+        // If we can't get more threads, the ones we have will do.
+        if (pthread_create(&tids[started], NULL, resolve_worker, &work) != 0) {
+            break;
+        }
+        started++;
+    }
+    resolve_worker(&work);
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
     }
+}
 
-    // Fail if no sandboxing has been specified.
-    // Wondering: technically we should just exec() the child to stay
-    // consistent; maybe the command line to this tool is programmatically
-    // generated. But I thought misusing `sst` is a more likely scenario.
-    // This might be something to address later...maybe an option that says
-    // `MIGHT_BE_EMPTY` (and can be specified any number of times) that
-    // tells `sst` to accept no sandbox rules given.
-    if (!fs_sandboxing_enabled && !net_sandboxing_enabled) {
-        fatal_error("no sandboxing options given");
+static int resolve_thread_count(const policy* pol) {
+    if (pol->resolve_threads > 0) {
+        return pol->resolve_threads;
     }
+    if (pol->fs_rule_count < RESOLVE_PARALLEL_MIN_RULES) {
+        return 1;
+    }
+    // One thread per CPU. On slow (network) storage more threads than that
+    // can pay off, which is what RESOLVE_THREADS is for; with everything
+    // cached, extra threads only get in each other's way.
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long threads = cpus > 0 ? cpus : 1;
+    if (threads > RESOLVE_MAX_THREADS) {
+        threads = RESOLVE_MAX_THREADS;
+    }
+    return (int)threads;
+}
+
+// How many paths to have open at once.
+static size_t resolve_window_size(void) {
+    struct rlimit rl;
+    size_t window = 4096;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        const size_t headroom = rl.rlim_cur > 128 ? (size_t)(rl.rlim_cur - 64) / 2 : 32;
+        if (headroom < window) {
+            window = headroom;
+        }
+    }
+    return window;
+}
+
+// Library code has no business writing to its caller's stderr, so what it
+// would warn about is kept here, and the command line tool says it with
+// print_deferred_warnings() once the ruleset is built.
+//
+// The Landlock ABI version of this kernel if it's newer than any this tool
+// knows about, otherwise 0.
+static int newer_landlock_abi = 0;
+// The ruleset cache's warnings, or why it couldn't be used (see
+// fetch_cached_ruleset()). Only the last ruleset's.
+static __thread char* ruleset_cache_warnings = NULL;
+
+static void set_ruleset_cache_warnings(const char* text, size_t len) {
+    free(ruleset_cache_warnings);
+    ruleset_cache_warnings = len > 0 ? strndup(text, len) : NULL;
+}
+
+static void print_deferred_warnings(void) {
+    static int warned_abi = 0;
+    if (newer_landlock_abi && !warned_abi) {
+        warned_abi = 1;
+        fprintf(stderr, "sst: warning: Landlock ABI version %d is newer than this tool was designed for. Some restrictions may not work as expected.\n", newer_landlock_abi);
+    }
+    if (ruleset_cache_warnings) {
+        fputs(ruleset_cache_warnings, stderr);
+        set_ruleset_cache_warnings(NULL, 0);
+    }
+}
 
+// Builds a Landlock ruleset out of `pol` and returns its fd. The flags to
+// pass to landlock_restrict_self() on this kernel go to `restrict_flags_out`.
+// If `ids_out` is not NULL, it gets the identity of every filesystem rule's
+// inode, in rule order. Does not return on failure.
+static int create_policy_ruleset(const policy* pol, __u32* restrict_flags_out, inode_id* ids_out) {
+    __u64 start_ns = timing_start();
     const int abi = landlock_create_ruleset(NULL, 0, LANDLOCK_CREATE_RULESET_VERSION);
+    timing_end("abi_probe", start_ns);
     if (abi < 0) {
         if (errno == ENOSYS) {
             fatal_error("Landlock is not supported by the kernel (ENOSYS)");
@@ -661,11 +1503,11 @@ int main(int argc, char **argv, char *const *const envp) {
 
     struct landlock_ruleset_attr attr = {0};
 
-    if (fs_sandboxing_enabled) {
+    if (pol->fs_sandboxing_enabled) {
         attr.handled_access_fs = FULL_FS_ACCESS;
     }
 
-    if (net_sandboxing_enabled) {
+    if (pol->net_sandboxing_enabled) {
         attr.handled_access_net =
             LANDLOCK_ACCESS_NET_BIND_TCP |
             LANDLOCK_ACCESS_NET_CONNECT_TCP;
@@ -693,67 +1535,134 @@ int main(int argc, char **argv, char *const *const envp) {
             restrict_flags &= ~LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON;
             __attribute__((fallthrough));
         case 7:
+            __attribute__((fallthrough));
+        case 8:
             break;
-        // I've heard rumors that ABI version 8 has UDP blocking...waiting
-        // for it dammit.
+        // I've heard rumors that a later ABI version has UDP blocking...
+        // waiting for it dammit.
         default:
-            fprintf(stderr, "sst: warning: Landlock ABI version %d is newer than this tool was designed for. Some restrictions may not work as expected.\n", abi);
+            // See print_deferred_warnings().
+            newer_landlock_abi = abi;
             break;
     }
 
+    start_ns = timing_start();
     const int ruleset_fd = landlock_create_ruleset(&attr, sizeof(attr), 0);
     if (ruleset_fd < 0) {
         fatal_error_errno("failed to create Landlock ruleset");
     }
+    timing_end("create_ruleset", start_ns);
 
-    for (size_t i = 0; i < fs_rule_count; i++) {
-        const char *path = fs_rules[i].path;
-
-        int fd;
-        if (fs_rules[i].is_directory) {
-            fd = open(path, O_PATH | O_CLOEXEC);
-            const int is_dir = is_directory(fd);
-            if (is_dir < 0) {
-                fatal_error_errno("Cannot invoke fstat on '%s'", path);
-            } else if (!is_dir) {
-                fatal_error("PATH_BENEATH_*: '%s' is not a directory", path);
+    // Under libsst, fatal_error() longjmp()s back to a caller that goes on
+    // running, so the ruleset, the paths still open in the window and
+    // `resolved` are closed and freed on the way out. The command line
+    // tool exits instead and needs none of this.
+    jmp_buf cleanup;
+    jmp_buf* const outer_error_jmp = sst_error_jmp;
+    resolved_path* volatile resolved = NULL;
+    // resolved[open_from..open_to) hold fds that are still open.
+    volatile size_t open_from = 0;
+    volatile size_t open_to = 0;
+    if (outer_error_jmp) {
+        if (setjmp(cleanup)) {
+            sst_error_jmp = outer_error_jmp;
+            for (size_t j = open_from; j < open_to; j++) {
+                if (resolved[j].fd >= 0) {
+                    close(resolved[j].fd);
+                }
             }
+            free(resolved);
+            close(ruleset_fd);
+            longjmp(*outer_error_jmp, 1);
+        }
+        sst_error_jmp = &cleanup;
+    }
+
+    const int threads = resolve_thread_count(pol);
+    const size_t window = threads > 1 ? resolve_window_size() : 1;
+    resolved = calloc(window, sizeof(resolved_path));
+    if (!resolved) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+
+    for (size_t start = 0; start < pol->fs_rule_count; start += window) {
+        const size_t n = pol->fs_rule_count - start < window ? pol->fs_rule_count - start : window;
+        start_ns = timing_start();
+        if (threads > 1) {
+            resolve_paths(&pol->fs_rules[start], resolved, n, threads);
         } else {
-            fd = open(path, O_RDWR | O_CLOEXEC);
-            const int is_reg = is_filelike(fd);
-            if (is_reg < 0) {
+            resolve_path(pol->fs_rules[start].path, &resolved[0]);
+        }
+        open_from = 0;
+        open_to = n;
+        timing_end("open_paths", start_ns);
+        start_ns = timing_start();
+
+        // Rule order from here on, so errors are reported the same way no
+        // matter how many threads did the opening.
+        for (size_t j = 0; j < n; j++) {
+            const size_t i = start + j;
+            const char *path = pol->fs_rules[i].path;
+            const resolved_path* res = &resolved[j];
+
+            if (res->open_errno) {
+                errno = res->open_errno;
+                fatal_error_errno("cannot open '%s' for sandboxing", path);
+            }
+            if (res->fstat_errno) {
+                errno = res->fstat_errno;
                 fatal_error_errno("Cannot invoke fstat on '%s'", path);
-            } else if (!is_reg) {
-                fatal_error("FILE_*: '%s' is not a file-like entity.", path);
             }
-        }
 
-        if (fd < 0) {
-            fatal_error_errno("cannot open '%s' for sandboxing", path);
-        }
+            if (pol->fs_rules[i].is_directory) {
+                if (!is_directory(res->sb.st_mode)) {
+                    fatal_error("PATH_BENEATH_*: '%s' is not a directory", path);
+                }
+            } else {
+                if (!is_filelike(res->sb.st_mode)) {
+                    fatal_error("FILE_*: '%s' is not a file-like entity.", path);
+                }
+            }
 
-        struct landlock_path_beneath_attr path_attr = {
-            .parent_fd = fd,
-            .allowed_access = fs_rules[i].access & attr.handled_access_fs
-        };
+            struct landlock_path_beneath_attr path_attr = {
+                .parent_fd = res->fd,
+                .allowed_access = pol->fs_rules[i].access & attr.handled_access_fs
+            };
 
-        if (landlock_add_rule(ruleset_fd, LANDLOCK_RULE_PATH_BENEATH, &path_attr, 0)) {
-            fatal_error_errno("failed to add filesystem rule to file '%s'", path);
-        }
+            const __u64 add_start_ns = timing_start();
+            if (landlock_add_rule(ruleset_fd, LANDLOCK_RULE_PATH_BENEATH, &path_attr, 0)) {
+                fatal_error_errno("failed to add filesystem rule to file '%s'", path);
+            }
+            if (sst_timing && sst_timing->slowest_max > 0) {
+                timing_rule_done(i, res->open_ns, timing_now() - add_start_ns);
+            }
 
-        close(fd);
+            if (ids_out) {
+                ids_out[i].dev = (__u64)res->sb.st_dev;
+                ids_out[i].ino = (__u64)res->sb.st_ino;
+            }
+
+            close(res->fd);
+            open_from = j + 1;
+        }
+        timing_end("add_fs_rules", start_ns);
     }
+    free(resolved);
+    resolved = NULL;
+    open_to = 0;
 
-    for (size_t i = 0; i < net_rule_count; i++) {
+    // One rule per port, with both directions in it.
+    start_ns = timing_start();
+    for (long port = next_net_rule_port(pol, 0); port >= 0; port = next_net_rule_port(pol, port + 1)) {
         struct landlock_net_port_attr port_attr = {
-            .port = (unsigned int)net_rules[i].port,
+            .port = (unsigned int)port,
             .allowed_access = 0
         };
 
-        if (net_rules[i].allow_incoming) {
+        if (port_allows_incoming(pol, port)) {
             port_attr.allowed_access |= LANDLOCK_ACCESS_NET_BIND_TCP;
         }
-        if (net_rules[i].allow_outgoing) {
+        if (port_allows_outgoing(pol, port)) {
             port_attr.allowed_access |= LANDLOCK_ACCESS_NET_CONNECT_TCP;
         }
 
@@ -761,17 +1670,7201 @@ int main(int argc, char **argv, char *const *const envp) {
             fatal_error_errno("failed to add network rule");
         }
     }
+    timing_end("add_net_rules", start_ns);
+
+    sst_error_jmp = outer_error_jmp;
+    *restrict_flags_out = restrict_flags;
+    return ruleset_fd;
+}
 
+static void restrict_self_with_ruleset(int ruleset_fd, __u32 restrict_flags) {
     if (landlock_restrict_self(ruleset_fd, restrict_flags)) {
+        const int err = errno;
+        close(ruleset_fd);
+        errno = err;
         fatal_error_errno("failed to apply Landlock ruleset");
     }
 
     close(ruleset_fd);
+}
 
-    const char *command = argv[sep_idx + 1];
-    char *const *command_args = &argv[sep_idx + 1];
+// Builds a Landlock ruleset out of `pol` and applies it to the calling
+// thread. Does not return on failure.
+static void apply_policy(const policy* pol) {
+    __u32 restrict_flags;
+    const int ruleset_fd = create_policy_ruleset(pol, &restrict_flags, NULL);
+    restrict_self_with_ruleset(ruleset_fd, restrict_flags);
+}
 
-    execvpe(command, command_args, envp);
+/****
+ * RULE OPTIMIZER
+ *
+ * OPTIMIZE_RULES shrinks the filesystem rule table before the ruleset is
+ * built. Landlock has to look at every rule on the way up from whatever is
+ * being accessed, so fewer rules means cheaper access checks for the whole
+ * life of the sandbox (and a faster start).
+ *
+ *  - Rules on the same inode are merged by OR-ing their access masks. The
+ *    kernel does the same thing, so this is always exact.
+ *
+ *  - A rule is dropped if the rules on its parent directories already grant
+ *    everything it does. Paths are resolved (realpath()) into a trie, and
+ *    because a parent always gets into the trie before its children, the
+ *    access granted by parent directories can be accumulated in a single
+ *    pass in trie order.
+ *
+ * Dropping a rule is only exact if the inode can't be reached through some
+ * other path that doesn't go through those parent directories. So we only
+ * drop rules on non-directories with a single hard link, and only if their
+ * filesystem is mounted in exactly one place. What we can't check is files
+ * being moved around by someone else after `sst` has started; the
+ * sandboxed program itself can't move them to another directory, as we
+ * never grant LANDLOCK_ACCESS_FS_REFER.
+ ****/
 
-    fatal_error_errno("execvpe failed");
+typedef struct sopt_node {
+    size_t parent;
+    const char* name;
+    size_t name_len;
+    // Index of the rule on this node, or SIZE_MAX.
+    size_t rule;
+    // Access granted by rules on this node and its parents.
+    __u32 granted;
+} opt_node;
+
+typedef struct sopt_trie {
+    opt_node* nodes;
+    size_t node_count;
+    size_t node_capacity;
+
+    // Open addressing hash of (parent, name) -> node index + 1.
+    size_t* edges;
+    size_t edge_mask;
+} opt_trie;
+
+typedef struct sopt_mount_dev {
+    dev_t dev;
+    size_t count;
+} opt_mount_dev;
+
+static __u64 fnv1a_hash(const char* data, size_t len) {
+    __u64 hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static __u64 opt_edge_hash(size_t parent, const char* name, size_t name_len) {
+    __u64 hash = fnv1a_hash(name, name_len);
+    hash ^= (__u64)parent * 0x9e3779b97f4a7c15ULL;
+    return hash;
+}
+
+static void opt_trie_grow_edges(opt_trie* trie) {
+    const size_t new_size = trie->edges ? (trie->edge_mask + 1) * 2 : 1024;
+    size_t* edges = calloc(new_size, sizeof(size_t));
+    if (!edges) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    for (size_t n = 1; n < trie->node_count; n++) {
+        const opt_node* node = &trie->nodes[n];
+        size_t slot = opt_edge_hash(node->parent, node->name, node->name_len) & (new_size - 1);
+        while (edges[slot]) {
+            slot = (slot + 1) & (new_size - 1);
+        }
+        edges[slot] = n + 1;
+    }
+    free(trie->edges);
+    trie->edges = edges;
+    trie->edge_mask = new_size - 1;
+}
+
+// Returns the child `name` of `parent`, creating it if needed.
+static size_t opt_trie_child(opt_trie* trie, size_t parent, const char* name, size_t name_len) {
+    if (!trie->edges || trie->node_count * 2 > trie->edge_mask) {
+        opt_trie_grow_edges(trie);
+    }
+
+    size_t slot = opt_edge_hash(parent, name, name_len) & trie->edge_mask;
+    while (trie->edges[slot]) {
+        const opt_node* node = &trie->nodes[trie->edges[slot] - 1];
+        if (node->parent == parent && node->name_len == name_len &&
+            memcmp(node->name, name, name_len) == 0) {
+            return trie->edges[slot] - 1;
+        }
+        slot = (slot + 1) & trie->edge_mask;
+    }
+
+    if (trie->node_count == trie->node_capacity) {
+        trie->node_capacity *= 2;
+        const size_t realloc_sz = sizeof(opt_node) * trie->node_capacity;
+        trie->nodes = realloc(trie->nodes, realloc_sz);
+        if (!trie->nodes) {
+            fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+        }
+    }
+    const size_t idx = trie->node_count++;
+    trie->nodes[idx].parent = parent;
+    trie->nodes[idx].name = name;
+    trie->nodes[idx].name_len = name_len;
+    trie->nodes[idx].rule = SIZE_MAX;
+    trie->nodes[idx].granted = 0;
+    trie->edges[slot] = idx + 1;
+    return idx;
+}
+
+// Returns the child `name` of `parent`, or SIZE_MAX if there is none.
+// Doesn't change the trie, so any number of threads can do this at once.
+static size_t opt_trie_find(const opt_trie* trie, size_t parent, const char* name, size_t name_len) {
+    if (!trie->edges) {
+        return SIZE_MAX;
+    }
+    size_t slot = opt_edge_hash(parent, name, name_len) & trie->edge_mask;
+    while (trie->edges[slot]) {
+        const opt_node* node = &trie->nodes[trie->edges[slot] - 1];
+        if (node->parent == parent && node->name_len == name_len &&
+            memcmp(node->name, name, name_len) == 0) {
+            return trie->edges[slot] - 1;
+        }
+        slot = (slot + 1) & trie->edge_mask;
+    }
+    return SIZE_MAX;
+}
+
+// How many times every device is mounted, from /proc/self/mountinfo.
+// Returns NULL if we can't tell, in which case nothing counts as mounted
+// only once.
+static opt_mount_dev* opt_read_mounts(size_t* count_out) {
+    FILE* f = fopen("/proc/self/mountinfo", "re");
+    if (!f) {
+        return NULL;
+    }
+
+    opt_mount_dev* devs = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    char* line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, f) >= 0) {
+        unsigned int major, minor;
+        if (sscanf(line, "%*d %*d %u:%u", &major, &minor) != 2) {
+            continue;
+        }
+        const dev_t dev = makedev(major, minor);
+        size_t i = 0;
+        while (i < count && devs[i].dev != dev) {
+            i++;
+        }
+        if (i == count) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                devs = realloc(devs, sizeof(opt_mount_dev) * capacity);
+                if (!devs) {
+                    fatal_error_errno("realloc(...) failed.");
+                }
+            }
+            devs[count].dev = dev;
+            devs[count].count = 0;
+            count++;
+        }
+        devs[i].count++;
+    }
+    free(line);
+    fclose(f);
+
+    *count_out = count;
+    return devs;
+}
+
+static int opt_mounted_once(const opt_mount_dev* devs, size_t count, dev_t dev) {
+    for (size_t i = 0; i < count; i++) {
+        if (devs[i].dev == dev) {
+            return devs[i].count == 1;
+        }
+    }
+    return 0;
+}
+
+// Rewrites pol->fs_rules in place. Rules whose paths can't be resolved are
+// left alone; building the ruleset will complain about them as usual.
+static void optimize_policy(policy* pol, size_t* merged_out, size_t* covered_out) {
+    const size_t count = pol->fs_rule_count;
+    size_t merged = 0;
+    size_t covered = 0;
+
+    // Per rule: 1 if it is to be dropped.
+    char* drop = calloc(count + 1, 1);
+    // Per rule: 1 if it may be dropped for being covered by its parents.
+    char* droppable = calloc(count + 1, 1);
+    // Per rule: trie node, or SIZE_MAX.
+    size_t* rule_node = calloc(count + 1, sizeof(size_t));
+    inode_id* ids = calloc(count + 1, sizeof(inode_id));
+    if (!drop || !droppable || !rule_node || !ids) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+
+    size_t mount_count = 0;
+    opt_mount_dev* mounts = opt_read_mounts(&mount_count);
+
+    opt_trie trie = {0};
+    trie.node_capacity = 1024;
+    trie.nodes = malloc(sizeof(opt_node) * trie.node_capacity);
+    if (!trie.nodes) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    trie.nodes[0].parent = SIZE_MAX;
+    trie.nodes[0].name = "";
+    trie.nodes[0].name_len = 0;
+    trie.nodes[0].rule = SIZE_MAX;
+    trie.nodes[0].granted = 0;
+    trie.node_count = 1;
+
+    // Same-inode rules, by a linear probe over this hash of inode -> rule + 1.
+    size_t id_table_size = 1024;
+    while (id_table_size < count * 2) {
+        id_table_size *= 2;
+    }
+    size_t* id_table = calloc(id_table_size, sizeof(size_t));
+    if (!id_table) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        fs_rule* rule = &pol->fs_rules[i];
+        rule_node[i] = SIZE_MAX;
+
+        // Never freed: the trie points into it.
+        char* resolved = realpath(rule->path, NULL);
+        struct stat sb;
+        if (!resolved || stat(resolved, &sb) != 0) {
+            free(resolved);
+            continue;
+        }
+        ids[i].dev = (__u64)sb.st_dev;
+        ids[i].ino = (__u64)sb.st_ino;
+
+        size_t slot = (size_t)(ids[i].ino * 0x9e3779b97f4a7c15ULL ^ ids[i].dev) & (id_table_size - 1);
+        int was_merged = 0;
+        while (id_table[slot]) {
+            const size_t other = id_table[slot] - 1;
+            if (ids[other].dev == ids[i].dev && ids[other].ino == ids[i].ino &&
+                pol->fs_rules[other].is_directory == rule->is_directory) {
+                pol->fs_rules[other].access |= rule->access;
+                drop[i] = 1;
+                merged++;
+                was_merged = 1;
+                break;
+            }
+            slot = (slot + 1) & (id_table_size - 1);
+        }
+        if (was_merged) {
+            free(resolved);
+            continue;
+        }
+        id_table[slot] = i + 1;
+
+        droppable[i] = opt_mounted_once(mounts, mount_count, sb.st_dev) &&
+                       (S_ISDIR(sb.st_mode) || sb.st_nlink == 1);
+
+        size_t node = 0;
+        const char* p = resolved;
+        while (*p) {
+            while (*p == '/') {
+                p++;
+            }
+            if (!*p) {
+                break;
+            }
+            const char* name = p;
+            while (*p && *p != '/') {
+                p++;
+            }
+            node = opt_trie_child(&trie, node, name, (size_t)(p - name));
+        }
+        if (trie.nodes[node].rule == SIZE_MAX) {
+            trie.nodes[node].rule = i;
+        }
+        rule_node[i] = node;
+    }
+
+    // Parents are always created before their children, so walking the
+    // nodes in index order visits every parent first.
+    for (size_t n = 0; n < trie.node_count; n++) {
+        opt_node* node = &trie.nodes[n];
+        const __u32 from_parents = n == 0 ? 0 : trie.nodes[node->parent].granted;
+        node->granted = from_parents;
+        if (node->rule == SIZE_MAX) {
+            continue;
+        }
+        const size_t r = node->rule;
+        const __u32 access = pol->fs_rules[r].access;
+        if (droppable[r] && (access & ~from_parents) == 0) {
+            drop[r] = 1;
+            covered++;
+        } else {
+            node->granted |= access;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!drop[i]) {
+            pol->fs_rules[kept++] = pol->fs_rules[i];
+        }
+    }
+    pol->fs_rule_count = kept;
+
+    free(id_table);
+    free(trie.edges);
+    free(trie.nodes);
+    free(mounts);
+    free(ids);
+    free(rule_node);
+    free(droppable);
+    free(drop);
+
+    *merged_out = merged;
+    *covered_out = covered;
 }
+
+// Fail if no sandboxing has been specified.
+// Wondering: technically we should just exec() the child to stay
+// consistent; maybe the command line to this tool is programmatically
+// generated. But I thought misusing `sst` is a more likely scenario.
+// This might be something to address later...maybe an option that says
+// `MIGHT_BE_EMPTY` (and can be specified any number of times) that
+// tells `sst` to accept no sandbox rules given.
+static void require_some_sandboxing(const policy* pol) {
+    if (!pol->fs_sandboxing_enabled && !pol->net_sandboxing_enabled) {
+        fatal_error("no sandboxing options given");
+    }
+}
+
+// sst --compile <output-file> option1 option2 ... optionN
+static int compile_main(int argc, char **argv) {
+    if (argc < 4) {
+        fatal_error("usage: sst --compile <output-file> option1 option2 ... optionN");
+    }
+
+    policy pol = {0};
+    parse_policy_args(&pol, argv, 3, argc);
+    require_some_sandboxing(&pol);
+    if (pol.optimize_rules) {
+        const size_t before = pol.fs_rule_count;
+        size_t merged, covered;
+        optimize_policy(&pol, &merged, &covered);
+        fprintf(stderr, "sst: OPTIMIZE_RULES: %zu filesystem rules -> %zu (%zu merged into a rule on the same inode, %zu covered by a parent directory)\n",
+                before, pol.fs_rule_count, merged, covered);
+    }
+    write_policy_file(&pol, argv[2]);
+
+    return 0;
+}
+
+/****
+ * BAKED POLICIES
+ *
+ * `sst --bake <policy-file> <header>` turns a compiled policy into C: a
+ * constant `policy` with its rule table and port bitmaps filled in. Building
+ * sst.c with -DSST_BAKED_POLICY='"<header>"' (see `make POLICY=... sst-<name>`)
+ * gives a binary that has nothing left to do at start-up but open the paths,
+ * add the rules and exec.
+ ****/
+
+static void bake_c_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        const unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7f || c == '?') {
+            // Always three digits, so the next character can't extend it;
+            // '?' so that nothing reads as a trigraph.
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void bake_port_bitmap(FILE* out, const char* name, const __u64* bitmap) {
+    fprintf(out, "    .%s = {", name);
+    int first = 1;
+    for (size_t w = 0; w < PORT_BITMAP_WORDS; w++) {
+        if (bitmap[w]) {
+            fprintf(out, "%s\n        [%zu] = 0x%016llxULL", first ? "" : ",", w, (unsigned long long)bitmap[w]);
+            first = 0;
+        }
+    }
+    fprintf(out, "%s},\n", first ? "0" : "\n    ");
+}
+
+// sst --bake <policy-file> <header>
+static int bake_main(int argc, char **argv) {
+    if (argc != 4) {
+        fatal_error("usage: sst --bake <policy-file> <header>");
+    }
+    const char* policy_path = argv[2];
+    const char* header_path = argv[3];
+
+    policy pol = {0};
+    load_policy_file(&pol, policy_path);
+    require_some_sandboxing(&pol);
+
+    FILE* out = fopen(header_path, "we");
+    if (!out) {
+        fatal_error_errno("cannot create '%s'", header_path);
+    }
+
+    fprintf(out, "// Generated by `sst --bake ");
+    bake_c_string(out, policy_path);
+    fprintf(out, "`; do not edit.\n\n");
+
+    // Not const: fs_rules isn't a pointer to const. Nothing writes to it.
+    if (pol.fs_rule_count == 0) {
+        fprintf(out, "static fs_rule baked_fs_rules[1];\n\n");
+    } else {
+        fprintf(out, "static fs_rule baked_fs_rules[%zu] = {\n", pol.fs_rule_count);
+        for (size_t i = 0; i < pol.fs_rule_count; i++) {
+            fprintf(out, "    { ");
+            bake_c_string(out, pol.fs_rules[i].path);
+            fprintf(out, ", %d, 0x%xU },\n", pol.fs_rules[i].is_directory ? 1 : 0, pol.fs_rules[i].access);
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "static const policy baked_policy = {\n");
+    fprintf(out, "    .fs_sandboxing_enabled = %d,\n", pol.fs_sandboxing_enabled);
+    fprintf(out, "    .net_sandboxing_enabled = %d,\n", pol.net_sandboxing_enabled);
+    fprintf(out, "    .fs_rule_count = %zu,\n", pol.fs_rule_count);
+    fprintf(out, "    .fs_rules = baked_fs_rules,\n");
+    bake_port_bitmap(out, "incoming_ports", pol.incoming_ports);
+    bake_port_bitmap(out, "outgoing_ports", pol.outgoing_ports);
+    fprintf(out, "    .net_rule_count = %zu,\n", pol.net_rule_count);
+    fprintf(out, "};\n");
+
+    if (fclose(out) != 0) {
+        fatal_error_errno("cannot write to '%s'", header_path);
+    }
+    return 0;
+}
+
+/****
+ * LAUNCHER DAEMON
+ *
+ * `sst --serve <socket> name=<policy-file> ...` builds each named policy
+ * once, in a "zygote" process per policy that has already called
+ * landlock_restrict_self(). Clients connect to <socket> and ask for a command
+ * to be run under one of the names; the zygote fork()s, the child exec()s the
+ * command and the zygote reports the wait status and rusage back to the
+ * client. Per job, that's one fork() instead of exec(sst) + rule building.
+ *
+ * Protocol (native byte order, one job per connection):
+ *
+ *   client -> server: serve_request, sent with a single sendmsg() that also
+ *                     carries the job's stdin/stdout/stderr as SCM_RIGHTS.
+ *   client -> server: payload_size bytes: cwd, argv[0..argc) and
+ *                     envp[0..envc), each NUL-terminated.
+ *   server -> client: serve_response, once the job has exited.
+ *
+ * `sst --submit` is a client that does this for a single command.
+ ****/
+
+#define SERVE_PROTOCOL_MAGIC 0x53535401
+#define SERVE_POLICY_NAME_MAX 64
+#define SERVE_MAX_PAYLOAD (16 * 1024 * 1024)
+#define SERVE_MAX_POLICIES 64
+// Connected clients that haven't sent their request yet, and how long they
+// get to send it.
+#define SERVE_MAX_PENDING 256
+#define SERVE_REQUEST_TIMEOUT_MS 5000
+
+typedef struct sserve_request {
+    __u32 magic;
+    __u32 payload_size;
+    __u32 argc;
+    __u32 envc;
+    char policy_name[SERVE_POLICY_NAME_MAX];
+} serve_request;
+
+typedef struct sserve_response {
+    __u32 magic;
+    // 0 if the job ran; otherwise an errno value describing why it could not
+    // be started (e.g. unknown policy name) and the rest is zero.
+    __s32 error;
+    // As returned by wait4().
+    __s32 wait_status;
+    __u32 reserved;
+    __u64 utime_us;
+    __u64 stime_us;
+    __u64 maxrss_kb;
+    __u64 minflt;
+    __u64 majflt;
+    __u64 nvcsw;
+    __u64 nivcsw;
+} serve_response;
+
+typedef struct sserve_zygote {
+    char name[SERVE_POLICY_NAME_MAX];
+    policy pol;
+    pid_t pid;
+    int ctl_fd;
+} serve_zygote;
+
+typedef struct sserve_job {
+    pid_t pid;
+    int conn_fd;
+} serve_job;
+
+static volatile sig_atomic_t serve_should_exit = 0;
+
+static void serve_handle_exit_signal(int sig) {
+    (void)sig;
+    serve_should_exit = 1;
+}
+
+static void serve_send_response(int conn_fd, const serve_response* resp) {
+    // Best effort: the client may have gone away, in which case there is no
+    // one to tell.
+    ssize_t ret;
+    do {
+        ret = send(conn_fd, resp, sizeof(*resp), MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+}
+
+static void serve_send_error(int conn_fd, int err) {
+    serve_response resp = {0};
+    resp.magic = SERVE_PROTOCOL_MAGIC;
+    resp.error = err;
+    serve_send_response(conn_fd, &resp);
+}
+
+// Receives up to `max_fds` file descriptors along with `len` bytes. Returns
+// the number of bytes received, or -1. Unused slots in `fds` are set to -1.
+static ssize_t recv_with_fds(int sock, void* buf, size_t len, int* fds, size_t max_fds, int flags) {
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * 8)];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * max_fds);
+
+    for (size_t i = 0; i < max_fds; i++) {
+        fds[i] = -1;
+    }
+
+    ssize_t ret;
+    do {
+        ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | flags);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return -1;
+    }
+
+    size_t nfds = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* received = (const int*)CMSG_DATA(cmsg);
+        for (size_t i = 0; i < n; i++) {
+            if (nfds < max_fds) {
+                fds[nfds++] = received[i];
+            } else {
+                close(received[i]);
+            }
+        }
+    }
+
+    if (msg.msg_flags & MSG_CTRUNC) {
+        for (size_t i = 0; i < max_fds; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    return ret;
+}
+
+static int send_with_fds(int sock, const void* buf, size_t len, const int* fds, size_t nfds) {
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * 8)];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { .iov_base = (void*)buf, .iov_len = len };
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (nfds > 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    ssize_t ret;
+    do {
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return -1;
+    }
+    if ((size_t)ret != len) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        const ssize_t ret = read(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ret == 0) {
+            errno = EPIPE;
+            return -1;
+        }
+        p += ret;
+        len -= (size_t)ret;
+    }
+    return 0;
+}
+
+// Runs in the fork()ed child of a zygote. stdio[] has the job's
+// stdin/stdout/stderr. Does not return.
+static void serve_exec_job(const serve_request* req, int conn_fd, const int* stdio) {
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    signal(SIGPIPE, SIG_DFL);
+
+    for (int i = 0; i < 3; i++) {
+        if (dup2(stdio[i], i) < 0) {
+            _exit(127);
+        }
+    }
+
+    char* payload = malloc((size_t)req->payload_size + 1);
+    if (!payload) {
+        fatal_error_errno("malloc(%u) failed.", req->payload_size + 1);
+    }
+    if (read_full(conn_fd, payload, req->payload_size) != 0) {
+        fatal_error_errno("cannot read job from client");
+    }
+    payload[req->payload_size] = '\0';
+
+    char** args = calloc((size_t)req->argc + 1, sizeof(char*));
+    char** env = calloc((size_t)req->envc + 1, sizeof(char*));
+    if (!args || !env) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+
+    const char* end = payload + req->payload_size;
+    char* p = payload;
+    const char* cwd = p;
+    p += strlen(p) + 1;
+    for (__u32 i = 0; i < req->argc; i++) {
+        if (p >= end) {
+            fatal_error("malformed job from client");
+        }
+        args[i] = p;
+        p += strlen(p) + 1;
+    }
+    for (__u32 i = 0; i < req->envc; i++) {
+        if (p >= end) {
+            fatal_error("malformed job from client");
+        }
+        env[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    if (cwd[0] && chdir(cwd) != 0) {
+        fatal_error_errno("cannot chdir to '%s'", cwd);
+    }
+
+    // execvpe() searches the PATH of the current environment, not of `env`.
+    environ = env;
+    execvpe(args[0], args, env);
+
+    fatal_error_errno("execvpe failed");
+}
+
+static void serve_reap_jobs(serve_job** jobs, size_t* job_count) {
+    for (;;) {
+        int status;
+        struct rusage ru;
+        const pid_t pid = wait4(-1, &status, WNOHANG, &ru);
+        if (pid <= 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < *job_count; i++) {
+            if ((*jobs)[i].pid != pid) {
+                continue;
+            }
+
+            serve_response resp = {0};
+            resp.magic = SERVE_PROTOCOL_MAGIC;
+            resp.wait_status = status;
+            resp.utime_us = (__u64)ru.ru_utime.tv_sec * 1000000 + (__u64)ru.ru_utime.tv_usec;
+            resp.stime_us = (__u64)ru.ru_stime.tv_sec * 1000000 + (__u64)ru.ru_stime.tv_usec;
+            resp.maxrss_kb = (__u64)ru.ru_maxrss;
+            resp.minflt = (__u64)ru.ru_minflt;
+            resp.majflt = (__u64)ru.ru_majflt;
+            resp.nvcsw = (__u64)ru.ru_nvcsw;
+            resp.nivcsw = (__u64)ru.ru_nivcsw;
+            serve_send_response((*jobs)[i].conn_fd, &resp);
+            close((*jobs)[i].conn_fd);
+
+            (*jobs)[i] = (*jobs)[*job_count - 1];
+            (*job_count)--;
+            break;
+        }
+    }
+}
+
+// The zygote: applies the policy to itself once, then forks a child for
+// every job the server hands over on `ctl_fd`. Does not return.
+static void serve_zygote_main(const serve_zygote* zyg, int ctl_fd) {
+    apply_policy(&zyg->pol);
+    print_deferred_warnings();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+        fatal_error_errno("sigprocmask failed");
+    }
+    const int sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig_fd < 0) {
+        fatal_error_errno("signalfd failed");
+    }
+
+    serve_job* jobs = NULL;
+    size_t job_count = 0;
+    size_t job_capacity = 0;
+    int ctl_open = 1;
+
+    while (ctl_open || job_count > 0) {
+        struct pollfd pfds[2] = {
+            { .fd = sig_fd, .events = POLLIN },
+            { .fd = ctl_open ? ctl_fd : -1, .events = POLLIN },
+        };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal_error_errno("poll failed");
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+            }
+            serve_reap_jobs(&jobs, &job_count);
+        }
+
+        if (!(pfds[1].revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+
+        // fds[0] is the client connection, fds[1..3] its stdio.
+        serve_request req;
+        int fds[4];
+        const ssize_t got = recv_with_fds(ctl_fd, &req, sizeof(req), fds, 4, 0);
+        if (got == 0 || (got < 0 && errno != EAGAIN)) {
+            // Server went away: finish what we have, then exit.
+            ctl_open = 0;
+            continue;
+        }
+        if (got != sizeof(req) || fds[3] < 0) {
+            for (int i = 0; i < 4; i++) {
+                if (fds[i] >= 0) {
+                    close(fds[i]);
+                }
+            }
+            continue;
+        }
+
+        if (job_count == job_capacity) {
+            job_capacity = job_capacity ? job_capacity * 2 : 64;
+            const size_t realloc_sz = sizeof(serve_job) * job_capacity;
+            jobs = realloc(jobs, realloc_sz);
+            if (!jobs) {
+                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+            }
+        }
+
+        const pid_t pid = fork();
+        if (pid == 0) {
+            serve_exec_job(&req, fds[0], &fds[1]);
+        }
+        if (pid < 0) {
+            serve_send_error(fds[0], errno);
+            close(fds[0]);
+        } else {
+            jobs[job_count].pid = pid;
+            jobs[job_count].conn_fd = fds[0];
+            job_count++;
+        }
+        close(fds[1]);
+        close(fds[2]);
+        close(fds[3]);
+    }
+
+    exit(0);
+}
+
+static int serve_listen(const char* socket_path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fatal_error("--serve: socket path '%s' is too long", socket_path);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        fatal_error_errno("socket(AF_UNIX) failed");
+    }
+
+    // A stale socket from an earlier run would make bind() fail. Anything
+    // else there is not ours to remove: think `sst --serve policy.txt`.
+    struct stat sb;
+    if (lstat(socket_path, &sb) == 0) {
+        if (!S_ISSOCK(sb.st_mode)) {
+            fatal_error("'%s' exists and is not a socket", socket_path);
+        }
+        unlink(socket_path);
+    }
+
+    // Only our own user gets to ask us to run things.
+    const mode_t old_umask = umask(0077);
+    const int bind_ret = bind(sock, (const struct sockaddr*)&addr, sizeof(addr));
+    umask(old_umask);
+    if (bind_ret != 0) {
+        fatal_error_errno("cannot bind to '%s'", socket_path);
+    }
+    if (listen(sock, SOMAXCONN) != 0) {
+        fatal_error_errno("listen failed");
+    }
+    return sock;
+}
+
+// Reads the request of a client that poll() says has sent something, and
+// passes it, along with the connection itself, to the right zygote. The
+// request is one sendmsg(), which arrives in one piece, so this never
+// waits for the client.
+static void serve_dispatch(int conn_fd, serve_zygote* zygotes, size_t zygote_count) {
+    serve_request req;
+    int fds[4];
+    fds[0] = conn_fd;
+    const ssize_t got = recv_with_fds(conn_fd, &req, sizeof(req), &fds[1], 3, MSG_DONTWAIT);
+    if (got != sizeof(req) || req.magic != SERVE_PROTOCOL_MAGIC || fds[3] < 0) {
+        serve_send_error(conn_fd, EPROTO);
+        goto out;
+    }
+    if (req.payload_size > SERVE_MAX_PAYLOAD || req.argc == 0) {
+        serve_send_error(conn_fd, E2BIG);
+        goto out;
+    }
+    req.policy_name[SERVE_POLICY_NAME_MAX - 1] = '\0';
+
+    serve_zygote* zyg = NULL;
+    for (size_t i = 0; i < zygote_count; i++) {
+        if (strcmp(zygotes[i].name, req.policy_name) == 0) {
+            zyg = &zygotes[i];
+            break;
+        }
+    }
+    if (!zyg) {
+        serve_send_error(conn_fd, ENOENT);
+        goto out;
+    }
+
+    if (send_with_fds(zyg->ctl_fd, &req, sizeof(req), fds, 4) != 0) {
+        fprintf(stderr, "sst: warning: cannot hand job to zygote for policy '%s': %s\n",
+                zyg->name, strerror(errno));
+        serve_send_error(conn_fd, errno);
+    }
+
+out:
+    for (int i = 0; i < 4; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+}
+
+// sst --serve <socket> name=<policy-file> ...
+static int serve_main(int argc, char **argv) {
+    if (argc < 4) {
+        fatal_error("usage: sst --serve <socket> name=<policy-file> [name=<policy-file> ...]");
+    }
+    const char* socket_path = argv[2];
+
+    const size_t zygote_count = (size_t)(argc - 3);
+    if (zygote_count > SERVE_MAX_POLICIES) {
+        fatal_error("--serve: too many policies (max %d)", SERVE_MAX_POLICIES);
+    }
+    serve_zygote* zygotes = calloc(zygote_count, sizeof(serve_zygote));
+    if (!zygotes) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+
+    // Load everything before forking anything, so that a typo fails the
+    // whole thing up front.
+    for (size_t i = 0; i < zygote_count; i++) {
+        const char* spec = argv[i + 3];
+        const char* eq = strchr(spec, '=');
+        if (!eq || eq == spec || eq[1] == '\0') {
+            fatal_error("--serve: expected name=<policy-file>, got '%s'", spec);
+        }
+        const size_t name_len = (size_t)(eq - spec);
+        if (name_len >= SERVE_POLICY_NAME_MAX) {
+            fatal_error("--serve: policy name in '%s' is too long", spec);
+        }
+        memcpy(zygotes[i].name, spec, name_len);
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(zygotes[i].name, zygotes[j].name) == 0) {
+                fatal_error("--serve: policy name '%s' given twice", zygotes[i].name);
+            }
+        }
+        load_policy_file(&zygotes[i].pol, eq + 1);
+        require_some_sandboxing(&zygotes[i].pol);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    for (size_t i = 0; i < zygote_count; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+            fatal_error_errno("socketpair failed");
+        }
+        const pid_t pid = fork();
+        if (pid < 0) {
+            fatal_error_errno("fork failed");
+        }
+        if (pid == 0) {
+            close(sv[0]);
+            for (size_t j = 0; j < i; j++) {
+                close(zygotes[j].ctl_fd);
+            }
+            prctl(PR_SET_PDEATHSIG, SIGTERM, 0, 0, 0);
+            serve_zygote_main(&zygotes[i], sv[1]);
+        }
+        close(sv[1]);
+        zygotes[i].pid = pid;
+        zygotes[i].ctl_fd = sv[0];
+    }
+
+    const int listen_fd = serve_listen(socket_path);
+
+    struct sigaction sa = {0};
+    sa.sa_handler = serve_handle_exit_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // Zygotes exiting is noted when handing them jobs fails; no zombies.
+    signal(SIGCHLD, SIG_IGN);
+
+    // Clients that have connected but not sent their request yet. They are
+    // polled along with the listening socket, so one that is slow to send
+    // (or never does) holds up nobody else.
+    struct pollfd pfds[1 + SERVE_MAX_PENDING];
+    __u64 deadlines[1 + SERVE_MAX_PENDING];
+    size_t pending = 0;
+    pfds[0] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+
+    while (!serve_should_exit) {
+        // With no room for more, new clients wait in the listen backlog.
+        pfds[0].fd = pending < SERVE_MAX_PENDING ? listen_fd : -1;
+        const __u64 now_ms = timing_now() / 1000000;
+        int timeout_ms = -1;
+        for (size_t i = 1; i <= pending; i++) {
+            const __u64 left = deadlines[i] > now_ms ? deadlines[i] - now_ms : 0;
+            if (timeout_ms < 0 || left < (__u64)timeout_ms) {
+                timeout_ms = (int)left;
+            }
+        }
+        if (poll(pfds, 1 + pending, timeout_ms) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal_error_errno("poll failed");
+        }
+
+        const __u64 after_ms = timing_now() / 1000000;
+        for (size_t i = 1; i <= pending;) {
+            if (pfds[i].revents) {
+                serve_dispatch(pfds[i].fd, zygotes, zygote_count);
+            } else if (deadlines[i] <= after_ms) {
+                serve_send_error(pfds[i].fd, ETIMEDOUT);
+                close(pfds[i].fd);
+            } else {
+                i++;
+                continue;
+            }
+            pfds[i] = pfds[pending];
+            deadlines[i] = deadlines[pending];
+            pending--;
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            const int conn_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (conn_fd >= 0) {
+                pending++;
+                pfds[pending] = (struct pollfd){ .fd = conn_fd, .events = POLLIN };
+                deadlines[pending] = after_ms + SERVE_REQUEST_TIMEOUT_MS;
+            } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                fatal_error_errno("accept failed");
+            }
+        }
+    }
+
+    for (size_t i = 1; i <= pending; i++) {
+        close(pfds[i].fd);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    for (size_t i = 0; i < zygote_count; i++) {
+        close(zygotes[i].ctl_fd);
+    }
+
+    return 0;
+}
+
+// sst --submit <socket> <name> -- command arg1 ... argN
+//
+// Runs one command through an `sst --serve` daemon, with our stdio, cwd and
+// environment, and exits the way the command did.
+static int submit_main(int argc, char **argv, char *const *const envp) {
+    if (argc < 6 || strcmp(argv[4], "--") != 0) {
+        fatal_error("usage: sst --submit <socket> <policy-name> -- command arg1 ... argN");
+    }
+    const char* socket_path = argv[2];
+    const char* name = argv[3];
+    char *const *command_args = &argv[5];
+
+    serve_request req = {0};
+    req.magic = SERVE_PROTOCOL_MAGIC;
+    if (strlen(name) >= SERVE_POLICY_NAME_MAX) {
+        fatal_error("--submit: policy name '%s' is too long", name);
+    }
+    strcpy(req.policy_name, name);
+
+    char* cwd = getcwd(NULL, 0);
+    if (!cwd) {
+        fatal_error_errno("getcwd failed");
+    }
+
+    size_t payload_size = strlen(cwd) + 1;
+    for (char *const *a = command_args; *a; a++) {
+        payload_size += strlen(*a) + 1;
+        req.argc++;
+    }
+    for (char *const *e = envp; *e; e++) {
+        payload_size += strlen(*e) + 1;
+        req.envc++;
+    }
+    if (payload_size > SERVE_MAX_PAYLOAD) {
+        fatal_error("--submit: command line and environment are too large");
+    }
+    req.payload_size = (__u32)payload_size;
+
+    char* payload = malloc(payload_size);
+    if (!payload) {
+        fatal_error_errno("malloc(%zu) failed.", payload_size);
+    }
+    char* p = payload;
+    p = stpcpy(p, cwd) + 1;
+    for (char *const *a = command_args; *a; a++) {
+        p = stpcpy(p, *a) + 1;
+    }
+    for (char *const *e = envp; *e; e++) {
+        p = stpcpy(p, *e) + 1;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fatal_error("--submit: socket path '%s' is too long", socket_path);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        fatal_error_errno("socket(AF_UNIX) failed");
+    }
+    if (connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fatal_error_errno("cannot connect to '%s'", socket_path);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    const int stdio[3] = { 0, 1, 2 };
+    if (send_with_fds(sock, &req, sizeof(req), stdio, 3) != 0) {
+        fatal_error_errno("cannot send request to '%s'", socket_path);
+    }
+    // If the server rejects the request outright, it says why and hangs up
+    // without reading the payload; the response is still worth reading.
+    if (write_full(sock, payload, payload_size) != 0 && errno != EPIPE && errno != ECONNRESET) {
+        fatal_error_errno("cannot send request to '%s'", socket_path);
+    }
+
+    serve_response resp;
+    if (read_full(sock, &resp, sizeof(resp)) != 0 || resp.magic != SERVE_PROTOCOL_MAGIC) {
+        fatal_error("no response from '%s'", socket_path);
+    }
+    if (resp.error == ENOENT) {
+        fatal_error("'%s' has no policy named '%s'", socket_path, name);
+    }
+    if (resp.error != 0) {
+        errno = resp.error;
+        fatal_error_errno("server could not run the command");
+    }
+
+    if (WIFEXITED(resp.wait_status)) {
+        return WEXITSTATUS(resp.wait_status);
+    }
+    if (WIFSIGNALED(resp.wait_status)) {
+        return 128 + WTERMSIG(resp.wait_status);
+    }
+    return 1;
+}
+
+/****
+ * RULESET CACHE
+ *
+ * `sst --ruleset-cache <socket>` keeps ready-made Landlock rulesets around so
+ * that `sst RULESET_CACHE:<socket> ...` can skip the open() +
+ * landlock_add_rule() per rule and go straight to landlock_restrict_self().
+ *
+ * Entries are keyed by the serialized policy (the same image `--compile`
+ * writes, with relative paths made absolute by the client). Each entry
+ * remembers the inode behind every rule and has inotify watches on every
+ * directory along every rule path; renaming or deleting anything along the
+ * way drops the entry, so a cached ruleset never points at a replaced inode.
+ *
+ * A ruleset can still be added to by whoever holds its fd, so a ruleset fd is
+ * never handed out twice: every entry has a small pool of identical
+ * rulesets that gets refilled whenever the cache is otherwise idle.
+ *
+ * Protocol (native byte order, one ruleset per connection):
+ *
+ *   client -> cache: ruleset_cache_request, then policy_size bytes of
+ *                    policy image.
+ *   cache -> client: ruleset_cache_response, with the ruleset fd attached as
+ *                    SCM_RIGHTS if error is 0, then message_size bytes of
+ *                    whatever `sst` would have printed to stderr while
+ *                    building the ruleset (warnings; or the error when error
+ *                    is not 0).
+ ****/
+
+#define RULESET_CACHE_MAGIC 0x53535402
+#define RULESET_CACHE_MAX_POLICY (64 * 1024 * 1024)
+#define RULESET_CACHE_MAX_MESSAGE 4096
+#define RULESET_CACHE_MAX_ENTRIES 64
+#define RULESET_CACHE_DEFAULT_POOL 8
+
+#define RULESET_CACHE_WATCH_MASK \
+    (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct sruleset_cache_request {
+    __u32 magic;
+    __u32 policy_size;
+} ruleset_cache_request;
+
+typedef struct sruleset_cache_response {
+    __u32 magic;
+    __s32 error;
+    __u32 restrict_flags;
+    __u32 message_size;
+} ruleset_cache_response;
+
+typedef struct swatch_key {
+    int wd;
+    char* name;
+} watch_key;
+
+typedef struct sruleset_cache_entry {
+    char* policy_bytes;
+    size_t policy_size;
+    __u64 hash;
+
+    inode_id* ids;
+    size_t id_count;
+
+    watch_key* watches;
+    size_t watch_count;
+
+    int* pool;
+    size_t pool_count;
+
+    __u32 restrict_flags;
+    char* message;
+    size_t message_size;
+
+    __u64 last_used;
+} ruleset_cache_entry;
+
+static int watch_key_cmp(const void* a, const void* b) {
+    const watch_key* x = a;
+    const watch_key* y = b;
+    if (x->wd != y->wd) {
+        return x->wd < y->wd ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// Builds the ruleset for a policy image in a child process, so that the
+// fatal_error() calls in the shared code can't take the cache down with
+// them. Returns the ruleset fd, or -1 with the child's complaints in
+// `*message_out`. On success, `*message_out` has any warnings.
+static int ruleset_cache_build(const char* policy_bytes, size_t policy_size,
+                               inode_id** ids_out, size_t* id_count_out,
+                               __u32* restrict_flags_out,
+                               char** message_out, size_t* message_size_out) {
+    int sv[2];
+    int err_pipe[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        fatal_error_errno("socketpair failed");
+    }
+    if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+        fatal_error_errno("pipe failed");
+    }
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        fatal_error_errno("fork failed");
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        close(err_pipe[0]);
+        if (dup2(err_pipe[1], 2) < 0) {
+            _exit(1);
+        }
+
+        policy pol = {0};
+        load_policy_buffer(&pol, policy_bytes, policy_size, "<ruleset cache request>");
+        require_some_sandboxing(&pol);
+
+        inode_id* ids = calloc(pol.fs_rule_count + 1, sizeof(inode_id));
+        if (!ids) {
+            fatal_error_errno("calloc(...) failed.");
+        }
+        __u32 restrict_flags;
+        const int ruleset_fd = create_policy_ruleset(&pol, &restrict_flags, ids);
+        print_deferred_warnings();
+
+        const __u32 hdr[2] = { restrict_flags, (__u32)pol.fs_rule_count };
+        if (send_with_fds(sv[1], hdr, sizeof(hdr), &ruleset_fd, 1) != 0 ||
+            write_full(sv[1], ids, sizeof(inode_id) * pol.fs_rule_count) != 0) {
+            fatal_error_errno("cannot send ruleset to cache");
+        }
+        _exit(0);
+    }
+    close(sv[1]);
+    close(err_pipe[1]);
+
+    int ruleset_fd = -1;
+    __u32 hdr[2];
+    inode_id* ids = NULL;
+    if (recv_with_fds(sv[0], hdr, sizeof(hdr), &ruleset_fd, 1, MSG_WAITALL) == sizeof(hdr) &&
+        ruleset_fd >= 0) {
+        ids = calloc((size_t)hdr[1] + 1, sizeof(inode_id));
+        if (!ids) {
+            fatal_error_errno("calloc(...) failed.");
+        }
+        if (read_full(sv[0], ids, sizeof(inode_id) * hdr[1]) != 0) {
+            close(ruleset_fd);
+            ruleset_fd = -1;
+        }
+    } else if (ruleset_fd >= 0) {
+        close(ruleset_fd);
+        ruleset_fd = -1;
+    }
+    close(sv[0]);
+
+    char* message = malloc(RULESET_CACHE_MAX_MESSAGE);
+    if (!message) {
+        fatal_error_errno("malloc(%d) failed.", RULESET_CACHE_MAX_MESSAGE);
+    }
+    size_t message_size = 0;
+    for (;;) {
+        const ssize_t got = read(err_pipe[0], message + message_size, RULESET_CACHE_MAX_MESSAGE - message_size);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;
+        }
+        message_size += (size_t)got;
+        if (message_size == RULESET_CACHE_MAX_MESSAGE) {
+            break;
+        }
+    }
+    close(err_pipe[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (ruleset_fd >= 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        close(ruleset_fd);
+        ruleset_fd = -1;
+    }
+
+    if (ruleset_fd < 0) {
+        free(ids);
+        ids = NULL;
+        if (message_size == 0) {
+            message_size = (size_t)snprintf(message, RULESET_CACHE_MAX_MESSAGE,
+                                            "sst: error: ruleset cache could not build the ruleset\n");
+        }
+    } else {
+        *ids_out = ids;
+        *id_count_out = hdr[1];
+        *restrict_flags_out = hdr[0];
+    }
+
+    *message_out = message;
+    *message_size_out = message_size;
+    return ruleset_fd;
+}
+
+static int ruleset_cache_add_watch(int inotify_fd, const char* dir, const char* name,
+                                   watch_key** keys, size_t* key_count, size_t* key_capacity) {
+    const int wd = inotify_add_watch(inotify_fd, dir, RULESET_CACHE_WATCH_MASK);
+    if (wd < 0) {
+        return -1;
+    }
+    if (*key_count == *key_capacity) {
+        *key_capacity = *key_capacity ? *key_capacity * 2 : 64;
+        const size_t realloc_sz = sizeof(watch_key) * *key_capacity;
+        *keys = realloc(*keys, realloc_sz);
+        if (!*keys) {
+            fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+        }
+    }
+    (*keys)[*key_count].wd = wd;
+    (*keys)[*key_count].name = strdup(name);
+    if (!(*keys)[*key_count].name) {
+        fatal_error_errno("strdup(...) failed.");
+    }
+    (*key_count)++;
+    return 0;
+}
+
+// Watches every directory along `path` for the next component being
+// renamed, replaced or deleted.
+static int ruleset_cache_watch_path(int inotify_fd, const char* path,
+                                    watch_key** keys, size_t* key_count, size_t* key_capacity) {
+    const size_t len = strlen(path);
+    int ret = 0;
+
+    size_t i = 0;
+    while (ret == 0 && i < len) {
+        while (i < len && path[i] == '/') {
+            i++;
+        }
+        if (i == len) {
+            break;
+        }
+        const size_t start = i;
+        while (i < len && path[i] != '/') {
+            i++;
+        }
+
+        // path[0..start) is the directory, path[start..i) the name in it.
+        char* dir = start == 0 ? strdup(".") : start == 1 ? strdup("/") : strndup(path, start);
+        char* name = strndup(path + start, i - start);
+        if (!dir || !name) {
+            fatal_error_errno("strdup(...) failed.");
+        }
+        ret = ruleset_cache_add_watch(inotify_fd, dir, name, keys, key_count, key_capacity);
+        free(dir);
+        free(name);
+    }
+
+    return ret;
+}
+
+// Sets up the watches for a new entry. Returns -1 if that can't be done,
+// in which case the entry must not be cached.
+static int ruleset_cache_watch_entry(int inotify_fd, ruleset_cache_entry* entry) {
+    policy pol = {0};
+    load_policy_buffer(&pol, entry->policy_bytes, entry->policy_size, "<ruleset cache entry>");
+
+    watch_key* keys = NULL;
+    size_t key_count = 0;
+    size_t key_capacity = 0;
+    int ret = 0;
+
+    for (size_t i = 0; i < pol.fs_rule_count && ret == 0; i++) {
+        ret = ruleset_cache_watch_path(inotify_fd, pol.fs_rules[i].path, &keys, &key_count, &key_capacity);
+
+        // Symlinks along the way are covered by the watch on their
+        // directory above; this covers what they pointed to.
+        char* resolved = realpath(pol.fs_rules[i].path, NULL);
+        if (ret == 0 && resolved && strcmp(resolved, pol.fs_rules[i].path) != 0) {
+            ret = ruleset_cache_watch_path(inotify_fd, resolved, &keys, &key_count, &key_capacity);
+        }
+        free(resolved);
+    }
+    free(pol.fs_rules);
+
+    if (key_count > 0) {
+        qsort(keys, key_count, sizeof(watch_key), watch_key_cmp);
+        size_t unique = 1;
+        for (size_t i = 1; i < key_count; i++) {
+            if (watch_key_cmp(&keys[i], &keys[unique - 1]) == 0) {
+                free(keys[i].name);
+            } else {
+                keys[unique++] = keys[i];
+            }
+        }
+        key_count = unique;
+    }
+
+    entry->watches = keys;
+    entry->watch_count = key_count;
+    return ret;
+}
+
+static int ruleset_cache_entry_watches(const ruleset_cache_entry* entry, int wd, const char* name) {
+    if (!name) {
+        for (size_t i = 0; i < entry->watch_count; i++) {
+            if (entry->watches[i].wd == wd) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    const watch_key key = { .wd = wd, .name = (char*)name };
+    return bsearch(&key, entry->watches, entry->watch_count, sizeof(watch_key), watch_key_cmp) != NULL;
+}
+
+static void ruleset_cache_free_entry(ruleset_cache_entry* entry) {
+    for (size_t i = 0; i < entry->pool_count; i++) {
+        close(entry->pool[i]);
+    }
+    for (size_t i = 0; i < entry->watch_count; i++) {
+        free(entry->watches[i].name);
+    }
+    free(entry->pool);
+    free(entry->watches);
+    free(entry->ids);
+    free(entry->message);
+    free(entry->policy_bytes);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static void ruleset_cache_drop_entry(ruleset_cache_entry* entries, size_t* entry_count, size_t idx) {
+    ruleset_cache_free_entry(&entries[idx]);
+    entries[idx] = entries[*entry_count - 1];
+    memset(&entries[*entry_count - 1], 0, sizeof(ruleset_cache_entry));
+    (*entry_count)--;
+}
+
+// Drops every entry affected by pending inotify events. Never blocks.
+static void ruleset_cache_process_events(int inotify_fd, ruleset_cache_entry* entries, size_t* entry_count) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        const ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            return;
+        }
+        for (char* p = buf; p < buf + len; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // We don't know what we missed.
+                while (*entry_count > 0) {
+                    ruleset_cache_drop_entry(entries, entry_count, 0);
+                }
+                continue;
+            }
+
+            // Events about the directory itself concern every path going
+            // through it.
+            const char* name = (ev->len > 0 && !(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)))
+                ? ev->name : NULL;
+            for (size_t i = 0; i < *entry_count; ) {
+                if (ruleset_cache_entry_watches(&entries[i], ev->wd, name)) {
+                    ruleset_cache_drop_entry(entries, entry_count, i);
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+}
+
+// Only serve processes of our own user that see the same filesystem as we
+// do; otherwise the paths in the policy might mean something else.
+static int ruleset_cache_check_peer(int conn_fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(conn_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        return -1;
+    }
+    if (cred.uid != geteuid()) {
+        return -1;
+    }
+
+    char ns_path[64];
+    snprintf(ns_path, sizeof(ns_path), "/proc/%d/ns/mnt", (int)cred.pid);
+    struct stat peer_ns, our_ns;
+    if (stat(ns_path, &peer_ns) != 0 || stat("/proc/self/ns/mnt", &our_ns) != 0) {
+        return -1;
+    }
+    if (peer_ns.st_dev != our_ns.st_dev || peer_ns.st_ino != our_ns.st_ino) {
+        return -1;
+    }
+    return 0;
+}
+
+static void ruleset_cache_respond(int conn_fd, int error, int ruleset_fd, __u32 restrict_flags,
+                                  const char* message, size_t message_size) {
+    ruleset_cache_response resp = {0};
+    resp.magic = RULESET_CACHE_MAGIC;
+    resp.error = error;
+    resp.restrict_flags = restrict_flags;
+    resp.message_size = (__u32)message_size;
+
+    if (send_with_fds(conn_fd, &resp, sizeof(resp), &ruleset_fd, ruleset_fd >= 0 ? 1 : 0) == 0 &&
+        message_size > 0) {
+        write_full(conn_fd, message, message_size);
+    }
+}
+
+static void ruleset_cache_handle(int conn_fd, int inotify_fd,
+                                 ruleset_cache_entry* entries, size_t* entry_count,
+                                 __u64* clock) {
+    const struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(conn_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (ruleset_cache_check_peer(conn_fd) != 0) {
+        ruleset_cache_respond(conn_fd, EPERM, -1, 0, NULL, 0);
+        return;
+    }
+
+    ruleset_cache_request req;
+    if (read_full(conn_fd, &req, sizeof(req)) != 0 || req.magic != RULESET_CACHE_MAGIC) {
+        ruleset_cache_respond(conn_fd, EPROTO, -1, 0, NULL, 0);
+        return;
+    }
+    if (req.policy_size > RULESET_CACHE_MAX_POLICY) {
+        ruleset_cache_respond(conn_fd, E2BIG, -1, 0, NULL, 0);
+        return;
+    }
+    char* bytes = malloc((size_t)req.policy_size + 1);
+    if (!bytes) {
+        fatal_error_errno("malloc(%u) failed.", req.policy_size + 1);
+    }
+    if (read_full(conn_fd, bytes, req.policy_size) != 0) {
+        free(bytes);
+        ruleset_cache_respond(conn_fd, EPROTO, -1, 0, NULL, 0);
+        return;
+    }
+
+    const __u64 hash = fnv1a_hash(bytes, req.policy_size);
+    (*clock)++;
+
+    // Anything renamed up to now must be noticed before handing out a
+    // ruleset from the pool.
+    ruleset_cache_process_events(inotify_fd, entries, entry_count);
+
+    ruleset_cache_entry* entry = NULL;
+    for (size_t i = 0; i < *entry_count; i++) {
+        if (entries[i].hash == hash && entries[i].policy_size == req.policy_size &&
+            memcmp(entries[i].policy_bytes, bytes, req.policy_size) == 0) {
+            entry = &entries[i];
+            break;
+        }
+    }
+
+    if (entry && entry->pool_count > 0) {
+        const int ruleset_fd = entry->pool[--entry->pool_count];
+        entry->last_used = *clock;
+        ruleset_cache_respond(conn_fd, 0, ruleset_fd, entry->restrict_flags, entry->message, entry->message_size);
+        close(ruleset_fd);
+        free(bytes);
+        return;
+    }
+
+    inode_id* ids = NULL;
+    size_t id_count = 0;
+    __u32 restrict_flags = 0;
+    char* message = NULL;
+    size_t message_size = 0;
+    const int ruleset_fd = ruleset_cache_build(bytes, req.policy_size, &ids, &id_count,
+                                               &restrict_flags, &message, &message_size);
+    if (ruleset_fd < 0) {
+        ruleset_cache_respond(conn_fd, EINVAL, -1, 0, message, message_size);
+        free(message);
+        free(bytes);
+        return;
+    }
+
+    ruleset_cache_respond(conn_fd, 0, ruleset_fd, restrict_flags, message, message_size);
+    close(ruleset_fd);
+
+    if (entry) {
+        // Pool ran dry; it gets refilled when we are idle.
+        entry->last_used = *clock;
+        free(ids);
+        free(message);
+        free(bytes);
+        return;
+    }
+
+    if (*entry_count == RULESET_CACHE_MAX_ENTRIES) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < *entry_count; i++) {
+            if (entries[i].last_used < entries[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        ruleset_cache_drop_entry(entries, entry_count, oldest);
+    }
+
+    ruleset_cache_entry* new_entry = &entries[*entry_count];
+    new_entry->policy_bytes = bytes;
+    new_entry->policy_size = req.policy_size;
+    new_entry->hash = hash;
+    new_entry->ids = ids;
+    new_entry->id_count = id_count;
+    new_entry->restrict_flags = restrict_flags;
+    new_entry->message = message;
+    new_entry->message_size = message_size;
+    new_entry->last_used = *clock;
+
+    if (ruleset_cache_watch_entry(inotify_fd, new_entry) != 0) {
+        fprintf(stderr, "sst: warning: cannot watch the paths of a policy (%s); not caching it\n", strerror(errno));
+        ruleset_cache_free_entry(new_entry);
+        return;
+    }
+    (*entry_count)++;
+}
+
+// Adds one ruleset to the pool of the first entry that is short of them.
+// Returns 0 if there was nothing to do.
+static int ruleset_cache_refill_one(int inotify_fd, ruleset_cache_entry* entries, size_t* entry_count,
+                                    size_t pool_size) {
+    for (size_t i = 0; i < *entry_count; i++) {
+        ruleset_cache_entry* entry = &entries[i];
+        if (entry->pool_count >= pool_size) {
+            continue;
+        }
+        if (!entry->pool) {
+            entry->pool = calloc(pool_size, sizeof(int));
+            if (!entry->pool) {
+                fatal_error_errno("calloc(...) failed.");
+            }
+        }
+
+        inode_id* ids = NULL;
+        size_t id_count = 0;
+        __u32 restrict_flags = 0;
+        char* message = NULL;
+        size_t message_size = 0;
+        const int ruleset_fd = ruleset_cache_build(entry->policy_bytes, entry->policy_size,
+                                                   &ids, &id_count, &restrict_flags,
+                                                   &message, &message_size);
+        free(message);
+
+        // A path now resolving to a different inode means the rulesets in
+        // the pool are stale, whether or not inotify told us.
+        if (ruleset_fd < 0 || id_count != entry->id_count ||
+            memcmp(ids, entry->ids, sizeof(inode_id) * id_count) != 0) {
+            if (ruleset_fd >= 0) {
+                close(ruleset_fd);
+            }
+            free(ids);
+            ruleset_cache_drop_entry(entries, entry_count, i);
+            return 1;
+        }
+        free(ids);
+
+        entry->pool[entry->pool_count++] = ruleset_fd;
+        // Events that came in while building may concern what we just built.
+        ruleset_cache_process_events(inotify_fd, entries, entry_count);
+        return 1;
+    }
+    return 0;
+}
+
+// sst --ruleset-cache <socket> [pool-size]
+static int ruleset_cache_main(int argc, char **argv) {
+    if (argc < 3 || argc > 4) {
+        fatal_error("usage: sst --ruleset-cache <socket> [pool-size]");
+    }
+    const char* socket_path = argv[2];
+    size_t pool_size = RULESET_CACHE_DEFAULT_POOL;
+    if (argc == 4) {
+        char* endptr = NULL;
+        const long n = strtol(argv[3], &endptr, 10);
+        if (*argv[3] == '\0' || *endptr != '\0' || n < 1 || n > 1024) {
+            fatal_error("--ruleset-cache: invalid pool size '%s'", argv[3]);
+        }
+        pool_size = (size_t)n;
+    }
+
+    ruleset_cache_entry* entries = calloc(RULESET_CACHE_MAX_ENTRIES, sizeof(ruleset_cache_entry));
+    if (!entries) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    size_t entry_count = 0;
+    __u64 clock = 0;
+
+    const int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        fatal_error_errno("inotify_init1 failed");
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    const int listen_fd = serve_listen(socket_path);
+
+    struct sigaction sa = {0};
+    sa.sa_handler = serve_handle_exit_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    int refill_pending = 0;
+    while (!serve_should_exit) {
+        struct pollfd pfds[2] = {
+            { .fd = listen_fd, .events = POLLIN },
+            { .fd = inotify_fd, .events = POLLIN },
+        };
+        const int ready = poll(pfds, 2, refill_pending ? 0 : -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal_error_errno("poll failed");
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            ruleset_cache_process_events(inotify_fd, entries, &entry_count);
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            const int conn_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (conn_fd >= 0) {
+                ruleset_cache_handle(conn_fd, inotify_fd, entries, &entry_count, &clock);
+                close(conn_fd);
+            } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                fatal_error_errno("accept failed");
+            }
+        }
+
+        if (ready == 0 || !refill_pending) {
+            refill_pending = ruleset_cache_refill_one(inotify_fd, entries, &entry_count, pool_size);
+        }
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+    return 0;
+}
+
+// Asks an `sst --ruleset-cache` daemon for a ready-made ruleset for `pol`.
+// Returns the ruleset fd, or -1 if the cache can't be used, in which case
+// the caller should build the ruleset itself. If the cache says the policy
+// is bad, this dies with the same complaint `sst` would have had.
+static int fetch_cached_ruleset(const policy* pol, __u32* restrict_flags_out) {
+    const char* socket_path = pol->ruleset_cache;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fatal_error("RULESET_CACHE: socket path '%s' is too long", socket_path);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // The cache has a different working directory than we do.
+    policy abs_pol = *pol;
+    abs_pol.fs_rule_capacity = pol->fs_rule_count + 1;
+    abs_pol.fs_rules = calloc(abs_pol.fs_rule_capacity, sizeof(fs_rule));
+    if (!abs_pol.fs_rules) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    char* cwd = NULL;
+    for (size_t i = 0; i < pol->fs_rule_count; i++) {
+        abs_pol.fs_rules[i] = pol->fs_rules[i];
+        if (pol->fs_rules[i].path[0] == '/') {
+            continue;
+        }
+        if (!cwd && !(cwd = getcwd(NULL, 0))) {
+            fatal_error_errno("getcwd failed");
+        }
+        char* abs_path = NULL;
+        if (asprintf(&abs_path, "%s/%s", cwd, pol->fs_rules[i].path) < 0) {
+            fatal_error_errno("asprintf failed");
+        }
+        abs_pol.fs_rules[i].path = abs_path;
+    }
+
+    size_t policy_size;
+    char* policy_bytes = serialize_policy(&abs_pol, &policy_size);
+    for (size_t i = 0; i < pol->fs_rule_count; i++) {
+        if (abs_pol.fs_rules[i].path != pol->fs_rules[i].path) {
+            free((char*)abs_pol.fs_rules[i].path);
+        }
+    }
+    free(abs_pol.fs_rules);
+    free(cwd);
+
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        free(policy_bytes);
+        fatal_error_errno("socket(AF_UNIX) failed");
+    }
+    if (connect(sock, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        // No cache running is fine; we just do the work ourselves.
+        free(policy_bytes);
+        close(sock);
+        return -1;
+    }
+
+    const ruleset_cache_request req = {
+        .magic = RULESET_CACHE_MAGIC,
+        .policy_size = (__u32)policy_size,
+    };
+    ruleset_cache_response resp;
+    int ruleset_fd = -1;
+    const int failed =
+        send(sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req) ||
+        (write_full(sock, policy_bytes, policy_size) != 0 && errno != EPIPE && errno != ECONNRESET) ||
+        recv_with_fds(sock, &resp, sizeof(resp), &ruleset_fd, 1, MSG_WAITALL) != sizeof(resp) ||
+        resp.magic != RULESET_CACHE_MAGIC;
+    free(policy_bytes);
+    if (failed) {
+        char warning[PATH_MAX + 128];
+        const int len = snprintf(warning, sizeof(warning),
+                                 "sst: warning: ruleset cache at '%s' is not responding properly; building the ruleset locally\n",
+                                 socket_path);
+        set_ruleset_cache_warnings(warning, len > 0 && (size_t)len < sizeof(warning) ? (size_t)len : 0);
+        if (ruleset_fd >= 0) {
+            close(ruleset_fd);
+        }
+        close(sock);
+        return -1;
+    }
+
+    // What `sst` would have printed to stderr while building the ruleset.
+    char message[RULESET_CACHE_MAX_MESSAGE];
+    size_t message_size = 0;
+    if (resp.message_size > 0 && resp.message_size <= RULESET_CACHE_MAX_MESSAGE &&
+        read_full(sock, message, resp.message_size) == 0) {
+        message_size = resp.message_size;
+    }
+    close(sock);
+
+    if (resp.error == EINVAL) {
+        // The cache ran the same code we would have, and failed the same
+        // way: its last line is our error, without the "sst: error: " that
+        // fatal_error() puts back for the command line tool.
+        if (ruleset_fd >= 0) {
+            close(ruleset_fd);
+        }
+        while (message_size > 0 && message[message_size - 1] == '\n') {
+            message_size--;
+        }
+        size_t line = message_size;
+        while (line > 0 && message[line - 1] != '\n') {
+            line--;
+        }
+        static const char prefix[] = "sst: error: ";
+        if (message_size - line >= sizeof(prefix) - 1 && memcmp(message + line, prefix, sizeof(prefix) - 1) == 0) {
+            line += sizeof(prefix) - 1;
+        }
+        if (line == message_size) {
+            fatal_error("ruleset cache at '%s' could not build the ruleset", socket_path);
+        }
+        fatal_error("%.*s", (int)(message_size - line), message + line);
+    }
+    set_ruleset_cache_warnings(message, message_size);
+    if (resp.error != 0 || ruleset_fd < 0) {
+        if (ruleset_fd >= 0) {
+            close(ruleset_fd);
+        }
+        return -1;
+    }
+
+    *restrict_flags_out = resp.restrict_flags;
+    return ruleset_fd;
+}
+
+/****
+ * LIBRARY API
+ *
+ * The sst_* functions of sst.h. `sst` itself goes through them too, so
+ * that the library can't drift away from what the command line does.
+ *
+ * Every one of them catches fatal errors (see fatal_error()) and turns
+ * them into a -1 return. Building a ruleset closes what it had open on the
+ * way out, as a rule path that doesn't exist is an ordinary way to fail.
+ * Otherwise whatever the failed call had allocated so far is leaked;
+ * failing is meant to be rare, as it means the sandbox can't be set up as
+ * asked.
+ ****/
+
+struct sst_policy {
+    policy pol;
+};
+
+// Threads in this process, from /proc/self/status; 0 if we can't tell.
+static long count_threads(void) {
+    FILE* f = fopen("/proc/self/status", "re");
+    if (!f) {
+        return 0;
+    }
+    long threads = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Threads: %ld", &threads) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return threads;
+}
+
+// Builds the ruleset for `pol`, or gets it from the ruleset cache.
+static int build_ruleset(policy* pol, __u32* restrict_flags_out) {
+    require_some_sandboxing(pol);
+
+    __u64 start_ns;
+    if (pol->optimize_rules) {
+        start_ns = timing_start();
+        size_t merged, covered;
+        optimize_policy(pol, &merged, &covered);
+        timing_end("optimize_rules", start_ns);
+    }
+
+    int ruleset_fd = -1;
+    if (pol->ruleset_cache) {
+        start_ns = timing_start();
+        ruleset_fd = fetch_cached_ruleset(pol, restrict_flags_out);
+        timing_end("ruleset_cache", start_ns);
+    }
+    if (ruleset_fd < 0) {
+        ruleset_fd = create_policy_ruleset(pol, restrict_flags_out, NULL);
+    }
+    return ruleset_fd;
+}
+
+// Builds the ruleset for `pol` and restricts the calling thread, or all
+// threads, with it.
+static void sandbox_self(policy* pol, unsigned int flags) {
+    require_some_sandboxing(pol);
+
+    __u32 extra_restrict_flags = 0;
+    if (!(flags & SST_APPLY_THIS_THREAD)) {
+        const int abi = landlock_create_ruleset(NULL, 0, LANDLOCK_CREATE_RULESET_VERSION);
+        if (abi >= 8) {
+            extra_restrict_flags |= LANDLOCK_RESTRICT_SELF_TSYNC;
+        } else if (abi >= 0 && count_threads() != 1) {
+            fatal_error("restricting all threads of a running process needs Landlock ABI 8 (this kernel has %d); "
+                        "apply the policy before starting threads, or to this thread only", abi);
+        }
+    }
+
+    restrict_privileges_for_landlock();
+
+    __u32 restrict_flags;
+    const int ruleset_fd = build_ruleset(pol, &restrict_flags);
+    const __u64 start_ns = timing_start();
+    restrict_self_with_ruleset(ruleset_fd, restrict_flags | extra_restrict_flags);
+    timing_end("restrict_self", start_ns);
+}
+
+sst_policy* sst_policy_new(void) {
+    return calloc(1, sizeof(sst_policy));
+}
+
+void sst_policy_free(sst_policy* pol) {
+    if (pol) {
+        free_policy(&pol->pol);
+        free(pol);
+    }
+}
+
+// Copies `count` strings into one buffer owned by `pol` and returns an
+// array of pointers into it (which the caller frees).
+static char** copy_strings(policy* pol, const char* const* strings, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += strlen(strings[i]) + 1;
+    }
+    char* buf = malloc(total ? total : 1);
+    char** copies = calloc(count ? count : 1, sizeof(char*));
+    if (!buf || !copies) {
+        fatal_error_errno("malloc(%zu) failed.", total);
+    }
+    policy_keep_buffer(pol, buf, 0);
+    for (size_t i = 0; i < count; i++) {
+        const size_t len = strlen(strings[i]) + 1;
+        memcpy(buf, strings[i], len);
+        copies[i] = buf;
+        buf += len;
+    }
+    return copies;
+}
+
+int sst_policy_add_options(sst_policy* pol, const char* const* options, size_t count) {
+    jmp_buf env;
+    if (setjmp(env)) {
+        sst_error_jmp = NULL;
+        errno = sst_error_errno;
+        return -1;
+    }
+    sst_error_jmp = &env;
+
+    if (count > INT_MAX) {
+        fatal_error("too many options");
+    }
+    char** copies = copy_strings(&pol->pol, options, count);
+    parse_policy_args(&pol->pol, copies, 0, (int)count);
+    free(copies);
+
+    sst_error_jmp = NULL;
+    return 0;
+}
+
+int sst_policy_add_option(sst_policy* pol, const char* option) {
+    return sst_policy_add_options(pol, &option, 1);
+}
+
+int sst_policy_enable(sst_policy* pol, unsigned int what) {
+    if (what & ~(SST_FILESYSTEM | SST_NETWORK)) {
+        snprintf(sst_error_message, sizeof(sst_error_message), "sst_policy_enable: unknown flags 0x%x", what);
+        errno = EINVAL;
+        return -1;
+    }
+    if (what & SST_FILESYSTEM) {
+        pol->pol.fs_sandboxing_enabled = 1;
+    }
+    if (what & SST_NETWORK) {
+        pol->pol.net_sandboxing_enabled = 1;
+    }
+    return 0;
+}
+
+static int add_path_rule(sst_policy* pol, const char* path, sst_access access, int is_directory) {
+    static const char* const names[] = { "READ", "EXEC", "WRITE", "EXEC_WRITE" };
+    if ((unsigned int)access >= sizeof(names) / sizeof(names[0])) {
+        snprintf(sst_error_message, sizeof(sst_error_message), "unknown sst_access %d", (int)access);
+        errno = EINVAL;
+        return -1;
+    }
+    // Exactly what the corresponding option would do.
+    char* option = NULL;
+    if (asprintf(&option, "%s_%s:%s", is_directory ? "PATH_BENEATH" : "FILE", names[access], path) < 0) {
+        snprintf(sst_error_message, sizeof(sst_error_message), "out of memory");
+        errno = ENOMEM;
+        return -1;
+    }
+    const int ret = sst_policy_add_option(pol, option);
+    free(option);
+    return ret;
+}
+
+int sst_policy_add_file(sst_policy* pol, const char* path, sst_access access) {
+    return add_path_rule(pol, path, access, 0);
+}
+
+int sst_policy_add_path_beneath(sst_policy* pol, const char* path, sst_access access) {
+    return add_path_rule(pol, path, access, 1);
+}
+
+int sst_policy_add_tcp_ports(sst_policy* pol, unsigned int first, unsigned int last, unsigned int directions) {
+    if (first > last || last >= PORT_COUNT || directions == 0 ||
+        (directions & ~(SST_INCOMING | SST_OUTGOING))) {
+        snprintf(sst_error_message, sizeof(sst_error_message),
+                 "sst_policy_add_tcp_ports: invalid ports %u-%u or directions 0x%x", first, last, directions);
+        errno = EINVAL;
+        return -1;
+    }
+    if (!pol->pol.net_sandboxing_enabled) {
+        snprintf(sst_error_message, sizeof(sst_error_message),
+                 "network rules require ENABLE_NETWORK_SANDBOXING");
+        errno = EINVAL;
+        return -1;
+    }
+    push_net_rule_range(&pol->pol, first, last,
+                        (directions & SST_INCOMING) != 0, (directions & SST_OUTGOING) != 0);
+    return 0;
+}
+
+int sst_policy_apply(sst_policy* pol, unsigned int flags) {
+    jmp_buf env;
+    if (setjmp(env)) {
+        sst_error_jmp = NULL;
+        errno = sst_error_errno;
+        return -1;
+    }
+    sst_error_jmp = &env;
+
+    if (flags & ~SST_APPLY_THIS_THREAD) {
+        fatal_error("sst_policy_apply: unknown flags 0x%x", flags);
+    }
+    sandbox_self(&pol->pol, flags);
+
+    sst_error_jmp = NULL;
+    return 0;
+}
+
+struct sst_ruleset {
+    int fd;
+    __u32 restrict_flags;
+};
+
+sst_ruleset* sst_ruleset_new(sst_policy* pol) {
+    jmp_buf env;
+    if (setjmp(env)) {
+        sst_error_jmp = NULL;
+        errno = sst_error_errno;
+        return NULL;
+    }
+    sst_error_jmp = &env;
+
+    __u32 restrict_flags;
+    const int fd = build_ruleset(&pol->pol, &restrict_flags);
+    sst_ruleset* ruleset = calloc(1, sizeof(sst_ruleset));
+    if (!ruleset) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        fatal_error_errno("calloc(...) failed.");
+    }
+    ruleset->fd = fd;
+    ruleset->restrict_flags = restrict_flags;
+
+    sst_error_jmp = NULL;
+    return ruleset;
+}
+
+int sst_ruleset_apply_thread(const sst_ruleset* ruleset) {
+    // no_new_privs is per thread too. Setting it again is cheap, and
+    // threads started before anyone called this don't have it.
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0 ||
+        landlock_restrict_self(ruleset->fd, ruleset->restrict_flags) != 0) {
+        const int err = errno;
+        snprintf(sst_error_message, sizeof(sst_error_message),
+                 "failed to apply Landlock ruleset: %s", strerror(err));
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void sst_ruleset_free(sst_ruleset* ruleset) {
+    if (ruleset) {
+        close(ruleset->fd);
+        free(ruleset);
+    }
+}
+
+// sst_spawn() runs the child on its own small stack in our address space,
+// like posix_spawn() does. It needs very little: a few system calls and
+// then execve().
+#define SPAWN_STACK_SIZE (64 * 1024)
+
+typedef struct sspawn_args {
+    const char* path;
+    char* const* argv;
+    char* const* envp;
+    const sst_ruleset* ruleset;
+    // Signal mask for the child; the parent's, unless the caller says.
+    const sigset_t* child_mask;
+    // dup2()ed to 0, 1 and 2 unless negative.
+    const int* stdio;
+    // Written by the child if it fails; the parent is suspended until the
+    // child has exec()ed or exited, so reading it afterwards is safe.
+    int error;
+    const char* failed_step;
+} spawn_args;
+
+static int spawn_child(void* arg) {
+    spawn_args* args = arg;
+
+    // Our signal handlers would run on this stack, in the parent's memory.
+    for (int sig = 1; sig < NSIG; sig++) {
+        struct sigaction sa;
+        if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_IGN && sa.sa_handler != SIG_DFL) {
+            sa.sa_handler = SIG_DFL;
+            sa.sa_flags = 0;
+            sigaction(sig, &sa, NULL);
+        }
+    }
+    sigprocmask(SIG_SETMASK, args->child_mask, NULL);
+
+    for (int i = 0; i < 3; i++) {
+        if (args->stdio[i] >= 0 && dup2(args->stdio[i], i) < 0) {
+            args->error = errno;
+            args->failed_step = "dup2";
+            _exit(127);
+        }
+    }
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
+        args->error = errno;
+        args->failed_step = "prctl(PR_SET_NO_NEW_PRIVS)";
+        _exit(127);
+    }
+    if (landlock_restrict_self(args->ruleset->fd, args->ruleset->restrict_flags) != 0) {
+        args->error = errno;
+        args->failed_step = "landlock_restrict_self";
+        _exit(127);
+    }
+    execve(args->path, args->argv, args->envp);
+    args->error = errno;
+    args->failed_step = "execve";
+    _exit(127);
+}
+
+// sst_spawn(), plus the child's stdio and signal mask (NULL: ours).
+static int spawn_sandboxed(pid_t* pid_out, const char* path, const sst_ruleset* ruleset,
+                           char* const argv[], char* const envp[],
+                           const int stdio[3], const sigset_t* child_mask) {
+    char* stack = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        const int err = errno;
+        snprintf(sst_error_message, sizeof(sst_error_message), "sst_spawn: cannot mmap a stack: %s", strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    // Nothing may run a handler on the child's stack before it has reset
+    // the handlers.
+    sigset_t all, parent_mask;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &parent_mask);
+
+    spawn_args args = {
+        .path = path,
+        .argv = argv,
+        .envp = envp,
+        .ruleset = ruleset,
+        .child_mask = child_mask ? child_mask : &parent_mask,
+        .stdio = stdio,
+    };
+    // No page tables are copied, so this costs the same no matter how big
+    // we are.
+    const pid_t pid = clone(spawn_child, stack + SPAWN_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+    const int clone_errno = errno;
+
+    pthread_sigmask(SIG_SETMASK, &parent_mask, NULL);
+    munmap(stack, SPAWN_STACK_SIZE);
+
+    if (pid < 0) {
+        snprintf(sst_error_message, sizeof(sst_error_message), "sst_spawn: clone failed: %s", strerror(clone_errno));
+        errno = clone_errno;
+        return -1;
+    }
+    if (args.error) {
+        // Reap it, so failing doesn't leave a zombie behind.
+        while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        snprintf(sst_error_message, sizeof(sst_error_message), "sst_spawn: %s failed for '%s': %s",
+                 args.failed_step, path, strerror(args.error));
+        errno = args.error;
+        return -1;
+    }
+    *pid_out = pid;
+    return 0;
+}
+
+int sst_spawn(pid_t* pid_out, const char* path, const sst_ruleset* ruleset,
+              char* const argv[], char* const envp[]) {
+    static const int inherit_stdio[3] = { -1, -1, -1 };
+    return spawn_sandboxed(pid_out, path, ruleset, argv, envp, inherit_stdio, NULL);
+}
+
+const char* sst_error(void) {
+    return sst_error_message;
+}
+
+// Finds `command` on $PATH the way execvpe() will. Returns NULL if
+// `command` has a slash in it (execvpe() takes it as is then) or isn't
+// found.
+static char* path_search(const char* command) {
+    if (strchr(command, '/')) {
+        return NULL;
+    }
+    const char* path = getenv("PATH");
+    if (!path) {
+        path = "/bin:/usr/bin";
+    }
+    while (1) {
+        const size_t len = strcspn(path, ":");
+        char* candidate = NULL;
+        // An empty entry means the current directory.
+        if (asprintf(&candidate, "%.*s%s%s", (int)len, path, len ? "/" : "", command) < 0) {
+            fatal_error_errno("asprintf failed");
+        }
+        struct stat sb;
+        if (stat(candidate, &sb) == 0 && S_ISREG(sb.st_mode) && access(candidate, X_OK) == 0) {
+            return candidate;
+        }
+        free(candidate);
+        if (path[len] == '\0') {
+            return NULL;
+        }
+        path += len + 1;
+    }
+}
+
+static int parse_long(const char* str, long min, long max, long* out) {
+    char* end = NULL;
+    errno = 0;
+    const long n = strtol(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || errno != 0 || n < min || n > max) {
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+/****
+ * JOB RUNNER
+ *
+ * `sst --jobs <n> --manifest <file> [--output-dir <dir>] option1 ... optionN`
+ * runs every command of a manifest under one policy, <n> at a time. The
+ * ruleset is built once, up front, and each job is then a spawn_sandboxed()
+ * that only calls landlock_restrict_self() and execve(). There are no
+ * per-worker queues to balance: whenever a job exits, its slot takes the
+ * next command of the manifest, so a slow job never holds up the ones
+ * behind it.
+ *
+ * The manifest (<file>, or - for stdin) has one command per line, split
+ * into words at blanks. '...' and "..." quote, and a backslash escapes the
+ * next character (inside "..." only before " and \). Empty lines and lines
+ * starting with # are skipped. There is no shell; write sh -c '...' for one.
+ *
+ * Jobs are numbered from 1 in manifest order and get /dev/null as stdin.
+ * With --output-dir, job <i> writes to <dir>/<i>.out and <dir>/<i>.err;
+ * otherwise its output goes to our stdout and stderr a line at a time,
+ * prefixed with "[<i>] ". When all jobs are done, a JSON line per job (wall
+ * time, CPU time, max RSS, how it exited) and one with the totals go to
+ * stderr.
+ ****/
+
+#define JOBS_MAX_WORKERS 4096
+// A line longer than this is passed on in pieces.
+#define JOBS_MAX_LINE (64 * 1024)
+
+typedef struct sjob_stream {
+    int fd;
+    char* pending;
+    size_t pending_len;
+} job_stream;
+
+typedef struct sjob {
+    char* command;
+    char** argv;
+    pid_t pid;
+    int done;
+    int wait_status;
+    __u64 start_ns;
+    __u64 end_ns;
+    struct rusage ru;
+    // stdout and stderr, when prefixing.
+    job_stream streams[2];
+} job;
+
+// Splits `line` into words in place (see above). Returns NULL on an
+// unterminated quote.
+static char** jobs_split_words(char* line) {
+    size_t word_count = 0;
+    size_t word_capacity = 8;
+    char** words = malloc(sizeof(char*) * word_capacity);
+    if (!words) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+
+    char* in = line;
+    char* out = line;
+    for (;;) {
+        while (*in == ' ' || *in == '\t') {
+            in++;
+        }
+        if (!*in) {
+            break;
+        }
+        if (word_count + 2 > word_capacity) {
+            word_capacity *= 2;
+            words = realloc(words, sizeof(char*) * word_capacity);
+            if (!words) {
+                fatal_error_errno("realloc(...) failed.");
+            }
+        }
+        words[word_count++] = out;
+
+        char quote = 0;
+        while (*in && (quote || (*in != ' ' && *in != '\t'))) {
+            const char c = *in++;
+            if (quote == '\'') {
+                if (c == '\'') {
+                    quote = 0;
+                } else {
+                    *out++ = c;
+                }
+            } else if (c == '\\' && *in && (!quote || *in == '"' || *in == '\\')) {
+                *out++ = *in++;
+            } else if (c == '"') {
+                quote = quote ? 0 : '"';
+            } else if (c == '\'' && !quote) {
+                quote = '\'';
+            } else {
+                *out++ = c;
+            }
+        }
+        if (quote) {
+            free(words);
+            return NULL;
+        }
+        // `out` never gets ahead of `in`, so this can't clobber the next
+        // word.
+        if (*in) {
+            in++;
+        }
+        *out++ = '\0';
+    }
+    words[word_count] = NULL;
+    return words;
+}
+
+static job* jobs_read_manifest(const char* path, size_t* count_out) {
+    FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "re");
+    if (!f) {
+        fatal_error_errno("--jobs: cannot open manifest '%s'", path);
+    }
+
+    job* jobs = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    char* line = NULL;
+    size_t line_size = 0;
+    size_t line_no = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_size, f)) >= 0) {
+        line_no++;
+        if (len > 0 && line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        const char* first = line + strspn(line, " \t");
+        if (*first == '\0' || *first == '#') {
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            const size_t realloc_sz = sizeof(job) * capacity;
+            jobs = realloc(jobs, realloc_sz);
+            if (!jobs) {
+                fatal_error_errno("realloc(..., %zu) failed.", realloc_sz);
+            }
+        }
+        job* j = &jobs[count];
+        memset(j, 0, sizeof(*j));
+        // The words are split out of a copy; `command` stays as written.
+        j->command = strdup(first);
+        char* words = strdup(first);
+        if (!j->command || !words) {
+            fatal_error_errno("strdup failed");
+        }
+        j->argv = jobs_split_words(words);
+        if (!j->argv) {
+            fatal_error("--jobs: %s:%zu: unterminated quote", path, line_no);
+        }
+        j->streams[0].fd = -1;
+        j->streams[1].fd = -1;
+        count++;
+    }
+    if (ferror(f)) {
+        fatal_error_errno("--jobs: cannot read manifest '%s'", path);
+    }
+    free(line);
+    if (f != stdin) {
+        fclose(f);
+    }
+
+    *count_out = count;
+    return jobs;
+}
+
+// Writes out the complete lines of `stream` with the job's prefix. With
+// `eof`, the rest too.
+static void jobs_relay(job_stream* stream, size_t index, int out_fd, int eof) {
+    char prefix[32];
+    const int prefix_len = snprintf(prefix, sizeof(prefix), "[%zu] ", index + 1);
+
+    char* p = stream->pending;
+    char* const end = p + stream->pending_len;
+    while (p < end) {
+        char* nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl && !eof && stream->pending_len < JOBS_MAX_LINE) {
+            break;
+        }
+        const size_t len = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+        // One write per line, so that lines of different jobs don't mix.
+        char* out = malloc((size_t)prefix_len + len + 1);
+        if (!out) {
+            fatal_error_errno("malloc(...) failed.");
+        }
+        memcpy(out, prefix, (size_t)prefix_len);
+        memcpy(out + prefix_len, p, len);
+        size_t out_len = (size_t)prefix_len + len;
+        if (!nl) {
+            out[out_len++] = '\n';
+        }
+        write_full(out_fd, out, out_len);
+        free(out);
+        p += len;
+    }
+    stream->pending_len = (size_t)(end - p);
+    memmove(stream->pending, p, stream->pending_len);
+}
+
+// Reads what there is on the stream; returns 0 once it's at EOF (and then
+// closed).
+static int jobs_read_stream(job_stream* stream, size_t index, int out_fd) {
+    if (!stream->pending) {
+        stream->pending = malloc(JOBS_MAX_LINE);
+        if (!stream->pending) {
+            fatal_error_errno("malloc(%d) failed.", JOBS_MAX_LINE);
+        }
+    }
+    for (;;) {
+        const ssize_t got = read(stream->fd, stream->pending + stream->pending_len,
+                                 JOBS_MAX_LINE - stream->pending_len);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                return 1;
+            }
+        }
+        if (got <= 0) {
+            jobs_relay(stream, index, out_fd, 1);
+            close(stream->fd);
+            stream->fd = -1;
+            free(stream->pending);
+            stream->pending = NULL;
+            return 0;
+        }
+        stream->pending_len += (size_t)got;
+        jobs_relay(stream, index, out_fd, 0);
+    }
+}
+
+static int jobs_open_output(const char* dir, size_t index, const char* suffix) {
+    char* path = NULL;
+    if (asprintf(&path, "%s/%zu.%s", dir, index + 1, suffix) < 0) {
+        fatal_error_errno("asprintf failed");
+    }
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fatal_error_errno("--jobs: cannot create '%s'", path);
+    }
+    free(path);
+    return fd;
+}
+
+// Starts job `index`. A job that can't be started counts as exited with 127,
+// like a shell would have it.
+static void jobs_start(job* jobs, size_t index, const sst_ruleset* ruleset, int devnull,
+                       const char* output_dir, const sigset_t* child_mask) {
+    job* j = &jobs[index];
+    int stdio[3] = { devnull, -1, -1 };
+    if (output_dir) {
+        stdio[1] = jobs_open_output(output_dir, index, "out");
+        stdio[2] = jobs_open_output(output_dir, index, "err");
+    } else {
+        for (int s = 0; s < 2; s++) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                fatal_error_errno("pipe2 failed");
+            }
+            fcntl(fds[0], F_SETFL, O_NONBLOCK);
+            j->streams[s].fd = fds[0];
+            stdio[1 + s] = fds[1];
+        }
+    }
+
+    char* found = path_search(j->argv[0]);
+    const char* path = found ? found : j->argv[0];
+    j->start_ns = timing_now();
+    if (!found && !strchr(j->argv[0], '/')) {
+        fprintf(stderr, "sst: error: job %zu: '%s' not found on $PATH\n", index + 1, j->argv[0]);
+        j->done = 1;
+    } else if (spawn_sandboxed(&j->pid, path, ruleset, j->argv, environ, stdio, child_mask) != 0) {
+        fprintf(stderr, "sst: error: job %zu: %s\n", index + 1, sst_error());
+        j->done = 1;
+    }
+    if (j->done) {
+        j->end_ns = j->start_ns;
+        j->wait_status = 127 << 8;
+    }
+    free(found);
+
+    close(stdio[1]);
+    close(stdio[2]);
+}
+
+static void jobs_write_summary(const job* jobs, size_t count, int workers, __u64 wall_ns) {
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&buf, &size);
+    if (!out) {
+        fatal_error_errno("open_memstream failed");
+    }
+
+    size_t failed = 0;
+    double user_ms = 0.0, sys_ms = 0.0;
+    long max_rss_kb = 0;
+    for (size_t i = 0; i < count; i++) {
+        const job* j = &jobs[i];
+        const double u = j->ru.ru_utime.tv_sec * 1000.0 + j->ru.ru_utime.tv_usec / 1000.0;
+        const double s = j->ru.ru_stime.tv_sec * 1000.0 + j->ru.ru_stime.tv_usec / 1000.0;
+        fprintf(out, "{\"sst_job\":%zu,\"command\":", i + 1);
+        timing_json_string(out, j->command);
+        if (WIFSIGNALED(j->wait_status)) {
+            fprintf(out, ",\"signal\":%d", WTERMSIG(j->wait_status));
+        } else {
+            fprintf(out, ",\"exit\":%d", WEXITSTATUS(j->wait_status));
+        }
+        fprintf(out, ",\"wall_ms\":%.3f,\"user_ms\":%.3f,\"sys_ms\":%.3f,\"maxrss_kb\":%ld}\n",
+                (j->end_ns - j->start_ns) / 1e6, u, s, j->ru.ru_maxrss);
+        failed += j->wait_status != 0;
+        user_ms += u;
+        sys_ms += s;
+        if (j->ru.ru_maxrss > max_rss_kb) {
+            max_rss_kb = j->ru.ru_maxrss;
+        }
+    }
+    fprintf(out, "{\"sst_jobs\":%zu,\"failed\":%zu,\"workers\":%d,\"wall_ms\":%.3f,\"user_ms\":%.3f,"
+            "\"sys_ms\":%.3f,\"maxrss_kb\":%ld}\n",
+            count, failed, workers, wall_ns / 1e6, user_ms, sys_ms, max_rss_kb);
+
+    if (fclose(out) != 0) {
+        fatal_error_errno("open_memstream failed");
+    }
+    write_full(2, buf, size);
+    free(buf);
+}
+
+// sst --jobs <n> --manifest <file> [--output-dir <dir>] option1 ... optionN
+static int jobs_main(int argc, char **argv) {
+    const char* usage = "usage: sst --jobs <n> --manifest <file> [--output-dir <dir>] option1 ... optionN";
+    if (argc < 5) {
+        fatal_error("%s", usage);
+    }
+    char* endptr = NULL;
+    const long n = strtol(argv[2], &endptr, 10);
+    if (*argv[2] == '\0' || *endptr != '\0' || n < 0 || n > JOBS_MAX_WORKERS) {
+        fatal_error("--jobs: invalid number of jobs '%s' (0-%d, 0 = one per CPU)", argv[2], JOBS_MAX_WORKERS);
+    }
+    int workers = (int)n;
+    if (workers == 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int)cpus : 1;
+    }
+
+    const char* manifest = NULL;
+    const char* output_dir = NULL;
+    int first_option = 3;
+    while (first_option + 1 < argc) {
+        if (strcmp(argv[first_option], "--manifest") == 0) {
+            manifest = argv[first_option + 1];
+        } else if (strcmp(argv[first_option], "--output-dir") == 0) {
+            output_dir = argv[first_option + 1];
+        } else {
+            break;
+        }
+        first_option += 2;
+    }
+    if (!manifest) {
+        fatal_error("%s", usage);
+    }
+
+    sst_policy* pol = sst_policy_new();
+    if (!pol) {
+        fatal_error_errno("out of memory");
+    }
+    if (sst_policy_add_options(pol, (const char* const*)&argv[first_option], (size_t)(argc - first_option)) != 0) {
+        fatal_error("%s", sst_error());
+    }
+
+    size_t count;
+    job* jobs = jobs_read_manifest(manifest, &count);
+
+    // Once, for every job.
+    sst_ruleset* ruleset = sst_ruleset_new(pol);
+        print_deferred_warnings();
+    if (!ruleset) {
+        fatal_error("%s", sst_error());
+    }
+    print_deferred_warnings();
+
+    const int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (devnull < 0) {
+        fatal_error_errno("cannot open /dev/null");
+    }
+
+    sigset_t mask, child_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, &child_mask) != 0) {
+        fatal_error_errno("sigprocmask failed");
+    }
+    const int sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig_fd < 0) {
+        fatal_error_errno("signalfd failed");
+    }
+
+    // A job's output can outlive it (in its own children), so this is not
+    // bounded by `workers`.
+    struct pollfd* pfds = calloc(count * 2 + 1, sizeof(struct pollfd));
+    size_t* pfd_jobs = calloc(count * 2 + 1, sizeof(size_t));
+    if (!pfds || !pfd_jobs) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+
+    const __u64 start_ns = timing_now();
+    size_t next = 0;
+    size_t running = 0;
+    // Jobs started, in order, whose process or output isn't finished yet.
+    size_t oldest_live = 0;
+    for (;;) {
+        while (running < (size_t)workers && next < count) {
+            jobs_start(jobs, next, ruleset, devnull, output_dir, &child_mask);
+            running += !jobs[next].done;
+            next++;
+        }
+        while (oldest_live < next && jobs[oldest_live].done &&
+               jobs[oldest_live].streams[0].fd < 0 && jobs[oldest_live].streams[1].fd < 0) {
+            oldest_live++;
+        }
+        if (oldest_live == count) {
+            break;
+        }
+
+        nfds_t nfds = 0;
+        pfds[nfds++] = (struct pollfd){ .fd = sig_fd, .events = POLLIN };
+        for (size_t i = oldest_live; i < next; i++) {
+            for (int s = 0; s < 2; s++) {
+                if (jobs[i].streams[s].fd >= 0) {
+                    pfd_jobs[nfds] = i * 2 + (size_t)s;
+                    pfds[nfds++] = (struct pollfd){ .fd = jobs[i].streams[s].fd, .events = POLLIN };
+                }
+            }
+        }
+        if (poll(pfds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal_error_errno("poll failed");
+        }
+
+        for (nfds_t p = 1; p < nfds; p++) {
+            if (pfds[p].revents) {
+                const size_t i = pfd_jobs[p] / 2;
+                const int s = (int)(pfd_jobs[p] % 2);
+                jobs_read_stream(&jobs[i].streams[s], i, 1 + s);
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+            }
+            int status;
+            struct rusage ru;
+            pid_t pid;
+            while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+                for (size_t i = oldest_live; i < next; i++) {
+                    if (jobs[i].pid == pid && !jobs[i].done) {
+                        jobs[i].done = 1;
+                        jobs[i].end_ns = timing_now();
+                        jobs[i].wait_status = status;
+                        jobs[i].ru = ru;
+                        running--;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    jobs_write_summary(jobs, count, workers, timing_now() - start_ns);
+
+    for (size_t i = 0; i < count; i++) {
+        if (jobs[i].wait_status != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/****
+ * SUPERVISOR
+ *
+ * `sst --supervise=<fd> option1 ... -- command` keeps `sst` around instead
+ * of exec()ing into the command: it fork()s, the child sandboxes itself and
+ * exec()s the command as usual, and `sst` waits for it with wait4() and
+ * writes one line of JSON about the run to <fd>: exit status, wall time, the
+ * time until the command was exec()ed, CPU time, max RSS, page faults and
+ * context switches. `sst` itself is not sandboxed, and exits the way the
+ * command did.
+ *
+ * Signals sent to `sst` are passed on to the command as soon as poll()
+ * wakes up, through a pidfd if the kernel has them. The ones a terminal
+ * sends already go to the command (it is in our process group), so those
+ * are not sent twice.
+ *
+ * With --restart (which works without --supervise too), `sst` forks again
+ * when the command exits, and SIGHUP forks a new one and SIGTERMs the old
+ * one(s) once it has exec()ed: a rolling restart, which together with
+ * LISTEN_TCP: sockets held open by `sst` doesn't refuse any connections.
+ ****/
+
+#define SUPERVISE_MAX_CHILDREN 16
+// A command that was up for less than this and died is restarted after a
+// delay, doubled each time it happens again.
+#define SUPERVISE_STABLE_MS 1000
+#define SUPERVISE_MIN_DELAY_MS 100
+#define SUPERVISE_MAX_DELAY_MS 5000
+
+static const int SUPERVISE_FORWARDED_SIGNALS[] = {
+    SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2, SIGALRM, SIGWINCH, SIGCONT,
+};
+
+static int supervise_parse_fd(const char* spec) {
+    char* end = NULL;
+    errno = 0;
+    const long fd = strtol(spec, &end, 10);
+    if (*spec == '\0' || *end != '\0' || errno != 0 || fd < 0 || fd > INT_MAX) {
+        fatal_error("--supervise: expected <fd>, got '%s'", spec);
+    }
+    if (fcntl((int)fd, F_GETFD) < 0) {
+        fatal_error("--supervise: file descriptor %d is not open", (int)fd);
+    }
+    return (int)fd;
+}
+
+// --restart=always|on-failure[,max=<n>]
+typedef struct ssupervise_restart {
+    int enabled;
+    int on_failure;
+    // How many times at most; -1 for no limit.
+    long max;
+} supervise_restart;
+
+static void supervise_parse_restart(const char* spec, supervise_restart* restart) {
+    const size_t len = strcspn(spec, ",");
+    if (len == 6 && strncmp(spec, "always", 6) == 0) {
+        restart->on_failure = 0;
+    } else if (len == 10 && strncmp(spec, "on-failure", 10) == 0) {
+        restart->on_failure = 1;
+    } else {
+        fatal_error("--restart: expected always or on-failure, got '%.*s'", (int)len, spec);
+    }
+    restart->enabled = 1;
+    restart->max = -1;
+    if (spec[len] == '\0') {
+        return;
+    }
+    const char* max = spec + len + 1;
+    if (strncmp(max, "max=", 4) != 0 || parse_long(max + 4, 0, INT_MAX, &restart->max) != 0) {
+        fatal_error("--restart: expected max=<n>, got '%s'", max);
+    }
+}
+
+static int supervise_pidfd_open(pid_t pid) {
+#ifdef __NR_pidfd_open
+    return (int)syscall(__NR_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void supervise_forward(pid_t pid, int pidfd, int sig) {
+#ifdef __NR_pidfd_send_signal
+    if (pidfd >= 0 && syscall(__NR_pidfd_send_signal, pidfd, sig, NULL, 0) == 0) {
+        return;
+    }
+#else
+    (void)pidfd;
+#endif
+    // Only we reap the child, so its pid can't have been reused yet.
+    kill(pid, sig);
+}
+
+// `run` is which run of the command this was, with --restart; 0 without.
+static void supervise_report(int report_fd, pid_t pid, char* const* command_args, int status,
+                             const struct rusage* ru, __u64 exec_ns, __u64 wall_ns, int run) {
+    if (report_fd < 0) {
+        return;
+    }
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&buf, &size);
+    if (!out) {
+        fatal_error_errno("open_memstream failed");
+    }
+
+    fprintf(out, "{\"sst_supervise\":1,\"pid\":%ld,", (long)pid);
+    if (run > 0) {
+        fprintf(out, "\"run\":%d,", run);
+    }
+    fprintf(out, "\"command\":[");
+    for (size_t i = 0; command_args[i]; i++) {
+        if (i) {
+            fputc(',', out);
+        }
+        timing_json_string(out, command_args[i]);
+    }
+    fputc(']', out);
+    if (WIFSIGNALED(status)) {
+        fprintf(out, ",\"signal\":%d,\"core_dumped\":%s", WTERMSIG(status), WCOREDUMP(status) ? "true" : "false");
+    } else {
+        fprintf(out, ",\"exit\":%d", WEXITSTATUS(status));
+    }
+    fprintf(out, ",\"wall_us\":%.3f,\"exec_us\":%.3f,\"user_us\":%ld,\"sys_us\":%ld,\"maxrss_kb\":%ld,"
+            "\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}\n",
+            wall_ns / 1000.0, exec_ns / 1000.0,
+            (long)ru->ru_utime.tv_sec * 1000000 + (long)ru->ru_utime.tv_usec,
+            (long)ru->ru_stime.tv_sec * 1000000 + (long)ru->ru_stime.tv_usec,
+            ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw);
+
+    if (fclose(out) != 0) {
+        fatal_error_errno("open_memstream failed");
+    }
+    if (write_full(report_fd, buf, size) != 0) {
+        fprintf(stderr, "sst: warning: --supervise: cannot write to file descriptor %d: %s\n",
+                report_fd, strerror(errno));
+    }
+    free(buf);
+}
+
+typedef struct ssupervise_child {
+    pid_t pid;
+    int pidfd;
+    // Closes when the child exec()s (or exits).
+    int exec_fd;
+    __u64 start_ns;
+    __u64 exec_ns;
+    int run;
+    // Replaced by a newer child: gets SIGTERM once that one has exec()ed,
+    // and its exit doesn't start another.
+    int retire_pending;
+    int retiring;
+} supervise_child;
+
+// Forks. Returns 0 in the child, which goes on to sandbox itself and exec
+// the command, and the pid in the parent.
+static pid_t supervise_fork(supervise_child* child, int report_fd, const sigset_t* old_mask) {
+    int exec_pipe[2];
+    if (pipe2(exec_pipe, O_CLOEXEC) != 0) {
+        fatal_error_errno("pipe2 failed");
+    }
+    const __u64 start_ns = timing_now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        fatal_error_errno("fork failed");
+    }
+    if (pid == 0) {
+        close(exec_pipe[0]);
+        if (report_fd > 2) {
+            close(report_fd);
+        }
+        sigprocmask(SIG_SETMASK, old_mask, NULL);
+        return 0;
+    }
+    close(exec_pipe[1]);
+    *child = (supervise_child){
+        .pid = pid,
+        .pidfd = supervise_pidfd_open(pid),
+        .exec_fd = exec_pipe[0],
+        .start_ns = start_ns,
+    };
+    return pid;
+}
+
+static int supervise_failed(int status) {
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+// Forks. Returns in the child, which goes on to sandbox itself and exec the
+// command; the parent supervises it and exits with its status. With
+// `restart`, it starts the command again as that says.
+static void supervise_command(int report_fd, const supervise_restart* restart, char* const* command_args) {
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    for (size_t i = 0; i < sizeof(SUPERVISE_FORWARDED_SIGNALS) / sizeof(SUPERVISE_FORWARDED_SIGNALS[0]); i++) {
+        sigaddset(&mask, SUPERVISE_FORWARDED_SIGNALS[i]);
+    }
+    sigaddset(&mask, SIGCHLD);
+    // Before the fork, so that nothing sent in between is lost.
+    if (sigprocmask(SIG_BLOCK, &mask, &old_mask) != 0) {
+        fatal_error_errno("sigprocmask failed");
+    }
+
+    supervise_child children[SUPERVISE_MAX_CHILDREN];
+    size_t child_count = 0;
+    int runs = 1;
+    if (supervise_fork(&children[child_count++], report_fd, &old_mask) == 0) {
+        return;
+    }
+    children[0].run = runs;
+
+    const int sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig_fd < 0) {
+        fatal_error_errno("signalfd failed");
+    }
+
+    int stopping = 0;
+    int status = 0;
+    // When to start the command again after it exited; 0 if not.
+    __u64 restart_at_ns = 0;
+    __u64 delay_ms = 0;
+    for (;;) {
+        if (child_count == 0 && restart_at_ns == 0) {
+            break;
+        }
+
+        struct pollfd pfds[1 + SUPERVISE_MAX_CHILDREN];
+        pfds[0] = (struct pollfd){ .fd = sig_fd, .events = POLLIN };
+        for (size_t i = 0; i < child_count; i++) {
+            pfds[1 + i] = (struct pollfd){ .fd = children[i].exec_fd, .events = POLLIN };
+        }
+        int timeout_ms = -1;
+        if (restart_at_ns) {
+            const __u64 now_ns = timing_now();
+            timeout_ms = restart_at_ns > now_ns ? (int)((restart_at_ns - now_ns + 999999) / 1000000) : 0;
+        }
+        if (poll(pfds, 1 + child_count, timeout_ms) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal_error_errno("poll failed");
+        }
+
+        int spawn = restart_at_ns && timing_now() >= restart_at_ns;
+
+        for (size_t i = 0; i < child_count; i++) {
+            if (children[i].exec_fd < 0 || !pfds[1 + i].revents) {
+                continue;
+            }
+            children[i].exec_ns = timing_now() - children[i].start_ns;
+            close(children[i].exec_fd);
+            children[i].exec_fd = -1;
+            // The new one is up (or dead, which the reaping below tells):
+            // now the ones it replaces can go.
+            for (size_t j = 0; j < i; j++) {
+                if (children[j].retire_pending) {
+                    children[j].retire_pending = 0;
+                    children[j].retiring = 1;
+                    supervise_forward(children[j].pid, children[j].pidfd, SIGTERM);
+                }
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+                const int sig = (int)si.ssi_signo;
+                if (sig == SIGCHLD) {
+                    continue;
+                }
+                const int from_kernel = si.ssi_code == SI_KERNEL;
+                if (restart->enabled && sig == SIGHUP && !from_kernel && !stopping) {
+                    // A rolling restart: the old children keep serving until
+                    // the new one has exec()ed.
+                    if (child_count == SUPERVISE_MAX_CHILDREN) {
+                        fprintf(stderr, "sst: warning: --restart: too many children, ignoring SIGHUP\n");
+                        continue;
+                    }
+                    for (size_t i = 0; i < child_count; i++) {
+                        if (!children[i].retiring) {
+                            children[i].retire_pending = 1;
+                        }
+                    }
+                    spawn = 1;
+                    continue;
+                }
+                if (sig == SIGTERM || sig == SIGINT || sig == SIGQUIT || sig == SIGHUP) {
+                    stopping = 1;
+                    restart_at_ns = 0;
+                    spawn = 0;
+                }
+                if (from_kernel) {
+                    continue;
+                }
+                for (size_t i = 0; i < child_count; i++) {
+                    if (!children[i].retiring) {
+                        supervise_forward(children[i].pid, children[i].pidfd, sig);
+                    }
+                }
+            }
+        }
+
+        for (;;) {
+            int child_status;
+            struct rusage ru;
+            const pid_t got = wait4(-1, &child_status, WNOHANG, &ru);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0 && errno != ECHILD) {
+                fatal_error_errno("wait4 failed");
+            }
+            if (got <= 0) {
+                break;
+            }
+            size_t index = 0;
+            while (index < child_count && children[index].pid != got) {
+                index++;
+            }
+            if (index == child_count) {
+                continue;
+            }
+            supervise_child child = children[index];
+            memmove(&children[index], &children[index + 1], sizeof(supervise_child) * (child_count - index - 1));
+            child_count--;
+
+            const __u64 wall_ns = timing_now() - child.start_ns;
+            if (child.exec_fd >= 0) {
+                child.exec_ns = wall_ns;
+                close(child.exec_fd);
+            }
+            if (child.pidfd >= 0) {
+                close(child.pidfd);
+            }
+            supervise_report(report_fd, child.pid, command_args, child_status, &ru, child.exec_ns, wall_ns,
+                             restart->enabled ? child.run : 0);
+            if (child.retiring) {
+                continue;
+            }
+            status = child_status;
+
+            if (child.exec_fd >= 0) {
+                // A replacement that never got to exec: keep the old ones.
+                int kept = 0;
+                for (size_t i = 0; i < child_count; i++) {
+                    if (children[i].retire_pending) {
+                        children[i].retire_pending = 0;
+                        kept = 1;
+                    }
+                }
+                if (kept) {
+                    fprintf(stderr, "sst: warning: --restart: the new command failed to start\n");
+                    continue;
+                }
+            }
+            if (child_count > 0 || stopping || !restart->enabled ||
+                (restart->on_failure && !supervise_failed(child_status)) ||
+                (restart->max >= 0 && runs > restart->max)) {
+                continue;
+            }
+            // Right away if it had been up for a while; if it keeps dying
+            // young, back off.
+            if (wall_ns >= SUPERVISE_STABLE_MS * 1000000ULL) {
+                delay_ms = 0;
+            } else {
+                delay_ms = delay_ms ? delay_ms * 2 : SUPERVISE_MIN_DELAY_MS;
+                if (delay_ms > SUPERVISE_MAX_DELAY_MS) {
+                    delay_ms = SUPERVISE_MAX_DELAY_MS;
+                }
+            }
+            restart_at_ns = timing_now() + delay_ms * 1000000ULL;
+            spawn = delay_ms == 0;
+        }
+
+        if (spawn && !stopping) {
+            restart_at_ns = 0;
+            runs++;
+            if (supervise_fork(&children[child_count], report_fd, &old_mask) == 0) {
+                close(sig_fd);
+                for (size_t i = 0; i < child_count; i++) {
+                    if (children[i].pidfd >= 0) {
+                        close(children[i].pidfd);
+                    }
+                }
+                return;
+            }
+            children[child_count++].run = runs;
+        }
+    }
+
+    if (WIFEXITED(status)) {
+        exit(WEXITSTATUS(status));
+    }
+    if (WIFSIGNALED(status)) {
+        exit(128 + WTERMSIG(status));
+    }
+    exit(1);
+}
+
+/****
+ * PLACEMENT
+ *
+ * CPU_AFFINITY:, NUMA_MEMBIND:, SCHED_POLICY:, NICE: and IOPRIO: set where
+ * and how the command runs, so it doesn't need numactl, taskset or ionice
+ * (and their exec()s) in front of it. They go among the sandboxing options
+ * but aren't part of the policy: main() takes them out and checks them
+ * before it parses anything else, and applies them just before exec.
+ *
+ * What can be checked up front is: syntax and ranges, that some of the CPUs
+ * are ours to use, and that the NUMA nodes exist. Permission errors (e.g.
+ * SCHED_POLICY:fifo without CAP_SYS_NICE) only show when they're applied.
+ ****/
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+
+#define PLACEMENT_MAX_CPUS 8192
+#define PLACEMENT_MAX_NODES 1024
+
+typedef struct splacement {
+    // NULL if not given.
+    cpu_set_t* cpus;
+    unsigned long* nodes;
+    int has_sched;
+    int sched_policy;
+    int sched_priority;
+    int has_nice;
+    int nice;
+    int has_ioprio;
+    int ioprio;
+} placement;
+
+static const char* const PLACEMENT_PREFIXES[] = {
+    "CPU_AFFINITY:", "NUMA_MEMBIND:", "SCHED_POLICY:", "NICE:", "IOPRIO:",
+};
+
+static int is_placement_option(const char* arg) {
+    for (size_t i = 0; i < sizeof(PLACEMENT_PREFIXES) / sizeof(PLACEMENT_PREFIXES[0]); i++) {
+        if (strncmp(arg, PLACEMENT_PREFIXES[i], strlen(PLACEMENT_PREFIXES[i])) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parses "<id>[-<id>][,...]" (like ALLOW_*_TCP_PORTS) into the bitmap
+// `bits` of `max_id + 1` bits. Returns -1 if malformed.
+static int parse_id_list(const char* str, long max_id, unsigned long* bits) {
+    const char* p = str;
+    do {
+        const size_t len = strcspn(p, ",");
+        char item[32];
+        if (len == 0 || len >= sizeof(item)) {
+            return -1;
+        }
+        memcpy(item, p, len);
+        item[len] = '\0';
+
+        long first, last;
+        char* dash = strchr(item, '-');
+        if (dash) {
+            *dash = '\0';
+            if (parse_long(item, 0, max_id, &first) != 0 || parse_long(dash + 1, 0, max_id, &last) != 0 ||
+                first > last) {
+                return -1;
+            }
+        } else {
+            if (parse_long(item, 0, max_id, &first) != 0) {
+                return -1;
+            }
+            last = first;
+        }
+        for (long id = first; id <= last; id++) {
+            bits[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+        }
+
+        p += len;
+    } while (*p++ == ',');
+    return 0;
+}
+
+static void placement_parse_cpus(placement* pl, const char* list) {
+    if (!pl->cpus) {
+        pl->cpus = CPU_ALLOC(PLACEMENT_MAX_CPUS);
+        if (!pl->cpus) {
+            fatal_error_errno("CPU_ALLOC failed");
+        }
+        CPU_ZERO_S(CPU_ALLOC_SIZE(PLACEMENT_MAX_CPUS), pl->cpus);
+    }
+    if (parse_id_list(list, PLACEMENT_MAX_CPUS - 1, (unsigned long*)pl->cpus) != 0) {
+        fatal_error("CPU_AFFINITY: invalid CPU list '%s' (e.g. 0-7,16)", list);
+    }
+
+    // Affinity outside of what we may use (cgroup cpusets, an outer
+    // taskset) is ignored by the kernel; all of it is an error.
+    const size_t size = CPU_ALLOC_SIZE(PLACEMENT_MAX_CPUS);
+    cpu_set_t* allowed = CPU_ALLOC(PLACEMENT_MAX_CPUS);
+    if (!allowed) {
+        fatal_error_errno("CPU_ALLOC failed");
+    }
+    if (sched_getaffinity(0, size, allowed) == 0) {
+        CPU_AND_S(size, allowed, allowed, pl->cpus);
+        if (CPU_COUNT_S(size, allowed) == 0) {
+            fatal_error("CPU_AFFINITY: none of the CPUs in '%s' are available to this process", list);
+        }
+    }
+    CPU_FREE(allowed);
+}
+
+static void placement_parse_nodes(placement* pl, const char* list) {
+    const size_t words = PLACEMENT_MAX_NODES / (8 * sizeof(unsigned long));
+    if (!pl->nodes) {
+        pl->nodes = calloc(words, sizeof(unsigned long));
+        if (!pl->nodes) {
+            fatal_error_errno("calloc(...) failed.");
+        }
+    }
+    unsigned long* nodes = calloc(words, sizeof(unsigned long));
+    if (!nodes) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    if (parse_id_list(list, PLACEMENT_MAX_NODES - 1, nodes) != 0) {
+        fatal_error("NUMA_MEMBIND: invalid node list '%s' (e.g. 0 or 0-1)", list);
+    }
+    for (long node = 0; node < PLACEMENT_MAX_NODES; node++) {
+        if (!(nodes[node / (8 * sizeof(unsigned long))] & (1UL << (node % (8 * sizeof(unsigned long)))))) {
+            continue;
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld", node);
+        struct stat sb;
+        if (stat(path, &sb) == 0) {
+            continue;
+        }
+        // Without NUMA, there's only node 0 and no sysfs for it.
+        if (node == 0 && stat("/sys/devices/system/node", &sb) != 0) {
+            continue;
+        }
+        fatal_error("NUMA_MEMBIND: there is no NUMA node %ld", node);
+    }
+    for (size_t w = 0; w < words; w++) {
+        pl->nodes[w] |= nodes[w];
+    }
+    free(nodes);
+}
+
+static void placement_parse_sched(placement* pl, const char* spec) {
+    static const struct {
+        const char* name;
+        int policy;
+    } policies[] = {
+        { "other", SCHED_OTHER },
+        { "batch", SCHED_BATCH },
+        { "idle", SCHED_IDLE },
+        { "fifo", SCHED_FIFO },
+        { "rr", SCHED_RR },
+    };
+    const size_t name_len = strcspn(spec, ":");
+    int policy = -1;
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strlen(policies[i].name) == name_len && strncmp(spec, policies[i].name, name_len) == 0) {
+            policy = policies[i].policy;
+        }
+    }
+    if (policy < 0) {
+        fatal_error("SCHED_POLICY: unknown policy in '%s' (other, batch, idle, fifo:<prio> or rr:<prio>)", spec);
+    }
+
+    const int min = sched_get_priority_min(policy);
+    const int max = sched_get_priority_max(policy);
+    long priority = 0;
+    if (spec[name_len] == ':') {
+        if (parse_long(spec + name_len + 1, min, max, &priority) != 0) {
+            fatal_error("SCHED_POLICY: invalid priority in '%s' (%d-%d)", spec, min, max);
+        }
+    } else if (min > 0) {
+        fatal_error("SCHED_POLICY: '%s' needs a priority (%d-%d), e.g. %s:%d", spec, min, max, spec, min);
+    }
+    pl->has_sched = 1;
+    pl->sched_policy = policy;
+    pl->sched_priority = (int)priority;
+}
+
+static void placement_parse_ioprio(placement* pl, const char* spec) {
+    const size_t name_len = strcspn(spec, ":");
+    int ioclass;
+    if (name_len == 2 && strncmp(spec, "rt", 2) == 0) {
+        ioclass = IOPRIO_CLASS_RT;
+    } else if (name_len == 2 && strncmp(spec, "be", 2) == 0) {
+        ioclass = IOPRIO_CLASS_BE;
+    } else if (name_len == 4 && strncmp(spec, "idle", 4) == 0) {
+        ioclass = IOPRIO_CLASS_IDLE;
+    } else {
+        fatal_error("IOPRIO: unknown class in '%s' (rt[:<level>], be[:<level>] or idle)", spec);
+    }
+
+    // Level 4 is what the kernel gives a best-effort process by default.
+    long level = 4;
+    if (spec[name_len] == ':') {
+        if (ioclass == IOPRIO_CLASS_IDLE || parse_long(spec + name_len + 1, 0, 7, &level) != 0) {
+            fatal_error("IOPRIO: invalid level in '%s' (0-7, none for idle)", spec);
+        }
+    } else if (ioclass == IOPRIO_CLASS_IDLE) {
+        level = 0;
+    }
+    pl->has_ioprio = 1;
+    pl->ioprio = (ioclass << IOPRIO_CLASS_SHIFT) | (int)level;
+}
+
+// If `arg` is a placement option, checks it and records it in `pl`.
+// Returns 0 if it isn't one.
+static int placement_parse(placement* pl, const char* arg) {
+    if (strncmp(arg, "CPU_AFFINITY:", 13) == 0) {
+        placement_parse_cpus(pl, arg + 13);
+    } else if (strncmp(arg, "NUMA_MEMBIND:", 13) == 0) {
+        placement_parse_nodes(pl, arg + 13);
+    } else if (strncmp(arg, "SCHED_POLICY:", 13) == 0) {
+        placement_parse_sched(pl, arg + 13);
+    } else if (strncmp(arg, "NICE:", 5) == 0) {
+        long nice;
+        if (parse_long(arg + 5, -20, 19, &nice) != 0) {
+            fatal_error("NICE: invalid nice value '%s' (-20-19)", arg + 5);
+        }
+        pl->has_nice = 1;
+        pl->nice = (int)nice;
+    } else if (strncmp(arg, "IOPRIO:", 7) == 0) {
+        placement_parse_ioprio(pl, arg + 7);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// All of these survive execve().
+static void placement_apply(const placement* pl) {
+    if (pl->nodes &&
+        syscall(__NR_set_mempolicy, MPOL_BIND, pl->nodes, (unsigned long)PLACEMENT_MAX_NODES + 1) != 0) {
+        fatal_error_errno("NUMA_MEMBIND: set_mempolicy failed");
+    }
+    if (pl->cpus && sched_setaffinity(0, CPU_ALLOC_SIZE(PLACEMENT_MAX_CPUS), pl->cpus) != 0) {
+        fatal_error_errno("CPU_AFFINITY: sched_setaffinity failed");
+    }
+    if (pl->has_ioprio && syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0, pl->ioprio) != 0) {
+        fatal_error_errno("IOPRIO: ioprio_set failed");
+    }
+    if (pl->has_nice && setpriority(PRIO_PROCESS, 0, pl->nice) != 0) {
+        fatal_error_errno("NICE: setpriority failed");
+    }
+    // Last, so that nothing above runs with a real-time priority.
+    if (pl->has_sched) {
+        const struct sched_param param = { .sched_priority = pl->sched_priority };
+        if (sched_setscheduler(0, pl->sched_policy, &param) != 0) {
+            fatal_error_errno("SCHED_POLICY: sched_setscheduler failed");
+        }
+    }
+}
+
+/****
+ * ELF DEPENDENCIES
+ *
+ * What the dynamic loader will open to run an executable, worked out the
+ * way ld.so does it: the PT_INTERP interpreter, then DT_NEEDED
+ * breadth-first, each looked up in the object's DT_RPATH (if it has no
+ * DT_RUNPATH), $LD_LIBRARY_PATH, its DT_RUNPATH, /etc/ld.so.cache and
+ * the default directories. $ORIGIN is expanded; other $ tokens are not, and
+ * dlopen()ed libraries can't be known.
+ *
+ * A candidate only counts if it is an ELF file of the executable's class and
+ * machine, like the loader requires. Objects are deduplicated by inode.
+ ****/
+
+#if __SIZEOF_POINTER__ == 8
+typedef Elf64_Ehdr elf_ehdr;
+typedef Elf64_Phdr elf_phdr;
+typedef Elf64_Dyn elf_dyn;
+#define ELF_NATIVE_CLASS ELFCLASS64
+#else
+typedef Elf32_Ehdr elf_ehdr;
+typedef Elf32_Phdr elf_phdr;
+typedef Elf32_Dyn elf_dyn;
+#define ELF_NATIVE_CLASS ELFCLASS32
+#endif
+
+#define ELF_MAX_OBJECTS 4096
+
+typedef struct self_name {
+    char* name;
+    size_t object;
+} elf_name;
+
+typedef struct self_deps {
+    // malloc()ed paths as found; [0] is the executable.
+    char** paths;
+    inode_id* ids;
+    __u64* sizes;
+    size_t count;
+    size_t capacity;
+    int machine;
+
+    // Open addressing hash of inode -> index + 1.
+    size_t* id_slots;
+    size_t id_mask;
+    // Open addressing hash of DT_NEEDED name -> object index. Like the
+    // loader, a name that was found once isn't looked for again.
+    elf_name* names;
+    size_t name_mask;
+    size_t name_count;
+
+    // If set, the directories where a library was looked for and not found
+    // (malloc()ed, possibly ones that don't exist) go to `missed_dirs`:
+    // a file showing up there would change the result. `uncacheable` is set
+    // if a search went through a relative directory.
+    int track_dirs;
+    char** missed_dirs;
+    size_t missed_dir_count;
+    size_t missed_dir_capacity;
+    int used_ldcache;
+    int uncacheable;
+} elf_deps;
+
+#define LDCACHE_OLD_MAGIC "ld.so-1.7.0"
+#define LDCACHE_NEW_MAGIC "glibc-ld.so.cache1.1"
+
+typedef struct sldcache_entry {
+    __s32 flags;
+    __u32 key;
+    __u32 value;
+    __u32 osversion;
+    __u64 hwcap;
+} ldcache_entry;
+
+typedef struct sldcache {
+    const char* base;
+    size_t size;
+    // Where the new format starts; string offsets are relative to it.
+    size_t new_off;
+    __u32 entry_count;
+    // Open addressing hash of key -> index + 1 of the first entry with
+    // that key (the entries are sorted by key).
+    __u32* slots;
+    size_t slot_mask;
+} ldcache;
+
+static int elf_read_ehdr(int fd, elf_ehdr* eh) {
+    if (pread(fd, eh, sizeof(*eh), 0) != (ssize_t)sizeof(*eh)) {
+        return -1;
+    }
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELF_NATIVE_CLASS) {
+        return -1;
+    }
+    return 0;
+}
+
+// Is `path` a loadable object for `machine`?
+static int elf_usable(const char* path, int machine) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    elf_ehdr eh;
+    const int ok = elf_read_ehdr(fd, &eh) == 0 && eh.e_machine == machine;
+    close(fd);
+    return ok;
+}
+
+static const char* ldcache_string(const ldcache* cache, __u32 offset) {
+    const size_t off = cache->new_off + offset;
+    if (off >= cache->size || !memchr(cache->base + off, '\0', cache->size - off)) {
+        return NULL;
+    }
+    return cache->base + off;
+}
+
+static const ldcache* ldcache_get(void) {
+    static ldcache cache;
+    static int loaded = 0;
+    if (loaded) {
+        return cache.base ? &cache : NULL;
+    }
+    loaded = 1;
+
+    const int fd = open("/etc/ld.so.cache", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < 48) {
+        close(fd);
+        return NULL;
+    }
+    const char* base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    const size_t size = (size_t)sb.st_size;
+
+    size_t new_off = 0;
+    if (memcmp(base, LDCACHE_OLD_MAGIC, strlen(LDCACHE_OLD_MAGIC)) == 0) {
+        // The old format (16-byte header, 12-byte entries) may come first,
+        // with the new one after it, 8-byte aligned.
+        __u32 old_count;
+        memcpy(&old_count, base + 12, sizeof(old_count));
+        new_off = (16 + (size_t)old_count * 12 + 7) & ~(size_t)7;
+    }
+    if (new_off + 48 > size || memcmp(base + new_off, LDCACHE_NEW_MAGIC, strlen(LDCACHE_NEW_MAGIC)) != 0) {
+        munmap((void*)base, size);
+        return NULL;
+    }
+    __u32 entry_count;
+    memcpy(&entry_count, base + new_off + 20, sizeof(entry_count));
+    if (entry_count > (size - new_off - 48) / sizeof(ldcache_entry)) {
+        munmap((void*)base, size);
+        return NULL;
+    }
+
+    cache.base = base;
+    cache.size = size;
+    cache.new_off = new_off;
+    cache.entry_count = entry_count;
+
+    // A lookup per DT_NEEDED adds up with hundreds of libraries; index the
+    // keys once instead of scanning every entry every time.
+    size_t slot_count = 64;
+    while (slot_count < (size_t)entry_count * 2) {
+        slot_count *= 2;
+    }
+    cache.slots = calloc(slot_count, sizeof(__u32));
+    if (!cache.slots) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    cache.slot_mask = slot_count - 1;
+    const ldcache_entry* entries = (const ldcache_entry*)(base + new_off + 48);
+    const char* prev = NULL;
+    for (__u32 i = 0; i < entry_count; i++) {
+        ldcache_entry e;
+        memcpy(&e, &entries[i], sizeof(e));
+        const char* key = ldcache_string(&cache, e.key);
+        if (!key || (prev && strcmp(prev, key) == 0)) {
+            continue;
+        }
+        prev = key;
+        size_t slot = fnv1a_hash(key, strlen(key)) & cache.slot_mask;
+        while (cache.slots[slot]) {
+            slot = (slot + 1) & cache.slot_mask;
+        }
+        cache.slots[slot] = i + 1;
+    }
+    return &cache;
+}
+
+
+// The path of the first usable `soname` in ld.so.cache, malloc()ed.
+static char* ldcache_lookup(const char* soname, int machine) {
+    const ldcache* cache = ldcache_get();
+    if (!cache) {
+        return NULL;
+    }
+    const ldcache_entry* entries = (const ldcache_entry*)(cache->base + cache->new_off + 48);
+    size_t slot = fnv1a_hash(soname, strlen(soname)) & cache->slot_mask;
+    __u32 first = 0;
+    for (; cache->slots[slot]; slot = (slot + 1) & cache->slot_mask) {
+        ldcache_entry e;
+        memcpy(&e, &entries[cache->slots[slot] - 1], sizeof(e));
+        const char* key = ldcache_string(cache, e.key);
+        if (key && strcmp(key, soname) == 0) {
+            first = cache->slots[slot];
+            break;
+        }
+    }
+    for (__u32 i = first ? first - 1 : cache->entry_count; i < cache->entry_count; i++) {
+        ldcache_entry e;
+        memcpy(&e, &entries[i], sizeof(e));
+        const char* key = ldcache_string(cache, e.key);
+        if (!key || strcmp(key, soname) != 0) {
+            break;
+        }
+        const char* value = ldcache_string(cache, e.value);
+        if (value && elf_usable(value, machine)) {
+            char* found = strdup(value);
+            if (!found) {
+                fatal_error_errno("strdup failed");
+            }
+            return found;
+        }
+    }
+    return NULL;
+}
+
+static void elf_deps_missed_dir(elf_deps* deps, const char* dir) {
+    if (dir[0] != '/') {
+        deps->uncacheable = 1;
+        return;
+    }
+    for (size_t i = 0; i < deps->missed_dir_count; i++) {
+        if (strcmp(deps->missed_dirs[i], dir) == 0) {
+            return;
+        }
+    }
+    if (deps->missed_dir_count == deps->missed_dir_capacity) {
+        deps->missed_dir_capacity = deps->missed_dir_capacity ? deps->missed_dir_capacity * 2 : 16;
+        deps->missed_dirs = realloc(deps->missed_dirs, sizeof(char*) * deps->missed_dir_capacity);
+        if (!deps->missed_dirs) {
+            fatal_error_errno("realloc(...) failed.");
+        }
+    }
+    deps->missed_dirs[deps->missed_dir_count] = strdup(dir);
+    if (!deps->missed_dirs[deps->missed_dir_count]) {
+        fatal_error_errno("strdup failed");
+    }
+    deps->missed_dir_count++;
+}
+
+// Looks for `soname` in the ':'-separated `dirs`, with $ORIGIN (and
+// ${ORIGIN}) being `origin`. Returns a malloc()ed path or NULL.
+static char* elf_search_dirs(elf_deps* deps, const char* dirs, const char* soname, const char* origin) {
+    const int machine = deps->machine;
+    if (!dirs) {
+        return NULL;
+    }
+    const char* p = dirs;
+    for (;;) {
+        const size_t len = strcspn(p, ":");
+        char* dir = strndup(p, len);
+        if (!dir) {
+            fatal_error_errno("strndup failed");
+        }
+        char* expanded = NULL;
+        const char* tail;
+        if ((tail = strncmp(dir, "$ORIGIN", 7) == 0 ? dir + 7 : strncmp(dir, "${ORIGIN}", 9) == 0 ? dir + 9 : NULL)) {
+            if (asprintf(&expanded, "%s%s", origin, tail) < 0) {
+                fatal_error_errno("asprintf failed");
+            }
+        }
+        const char* d = expanded ? expanded : dir;
+        char* candidate = NULL;
+        if (!strchr(d, '$')) {
+            // An empty entry means the current directory.
+            if (asprintf(&candidate, "%s%s%s", d, *d ? "/" : "", soname) < 0) {
+                fatal_error_errno("asprintf failed");
+            }
+            if (!elf_usable(candidate, machine)) {
+                free(candidate);
+                candidate = NULL;
+                if (deps->track_dirs) {
+                    elf_deps_missed_dir(deps, *d ? d : ".");
+                }
+            }
+        }
+        free(expanded);
+        free(dir);
+        if (candidate) {
+            return candidate;
+        }
+        if (p[len] == '\0') {
+            return NULL;
+        }
+        p += len + 1;
+    }
+}
+
+static char* elf_find_library(elf_deps* deps, const char* soname, const char* origin, const char* rpath,
+                              const char* runpath) {
+    if (strchr(soname, '/')) {
+        char* copy = strdup(soname);
+        if (!copy) {
+            fatal_error_errno("strdup failed");
+        }
+        return copy;
+    }
+    char* found = NULL;
+    if (!runpath) {
+        found = elf_search_dirs(deps, rpath, soname, origin);
+    }
+    if (!found) {
+        found = elf_search_dirs(deps, getenv("LD_LIBRARY_PATH"), soname, origin);
+    }
+    if (!found) {
+        found = elf_search_dirs(deps, runpath, soname, origin);
+    }
+    if (!found) {
+        deps->used_ldcache = 1;
+        found = ldcache_lookup(soname, deps->machine);
+    }
+    if (!found) {
+        found = elf_search_dirs(deps, __SIZEOF_POINTER__ == 8 ? "/lib64:/usr/lib64:/lib:/usr/lib" : "/lib:/usr/lib",
+                                soname, origin);
+    }
+    return found;
+}
+
+static size_t elf_id_slot(const elf_deps* deps, __u64 dev, __u64 ino) {
+    size_t slot = (size_t)((dev * 0x9e3779b97f4a7c15ULL) ^ (ino * 0xff51afd7ed558ccdULL)) & deps->id_mask;
+    while (deps->id_slots[slot]) {
+        const inode_id* id = &deps->ids[deps->id_slots[slot] - 1];
+        if (id->dev == dev && id->ino == ino) {
+            break;
+        }
+        slot = (slot + 1) & deps->id_mask;
+    }
+    return slot;
+}
+
+// The index of the object found for DT_NEEDED `name`, or SIZE_MAX.
+static size_t elf_deps_find_name(const elf_deps* deps, const char* name) {
+    if (!deps->names) {
+        return SIZE_MAX;
+    }
+    for (size_t slot = fnv1a_hash(name, strlen(name)) & deps->name_mask; deps->names[slot].name;
+         slot = (slot + 1) & deps->name_mask) {
+        if (strcmp(deps->names[slot].name, name) == 0) {
+            return deps->names[slot].object;
+        }
+    }
+    return SIZE_MAX;
+}
+
+static void elf_deps_add_name(elf_deps* deps, const char* name, size_t object) {
+    if (!deps->names || deps->name_count * 2 >= deps->name_mask) {
+        const size_t new_size = deps->names ? (deps->name_mask + 1) * 2 : 256;
+        elf_name* names = calloc(new_size, sizeof(elf_name));
+        if (!names) {
+            fatal_error_errno("calloc(...) failed.");
+        }
+        for (size_t i = 0; deps->names && i <= deps->name_mask; i++) {
+            if (!deps->names[i].name) {
+                continue;
+            }
+            size_t slot = fnv1a_hash(deps->names[i].name, strlen(deps->names[i].name)) & (new_size - 1);
+            while (names[slot].name) {
+                slot = (slot + 1) & (new_size - 1);
+            }
+            names[slot] = deps->names[i];
+        }
+        free(deps->names);
+        deps->names = names;
+        deps->name_mask = new_size - 1;
+    }
+    size_t slot = fnv1a_hash(name, strlen(name)) & deps->name_mask;
+    while (deps->names[slot].name) {
+        slot = (slot + 1) & deps->name_mask;
+    }
+    deps->names[slot].name = strdup(name);
+    if (!deps->names[slot].name) {
+        fatal_error_errno("strdup failed");
+    }
+    deps->names[slot].object = object;
+    deps->name_count++;
+}
+
+// Adds `path` (taking ownership) unless it's already there. Returns its
+// index, or SIZE_MAX if it can't be opened.
+static size_t elf_deps_add(elf_deps* deps, char* path) {
+    struct stat sb;
+    if (deps->count == ELF_MAX_OBJECTS || stat(path, &sb) != 0) {
+        free(path);
+        return SIZE_MAX;
+    }
+    if (!deps->id_slots) {
+        // ELF_MAX_OBJECTS fit at half load.
+        deps->id_mask = 2 * ELF_MAX_OBJECTS - 1;
+        deps->id_slots = calloc(deps->id_mask + 1, sizeof(size_t));
+        if (!deps->id_slots) {
+            fatal_error_errno("calloc(...) failed.");
+        }
+    }
+    const size_t slot = elf_id_slot(deps, (__u64)sb.st_dev, (__u64)sb.st_ino);
+    if (deps->id_slots[slot]) {
+        free(path);
+        return deps->id_slots[slot] - 1;
+    }
+    if (deps->count == deps->capacity) {
+        deps->capacity = deps->capacity ? deps->capacity * 2 : 32;
+        deps->paths = realloc(deps->paths, sizeof(char*) * deps->capacity);
+        deps->ids = realloc(deps->ids, sizeof(inode_id) * deps->capacity);
+        deps->sizes = realloc(deps->sizes, sizeof(__u64) * deps->capacity);
+        if (!deps->paths || !deps->ids || !deps->sizes) {
+            fatal_error_errno("realloc(...) failed.");
+        }
+    }
+    deps->paths[deps->count] = path;
+    deps->ids[deps->count] = (inode_id){ .dev = (__u64)sb.st_dev, .ino = (__u64)sb.st_ino };
+    deps->sizes[deps->count] = (__u64)sb.st_size;
+    deps->id_slots[slot] = ++deps->count;
+    return deps->count - 1;
+}
+
+// File offset of virtual address `vaddr`, through the PT_LOAD segments.
+static size_t elf_vaddr_offset(const elf_phdr* ph, size_t phnum, __u64 vaddr) {
+    for (size_t i = 0; i < phnum; i++) {
+        if (ph[i].p_type == PT_LOAD && vaddr >= ph[i].p_vaddr && vaddr - ph[i].p_vaddr < ph[i].p_filesz) {
+            return (size_t)(ph[i].p_offset + (vaddr - ph[i].p_vaddr));
+        }
+    }
+    return (size_t)-1;
+}
+
+// Adds what deps->paths[index] needs. Anything malformed is skipped: the
+// loader will complain about it, we only look.
+static void elf_scan(elf_deps* deps, size_t index) {
+    const char* path = deps->paths[index];
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat sb;
+    elf_ehdr eh;
+    if (fstat(fd, &sb) != 0 || elf_read_ehdr(fd, &eh) != 0 || (size_t)sb.st_size < sizeof(eh) ||
+        (index > 0 && eh.e_machine != deps->machine)) {
+        close(fd);
+        return;
+    }
+    if (index == 0) {
+        deps->machine = eh.e_machine;
+    }
+    const size_t size = (size_t)sb.st_size;
+    const char* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return;
+    }
+
+    const size_t phnum = eh.e_phnum;
+    if (eh.e_phentsize != sizeof(elf_phdr) || eh.e_phoff > size || phnum > (size - eh.e_phoff) / sizeof(elf_phdr)) {
+        munmap((void*)base, size);
+        return;
+    }
+    elf_phdr* ph = malloc(sizeof(elf_phdr) * (phnum ? phnum : 1));
+    if (!ph) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    memcpy(ph, base + eh.e_phoff, sizeof(elf_phdr) * phnum);
+
+    const elf_phdr* dynamic = NULL;
+    for (size_t i = 0; i < phnum; i++) {
+        if (ph[i].p_type == PT_INTERP && ph[i].p_offset < size && ph[i].p_filesz <= size - ph[i].p_offset &&
+            ph[i].p_filesz > 0 && memchr(base + ph[i].p_offset, '\0', ph[i].p_filesz)) {
+            char* interp = strdup(base + ph[i].p_offset);
+            if (!interp) {
+                fatal_error_errno("strdup failed");
+            }
+            elf_deps_add(deps, interp);
+        } else if (ph[i].p_type == PT_DYNAMIC) {
+            dynamic = &ph[i];
+        }
+    }
+
+    if (dynamic && dynamic->p_offset < size && dynamic->p_filesz <= size - dynamic->p_offset) {
+        const size_t dyn_count = dynamic->p_filesz / sizeof(elf_dyn);
+        elf_dyn* dyn = malloc(sizeof(elf_dyn) * (dyn_count ? dyn_count : 1));
+        if (!dyn) {
+            fatal_error_errno("malloc(...) failed.");
+        }
+        memcpy(dyn, base + dynamic->p_offset, sizeof(elf_dyn) * dyn_count);
+
+        __u64 strtab_vaddr = 0;
+        __u64 strsz = 0;
+        long rpath = -1, runpath = -1;
+        for (size_t i = 0; i < dyn_count && dyn[i].d_tag != DT_NULL; i++) {
+            if (dyn[i].d_tag == DT_STRTAB) {
+                strtab_vaddr = dyn[i].d_un.d_ptr;
+            } else if (dyn[i].d_tag == DT_STRSZ) {
+                strsz = dyn[i].d_un.d_val;
+            } else if (dyn[i].d_tag == DT_RPATH) {
+                rpath = (long)dyn[i].d_un.d_val;
+            } else if (dyn[i].d_tag == DT_RUNPATH) {
+                runpath = (long)dyn[i].d_un.d_val;
+            }
+        }
+        const size_t strtab = elf_vaddr_offset(ph, phnum, strtab_vaddr);
+        if (strtab < size && strsz <= size - strtab) {
+            const char* strings = base + strtab;
+#define ELF_STRING(off) ((__u64)(off) < strsz && memchr(strings + (off), '\0', strsz - (off)) ? strings + (off) : NULL)
+            // $ORIGIN is the directory the object is in.
+            char* origin = strdup(path);
+            if (!origin) {
+                fatal_error_errno("strdup failed");
+            }
+            char* slash = strrchr(origin, '/');
+            if (slash) {
+                *slash = slash == origin ? (slash[1] = '\0', '/') : '\0';
+            } else {
+                strcpy(origin, ".");
+            }
+            const char* rpath_str = rpath >= 0 ? ELF_STRING(rpath) : NULL;
+            const char* runpath_str = runpath >= 0 ? ELF_STRING(runpath) : NULL;
+            for (size_t i = 0; i < dyn_count && dyn[i].d_tag != DT_NULL; i++) {
+                const char* needed = dyn[i].d_tag == DT_NEEDED ? ELF_STRING(dyn[i].d_un.d_val) : NULL;
+                if (!needed || elf_deps_find_name(deps, needed) != SIZE_MAX) {
+                    continue;
+                }
+                char* found = elf_find_library(deps, needed, origin, rpath_str, runpath_str);
+                const size_t object = found ? elf_deps_add(deps, found) : SIZE_MAX;
+                if (object != SIZE_MAX) {
+                    elf_deps_add_name(deps, needed, object);
+                }
+            }
+#undef ELF_STRING
+            free(origin);
+        }
+        free(dyn);
+    }
+
+    free(ph);
+    munmap((void*)base, size);
+}
+
+// Collects `executable` and everything it loads into `deps`.
+static void elf_collect(elf_deps* deps, const char* executable) {
+    char* copy = strdup(executable);
+    if (!copy) {
+        fatal_error_errno("strdup failed");
+    }
+    if (elf_deps_add(deps, copy) != 0) {
+        return;
+    }
+    // Breadth-first, like the loader's search order.
+    for (size_t i = 0; i < deps->count; i++) {
+        elf_scan(deps, i);
+    }
+}
+
+// The PT_INTERP of `path`, malloc()ed; NULL if it isn't a (native) ELF file
+// or has none.
+static char* elf_interpreter(const char* path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    char* interp = NULL;
+    elf_ehdr eh;
+    if (elf_read_ehdr(fd, &eh) == 0 && eh.e_phentsize == sizeof(elf_phdr)) {
+        for (size_t i = 0; i < eh.e_phnum && !interp; i++) {
+            elf_phdr ph;
+            if (pread(fd, &ph, sizeof(ph), (off_t)(eh.e_phoff + i * sizeof(ph))) != (ssize_t)sizeof(ph)) {
+                break;
+            }
+            if (ph.p_type != PT_INTERP || ph.p_filesz == 0 || ph.p_filesz > PATH_MAX) {
+                continue;
+            }
+            interp = calloc(1, (size_t)ph.p_filesz + 1);
+            if (!interp) {
+                fatal_error_errno("calloc(...) failed.");
+            }
+            if (pread(fd, interp, (size_t)ph.p_filesz, (off_t)ph.p_offset) != (ssize_t)ph.p_filesz || !interp[0]) {
+                free(interp);
+                interp = NULL;
+                break;
+            }
+        }
+    }
+    close(fd);
+    return interp;
+}
+
+// The #! interpreter of `path`, malloc()ed; NULL if it isn't a script (or
+// the interpreter isn't an absolute path).
+static char* shebang_interpreter(const char* path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    char line[256];
+    const ssize_t n = pread(fd, line, sizeof(line) - 1, 0);
+    close(fd);
+    if (n <= 2 || line[0] != '#' || line[1] != '!') {
+        return NULL;
+    }
+    line[n] = '\0';
+    char* start = line + 2;
+    start += strspn(start, " \t");
+    start[strcspn(start, " \t\n")] = '\0';
+    if (start[0] != '/') {
+        return NULL;
+    }
+    char* interp = strdup(start);
+    if (!interp) {
+        fatal_error_errno("strdup failed");
+    }
+    return interp;
+}
+
+static void elf_deps_free(elf_deps* deps) {
+    for (size_t i = 0; i < deps->count; i++) {
+        free(deps->paths[i]);
+    }
+    for (size_t i = 0; deps->names && i <= deps->name_mask; i++) {
+        free(deps->names[i].name);
+    }
+    for (size_t i = 0; i < deps->missed_dir_count; i++) {
+        free(deps->missed_dirs[i]);
+    }
+    free(deps->paths);
+    free(deps->ids);
+    free(deps->sizes);
+    free(deps->id_slots);
+    free(deps->names);
+    free(deps->missed_dirs);
+    memset(deps, 0, sizeof(*deps));
+}
+
+/****
+ * PREWARM
+ *
+ * PREWARM reads the command's executable, its ELF interpreter and the
+ * shared libraries it needs (see ELF DEPENDENCIES) into the page cache, and
+ * PREWARM:<path> does the same for a file, or every file under a directory.
+ * A cold start then doesn't fault them in a page at a time, one after the
+ * other. The work starts on a thread of its own right after parsing, so it
+ * overlaps building the ruleset; readahead() is issued from a pool of threads
+ * so the storage gets many requests at once. main() waits for it just before
+ * exec.
+ *
+ * It only reads, isn't part of the policy, and skips what it can't open.
+ ****/
+
+#define PREWARM_MAX_THREADS 16
+// Big files are split so that more than one thread can work on them.
+#define PREWARM_CHUNK_SIZE (8 << 20)
+#define PREWARM_MAX_DEPTH 64
+
+typedef struct sprewarm_chunk {
+    const char* path;
+    off_t offset;
+    size_t len;
+} prewarm_chunk;
+
+typedef struct sprewarm {
+    int command_deps;
+    const char** paths;
+    size_t path_count;
+
+    const char* command;
+    pthread_t thread;
+    int started;
+    __u64 start_ns;
+
+    // What the thread found; the chunks point into these.
+    elf_deps deps;
+    char** files;
+    size_t file_count;
+    size_t file_capacity;
+    prewarm_chunk* chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    size_t next;
+} prewarm;
+
+static int is_prewarm_option(const char* arg) {
+    return strcmp(arg, "PREWARM") == 0 || strncmp(arg, "PREWARM:", 8) == 0;
+}
+
+static int prewarm_parse(prewarm* pw, const char* arg) {
+    if (strcmp(arg, "PREWARM") == 0) {
+        pw->command_deps = 1;
+        return 1;
+    }
+    if (strncmp(arg, "PREWARM:", 8) != 0) {
+        return 0;
+    }
+    const char* path = arg + 8;
+    struct stat sb;
+    if (!path[0]) {
+        fatal_error("PREWARM: path is empty");
+    }
+    if (stat(path, &sb) != 0) {
+        fatal_error_errno("PREWARM: cannot stat '%s'", path);
+    }
+    pw->paths = realloc(pw->paths, sizeof(char*) * (pw->path_count + 1));
+    if (!pw->paths) {
+        fatal_error_errno("realloc(...) failed.");
+    }
+    pw->paths[pw->path_count++] = path;
+    return 1;
+}
+
+static void prewarm_add_chunks(prewarm* pw, const char* path, __u64 size) {
+    for (__u64 offset = 0; offset < size; offset += PREWARM_CHUNK_SIZE) {
+        if (pw->chunk_count == pw->chunk_capacity) {
+            pw->chunk_capacity = pw->chunk_capacity ? pw->chunk_capacity * 2 : 64;
+            pw->chunks = realloc(pw->chunks, sizeof(prewarm_chunk) * pw->chunk_capacity);
+            if (!pw->chunks) {
+                fatal_error_errno("realloc(...) failed.");
+            }
+        }
+        const __u64 left = size - offset;
+        pw->chunks[pw->chunk_count++] = (prewarm_chunk){
+            .path = path,
+            .offset = (off_t)offset,
+            .len = left < PREWARM_CHUNK_SIZE ? (size_t)left : PREWARM_CHUNK_SIZE,
+        };
+    }
+}
+
+// Takes ownership of `path`.
+static void prewarm_add_file(prewarm* pw, char* path, __u64 size) {
+    if (pw->file_count == pw->file_capacity) {
+        pw->file_capacity = pw->file_capacity ? pw->file_capacity * 2 : 64;
+        pw->files = realloc(pw->files, sizeof(char*) * pw->file_capacity);
+        if (!pw->files) {
+            fatal_error_errno("realloc(...) failed.");
+        }
+    }
+    pw->files[pw->file_count++] = path;
+    prewarm_add_chunks(pw, path, size);
+}
+
+// Adds `path`, or the regular files under it. Symlinks are followed at the
+// top only, like `find <path>`.
+static void prewarm_walk(prewarm* pw, const char* path, int depth) {
+    struct stat sb;
+    if ((depth == 0 ? stat(path, &sb) : lstat(path, &sb)) != 0) {
+        return;
+    }
+    if (S_ISREG(sb.st_mode)) {
+        char* copy = strdup(path);
+        if (!copy) {
+            fatal_error_errno("strdup failed");
+        }
+        prewarm_add_file(pw, copy, (__u64)sb.st_size);
+        return;
+    }
+    if (!S_ISDIR(sb.st_mode) || depth == PREWARM_MAX_DEPTH) {
+        return;
+    }
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(dir))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        char* child = NULL;
+        if (asprintf(&child, "%s/%s", path, de->d_name) < 0) {
+            fatal_error_errno("asprintf failed");
+        }
+        prewarm_walk(pw, child, depth + 1);
+        free(child);
+    }
+    closedir(dir);
+}
+
+static void* prewarm_worker(void* arg) {
+    prewarm* pw = arg;
+    for (;;) {
+        const size_t i = __atomic_fetch_add(&pw->next, 1, __ATOMIC_RELAXED);
+        if (i >= pw->chunk_count) {
+            return NULL;
+        }
+        const prewarm_chunk* chunk = &pw->chunks[i];
+        const int fd = open(chunk->path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        // readahead() doesn't work on everything (e.g. some FUSE
+        // filesystems); fadvise() is the portable way to ask for the same.
+        if (readahead(fd, chunk->offset, chunk->len) != 0) {
+            posix_fadvise(fd, chunk->offset, (off_t)chunk->len, POSIX_FADV_WILLNEED);
+        }
+        close(fd);
+    }
+}
+
+static void* prewarm_thread(void* arg) {
+    prewarm* pw = arg;
+    if (pw->command_deps) {
+        char* found = path_search(pw->command);
+        elf_collect(&pw->deps, found ? found : pw->command);
+        free(found);
+        for (size_t i = 0; i < pw->deps.count; i++) {
+            prewarm_add_chunks(pw, pw->deps.paths[i], pw->deps.sizes[i]);
+        }
+    }
+    for (size_t i = 0; i < pw->path_count; i++) {
+        prewarm_walk(pw, pw->paths[i], 0);
+    }
+
+    // This thread is one of the workers.
+    size_t threads = pw->chunk_count < PREWARM_MAX_THREADS ? pw->chunk_count : PREWARM_MAX_THREADS;
+    pthread_t tids[PREWARM_MAX_THREADS];
+    size_t started = 0;
+    for (size_t i = 1; i < threads; i++) {
+        if (pthread_create(&tids[started], NULL, prewarm_worker, pw) != 0) {
+            break;
+        }
+        started++;
+    }
+    prewarm_worker(pw);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    return NULL;
+}
+
+static void prewarm_start(prewarm* pw, const char* command) {
+    if (!pw->command_deps && pw->path_count == 0) {
+        return;
+    }
+    pw->command = command;
+    pw->start_ns = timing_start();
+    // If there's no thread to be had, the command starts cold; that's all.
+    pw->started = pthread_create(&pw->thread, NULL, prewarm_thread, pw) == 0;
+}
+
+static void prewarm_finish(prewarm* pw) {
+    if (pw->started) {
+        pthread_join(pw->thread, NULL);
+        // From the start, since it overlaps with the rest.
+        timing_end("prewarm", pw->start_ns);
+    }
+    elf_deps_free(&pw->deps);
+    for (size_t i = 0; i < pw->file_count; i++) {
+        free(pw->files[i]);
+    }
+    free(pw->files);
+    free(pw->chunks);
+    free(pw->paths);
+    memset(pw, 0, sizeof(*pw));
+}
+
+/****
+ * EXEC DEPS
+ *
+ * EXEC_DEPS:<path> allows running <path> and exactly what it loads: a
+ * FILE_EXEC rule for the executable, its ELF interpreter and every shared
+ * library found by ELF DEPENDENCIES (and the #! interpreters, for a script),
+ * plus FILE_READ:/etc/ld.so.cache if the loader will look there. Plain
+ * EXEC_DEPS does the same for the command after `--`.
+ *
+ * That walk opens every object and looks for every DT_NEEDED in a few
+ * directories, which adds up for a program with hundreds of libraries. So
+ * the result is cached in $SST_CACHE_DIR, $XDG_CACHE_HOME/sst or
+ * ~/.cache/sst (SST_CACHE_DIR= turns that off), in a file per executable
+ * named after its path, inode and mtime. A cached result is only used if
+ * every file in it still has the same inode, mtime and size, and so do the
+ * directories where a library was looked for and not found: a library
+ * showing up there would be found first.
+ *
+ * The cache file is the list of paths, native byte order:
+ *
+ *   exec_deps_cache_header
+ *   exec_deps_cache_entry * entry_count ([0] is the executable)
+ *   string table (NUL-terminated paths)
+ ****/
+
+#define EXEC_DEPS_CACHE_MAGIC "SSTDEPS1"
+#define EXEC_DEPS_CACHE_VERSION 1
+#define EXEC_DEPS_CACHE_MAX_SIZE (16 * 1024 * 1024)
+#define EXEC_DEPS_MAX_INTERPRETERS 4
+
+// Only has to be unchanged.
+#define EXEC_DEPS_CHECK 0
+#define EXEC_DEPS_EXEC  1
+#define EXEC_DEPS_READ  2
+
+typedef struct sexec_deps_cache_header {
+    char magic[8];
+    __u32 version;
+    __u32 entry_count;
+    __u32 strings_size;
+    // Offset of $LD_LIBRARY_PATH in the strings, or UINT32_MAX if it isn't
+    // set: the result depends on it.
+    __u32 library_path_offset;
+} exec_deps_cache_header;
+
+typedef struct sexec_deps_cache_entry {
+    // All 0 for a directory that didn't exist.
+    __u64 dev;
+    __u64 ino;
+    __s64 mtime_sec;
+    __s64 mtime_nsec;
+    __u64 size;
+    __u32 path_offset;
+    __u32 kind;
+} exec_deps_cache_entry;
+
+typedef struct sexec_deps_list {
+    const char** paths;
+    __u32* kinds;
+    size_t count;
+    size_t capacity;
+} exec_deps_list;
+
+static void exec_deps_list_add(exec_deps_list* list, const char* path, __u32 kind) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->paths = realloc(list->paths, sizeof(char*) * list->capacity);
+        list->kinds = realloc(list->kinds, sizeof(__u32) * list->capacity);
+        if (!list->paths || !list->kinds) {
+            fatal_error_errno("realloc(...) failed.");
+        }
+    }
+    list->paths[list->count] = path;
+    list->kinds[list->count] = kind;
+    list->count++;
+}
+
+static void exec_deps_stat(const char* path, exec_deps_cache_entry* e) {
+    struct stat sb;
+    if (stat(path, &sb) != 0) {
+        e->dev = e->ino = e->size = 0;
+        e->mtime_sec = e->mtime_nsec = 0;
+        return;
+    }
+    e->dev = (__u64)sb.st_dev;
+    e->ino = (__u64)sb.st_ino;
+    e->mtime_sec = (__s64)sb.st_mtim.tv_sec;
+    e->mtime_nsec = (__s64)sb.st_mtim.tv_nsec;
+    e->size = (__u64)sb.st_size;
+}
+
+// Where the cache file for `path` (which is `sb`) goes, malloc()ed; NULL if
+// there's no cache.
+static char* exec_deps_cache_path(const char* path, const struct stat* sb) {
+    const char* dir = getenv("SST_CACHE_DIR");
+    char* base = NULL;
+    if (dir) {
+        if (!dir[0]) {
+            return NULL;
+        }
+        base = strdup(dir);
+    } else if ((dir = getenv("XDG_CACHE_HOME")) && dir[0] == '/') {
+        if (asprintf(&base, "%s/sst", dir) < 0) {
+            base = NULL;
+        }
+    } else if ((dir = getenv("HOME")) && dir[0] == '/') {
+        if (asprintf(&base, "%s/.cache/sst", dir) < 0) {
+            base = NULL;
+        }
+    } else {
+        return NULL;
+    }
+    if (!base) {
+        fatal_error_errno("out of memory");
+    }
+
+    const char* library_path = getenv("LD_LIBRARY_PATH");
+    __u64 hash = fnv1a_hash(path, strlen(path) + 1);
+    hash ^= fnv1a_hash(library_path ? library_path : "", library_path ? strlen(library_path) + 1 : 0);
+    const __u64 id[4] = { (__u64)sb->st_dev, (__u64)sb->st_ino, (__u64)sb->st_mtim.tv_sec,
+                          (__u64)sb->st_mtim.tv_nsec };
+    hash = hash * 0x100000001b3ULL ^ fnv1a_hash((const char*)id, sizeof(id));
+    char* file = NULL;
+    if (asprintf(&file, "%s/exec-deps-%016llx", base, (unsigned long long)hash) < 0) {
+        fatal_error_errno("asprintf failed");
+    }
+    free(base);
+    return file;
+}
+
+// A cache file image that still holds for `path`, or NULL. Its size goes to
+// `size_out`.
+static char* exec_deps_cache_load(const char* cache_path, const char* path, size_t* size_out) {
+    const int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat sb;
+    char* buf = NULL;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || (size_t)sb.st_size < sizeof(exec_deps_cache_header) ||
+        sb.st_size > EXEC_DEPS_CACHE_MAX_SIZE || !(buf = malloc((size_t)sb.st_size)) ||
+        pread(fd, buf, (size_t)sb.st_size, 0) != sb.st_size) {
+        free(buf);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    const size_t size = (size_t)sb.st_size;
+
+    exec_deps_cache_header hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+    const size_t str_off = sizeof(hdr) + (size_t)hdr.entry_count * sizeof(exec_deps_cache_entry);
+    const char* strings = buf + str_off;
+    const char* library_path = getenv("LD_LIBRARY_PATH");
+    if (memcmp(hdr.magic, EXEC_DEPS_CACHE_MAGIC, sizeof(hdr.magic)) != 0 || hdr.version != EXEC_DEPS_CACHE_VERSION ||
+        hdr.entry_count == 0 || str_off + hdr.strings_size != size || hdr.strings_size == 0 ||
+        buf[size - 1] != '\0' ||
+        (hdr.library_path_offset == UINT32_MAX
+             ? library_path != NULL
+             : (hdr.library_path_offset >= hdr.strings_size || !library_path ||
+                strcmp(strings + hdr.library_path_offset, library_path) != 0))) {
+        free(buf);
+        return NULL;
+    }
+    const exec_deps_cache_entry* entries = (const exec_deps_cache_entry*)(buf + sizeof(hdr));
+    for (__u32 i = 0; i < hdr.entry_count; i++) {
+        exec_deps_cache_entry e;
+        memcpy(&e, &entries[i], sizeof(e));
+        if (e.path_offset >= hdr.strings_size || e.kind > EXEC_DEPS_READ ||
+            (i == 0 && strcmp(strings + e.path_offset, path) != 0)) {
+            free(buf);
+            return NULL;
+        }
+        exec_deps_cache_entry now;
+        exec_deps_stat(strings + e.path_offset, &now);
+        if (now.dev != e.dev || now.ino != e.ino || now.mtime_sec != e.mtime_sec || now.mtime_nsec != e.mtime_nsec ||
+            now.size != e.size) {
+            free(buf);
+            return NULL;
+        }
+    }
+    *size_out = size;
+    return buf;
+}
+
+// A cache file image of `list`; its size goes to `size_out`.
+static char* exec_deps_cache_image(const exec_deps_list* list, size_t* size_out) {
+    const char* library_path = getenv("LD_LIBRARY_PATH");
+    size_t strings_size = library_path ? strlen(library_path) + 1 : 0;
+    for (size_t i = 0; i < list->count; i++) {
+        strings_size += strlen(list->paths[i]) + 1;
+    }
+    if (list->count > UINT32_MAX || strings_size > UINT32_MAX) {
+        fatal_error("EXEC_DEPS: too many dependencies");
+    }
+    const size_t size = sizeof(exec_deps_cache_header) + list->count * sizeof(exec_deps_cache_entry) + strings_size;
+    char* buf = calloc(1, size);
+    if (!buf) {
+        fatal_error_errno("calloc(1, %zu) failed.", size);
+    }
+    exec_deps_cache_header* hdr = (exec_deps_cache_header*)buf;
+    exec_deps_cache_entry* entries = (exec_deps_cache_entry*)(hdr + 1);
+    char* strings = (char*)(entries + list->count);
+    memcpy(hdr->magic, EXEC_DEPS_CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = EXEC_DEPS_CACHE_VERSION;
+    hdr->entry_count = (__u32)list->count;
+    hdr->strings_size = (__u32)strings_size;
+    hdr->library_path_offset = UINT32_MAX;
+
+    size_t pos = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const size_t len = strlen(list->paths[i]);
+        memcpy(strings + pos, list->paths[i], len + 1);
+        exec_deps_stat(list->paths[i], &entries[i]);
+        entries[i].path_offset = (__u32)pos;
+        entries[i].kind = list->kinds[i];
+        pos += len + 1;
+    }
+    if (library_path) {
+        memcpy(strings + pos, library_path, strlen(library_path) + 1);
+        hdr->library_path_offset = (__u32)pos;
+    }
+    *size_out = size;
+    return buf;
+}
+
+// Best effort: a cache that can't be written is only slower.
+static void exec_deps_cache_store(const char* cache_path, const char* image, size_t size) {
+    // mkdir -p of the directory.
+    char* dir = strdup(cache_path);
+    if (!dir) {
+        fatal_error_errno("strdup failed");
+    }
+    *strrchr(dir, '/') = '\0';
+    for (char* p = dir + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(dir, 0700);
+            *p = '/';
+        }
+    }
+    mkdir(dir, 0700);
+    free(dir);
+
+    char* tmp_path = NULL;
+    if (asprintf(&tmp_path, "%s.XXXXXX", cache_path) < 0) {
+        fatal_error_errno("asprintf failed");
+    }
+    const int fd = mkostemp(tmp_path, O_CLOEXEC);
+    if (fd >= 0) {
+        const int ok = write_full(fd, image, size) == 0;
+        if (close(fd) != 0 || !ok || rename(tmp_path, cache_path) != 0) {
+            unlink(tmp_path);
+        }
+    }
+    free(tmp_path);
+}
+
+// Walks what running `path` loads.
+static char* exec_deps_walk(const char* path, size_t* size_out, int* cacheable) {
+    exec_deps_list list = {0};
+    char* scripts[EXEC_DEPS_MAX_INTERPRETERS + 1];
+    size_t script_count = 0;
+
+    // A script is run by its #! interpreter, which may be a script too.
+    const char* current = path;
+    char* next;
+    while (script_count < EXEC_DEPS_MAX_INTERPRETERS && (next = shebang_interpreter(current))) {
+        exec_deps_list_add(&list, current, EXEC_DEPS_EXEC);
+        scripts[script_count++] = next;
+        current = next;
+    }
+
+    elf_deps deps = {0};
+    deps.track_dirs = 1;
+    elf_collect(&deps, current);
+    if (deps.count == 0) {
+        fatal_error("EXEC_DEPS: cannot open '%s'", current);
+    }
+    for (size_t i = 0; i < deps.count; i++) {
+        exec_deps_list_add(&list, deps.paths[i], EXEC_DEPS_EXEC);
+    }
+    if (deps.used_ldcache) {
+        exec_deps_list_add(&list, "/etc/ld.so.cache", EXEC_DEPS_READ);
+    }
+    for (size_t i = 0; i < deps.missed_dir_count; i++) {
+        exec_deps_list_add(&list, deps.missed_dirs[i], EXEC_DEPS_CHECK);
+    }
+
+    char* image = exec_deps_cache_image(&list, size_out);
+    *cacheable = !deps.uncacheable;
+    elf_deps_free(&deps);
+    for (size_t i = 0; i < script_count; i++) {
+        free(scripts[i]);
+    }
+    free(list.paths);
+    free(list.kinds);
+    return image;
+}
+
+// Adds the rules for running `path`. If `search`, `path` is a command the
+// way execvpe() takes it.
+static void exec_deps_add_rules(policy* pol, const char* path, int search) {
+    char* found = search ? path_search(path) : NULL;
+    // The loader's $ORIGIN for the executable is where it really is.
+    char* real = realpath(found ? found : path, NULL);
+    if (!real) {
+        fatal_error_errno("EXEC_DEPS: cannot find '%s'", found ? found : path);
+    }
+    free(found);
+    path = real;
+    struct stat sb;
+    if (stat(path, &sb) != 0) {
+        fatal_error_errno("EXEC_DEPS: cannot stat '%s'", path);
+    }
+
+    char* cache_path = exec_deps_cache_path(path, &sb);
+    size_t size = 0;
+    char* image = cache_path ? exec_deps_cache_load(cache_path, path, &size) : NULL;
+    if (!image) {
+        int cacheable;
+        image = exec_deps_walk(path, &size, &cacheable);
+        if (cache_path && cacheable) {
+            exec_deps_cache_store(cache_path, image, size);
+        }
+    }
+    free(cache_path);
+    free(real);
+
+    // The rules point into the image.
+    policy_keep_buffer(pol, image, 0);
+    exec_deps_cache_header hdr;
+    memcpy(&hdr, image, sizeof(hdr));
+    const exec_deps_cache_entry* entries = (const exec_deps_cache_entry*)(image + sizeof(hdr));
+    const char* strings = (const char*)(entries + hdr.entry_count);
+    for (__u32 i = 0; i < hdr.entry_count; i++) {
+        exec_deps_cache_entry e;
+        memcpy(&e, &entries[i], sizeof(e));
+        if (e.kind == EXEC_DEPS_EXEC) {
+            push_fs_rule(pol, strings + e.path_offset, 0, READ_EXEC_ACCESS_FILELIKE);
+        } else if (e.kind == EXEC_DEPS_READ) {
+            push_fs_rule(pol, strings + e.path_offset, 0, READ_ACCESS_FILELIKE);
+        }
+    }
+}
+
+// sst --exec-deps <command>: the options EXEC_DEPS adds, one per line.
+static int exec_deps_main(int argc, char** argv) {
+    if (argc != 3) {
+        fatal_error("usage: sst --exec-deps <command>");
+    }
+    policy pol;
+    memset(&pol, 0, sizeof(pol));
+    exec_deps_add_rules(&pol, argv[2], 1);
+    for (size_t i = 0; i < pol.fs_rule_count; i++) {
+        printf("%s:%s\n", pol.fs_rules[i].access == READ_EXEC_ACCESS_FILELIKE ? "FILE_EXEC" : "FILE_READ",
+               pol.fs_rules[i].path);
+    }
+    if (fflush(stdout) != 0) {
+        fatal_error_errno("cannot write to stdout");
+    }
+    free_policy(&pol);
+    return 0;
+}
+
+/****
+ * LISTENING SOCKETS
+ *
+ * LISTEN_TCP:<addr>:<port> has `sst` bind and listen on a TCP socket before
+ * it sandboxes itself, and hand it to the command the way systemd's socket
+ * activation does: the sockets are file descriptors 3, 4, ... in the order
+ * given, and $LISTEN_FDS and $LISTEN_PID say so (sd_listen_fds() reads
+ * them). The command needs no ALLOW_INCOMING_TCP_PORT and may be denied
+ * binding altogether.
+ *
+ * Under --supervise or --restart the sockets stay open in `sst`, so they
+ * outlive the command: connections that come in while it restarts wait in
+ * the backlog instead of being refused.
+ *
+ * <addr> is an IPv4 address, an IPv6 one in brackets, or * for any IPv4
+ * address. Like placement, these aren't part of the policy; main() takes
+ * them out and binds right away, so a port in use fails before anything
+ * else.
+ ****/
+
+#define LISTEN_MAX_SOCKETS 64
+
+typedef struct slisten_sockets {
+    int fds[LISTEN_MAX_SOCKETS];
+    size_t count;
+} listen_sockets;
+
+static int is_listen_option(const char* arg) {
+    return strncmp(arg, "LISTEN_TCP:", 11) == 0;
+}
+
+static int listen_parse(listen_sockets* ls, const char* arg) {
+    if (!is_listen_option(arg)) {
+        return 0;
+    }
+    const char* spec = arg + 11;
+    const char* colon = strrchr(spec, ':');
+    long port;
+    if (!colon || parse_long(colon + 1, 1, 65535, &port) != 0) {
+        fatal_error("LISTEN_TCP: expected <addr>:<port>, got '%s'", spec);
+    }
+    char* host = strndup(spec, (size_t)(colon - spec));
+    if (!host) {
+        fatal_error_errno("strndup failed");
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    const size_t host_len = strlen(host);
+    if (host_len > 2 && host[0] == '[' && host[host_len - 1] == ']') {
+        struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&addr;
+        host[host_len - 1] = '\0';
+        if (inet_pton(AF_INET6, host + 1, &sin6->sin6_addr) != 1) {
+            fatal_error("LISTEN_TCP: invalid IPv6 address '%s'", host + 1);
+        }
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons((uint16_t)port);
+        addr_len = sizeof(*sin6);
+    } else {
+        struct sockaddr_in* sin = (struct sockaddr_in*)&addr;
+        if (strcmp(host, "*") == 0) {
+            sin->sin_addr.s_addr = htonl(INADDR_ANY);
+        } else if (inet_pton(AF_INET, host, &sin->sin_addr) != 1) {
+            fatal_error("LISTEN_TCP: invalid IPv4 address '%s' (IPv6 goes in brackets)", host);
+        }
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons((uint16_t)port);
+        addr_len = sizeof(*sin);
+    }
+    free(host);
+
+    if (ls->count == LISTEN_MAX_SOCKETS) {
+        fatal_error("LISTEN_TCP: too many sockets (at most %d)", LISTEN_MAX_SOCKETS);
+    }
+    const int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fatal_error_errno("LISTEN_TCP: socket failed for '%s'", spec);
+    }
+    const int one = 1;
+    // So that a restarted `sst` doesn't wait out TIME_WAIT.
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0) {
+        fatal_error_errno("LISTEN_TCP: setsockopt(SO_REUSEADDR) failed");
+    }
+    if (addr.ss_family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one)) != 0) {
+        fatal_error_errno("LISTEN_TCP: setsockopt(IPV6_V6ONLY) failed");
+    }
+    if (bind(fd, (struct sockaddr*)&addr, addr_len) != 0) {
+        fatal_error_errno("LISTEN_TCP: cannot bind '%s'", spec);
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        fatal_error_errno("LISTEN_TCP: cannot listen on '%s'", spec);
+    }
+    ls->fds[ls->count++] = fd;
+    return 1;
+}
+
+// Moves the sockets to 3, 4, ... (whatever is there is closed) and returns
+// `envp` with LISTEN_FDS and LISTEN_PID set for this process. Just before
+// exec.
+static char* const* listen_apply(const listen_sockets* ls, char* const* envp) {
+    if (ls->count == 0) {
+        return envp;
+    }
+    const int first = 3;
+    const int n = (int)ls->count;
+    // Out of the way first, as some may already sit where others go.
+    int moved[LISTEN_MAX_SOCKETS];
+    for (int i = 0; i < n; i++) {
+        moved[i] = fcntl(ls->fds[i], F_DUPFD_CLOEXEC, first + n);
+        if (moved[i] < 0) {
+            fatal_error_errno("LISTEN_TCP: fcntl(F_DUPFD) failed");
+        }
+        close(ls->fds[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        // The new descriptor doesn't have O_CLOEXEC.
+        if (dup2(moved[i], first + i) < 0) {
+            fatal_error_errno("LISTEN_TCP: dup2 failed");
+        }
+        close(moved[i]);
+    }
+
+    size_t env_count = 0;
+    while (envp[env_count]) {
+        env_count++;
+    }
+    char** env = malloc(sizeof(char*) * (env_count + 3));
+    if (!env) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    size_t out = 0;
+    for (size_t i = 0; i < env_count; i++) {
+        // The names too: they'd describe someone else's sockets.
+        if (strncmp(envp[i], "LISTEN_FDS=", 11) != 0 && strncmp(envp[i], "LISTEN_PID=", 11) != 0 &&
+            strncmp(envp[i], "LISTEN_FDNAMES=", 15) != 0) {
+            env[out++] = envp[i];
+        }
+    }
+    if (asprintf(&env[out++], "LISTEN_FDS=%d", n) < 0 ||
+        asprintf(&env[out++], "LISTEN_PID=%ld", (long)getpid()) < 0) {
+        fatal_error_errno("asprintf failed");
+    }
+    env[out] = NULL;
+    return env;
+}
+
+/****
+ * LEARNING MODE
+ *
+ * `sst --learn <output> -- command` runs the command without a sandbox,
+ * watches what it opens, executes, creates, removes, binds and connects to,
+ * and writes the options for a policy that allows just that to <output>,
+ * one per line.
+ *
+ * Tracing every system call with ptrace() makes a build crawl, so the
+ * command gets a seccomp filter that only sends the system calls Landlock
+ * cares about to us (SECCOMP_RET_TRACE) and lets everything else through
+ * without a stop. For those, we read the arguments at the seccomp stop and
+ * look at the result at syscall exit, and only what succeeded counts: the
+ * libraries the loader didn't find, say, don't end up in the policy.
+ *
+ * The policy is as tight as the options allow. Files get FILE_* rules. A
+ * directory that was listed, or had entries created or removed in it, can
+ * only be allowed with PATH_BENEATH_*. A directory where most entries were
+ * used (at least LEARN_GROUP_MIN_ENTRIES, and LEARN_GROUP_MIN_PERCENT of
+ * them, counting subdirectories that were grouped too) becomes one
+ * PATH_BENEATH_* rule instead of a rule per file. Rules that one on a
+ * parent directory already covers are left out, as with OPTIMIZE_RULES.
+ *
+ * It sees what this run does, no more: anything the command does only
+ * sometimes has to be in the run. System calls made through a 32-bit ABI
+ * aren't traced.
+ ****/
+
+#define LEARN_READ      (1U << 0)
+#define LEARN_WRITE     (1U << 1)
+#define LEARN_EXEC      (1U << 2)
+// Only for directories: listed, and entries created or removed in it.
+#define LEARN_LIST      (1U << 3)
+#define LEARN_DIR_WRITE (1U << 4)
+
+#define LEARN_GROUP_MIN_ENTRIES 8
+#define LEARN_GROUP_MIN_PERCENT 50
+// Paths one system call can add (rename(): both parents).
+#define LEARN_MAX_PENDING 2
+// #! interpreters of #! interpreters, like the kernel allows.
+#define LEARN_MAX_INTERPRETERS 4
+
+#if defined(__x86_64__)
+#define LEARN_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define LEARN_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#endif
+
+typedef struct slearn_path {
+    char* path;
+    __u32 kinds;
+} learn_path;
+
+typedef struct slearn_tracee {
+    pid_t tid;
+    // What the system call in progress adds if it succeeds.
+    learn_path pending[LEARN_MAX_PENDING];
+    size_t pending_count;
+    long port;
+    int port_incoming;
+} learn_tracee;
+
+typedef struct slearn {
+    // Open addressing hash of path -> kinds.
+    learn_path* paths;
+    size_t path_mask;
+    size_t path_count;
+
+    learn_tracee* tracees;
+    size_t tracee_count;
+    size_t tracee_capacity;
+
+    unsigned char incoming_ports[65536 / 8];
+    unsigned char outgoing_ports[65536 / 8];
+} learn;
+
+static void learn_add(learn* lr, char* path, __u32 kinds);
+
+static const int LEARN_SYSCALLS[] = {
+#ifdef __NR_open
+    __NR_open,
+#endif
+#ifdef __NR_creat
+    __NR_creat,
+#endif
+    __NR_openat,
+#ifdef __NR_openat2
+    __NR_openat2,
+#endif
+    __NR_execve,
+    __NR_execveat,
+#ifdef __NR_mkdir
+    __NR_mkdir,
+#endif
+    __NR_mkdirat,
+#ifdef __NR_mknod
+    __NR_mknod,
+#endif
+    __NR_mknodat,
+#ifdef __NR_rmdir
+    __NR_rmdir,
+#endif
+#ifdef __NR_unlink
+    __NR_unlink,
+#endif
+    __NR_unlinkat,
+#ifdef __NR_rename
+    __NR_rename,
+#endif
+#ifdef __NR_renameat
+    __NR_renameat,
+#endif
+    __NR_renameat2,
+#ifdef __NR_link
+    __NR_link,
+#endif
+    __NR_linkat,
+#ifdef __NR_symlink
+    __NR_symlink,
+#endif
+    __NR_symlinkat,
+    __NR_truncate,
+    __NR_bind,
+    __NR_connect,
+};
+
+#define LEARN_SYSCALL_COUNT (sizeof(LEARN_SYSCALLS) / sizeof(LEARN_SYSCALLS[0]))
+
+// In the child, just before exec: stop at the system calls above.
+static void learn_install_filter(void) {
+#ifdef LEARN_AUDIT_ARCH
+    struct sock_filter filter[4 + LEARN_SYSCALL_COUNT + 2];
+    size_t n = 0;
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+    filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, LEARN_AUDIT_ARCH, 1, 0);
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+    for (size_t i = 0; i < LEARN_SYSCALL_COUNT; i++) {
+        // To the SECCOMP_RET_TRACE at the end.
+        filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (__u32)LEARN_SYSCALLS[i],
+                                                   (__u8)(LEARN_SYSCALL_COUNT - i), 0);
+    }
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+    const struct sock_fprog prog = { .len = (unsigned short)n, .filter = filter };
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) != 0) {
+        fatal_error_errno("--learn: cannot install the seccomp filter");
+    }
+#endif
+}
+
+static learn_tracee* learn_tracee_get(learn* lr, pid_t tid, int* is_new) {
+    for (size_t i = 0; i < lr->tracee_count; i++) {
+        if (lr->tracees[i].tid == tid) {
+            *is_new = 0;
+            return &lr->tracees[i];
+        }
+    }
+    if (lr->tracee_count == lr->tracee_capacity) {
+        lr->tracee_capacity = lr->tracee_capacity ? lr->tracee_capacity * 2 : 16;
+        lr->tracees = realloc(lr->tracees, sizeof(learn_tracee) * lr->tracee_capacity);
+        if (!lr->tracees) {
+            fatal_error_errno("realloc(...) failed.");
+        }
+    }
+    learn_tracee* t = &lr->tracees[lr->tracee_count++];
+    memset(t, 0, sizeof(*t));
+    t->tid = tid;
+    t->port = -1;
+    *is_new = 1;
+    return t;
+}
+
+static void learn_tracee_clear(learn_tracee* t) {
+    for (size_t i = 0; i < t->pending_count; i++) {
+        free(t->pending[i].path);
+    }
+    t->pending_count = 0;
+    t->port = -1;
+}
+
+static void learn_tracee_forget(learn* lr, pid_t tid) {
+    for (size_t i = 0; i < lr->tracee_count; i++) {
+        if (lr->tracees[i].tid == tid) {
+            learn_tracee_clear(&lr->tracees[i]);
+            lr->tracees[i] = lr->tracees[--lr->tracee_count];
+            return;
+        }
+    }
+}
+
+// Reads a NUL-terminated string from the tracee. Returns a malloc()ed copy,
+// or NULL if it can't be read or is too long for a path.
+static char* learn_read_string(pid_t tid, unsigned long addr) {
+    char* buf = malloc(PATH_MAX);
+    if (!buf) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t got = 0;
+    while (got < PATH_MAX) {
+        // A page at a time: the next one may not be mapped.
+        size_t chunk = page - ((addr + got) & (page - 1));
+        if (chunk > PATH_MAX - got) {
+            chunk = PATH_MAX - got;
+        }
+        const struct iovec local = { .iov_base = buf + got, .iov_len = chunk };
+        const struct iovec remote = { .iov_base = (void*)(addr + got), .iov_len = chunk };
+        const ssize_t n = process_vm_readv(tid, &local, 1, &remote, 1, 0);
+        if (n <= 0) {
+            break;
+        }
+        const char* nul = memchr(buf + got, '\0', (size_t)n);
+        if (nul) {
+            return buf;
+        }
+        got += (size_t)n;
+    }
+    free(buf);
+    return NULL;
+}
+
+static char* learn_readlink(const char* link) {
+    char* buf = malloc(PATH_MAX);
+    if (!buf) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    const ssize_t len = readlink(link, buf, PATH_MAX - 1);
+    if (len <= 0) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+// The absolute path of `path` (in the tracee) relative to `dirfd`,
+// malloc()ed.
+static char* learn_path_at(pid_t tid, int dirfd, unsigned long path_addr) {
+    char* path = learn_read_string(tid, path_addr);
+    if (!path || path[0] == '/') {
+        return path;
+    }
+    char* link = NULL;
+    if ((dirfd == AT_FDCWD ? asprintf(&link, "/proc/%d/cwd", (int)tid)
+                           : asprintf(&link, "/proc/%d/fd/%d", (int)tid, dirfd)) < 0) {
+        fatal_error_errno("asprintf failed");
+    }
+    char* base = learn_readlink(link);
+    free(link);
+    char* joined = NULL;
+    if (base && base[0] == '/') {
+        if (asprintf(&joined, "%s%s%s", base, path[0] && strcmp(base, "/") != 0 ? "/" : "", path) < 0) {
+            fatal_error_errno("asprintf failed");
+        }
+    }
+    free(base);
+    free(path);
+    return joined;
+}
+
+static void learn_pend(learn_tracee* t, char* path, __u32 kinds) {
+    if (!path) {
+        return;
+    }
+    if (t->pending_count == LEARN_MAX_PENDING) {
+        free(path);
+        return;
+    }
+    t->pending[t->pending_count++] = (learn_path){ .path = path, .kinds = kinds };
+}
+
+// The directory `path` is in. Takes ownership of `path`.
+static char* learn_parent(char* path) {
+    if (!path) {
+        return NULL;
+    }
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    while (len > 0 && path[len - 1] != '/') {
+        len--;
+    }
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    path[len] = '\0';
+    return path;
+}
+
+static void learn_open(learn_tracee* t, int dirfd, unsigned long path_addr, __u64 flags) {
+    // Landlock doesn't check O_PATH opens.
+    if (flags & O_PATH) {
+        return;
+    }
+    char* path = learn_path_at(t->tid, dirfd, path_addr);
+    if (!path) {
+        return;
+    }
+    __u32 kinds = 0;
+    switch (flags & O_ACCMODE) {
+    case O_RDONLY:
+        kinds = LEARN_READ;
+        break;
+    case O_WRONLY:
+        kinds = LEARN_WRITE;
+        break;
+    default:
+        kinds = LEARN_READ | LEARN_WRITE;
+        break;
+    }
+    if (flags & O_TRUNC) {
+        kinds |= LEARN_WRITE;
+    }
+    struct stat sb;
+    if ((flags & O_CREAT) && lstat(path, &sb) != 0) {
+        char* parent = strdup(path);
+        if (!parent) {
+            fatal_error_errno("strdup failed");
+        }
+        learn_pend(t, learn_parent(parent), LEARN_DIR_WRITE);
+    }
+    learn_pend(t, path, kinds);
+}
+
+// Where `sockfd` is a TCP socket (or we can't tell), remembers the port of
+// `addr` for when bind() or connect() succeeds.
+static void learn_socket(learn_tracee* t, int sockfd, unsigned long addr, unsigned long addr_len, int incoming) {
+    struct sockaddr_storage ss;
+    memset(&ss, 0, sizeof(ss));
+    if (addr_len > sizeof(ss)) {
+        addr_len = sizeof(ss);
+    }
+    const struct iovec local = { .iov_base = &ss, .iov_len = addr_len };
+    const struct iovec remote = { .iov_base = (void*)addr, .iov_len = addr_len };
+    if (addr_len < sizeof(sa_family_t) || process_vm_readv(t->tid, &local, 1, &remote, 1, 0) != (ssize_t)addr_len) {
+        return;
+    }
+    long port;
+    if (ss.ss_family == AF_INET && addr_len >= sizeof(struct sockaddr_in)) {
+        port = ntohs(((struct sockaddr_in*)&ss)->sin_port);
+    } else if (ss.ss_family == AF_INET6 && addr_len >= sizeof(struct sockaddr_in6)) {
+        port = ntohs(((struct sockaddr_in6*)&ss)->sin6_port);
+    } else {
+        return;
+    }
+
+    // Landlock only has TCP rules: skip UDP and the like if we can get at
+    // the socket (pidfd_getfd() needs Linux 5.6 and a thread group leader).
+    char* status_path = NULL;
+    if (asprintf(&status_path, "/proc/%d/status", (int)t->tid) < 0) {
+        fatal_error_errno("asprintf failed");
+    }
+    FILE* f = fopen(status_path, "re");
+    free(status_path);
+    long tgid = -1;
+    if (f) {
+        char line[256];
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "Tgid: %ld", &tgid) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+#if defined(__NR_pidfd_open) && defined(__NR_pidfd_getfd)
+    const int pidfd = tgid > 0 ? (int)syscall(__NR_pidfd_open, (pid_t)tgid, 0) : -1;
+    if (pidfd >= 0) {
+        const int fd = (int)syscall(__NR_pidfd_getfd, pidfd, sockfd, 0);
+        close(pidfd);
+        if (fd >= 0) {
+            int type = 0, protocol = 0;
+            socklen_t len = sizeof(type);
+            const int ok = getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 &&
+                           (len = sizeof(protocol), getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len) == 0);
+            close(fd);
+            if (ok && (type != SOCK_STREAM || (protocol != IPPROTO_TCP && protocol != 0))) {
+                return;
+            }
+        }
+    }
+#else
+    (void)sockfd;
+    (void)tgid;
+#endif
+    t->port = port;
+    t->port_incoming = incoming;
+}
+
+// At a seccomp stop: what will system call `nr` touch?
+static void learn_syscall(learn_tracee* t, long nr, const uint64_t* args) {
+    const pid_t tid = t->tid;
+    learn_tracee_clear(t);
+#define ARG_FD(i) ((int)(__s32)args[i])
+    switch (nr) {
+#ifdef __NR_open
+    case __NR_open:
+        learn_open(t, AT_FDCWD, args[0], args[1]);
+        break;
+#endif
+#ifdef __NR_creat
+    case __NR_creat:
+        learn_open(t, AT_FDCWD, args[0], O_CREAT | O_WRONLY | O_TRUNC);
+        break;
+#endif
+    case __NR_openat:
+        learn_open(t, ARG_FD(0), args[1], args[2]);
+        break;
+#ifdef __NR_openat2
+    case __NR_openat2: {
+        // struct open_how starts with the __u64 flags.
+        __u64 flags = 0;
+        const struct iovec local = { .iov_base = &flags, .iov_len = sizeof(flags) };
+        const struct iovec remote = { .iov_base = (void*)args[2], .iov_len = sizeof(flags) };
+        if (args[3] >= sizeof(flags) && process_vm_readv(tid, &local, 1, &remote, 1, 0) == sizeof(flags)) {
+            learn_open(t, ARG_FD(0), args[1], flags);
+        }
+        break;
+    }
+#endif
+    case __NR_execve:
+        learn_pend(t, learn_path_at(tid, AT_FDCWD, args[0]), LEARN_EXEC);
+        break;
+    case __NR_execveat: {
+        char* path = learn_path_at(tid, ARG_FD(0), args[1]);
+        if (path && (args[4] & AT_EMPTY_PATH)) {
+            char* given = learn_read_string(tid, args[1]);
+            if (given && !given[0]) {
+                char* link = NULL;
+                if (asprintf(&link, "/proc/%d/fd/%d", (int)tid, ARG_FD(0)) < 0) {
+                    fatal_error_errno("asprintf failed");
+                }
+                free(path);
+                path = learn_readlink(link);
+                free(link);
+            }
+            free(given);
+        }
+        learn_pend(t, path, LEARN_EXEC);
+        break;
+    }
+#ifdef __NR_mkdir
+    case __NR_mkdir:
+#endif
+#ifdef __NR_mknod
+    case __NR_mknod:
+#endif
+#ifdef __NR_rmdir
+    case __NR_rmdir:
+#endif
+#ifdef __NR_unlink
+    case __NR_unlink:
+#endif
+#if defined(__NR_mkdir) || defined(__NR_mknod) || defined(__NR_rmdir) || defined(__NR_unlink)
+        learn_pend(t, learn_parent(learn_path_at(tid, AT_FDCWD, args[0])), LEARN_DIR_WRITE);
+        break;
+#endif
+    case __NR_mkdirat:
+    case __NR_mknodat:
+    case __NR_unlinkat:
+        learn_pend(t, learn_parent(learn_path_at(tid, ARG_FD(0), args[1])), LEARN_DIR_WRITE);
+        break;
+#ifdef __NR_rename
+    case __NR_rename:
+        learn_pend(t, learn_parent(learn_path_at(tid, AT_FDCWD, args[0])), LEARN_DIR_WRITE);
+        learn_pend(t, learn_parent(learn_path_at(tid, AT_FDCWD, args[1])), LEARN_DIR_WRITE);
+        break;
+#endif
+#ifdef __NR_renameat
+    case __NR_renameat:
+#endif
+    case __NR_renameat2:
+        learn_pend(t, learn_parent(learn_path_at(tid, ARG_FD(0), args[1])), LEARN_DIR_WRITE);
+        learn_pend(t, learn_parent(learn_path_at(tid, ARG_FD(2), args[3])), LEARN_DIR_WRITE);
+        break;
+#ifdef __NR_link
+    case __NR_link:
+        learn_pend(t, learn_parent(learn_path_at(tid, AT_FDCWD, args[1])), LEARN_DIR_WRITE);
+        break;
+#endif
+    case __NR_linkat:
+        learn_pend(t, learn_parent(learn_path_at(tid, ARG_FD(2), args[3])), LEARN_DIR_WRITE);
+        break;
+#ifdef __NR_symlink
+    case __NR_symlink:
+        learn_pend(t, learn_parent(learn_path_at(tid, AT_FDCWD, args[1])), LEARN_DIR_WRITE);
+        break;
+#endif
+    case __NR_symlinkat:
+        learn_pend(t, learn_parent(learn_path_at(tid, ARG_FD(1), args[2])), LEARN_DIR_WRITE);
+        break;
+    case __NR_truncate:
+        learn_pend(t, learn_path_at(tid, AT_FDCWD, args[0]), LEARN_WRITE);
+        break;
+    case __NR_bind:
+        learn_socket(t, ARG_FD(0), args[1], args[2], 1);
+        break;
+    case __NR_connect:
+        learn_socket(t, ARG_FD(0), args[1], args[2], 0);
+        break;
+    default:
+        break;
+    }
+#undef ARG_FD
+}
+
+// A successful exec also executes the #! interpreter or the ELF
+// interpreter (Landlock checks both).
+static void learn_add_interpreters(learn* lr, const char* path) {
+    char* current = strdup(path);
+    if (!current) {
+        fatal_error_errno("strdup failed");
+    }
+    for (int depth = 0; current && depth < LEARN_MAX_INTERPRETERS; depth++) {
+        char* next = shebang_interpreter(current);
+        if (!next) {
+            next = elf_interpreter(current);
+        }
+        free(current);
+        current = next;
+        if (current) {
+            char* copy = strdup(current);
+            if (!copy) {
+                fatal_error_errno("strdup failed");
+            }
+            learn_add(lr, copy, LEARN_EXEC);
+        }
+    }
+    free(current);
+}
+
+// At syscall exit: keep what the system call touched if it worked, going
+// by its return value `rval`.
+static void learn_commit(learn* lr, learn_tracee* t, long rval) {
+    int succeeded = rval >= 0;
+    if (t->port >= 0 && !t->port_incoming && (rval == -EINPROGRESS || rval == -EINTR)) {
+        // A non-blocking (or interrupted) connect() that goes on in the
+        // background: Landlock has let it through already.
+        succeeded = 1;
+    }
+    if (succeeded) {
+        for (size_t i = 0; i < t->pending_count; i++) {
+            if (t->pending[i].kinds & LEARN_EXEC) {
+                learn_add_interpreters(lr, t->pending[i].path);
+            }
+            learn_add(lr, t->pending[i].path, t->pending[i].kinds);
+        }
+        t->pending_count = 0;
+        if (t->port >= 0) {
+            unsigned char* ports = t->port_incoming ? lr->incoming_ports : lr->outgoing_ports;
+            ports[t->port / 8] |= (unsigned char)(1U << (t->port % 8));
+        }
+    }
+    learn_tracee_clear(t);
+}
+
+// Takes ownership of `path`.
+static void learn_add(learn* lr, char* path, __u32 kinds) {
+    // /proc/<pid>/... is the command's own /proc/self/... under `sst`, which
+    // exec()s into it; the fds there are just other files.
+    if (strncmp(path, "/proc/", 6) == 0 && path[6] >= '0' && path[6] <= '9') {
+        const char* rest = path + 6 + strspn(path + 6, "0123456789");
+        if (*rest == '\0' || *rest == '/') {
+            char* self = NULL;
+            if (strncmp(rest, "/fd/", 4) == 0 || asprintf(&self, "/proc/self%s", rest) < 0) {
+                free(path);
+                return;
+            }
+            free(path);
+            path = self;
+        }
+    }
+
+    if (lr->path_count * 2 >= lr->path_mask) {
+        const size_t new_size = lr->paths ? (lr->path_mask + 1) * 2 : 1024;
+        learn_path* table = calloc(new_size, sizeof(learn_path));
+        if (!table) {
+            fatal_error_errno("calloc(...) failed.");
+        }
+        for (size_t i = 0; lr->paths && i <= lr->path_mask; i++) {
+            if (!lr->paths[i].path) {
+                continue;
+            }
+            size_t slot = fnv1a_hash(lr->paths[i].path, strlen(lr->paths[i].path)) & (new_size - 1);
+            while (table[slot].path) {
+                slot = (slot + 1) & (new_size - 1);
+            }
+            table[slot] = lr->paths[i];
+        }
+        free(lr->paths);
+        lr->paths = table;
+        lr->path_mask = new_size - 1;
+    }
+    size_t slot = fnv1a_hash(path, strlen(path)) & lr->path_mask;
+    while (lr->paths[slot].path) {
+        if (strcmp(lr->paths[slot].path, path) == 0) {
+            lr->paths[slot].kinds |= kinds;
+            free(path);
+            return;
+        }
+        slot = (slot + 1) & lr->path_mask;
+    }
+    lr->paths[slot] = (learn_path){ .path = path, .kinds = kinds };
+    lr->path_count++;
+}
+
+// The option (FILE_* or PATH_BENEATH_*) and access for `kinds`.
+static const char* learn_option(__u32 kinds, int dir, __u32* access) {
+    const int exec = (kinds & LEARN_EXEC) != 0;
+    const int write = (kinds & (LEARN_WRITE | LEARN_DIR_WRITE)) != 0;
+    if (exec && write) {
+        *access = dir ? EXEC_WRITE_FILE_ACCESS_DIR : EXEC_WRITE_FILE_ACCESS_FILELIKE;
+        return dir ? "PATH_BENEATH_EXEC_WRITE" : "FILE_EXEC_WRITE";
+    }
+    if (exec) {
+        *access = dir ? READ_EXEC_ACCESS_DIR : READ_EXEC_ACCESS_FILELIKE;
+        return dir ? "PATH_BENEATH_EXEC" : "FILE_EXEC";
+    }
+    if (write) {
+        *access = dir ? READ_WRITE_ACCESS_DIR : READ_WRITE_ACCESS_FILELIKE;
+        return dir ? "PATH_BENEATH_WRITE" : "FILE_WRITE";
+    }
+    *access = dir ? READ_ACCESS_DIR : READ_ACCESS_FILELIKE;
+    return dir ? "PATH_BENEATH_READ" : "FILE_READ";
+}
+
+typedef struct slearn_rule {
+    char* path;
+    const char* option;
+} learn_rule;
+
+static int learn_rule_cmp(const void* a, const void* b) {
+    return strcmp(((const learn_rule*)a)->path, ((const learn_rule*)b)->path);
+}
+
+static char* learn_node_path(const opt_trie* trie, size_t n) {
+    size_t len = 0;
+    for (size_t i = n; i != 0; i = trie->nodes[i].parent) {
+        len += trie->nodes[i].name_len + 1;
+    }
+    char* path = malloc(len + 2);
+    if (!path) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    path[len] = '\0';
+    for (size_t i = n; i != 0; i = trie->nodes[i].parent) {
+        len -= trie->nodes[i].name_len;
+        memcpy(path + len, trie->nodes[i].name, trie->nodes[i].name_len);
+        path[--len] = '/';
+    }
+    if (n == 0) {
+        strcpy(path, "/");
+    }
+    return path;
+}
+
+static size_t learn_count_entries(const char* path) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return SIZE_MAX;
+    }
+    size_t count = 0;
+    struct dirent* de;
+    while ((de = readdir(dir))) {
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+// Writes the options; returns how many rules there are.
+static size_t learn_write_options(learn* lr, FILE* out) {
+    opt_trie trie = {0};
+    trie.node_capacity = 1024;
+    trie.nodes = malloc(sizeof(opt_node) * trie.node_capacity);
+    if (!trie.nodes) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    trie.nodes[0] = (opt_node){ .parent = SIZE_MAX, .name = "", .name_len = 0, .rule = SIZE_MAX, .granted = 0 };
+    trie.node_count = 1;
+
+    // Kept until the end: the trie points into them.
+    char** resolved = calloc(lr->path_count + 1, sizeof(char*));
+    size_t* path_nodes = calloc(lr->path_count + 1, sizeof(size_t));
+    __u32* path_kinds = calloc(lr->path_count + 1, sizeof(__u32));
+    if (!resolved || !path_nodes || !path_kinds) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    size_t resolved_count = 0;
+    for (size_t i = 0; lr->paths && i <= lr->path_mask; i++) {
+        const learn_path* lp = &lr->paths[i];
+        if (!lp->path) {
+            continue;
+        }
+        // What is gone by now (temporary files) needs no rule of its own:
+        // creating and removing it is allowed on the directory.
+        char* path = strncmp(lp->path, "/proc/", 6) == 0 ? strdup(lp->path) : realpath(lp->path, NULL);
+        struct stat sb;
+        if (!path || strchr(path, '\n') || stat(path, &sb) != 0) {
+            free(path);
+            continue;
+        }
+        size_t node = 0;
+        const char* p = path;
+        while (*p) {
+            while (*p == '/') {
+                p++;
+            }
+            if (!*p) {
+                break;
+            }
+            const char* name = p;
+            while (*p && *p != '/') {
+                p++;
+            }
+            node = opt_trie_child(&trie, node, name, (size_t)(p - name));
+        }
+        __u32 k = lp->kinds;
+        if (S_ISDIR(sb.st_mode)) {
+            // Opening a directory is listing it.
+            k = (k & LEARN_DIR_WRITE) | (k & (LEARN_READ | LEARN_WRITE | LEARN_LIST) ? LEARN_LIST : 0);
+        } else {
+            k &= LEARN_READ | LEARN_WRITE | LEARN_EXEC;
+        }
+        resolved[resolved_count] = path;
+        path_nodes[resolved_count] = node;
+        path_kinds[resolved_count++] = k;
+    }
+
+    // Per node: the kinds on the node itself; whether it's a directory
+    // (every node with something beneath it is); the kinds of everything
+    // beneath; 1 if it has a rule for being listed or written, 2 if it has
+    // one for most entries being used; how many of its entries are covered.
+    __u32* kinds = calloc(trie.node_count, sizeof(__u32));
+    char* is_dir = malloc(trie.node_count);
+    __u32* beneath = calloc(trie.node_count, sizeof(__u32));
+    char* grouped = calloc(trie.node_count, 1);
+    size_t* covered = calloc(trie.node_count, sizeof(size_t));
+    if (!kinds || !is_dir || !beneath || !grouped || !covered) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    memset(is_dir, 1, trie.node_count);
+    for (size_t i = 0; i < resolved_count; i++) {
+        kinds[path_nodes[i]] |= path_kinds[i];
+        if (path_kinds[i] & (LEARN_READ | LEARN_WRITE | LEARN_EXEC)) {
+            is_dir[path_nodes[i]] = 0;
+        }
+    }
+
+    // Children come after their parents, so backwards is bottom-up.
+    for (size_t n = trie.node_count; n-- > 0;) {
+        beneath[n] |= kinds[n];
+        if (is_dir[n]) {
+            if (kinds[n] & (LEARN_LIST | LEARN_DIR_WRITE)) {
+                grouped[n] = 1;
+            } else if (n != 0 && covered[n] >= LEARN_GROUP_MIN_ENTRIES) {
+                char* path = learn_node_path(&trie, n);
+                const size_t entries = strncmp(path, "/proc/", 6) == 0 ? SIZE_MAX : learn_count_entries(path);
+                free(path);
+                if (entries != SIZE_MAX && covered[n] * 100 >= entries * LEARN_GROUP_MIN_PERCENT) {
+                    grouped[n] = 2;
+                }
+            }
+        }
+        if (n != 0) {
+            const size_t parent = trie.nodes[n].parent;
+            beneath[parent] |= beneath[n];
+            if (!is_dir[n] || grouped[n]) {
+                covered[parent]++;
+            }
+        }
+    }
+
+    learn_rule* found = malloc(sizeof(learn_rule) * trie.node_count);
+    if (!found) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    size_t rules = 0;
+    for (size_t n = 0; n < trie.node_count; n++) {
+        opt_node* node = &trie.nodes[n];
+        node->granted = n == 0 ? 0 : trie.nodes[node->parent].granted;
+        __u32 want;
+        const char* option;
+        if (is_dir[n] && grouped[n]) {
+            // Listing or writing a directory is all about the directory; a
+            // group covers all it was grouped for.
+            option = learn_option(grouped[n] == 2 ? beneath[n] : kinds[n], 1, &want);
+        } else if (!is_dir[n] && kinds[n]) {
+            option = learn_option(kinds[n], 0, &want);
+        } else {
+            continue;
+        }
+        if ((want & ~node->granted) == 0) {
+            continue;
+        }
+        node->granted |= want;
+        found[rules++] = (learn_rule){ .path = learn_node_path(&trie, n), .option = option };
+    }
+    qsort(found, rules, sizeof(learn_rule), learn_rule_cmp);
+
+    fprintf(out, "ENABLE_FILESYSTEM_SANDBOXING\n");
+    fprintf(out, "ENABLE_NETWORK_SANDBOXING\n");
+    for (size_t i = 0; i < rules; i++) {
+        fprintf(out, "%s:%s\n", found[i].option, found[i].path);
+        free(found[i].path);
+    }
+    free(found);
+
+    for (int incoming = 1; incoming >= 0; incoming--) {
+        const unsigned char* ports = incoming ? lr->incoming_ports : lr->outgoing_ports;
+        for (long port = 0; port < 65536; port++) {
+            if (ports[port / 8] & (1U << (port % 8))) {
+                fprintf(out, "ALLOW_%s_TCP_PORT:%ld\n", incoming ? "INCOMING" : "OUTGOING", port);
+                rules++;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < resolved_count; i++) {
+        free(resolved[i]);
+    }
+    free(resolved);
+    free(path_kinds);
+    free(path_nodes);
+    free(covered);
+    free(grouped);
+    free(beneath);
+    free(is_dir);
+    free(kinds);
+    free(trie.edges);
+    free(trie.nodes);
+    return rules;
+}
+
+// sst --learn <output> -- command args...
+static int learn_main(int argc, char** argv, char* const* envp) {
+    if (argc < 5 || strcmp(argv[3], "--") != 0) {
+        fatal_error("usage: sst --learn <output> -- command args...");
+    }
+#ifndef LEARN_AUDIT_ARCH
+    (void)envp;
+    fatal_error("--learn: not supported on this architecture");
+#else
+    const char* output = argv[2];
+    char** command_args = &argv[4];
+
+    // Up front, so that a run isn't for nothing. Not stdout: that's the
+    // command's.
+    FILE* out = fopen(output, "we");
+    if (!out) {
+        fatal_error_errno("--learn: cannot open '%s'", output);
+    }
+
+    const pid_t child = fork();
+    if (child < 0) {
+        fatal_error_errno("fork failed");
+    }
+    if (child == 0) {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0) {
+            fatal_error_errno("--learn: ptrace(PTRACE_TRACEME) failed");
+        }
+        // Until the tracer has set its options.
+        raise(SIGSTOP);
+        learn_install_filter();
+        execvpe(command_args[0], command_args, envp);
+        fatal_error_errno("execvpe failed");
+    }
+
+    // The command gets these from the terminal itself; we carry on to
+    // write out what it did.
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    int status;
+    if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status)) {
+        fatal_error("--learn: the command did not start");
+    }
+    const long options = PTRACE_O_EXITKILL | PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACEFORK |
+                         PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC;
+    if (ptrace(PTRACE_SETOPTIONS, child, NULL, (void*)options) != 0) {
+        fatal_error_errno("--learn: ptrace(PTRACE_SETOPTIONS) failed");
+    }
+
+    learn lr;
+    memset(&lr, 0, sizeof(lr));
+    int is_new;
+    learn_tracee_get(&lr, child, &is_new);
+    ptrace(PTRACE_CONT, child, NULL, NULL);
+
+    int child_status = 0;
+    for (;;) {
+        const pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ECHILD) {
+                break;
+            }
+            fatal_error_errno("waitpid failed");
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == child) {
+                child_status = status;
+            }
+            learn_tracee_forget(&lr, tid);
+            continue;
+        }
+        if (!WIFSTOPPED(status)) {
+            continue;
+        }
+
+        learn_tracee* t = learn_tracee_get(&lr, tid, &is_new);
+        const int sig = WSTOPSIG(status);
+        const int event = status >> 16;
+        int inject = 0;
+        if (sig == (SIGTRAP | 0x80)) {
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, (void*)sizeof(info), &info) > 0 &&
+                info.op == PTRACE_SYSCALL_INFO_EXIT) {
+                learn_commit(&lr, t, (long)info.exit.rval);
+            }
+        } else if (sig == SIGTRAP && event == PTRACE_EVENT_SECCOMP) {
+            struct __ptrace_syscall_info info;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, (void*)sizeof(info), &info) > 0 &&
+                info.op == PTRACE_SYSCALL_INFO_SECCOMP) {
+                learn_syscall(t, (long)info.seccomp.nr, info.seccomp.args);
+            }
+        } else if (sig == SIGTRAP && event != 0) {
+            // Fork, clone and exec events: the new tracees show up by
+            // themselves.
+        } else if (!(is_new && sig == SIGSTOP)) {
+            // A signal for the command (or a group-stop, which we don't
+            // keep it in).
+            siginfo_t si;
+            if (ptrace(PTRACE_GETSIGINFO, tid, NULL, &si) == 0) {
+                inject = sig;
+            }
+        }
+        // Stop at the exit only if there is something to look at there.
+        const int at_exit = t->pending_count > 0 || t->port >= 0;
+        ptrace(at_exit ? PTRACE_SYSCALL : PTRACE_CONT, tid, NULL, (void*)(long)inject);
+    }
+
+    const size_t rules = learn_write_options(&lr, out);
+    if (fclose(out) != 0) {
+        fatal_error_errno("--learn: cannot write '%s'", output);
+    }
+    fprintf(stderr, "sst: --learn: %zu paths seen, %zu rules written to %s\n", lr.path_count, rules, output);
+
+    for (size_t i = 0; lr.paths && i <= lr.path_mask; i++) {
+        free(lr.paths[i].path);
+    }
+    free(lr.paths);
+    free(lr.tracees);
+
+    if (WIFEXITED(child_status)) {
+        return WEXITSTATUS(child_status);
+    }
+    return WIFSIGNALED(child_status) ? 128 + WTERMSIG(child_status) : 1;
+#endif
+}
+
+/****
+ * NESTED SST
+ *
+ * `sst A -- sst B -- command` stacks two Landlock layers: the command may do
+ * what both A and B allow. When the command after `--` is this same `sst`
+ * binary, we parse B ourselves and build one layer that allows exactly the
+ * same. That saves an exec and a ruleset, and Landlock walks one layer
+ * instead of two on every access check (and allows only 16 of them).
+ *
+ * The merged layer handles what either layer handles. A layer only
+ * restricts what it handles, so if only one of A and B does filesystem (or
+ * network) sandboxing, its rules are taken as they are. If both do:
+ *
+ *  - A port is allowed if both allow it.
+ *
+ *  - A path is allowed by A if a rule of A on it or on one of its parent
+ *    directories grants the access, and the same for B. Both of those rules
+ *    are on the way up from the path, so they are on the same inode or one
+ *    is a parent of the other. A rule on the lower one with the
+ *    intersection of the two access masks allows exactly what both do, so
+ *    that's what we add for every such pair.
+ *
+ * The pairs have the same catch as OPTIMIZE_RULES: the lower inode mustn't
+ * be reachable without going through the upper one, so it must be a
+ * directory or have a single hard link, on a filesystem mounted only once.
+ *
+ * Also, the inner `sst` has to be able to run under A at all: A has to let
+ * it execute `sst` and read its POLICY_FILEs and *_LISTs. Anything we can't
+ * tell for sure (fd: lists, RULESET_CACHE, --modes, a dynamically linked
+ * `sst`, paths that don't resolve, ...) and NO_COALESCE mean nesting for
+ * real, by exec()ing the inner `sst` as before.
+ ****/
+
+typedef struct snest_rule {
+    const fs_rule* rule;
+    // realpath(); NULL once it's been handed over to a policy.
+    char* resolved;
+    inode_id id;
+    // The parent directories' inodes, from / down.
+    inode_id* parents;
+    size_t parent_count;
+    // Can't be reached other than through its parent directories.
+    int exact_below;
+} nest_rule;
+
+typedef struct snest_layer {
+    nest_rule* rules;
+    size_t count;
+    // Open addressing hash of inode -> rule + 1. Rules on the same inode
+    // each have their own slot.
+    size_t* id_table;
+    size_t id_mask;
+} nest_layer;
+
+static size_t nest_id_slot(inode_id id, size_t mask) {
+    return (size_t)(id.ino * 0x9e3779b97f4a7c15ULL ^ id.dev) & mask;
+}
+
+static int nest_same_id(inode_id a, inode_id b) {
+    return a.dev == b.dev && a.ino == b.ino;
+}
+
+static void nest_free_rule(nest_rule* r) {
+    free(r->resolved);
+    free(r->parents);
+}
+
+// Returns -1 if `path` can't be resolved.
+static int nest_resolve(const char* path, nest_rule* out, const opt_mount_dev* mounts, size_t mount_count) {
+    memset(out, 0, sizeof(*out));
+    struct stat sb;
+    out->resolved = realpath(path, NULL);
+    if (!out->resolved || stat(out->resolved, &sb) != 0) {
+        nest_free_rule(out);
+        return -1;
+    }
+    out->id.dev = (__u64)sb.st_dev;
+    out->id.ino = (__u64)sb.st_ino;
+    out->exact_below = opt_mounted_once(mounts, mount_count, sb.st_dev) &&
+                       (S_ISDIR(sb.st_mode) || sb.st_nlink == 1);
+
+    size_t depth = 0;
+    for (const char* p = out->resolved; *p; p++) {
+        depth += *p == '/';
+    }
+    out->parents = calloc(depth + 1, sizeof(inode_id));
+    if (!out->parents) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    // Every '/' ends a parent directory; "/" itself is the first one. The
+    // resolved path has no symlinks, so these are the directories the
+    // kernel goes through.
+    char* const resolved = out->resolved;
+    if (strcmp(resolved, "/") == 0) {
+        return 0;
+    }
+    for (char* p = resolved; *p; p++) {
+        if (*p != '/') {
+            continue;
+        }
+        const char saved = p[1];
+        p[1] = '\0';
+        const int failed = stat(resolved, &sb) != 0;
+        p[1] = saved;
+        if (failed) {
+            nest_free_rule(out);
+            return -1;
+        }
+        out->parents[out->parent_count].dev = (__u64)sb.st_dev;
+        out->parents[out->parent_count].ino = (__u64)sb.st_ino;
+        out->parent_count++;
+    }
+    return 0;
+}
+
+static void nest_layer_free(nest_layer* layer) {
+    for (size_t i = 0; i < layer->count; i++) {
+        nest_free_rule(&layer->rules[i]);
+    }
+    free(layer->rules);
+    free(layer->id_table);
+    memset(layer, 0, sizeof(*layer));
+}
+
+// Hands the resolved paths over to `pol`, as merged rules point into them.
+static void nest_layer_keep_paths(nest_layer* layer, policy* pol) {
+    for (size_t i = 0; i < layer->count; i++) {
+        if (layer->rules[i].resolved) {
+            policy_keep_buffer(pol, layer->rules[i].resolved, 0);
+            layer->rules[i].resolved = NULL;
+        }
+    }
+}
+
+// Returns -1 if some rule's path can't be resolved.
+static int nest_layer_init(nest_layer* layer, const policy* pol, const opt_mount_dev* mounts, size_t mount_count) {
+    memset(layer, 0, sizeof(*layer));
+    size_t table_size = 64;
+    while (table_size < pol->fs_rule_count * 2) {
+        table_size *= 2;
+    }
+    layer->rules = calloc(pol->fs_rule_count + 1, sizeof(nest_rule));
+    layer->id_table = calloc(table_size, sizeof(size_t));
+    if (!layer->rules || !layer->id_table) {
+        fatal_error_errno("calloc(...) failed.");
+    }
+    layer->id_mask = table_size - 1;
+
+    for (size_t i = 0; i < pol->fs_rule_count; i++) {
+        nest_rule* r = &layer->rules[i];
+        if (nest_resolve(pol->fs_rules[i].path, r, mounts, mount_count) != 0) {
+            nest_layer_free(layer);
+            return -1;
+        }
+        r->rule = &pol->fs_rules[i];
+        layer->count++;
+
+        size_t slot = nest_id_slot(r->id, layer->id_mask);
+        while (layer->id_table[slot]) {
+            slot = (slot + 1) & layer->id_mask;
+        }
+        layer->id_table[slot] = i + 1;
+    }
+    return 0;
+}
+
+// What `layer` grants on `target`, i.e. the access of all rules on it or on
+// its parent directories.
+static __u32 nest_granted(const nest_layer* layer, const nest_rule* target) {
+    __u32 granted = 0;
+    for (size_t i = 0; i <= target->parent_count; i++) {
+        const inode_id id = i < target->parent_count ? target->parents[i] : target->id;
+        for (size_t slot = nest_id_slot(id, layer->id_mask); layer->id_table[slot];
+             slot = (slot + 1) & layer->id_mask) {
+            const nest_rule* r = &layer->rules[layer->id_table[slot] - 1];
+            if (nest_same_id(r->id, id)) {
+                granted |= r->rule->access;
+            }
+        }
+    }
+    return granted;
+}
+
+// Does `pol` (resolved into `layer`) allow `access` on `path`?
+static int nest_allows(const policy* pol, const nest_layer* layer, const char* path, __u32 access,
+                       const opt_mount_dev* mounts, size_t mount_count) {
+    if (!pol->fs_sandboxing_enabled) {
+        return 1;
+    }
+    nest_rule target;
+    if (nest_resolve(path, &target, mounts, mount_count) != 0) {
+        return 0;
+    }
+    const int allowed = (nest_granted(layer, &target) & access) == access;
+    nest_free_rule(&target);
+    return allowed;
+}
+
+// Adds to `out` the intersections of each rule of `lower` with the rules of
+// `upper` on its parent directories (and with `upper`'s rules on the same
+// inode, if `same_inode`). Returns -1 if that can't be done exactly.
+static int nest_intersect(const nest_layer* lower, const nest_layer* upper, int same_inode, policy* out) {
+    for (size_t i = 0; i < lower->count; i++) {
+        const nest_rule* r = &lower->rules[i];
+        const size_t first = same_inode ? 0 : 1;
+        for (size_t k = first; k <= r->parent_count; k++) {
+            const int on_parent = k > 0;
+            const inode_id id = on_parent ? r->parents[r->parent_count - k] : r->id;
+            for (size_t slot = nest_id_slot(id, upper->id_mask); upper->id_table[slot];
+                 slot = (slot + 1) & upper->id_mask) {
+                const nest_rule* u = &upper->rules[upper->id_table[slot] - 1];
+                if (!nest_same_id(u->id, id)) {
+                    continue;
+                }
+                if (on_parent ? !r->exact_below : u->rule->is_directory != r->rule->is_directory) {
+                    return -1;
+                }
+                const __u32 access = r->rule->access & u->rule->access;
+                if (access) {
+                    push_fs_rule(out, r->resolved, r->rule->is_directory, access);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Merges `inner` into `outer` (resolved into `outer_layer`), if the result
+// allows exactly what the two layers would. Returns -1 and leaves both
+// alone otherwise.
+static int coalesce_policies(policy* outer, nest_layer* outer_layer, policy* inner,
+                             const opt_mount_dev* mounts, size_t mount_count) {
+    policy merged = {0};
+    nest_layer inner_layer = {0};
+    if (outer->fs_sandboxing_enabled && inner->fs_sandboxing_enabled) {
+        if (nest_layer_init(&inner_layer, inner, mounts, mount_count) != 0) {
+            return -1;
+        }
+        if (nest_intersect(&inner_layer, outer_layer, 1, &merged) != 0 ||
+            nest_intersect(outer_layer, &inner_layer, 0, &merged) != 0) {
+            nest_layer_free(&inner_layer);
+            free(merged.fs_rules);
+            return -1;
+        }
+        nest_layer_keep_paths(&inner_layer, outer);
+        nest_layer_keep_paths(outer_layer, outer);
+        nest_layer_free(&inner_layer);
+        free(outer->fs_rules);
+        outer->fs_rules = merged.fs_rules;
+        outer->fs_rule_count = merged.fs_rule_count;
+        outer->fs_rule_capacity = merged.fs_rule_capacity;
+    } else if (inner->fs_sandboxing_enabled) {
+        free(outer->fs_rules);
+        outer->fs_rules = inner->fs_rules;
+        outer->fs_rule_count = inner->fs_rule_count;
+        outer->fs_rule_capacity = inner->fs_rule_capacity;
+        inner->fs_rules = NULL;
+        inner->fs_rule_count = 0;
+        inner->fs_rule_capacity = 0;
+    }
+
+    if (outer->net_sandboxing_enabled && inner->net_sandboxing_enabled) {
+        for (size_t w = 0; w < PORT_BITMAP_WORDS; w++) {
+            outer->incoming_ports[w] &= inner->incoming_ports[w];
+            outer->outgoing_ports[w] &= inner->outgoing_ports[w];
+        }
+    } else if (inner->net_sandboxing_enabled) {
+        memcpy(outer->incoming_ports, inner->incoming_ports, sizeof(outer->incoming_ports));
+        memcpy(outer->outgoing_ports, inner->outgoing_ports, sizeof(outer->outgoing_ports));
+    }
+    outer->net_rule_count = 0;
+    for (long port = next_net_rule_port(outer, 0); port >= 0; port = next_net_rule_port(outer, port + 1)) {
+        outer->net_rule_count++;
+    }
+
+    outer->fs_sandboxing_enabled |= inner->fs_sandboxing_enabled;
+    outer->net_sandboxing_enabled |= inner->net_sandboxing_enabled;
+    outer->optimize_rules |= inner->optimize_rules;
+    if (inner->resolve_threads > outer->resolve_threads) {
+        outer->resolve_threads = inner->resolve_threads;
+    }
+    // The inner rules point into these.
+    for (size_t i = 0; i < inner->buffer_count; i++) {
+        policy_keep_buffer(outer, inner->buffers[i].base, inner->buffers[i].mmap_size);
+    }
+    inner->buffer_count = 0;
+    return 0;
+}
+
+// If argv[command_idx] is this `sst` with options that can be merged into
+// `pol` exactly, merges them and returns the index of the inner command.
+// Returns -1 otherwise.
+static int coalesce_one(policy* pol, int argc, char** argv, int command_idx, const struct stat* self_sb,
+                        const opt_mount_dev* mounts, size_t mount_count) {
+    char* found = path_search(argv[command_idx]);
+    const char* command = found ? found : argv[command_idx];
+    int result = -1;
+    nest_layer outer_layer = {0};
+    sst_policy* inner = NULL;
+
+    struct stat sb;
+    if (stat(command, &sb) != 0 || sb.st_dev != self_sb->st_dev || sb.st_ino != self_sb->st_ino) {
+        goto out;
+    }
+
+    const int first = command_idx + 1;
+    int sep = -1;
+    for (int i = first; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--") == 0) {
+            sep = i;
+            break;
+        }
+        if (arg[0] == '-' || strcmp(arg, "NO_COALESCE") == 0 || strncmp(arg, "RULESET_CACHE:", 14) == 0 ||
+            strstr(arg, "_LIST:fd:") || is_placement_option(arg) || is_prewarm_option(arg) ||
+            is_listen_option(arg) || strcmp(arg, "EXEC_DEPS") == 0) {
+            goto out;
+        }
+    }
+    // Let the inner `sst` complain about these.
+    if (sep <= first || sep == argc - 1) {
+        goto out;
+    }
+
+    // Could the inner `sst` do its thing under `pol`?
+    if (pol->fs_sandboxing_enabled && nest_layer_init(&outer_layer, pol, mounts, mount_count) != 0) {
+        goto out;
+    }
+    if (!nest_allows(pol, &outer_layer, command, LANDLOCK_ACCESS_FS_EXECUTE, mounts, mount_count)) {
+        goto out;
+    }
+    for (int i = first; i < sep; i++) {
+        const char* file = NULL;
+        if (strncmp(argv[i], "POLICY_FILE:", 12) == 0) {
+            file = argv[i] + 12;
+        } else if (strstr(argv[i], "_LIST:")) {
+            file = strstr(argv[i], "_LIST:") + 6;
+        }
+        if (file && !nest_allows(pol, &outer_layer, file, LANDLOCK_ACCESS_FS_READ_FILE, mounts, mount_count)) {
+            goto out;
+        }
+    }
+
+    inner = sst_policy_new();
+    if (!inner) {
+        fatal_error_errno("out of memory");
+    }
+    if (sst_policy_add_options(inner, (const char* const*)&argv[first], (size_t)(sep - first)) != 0) {
+        goto out;
+    }
+    if (!inner->pol.fs_sandboxing_enabled && !inner->pol.net_sandboxing_enabled) {
+        goto out;
+    }
+    if (coalesce_policies(pol, &outer_layer, &inner->pol, mounts, mount_count) == 0) {
+        result = sep + 1;
+    }
+
+out:
+    sst_policy_free(inner);
+    nest_layer_free(&outer_layer);
+    free(found);
+    return result;
+}
+
+// Merges as many nested `sst`s as possible into `pol`, starting from the
+// command at argv[command_idx]. Returns the index of the command to run.
+static int coalesce_nested(policy* pol, int argc, char** argv, int command_idx) {
+    struct stat self_sb;
+    // A dynamically linked `sst` would also need its libraries under the
+    // outer policy; not worth figuring out.
+    if (pol->no_coalesce || getauxval(AT_BASE) != 0 || stat("/proc/self/exe", &self_sb) != 0) {
+        return command_idx;
+    }
+    size_t mount_count = 0;
+    opt_mount_dev* mounts = opt_read_mounts(&mount_count);
+    int next;
+    while ((next = coalesce_one(pol, argc, argv, command_idx, &self_sb, mounts, mount_count)) >= 0) {
+        command_idx = next;
+    }
+    free(mounts);
+    return command_idx;
+}
+
+/****
+ * POLICY CHECKER
+ *
+ * `sst --check <queries> option1 ... optionN` tells which of the queries
+ * the policy would deny, without running anything. A query is a line
+ *
+ *     <access>[,<access>...] <path>
+ *
+ * where <access> is one of the LANDLOCK_ACCESS_FS_* names in lower case
+ * (read_file, write_file, execute, read_dir, make_reg, ...) or read, write,
+ * exec or list for short. The denied ones are printed in the same format,
+ * with only the missing access rights, so the output is a query file too.
+ *
+ * The rules' paths are resolved into an opt_trie, and as in OPTIMIZE_RULES,
+ * every node gets what the rules on it and on its parent directories grant
+ * in one pass in trie order. A query walks down the trie as far as its path
+ * goes; everything below a node gets what the node gets, so that's the
+ * answer. As with Landlock, creating, removing and linking entries is
+ * checked on the directory they're in, everything else on the path itself.
+ *
+ * This goes by path, where the kernel goes by inode, so a file reached
+ * through a hard link or a bind mount outside of the rules' directories can
+ * get a different answer from the kernel. Query paths go through
+ * realpath() like the rules' paths do (as far as they exist), or else
+ * /bin/ls would miss FILE_EXEC:/bin/ls on a system where /bin is a symlink.
+ * Directories are resolved once per thread, each from its parent, so that
+ * is an lstat() per query and one per directory. --no-resolve skips that
+ * and takes them as they are, minus "." and ".."; that is faster, but only
+ * right for paths that are resolved already.
+ *
+ * The query file is mmap()ed and cut into chunks of whole lines, one per
+ * thread. The trie doesn't change once it's built, so the threads share it
+ * as it is.
+ ****/
+
+#define CHECK_MAX_THREADS 64
+// Less of the query file than this per thread isn't worth a thread.
+#define CHECK_MIN_CHUNK (256 * 1024)
+
+// Checked on the directory the entry is (or is to be) in.
+static const __u32 CHECK_PARENT_ACCESS =
+    LANDLOCK_ACCESS_FS_REMOVE_DIR |
+    LANDLOCK_ACCESS_FS_REMOVE_FILE |
+    LANDLOCK_ACCESS_FS_MAKE_CHAR |
+    LANDLOCK_ACCESS_FS_MAKE_DIR |
+    LANDLOCK_ACCESS_FS_MAKE_REG |
+    LANDLOCK_ACCESS_FS_MAKE_SOCK |
+    LANDLOCK_ACCESS_FS_MAKE_FIFO |
+    LANDLOCK_ACCESS_FS_MAKE_BLOCK |
+    LANDLOCK_ACCESS_FS_MAKE_SYM |
+    LANDLOCK_ACCESS_FS_REFER;
+
+// The first name of every access right is the one that gets printed.
+static const struct {
+    const char* name;
+    __u32 access;
+} check_access_names[] = {
+    { "execute",     LANDLOCK_ACCESS_FS_EXECUTE },
+    { "write_file",  LANDLOCK_ACCESS_FS_WRITE_FILE },
+    { "read_file",   LANDLOCK_ACCESS_FS_READ_FILE },
+    { "read_dir",    LANDLOCK_ACCESS_FS_READ_DIR },
+    { "remove_dir",  LANDLOCK_ACCESS_FS_REMOVE_DIR },
+    { "remove_file", LANDLOCK_ACCESS_FS_REMOVE_FILE },
+    { "make_char",   LANDLOCK_ACCESS_FS_MAKE_CHAR },
+    { "make_dir",    LANDLOCK_ACCESS_FS_MAKE_DIR },
+    { "make_reg",    LANDLOCK_ACCESS_FS_MAKE_REG },
+    { "make_sock",   LANDLOCK_ACCESS_FS_MAKE_SOCK },
+    { "make_fifo",   LANDLOCK_ACCESS_FS_MAKE_FIFO },
+    { "make_block",  LANDLOCK_ACCESS_FS_MAKE_BLOCK },
+    { "make_sym",    LANDLOCK_ACCESS_FS_MAKE_SYM },
+    { "refer",       LANDLOCK_ACCESS_FS_REFER },
+    { "truncate",    LANDLOCK_ACCESS_FS_TRUNCATE },
+    { "ioctl_dev",   LANDLOCK_ACCESS_FS_IOCTL_DEV },
+    { "read",        LANDLOCK_ACCESS_FS_READ_FILE },
+    { "write",       LANDLOCK_ACCESS_FS_WRITE_FILE },
+    { "exec",        LANDLOCK_ACCESS_FS_EXECUTE },
+    { "list",        LANDLOCK_ACCESS_FS_READ_DIR },
+};
+
+#define CHECK_ACCESS_NAME_COUNT (sizeof(check_access_names) / sizeof(check_access_names[0]))
+
+// Slots of every thread's cache of resolved directories. Direct-mapped: a
+// collision just replaces what was there.
+#define CHECK_DIR_CACHE_SIZE 65536
+
+typedef struct scheck_dir {
+    // As in the query; NULL if the slot is empty.
+    char* raw;
+    size_t raw_len;
+    // As check_query_path() made it.
+    char* resolved;
+    size_t resolved_len;
+    // The directory exists, so all of `resolved` went through realpath().
+    int exists;
+} check_dir;
+
+typedef struct scheck_worker {
+    const opt_trie* trie;
+    // Whole lines of the query file.
+    const char* start;
+    const char* end;
+    int resolve;
+    // CHECK_DIR_CACHE_SIZE of them, if `resolve`.
+    check_dir* dirs;
+
+    // The denied queries, as they are to be printed.
+    char* out;
+    size_t out_len;
+    size_t out_capacity;
+
+    size_t queries;
+    size_t denied;
+    // The first line that isn't a query, or NULL.
+    const char* bad_line;
+} check_worker;
+
+// "name,name,..." -> access rights. 0 if some name is unknown.
+static __u32 check_parse_access(const char* s, size_t len) {
+    __u32 access = 0;
+    const char* const end = s + len;
+    while (s < end) {
+        const char* comma = memchr(s, ',', (size_t)(end - s));
+        const size_t name_len = comma ? (size_t)(comma - s) : (size_t)(end - s);
+        size_t i = 0;
+        while (i < CHECK_ACCESS_NAME_COUNT && (strlen(check_access_names[i].name) != name_len ||
+                                               memcmp(check_access_names[i].name, s, name_len) != 0)) {
+            i++;
+        }
+        if (i == CHECK_ACCESS_NAME_COUNT) {
+            return 0;
+        }
+        access |= check_access_names[i].access;
+        s += name_len + (comma ? 1 : 0);
+    }
+    return access;
+}
+
+// Copies the absolute `path` to `out` (PATH_MAX bytes) without ".", ".."
+// and repeated or trailing slashes. Returns the length, or -1 if `path`
+// isn't absolute or is too long.
+static long check_normalize(const char* path, size_t len, char* out) {
+    if (len == 0 || path[0] != '/') {
+        return -1;
+    }
+    size_t n = 0;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && path[i] == '/') {
+            i++;
+        }
+        const size_t start = i;
+        while (i < len && path[i] != '/') {
+            i++;
+        }
+        const size_t name_len = i - start;
+        if (name_len == 0 || (name_len == 1 && path[start] == '.')) {
+            continue;
+        }
+        if (name_len == 2 && path[start] == '.' && path[start + 1] == '.') {
+            // ".." of / is / itself.
+            while (n > 0 && out[n - 1] != '/') {
+                n--;
+            }
+            if (n > 0) {
+                n--;
+            }
+            continue;
+        }
+        if (n + 1 + name_len >= PATH_MAX) {
+            return -1;
+        }
+        out[n++] = '/';
+        memcpy(out + n, path + start, name_len);
+        n += name_len;
+    }
+    if (n == 0) {
+        out[n++] = '/';
+    }
+    out[n] = '\0';
+    return (long)n;
+}
+
+// Is the absolute `path` already what check_normalize() would make of it?
+// Traced paths nearly always are; this skips the copy for them.
+static int check_is_normal(const char* path, size_t len) {
+    if (len == 0 || path[0] != '/' || len >= PATH_MAX || (len > 1 && path[len - 1] == '/')) {
+        return 0;
+    }
+    const char* const end = path + len;
+    for (const char* p = path; p && p < end; p = memchr(p + 1, '/', (size_t)(end - p - 1))) {
+        const size_t rest = (size_t)(end - p - 1);
+        if (rest > 0 && p[1] == '/') {
+            return 0;
+        }
+        if (rest > 0 && p[1] == '.' &&
+            (rest == 1 || p[2] == '/' || (p[2] == '.' && (rest == 2 || p[3] == '/')))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The query path as the trie wants it, in `out` (PATH_MAX bytes). With
+// `resolve`, the longest part of it that exists goes through realpath(), so
+// a path that doesn't exist (yet) still gets its symlinked parent
+// directories resolved; the rest is taken as it is. `*exists_out` says if
+// all of it existed. Returns the length, or -1.
+static long check_query_path(const char* path, size_t len, int resolve, char* out, int* exists_out) {
+    *exists_out = 0;
+    if (!resolve || len == 0 || path[0] != '/' || len >= PATH_MAX) {
+        return check_normalize(path, len, out);
+    }
+    char raw[PATH_MAX];
+    char resolved[PATH_MAX];
+    memcpy(raw, path, len);
+    raw[len] = '\0';
+    // raw[0..cut) is the part that is tried, without its trailing slash.
+    size_t cut = len;
+    for (;;) {
+        const char saved = raw[cut];
+        raw[cut] = '\0';
+        const char* found = realpath(cut == 0 ? "/" : raw, resolved);
+        raw[cut] = saved;
+        if (found) {
+            break;
+        }
+        if (cut == 0) {
+            return check_normalize(path, len, out);
+        }
+        while (cut > 0 && raw[cut - 1] != '/') {
+            cut--;
+        }
+        if (cut > 0) {
+            cut--;
+        }
+    }
+    const size_t resolved_len = strlen(resolved);
+    if (resolved_len + (len - cut) >= PATH_MAX) {
+        return -1;
+    }
+    memcpy(resolved + resolved_len, raw + cut, len - cut + 1);
+    *exists_out = cut == len;
+    return check_normalize(resolved, resolved_len + (len - cut), out);
+}
+
+// Appends "/<name>" to the resolved directory of `d` in `out`. Returns the
+// length, or -1 if it's too long.
+static long check_dir_join(const check_dir* d, const char* name, size_t name_len, char* out) {
+    if (d->resolved_len + 1 + name_len >= PATH_MAX) {
+        return -1;
+    }
+    size_t n = d->resolved_len;
+    memcpy(out, d->resolved, n);
+    // "/" already ends in one.
+    if (n > 1) {
+        out[n++] = '/';
+    }
+    memcpy(out + n, name, name_len);
+    n += name_len;
+    out[n] = '\0';
+    return (long)n;
+}
+
+// Resolves `d`'s name, which is in `out` (`n` bytes) already: the name
+// exists if `d` does and lstat() finds it, and only a symlink needs more.
+static long check_resolve_name(const check_dir* d, char* out, long n, int* exists_out) {
+    *exists_out = 0;
+    struct stat sb;
+    if (n < 0 || !d->exists || lstat(out, &sb) != 0) {
+        return n;
+    }
+    if (S_ISLNK(sb.st_mode)) {
+        char link[PATH_MAX];
+        memcpy(link, out, (size_t)n + 1);
+        return check_query_path(link, (size_t)n, 1, out, exists_out);
+    }
+    *exists_out = 1;
+    return n;
+}
+
+static int check_is_dot_name(const char* name, size_t name_len) {
+    return name_len == 0 || (name_len == 1 && name[0] == '.') ||
+           (name_len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+// The directory path[0..len), resolved: from the cache, or from its parent
+// directory (looked up the same way) and an lstat() of its name. So every
+// directory costs one system call, the first time. NULL if it's too long.
+static const check_dir* check_dir_lookup(check_worker* w, const char* path, size_t len) {
+    const size_t slot = fnv1a_hash(path, len) & (CHECK_DIR_CACHE_SIZE - 1);
+    check_dir* d = &w->dirs[slot];
+    if (d->raw && d->raw_len == len && memcmp(d->raw, path, len) == 0) {
+        return d;
+    }
+
+    char out[PATH_MAX];
+    long n;
+    int exists;
+    const char* slash = len > 1 ? memrchr(path, '/', len) : NULL;
+    const char* name = slash ? slash + 1 : NULL;
+    const size_t name_len = slash ? (size_t)(path + len - name) : 0;
+    if (!slash || check_is_dot_name(name, name_len)) {
+        // "/", and the odd "//", "." or "..", the slow way.
+        n = check_query_path(path, len, 1, out, &exists);
+    } else {
+        const check_dir* parent = check_dir_lookup(w, path, slash == path ? 1 : (size_t)(slash - path));
+        if (!parent) {
+            return NULL;
+        }
+        n = check_resolve_name(parent, out, check_dir_join(parent, name, name_len, out), &exists);
+    }
+    if (n < 0) {
+        return NULL;
+    }
+
+    // The parent may have taken the same slot; it's done with it now.
+    d = &w->dirs[slot];
+    free(d->raw);
+    free(d->resolved);
+    d->raw = malloc(len);
+    d->resolved = malloc((size_t)n + 1);
+    if (!d->raw || !d->resolved) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    memcpy(d->raw, path, len);
+    memcpy(d->resolved, out, (size_t)n + 1);
+    d->raw_len = len;
+    d->resolved_len = (size_t)n;
+    d->exists = exists;
+    return d;
+}
+
+// check_query_path() with `resolve`, with directories resolved once per
+// thread (a trace has lots of paths in the same directories). What's left
+// per query is an lstat() of the last component, and not even that if the
+// directory doesn't exist.
+static long check_resolve_cached(check_worker* w, const char* path, size_t len, char* out) {
+    int exists;
+    const char* slash = len > 0 && len < PATH_MAX && path[0] == '/' ? memrchr(path, '/', len) : NULL;
+    const char* name = slash ? slash + 1 : NULL;
+    const size_t name_len = slash ? (size_t)(path + len - name) : 0;
+    if (!slash || check_is_dot_name(name, name_len)) {
+        return check_query_path(path, len, 1, out, &exists);
+    }
+    const check_dir* d = check_dir_lookup(w, path, slash == path ? 1 : (size_t)(slash - path));
+    if (!d) {
+        return -1;
+    }
+    return check_resolve_name(d, out, check_dir_join(d, name, name_len, out), &exists);
+}
+
+// What the rules grant on the normalized `path`, or on the directory it is
+// in if `parent`.
+static __u32 check_granted(const opt_trie* trie, const char* path, size_t len, int parent) {
+    if (parent) {
+        while (len > 1 && path[len - 1] != '/') {
+            len--;
+        }
+    }
+    size_t node = 0;
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && path[i] == '/') {
+            i++;
+        }
+        const size_t start = i;
+        while (i < len && path[i] != '/') {
+            i++;
+        }
+        if (i == start) {
+            break;
+        }
+        const size_t child = opt_trie_find(trie, node, path + start, i - start);
+        if (child == SIZE_MAX) {
+            break;
+        }
+        node = child;
+    }
+    return trie->nodes[node].granted;
+}
+
+static void check_emit(check_worker* w, const char* s, size_t len) {
+    if (w->out_capacity - w->out_len < len) {
+        size_t capacity = w->out_capacity ? w->out_capacity : 64 * 1024;
+        while (capacity - w->out_len < len) {
+            capacity *= 2;
+        }
+        w->out = realloc(w->out, capacity);
+        if (!w->out) {
+            fatal_error_errno("realloc(..., %zu) failed.", capacity);
+        }
+        w->out_capacity = capacity;
+    }
+    memcpy(w->out + w->out_len, s, len);
+    w->out_len += len;
+}
+
+static void* check_worker_main(void* arg) {
+    check_worker* w = arg;
+    char path[PATH_MAX];
+    const char* next;
+    if (w->resolve) {
+        w->dirs = calloc(CHECK_DIR_CACHE_SIZE, sizeof(check_dir));
+        if (!w->dirs) {
+            fatal_error_errno("calloc(...) failed.");
+        }
+    }
+    for (const char* line = w->start; line < w->end; line = next) {
+        const char* nl = memchr(line, '\n', (size_t)(w->end - line));
+        next = nl ? nl + 1 : w->end;
+        size_t len = (size_t)((nl ? nl : w->end) - line);
+        if (len > 0 && line[len - 1] == '\r') {
+            len--;
+        }
+        if (len == 0 || line[0] == '#') {
+            continue;
+        }
+
+        const char* const line_end = line + len;
+        const char* p = line;
+        while (p < line_end && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        const __u32 access = check_parse_access(line, (size_t)(p - line));
+        while (p < line_end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        const size_t query_len = (size_t)(line_end - p);
+        const char* query_path = p;
+        long path_len = (long)query_len;
+        if (!access || memchr(p, '\0', query_len)) {
+            path_len = -1;
+        } else if (w->resolve) {
+            query_path = path;
+            path_len = check_resolve_cached(w, p, query_len, path);
+        } else if (!check_is_normal(p, query_len)) {
+            int exists;
+            query_path = path;
+            path_len = check_query_path(p, query_len, 0, path, &exists);
+        }
+        if (path_len < 0) {
+            w->bad_line = line;
+            break;
+        }
+
+        __u32 missing = 0;
+        if (access & CHECK_PARENT_ACCESS) {
+            missing |= access & CHECK_PARENT_ACCESS & ~check_granted(w->trie, query_path, (size_t)path_len, 1);
+        }
+        if (access & ~CHECK_PARENT_ACCESS) {
+            missing |= access & ~CHECK_PARENT_ACCESS & ~check_granted(w->trie, query_path, (size_t)path_len, 0);
+        }
+        w->queries++;
+        if (!missing) {
+            continue;
+        }
+        w->denied++;
+        int first = 1;
+        for (size_t i = 0; i < CHECK_ACCESS_NAME_COUNT; i++) {
+            if (missing & check_access_names[i].access) {
+                if (!first) {
+                    check_emit(w, ",", 1);
+                }
+                check_emit(w, check_access_names[i].name, strlen(check_access_names[i].name));
+                missing &= ~check_access_names[i].access;
+                first = 0;
+            }
+        }
+        check_emit(w, " ", 1);
+        check_emit(w, p, query_len);
+        check_emit(w, "\n", 1);
+    }
+    for (size_t i = 0; w->dirs && i < CHECK_DIR_CACHE_SIZE; i++) {
+        free(w->dirs[i].raw);
+        free(w->dirs[i].resolved);
+    }
+    free(w->dirs);
+    w->dirs = NULL;
+    return NULL;
+}
+
+// Builds the trie of `pol`'s rules. Fails where building the ruleset would.
+// The resolved paths go to `*resolved_out`; the trie points into them.
+static void check_build_trie(const policy* pol, opt_trie* trie, char*** resolved_out) {
+    memset(trie, 0, sizeof(*trie));
+    trie->node_capacity = 1024;
+    trie->nodes = malloc(sizeof(opt_node) * trie->node_capacity);
+    char** resolved = calloc(pol->fs_rule_count + 1, sizeof(char*));
+    if (!trie->nodes || !resolved) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    trie->nodes[0] = (opt_node){ .parent = SIZE_MAX, .name = "", .name_len = 0, .rule = SIZE_MAX, .granted = 0 };
+    trie->node_count = 1;
+
+    for (size_t i = 0; i < pol->fs_rule_count; i++) {
+        const fs_rule* rule = &pol->fs_rules[i];
+        struct stat sb;
+        resolved[i] = realpath(rule->path, NULL);
+        if (!resolved[i] || stat(resolved[i], &sb) != 0) {
+            fatal_error_errno("cannot open '%s' for sandboxing", rule->path);
+        }
+        if (rule->is_directory) {
+            if (!is_directory(sb.st_mode)) {
+                fatal_error("PATH_BENEATH_*: '%s' is not a directory", rule->path);
+            }
+        } else {
+            if (!is_filelike(sb.st_mode)) {
+                fatal_error("FILE_*: '%s' is not a file-like entity.", rule->path);
+            }
+        }
+
+        size_t node = 0;
+        const char* p = resolved[i];
+        while (*p) {
+            while (*p == '/') {
+                p++;
+            }
+            if (!*p) {
+                break;
+            }
+            const char* name = p;
+            while (*p && *p != '/') {
+                p++;
+            }
+            node = opt_trie_child(trie, node, name, (size_t)(p - name));
+        }
+        if (trie->nodes[node].rule == SIZE_MAX) {
+            trie->nodes[node].rule = i;
+        }
+        // As create_policy_ruleset() hands them to the kernel.
+        trie->nodes[node].granted |= rule->access & FULL_FS_ACCESS;
+    }
+
+    // A layer that doesn't handle filesystem access doesn't restrict it.
+    if (!pol->fs_sandboxing_enabled) {
+        trie->nodes[0].granted = FULL_FS_ACCESS;
+    }
+    for (size_t n = 1; n < trie->node_count; n++) {
+        trie->nodes[n].granted |= trie->nodes[trie->nodes[n].parent].granted;
+    }
+    *resolved_out = resolved;
+}
+
+// The query file, mmap()ed if it's a regular file. `*mapped_out` is the
+// size of the mapping, or 0 if it was read into a malloc()ed buffer.
+static char* check_read_queries(const char* source, size_t* size_out, size_t* mapped_out) {
+    const int fd = strcmp(source, "-") == 0 ? 0 : open(source, O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        fatal_error_errno("--check: cannot open '%s'", source);
+    }
+    *mapped_out = 0;
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        char* data = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fatal_error_errno("--check: cannot mmap '%s'", source);
+        }
+        if (fd != 0) {
+            close(fd);
+        }
+        *size_out = (size_t)sb.st_size;
+        *mapped_out = (size_t)sb.st_size;
+        return data;
+    }
+
+    size_t capacity = 64 * 1024;
+    size_t size = 0;
+    char* buf = malloc(capacity);
+    if (!buf) {
+        fatal_error_errno("malloc(%zu) failed.", capacity);
+    }
+    for (;;) {
+        if (size == capacity) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+            if (!buf) {
+                fatal_error_errno("realloc(..., %zu) failed.", capacity);
+            }
+        }
+        const ssize_t got = read(fd, buf + size, capacity - size);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fatal_error_errno("--check: cannot read '%s'", source);
+        }
+        if (got == 0) {
+            break;
+        }
+        size += (size_t)got;
+    }
+    if (fd != 0) {
+        close(fd);
+    }
+    *size_out = size;
+    return buf;
+}
+
+// sst --check <queries> [--threads <n>] [--no-resolve] option1 ... optionN
+static int check_main(int argc, char **argv) {
+    const char* usage = "usage: sst --check <queries> [--threads <n>] [--no-resolve] option1 ... optionN";
+    if (argc < 4) {
+        fatal_error("%s", usage);
+    }
+    const char* source = argv[2];
+    long threads = 0;
+    int resolve = 1;
+    int first_option = 3;
+    while (first_option < argc) {
+        if (strcmp(argv[first_option], "--threads") == 0 && first_option + 1 < argc) {
+            if (parse_long(argv[first_option + 1], 0, CHECK_MAX_THREADS, &threads) != 0) {
+                fatal_error("--check: invalid number of threads '%s' (0-%d, 0 = one per CPU)",
+                            argv[first_option + 1], CHECK_MAX_THREADS);
+            }
+            first_option += 2;
+        } else if (strcmp(argv[first_option], "--no-resolve") == 0) {
+            resolve = 0;
+            first_option++;
+        } else {
+            break;
+        }
+    }
+    if (first_option == argc) {
+        fatal_error("%s", usage);
+    }
+
+    sst_policy* pol = sst_policy_new();
+    if (!pol) {
+        fatal_error_errno("out of memory");
+    }
+    if (sst_policy_add_options(pol, (const char* const*)&argv[first_option], (size_t)(argc - first_option)) != 0) {
+        fatal_error("%s", sst_error());
+    }
+    require_some_sandboxing(&pol->pol);
+
+    opt_trie trie;
+    char** resolved;
+    check_build_trie(&pol->pol, &trie, &resolved);
+
+    size_t size;
+    size_t mapped;
+    char* data = check_read_queries(source, &size, &mapped);
+
+    if (threads == 0) {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (cpus < CHECK_MAX_THREADS ? cpus : CHECK_MAX_THREADS) : 1;
+    }
+    if ((size_t)threads > size / CHECK_MIN_CHUNK) {
+        threads = size / CHECK_MIN_CHUNK > 0 ? (long)(size / CHECK_MIN_CHUNK) : 1;
+    }
+
+    check_worker workers[CHECK_MAX_THREADS];
+    pthread_t tids[CHECK_MAX_THREADS];
+    int started[CHECK_MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+    const char* chunk_start = data;
+    for (long i = 0; i < threads; i++) {
+        const char* chunk_end = data + size;
+        if (i < threads - 1) {
+            // Up to the end of the line the cut is in.
+            const char* cut = data + size / (size_t)threads * (size_t)(i + 1);
+            if (cut < chunk_start) {
+                cut = chunk_start;
+            }
+            const char* nl = memchr(cut, '\n', (size_t)(data + size - cut));
+            chunk_end = nl ? nl + 1 : data + size;
+        }
+        workers[i] = (check_worker){ .trie = &trie, .start = chunk_start, .end = chunk_end, .resolve = resolve };
+        chunk_start = chunk_end;
+    }
+    for (long i = 1; i < threads; i++) {
+        // If we can't get another thread, this one does the work.
+        started[i] = pthread_create(&tids[i], NULL, check_worker_main, &workers[i]) == 0;
+        if (!started[i]) {
+            check_worker_main(&workers[i]);
+        }
+    }
+    check_worker_main(&workers[0]);
+
+    size_t queries = 0;
+    size_t denied = 0;
+    for (long i = 0; i < threads; i++) {
+        if (i > 0 && started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+        check_worker* w = &workers[i];
+        // In file order, so this is the first bad line there is.
+        if (w->bad_line) {
+            size_t line_no = 1;
+            for (const char* p = data; (p = memchr(p, '\n', (size_t)(w->bad_line - p))) != NULL; p++) {
+                line_no++;
+            }
+            const char* nl = memchr(w->bad_line, '\n', (size_t)(data + size - w->bad_line));
+            const size_t len = (size_t)((nl ? nl : data + size) - w->bad_line);
+            fatal_error("--check: '%s' line %zu is not a query: '%.*s'", source, line_no,
+                        (int)(len < 200 ? len : 200), w->bad_line);
+        }
+        if (w->out_len > 0 && write_full(1, w->out, w->out_len) != 0) {
+            fatal_error_errno("--check: cannot write to stdout");
+        }
+        queries += w->queries;
+        denied += w->denied;
+        free(w->out);
+    }
+    fprintf(stderr, "sst: --check: %zu queries, %zu denied\n", queries, denied);
+
+    if (mapped) {
+        munmap(data, mapped);
+    } else {
+        free(data);
+    }
+    for (size_t i = 0; i < pol->pol.fs_rule_count; i++) {
+        free(resolved[i]);
+    }
+    free(resolved);
+    free(trie.edges);
+    free(trie.nodes);
+    sst_policy_free(pol);
+    return denied ? 2 : 0;
+}
+
+#if defined(SST_LIBRARY) || defined(SST_BAKED_POLICY)
+// Built as libsst, or with a baked policy: main() is not this. The command
+// line tool stays in under another name, so that the rest of this file
+// doesn't count as unused (the compiler drops it all anyway).
+__attribute__((unused)) static int sst_main(int argc, char **argv, char *const *const envp) {
+#else
+int main(int argc, char **argv, char *const *const envp) {
+#endif
+    // First thing, so the timing covers as much of sst as possible.
+    const char* timing_spec = NULL;
+    const char* supervise_spec = NULL;
+    const char* restart_spec = NULL;
+    while (argc > 1) {
+        if (strncmp(argv[1], "--timing=", 9) == 0) {
+            timing_spec = argv[1] + 9;
+        } else if (strncmp(argv[1], "--supervise=", 12) == 0) {
+            supervise_spec = argv[1] + 12;
+        } else if (strncmp(argv[1], "--restart=", 10) == 0) {
+            restart_spec = argv[1] + 10;
+        } else {
+            break;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (!timing_spec) {
+        timing_spec = getenv("SST_TIMING");
+        if (timing_spec && !timing_spec[0]) {
+            timing_spec = NULL;
+        }
+    }
+    const __u64 main_start_ns = timing_spec ? timing_now() : 0;
+
+    restrict_privileges_for_landlock();
+
+    // Is the user looking for help from their untimely demise? Or just
+    // wanting to figure out wtf is 'sst' because they saw it in a shell
+    // script somewhere. If yes, then print help, exit.
+    if ((argc == 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0)) ||
+         argc == 1) {
+        show_help(stdout);
+        exit(0);
+    }
+
+    if (strcmp(argv[1], "--compile") == 0) {
+        return compile_main(argc, argv);
+    }
+
+    if (strcmp(argv[1], "--bake") == 0) {
+        return bake_main(argc, argv);
+    }
+
+    if (strcmp(argv[1], "--serve") == 0) {
+        return serve_main(argc, argv);
+    }
+
+    if (strcmp(argv[1], "--submit") == 0) {
+        return submit_main(argc, argv, envp);
+    }
+
+    if (strcmp(argv[1], "--ruleset-cache") == 0) {
+        return ruleset_cache_main(argc, argv);
+    }
+
+    if (strcmp(argv[1], "--jobs") == 0) {
+        return jobs_main(argc, argv);
+    }
+
+    if (strcmp(argv[1], "--learn") == 0) {
+        return learn_main(argc, argv, envp);
+    }
+
+    if (strcmp(argv[1], "--exec-deps") == 0) {
+        return exec_deps_main(argc, argv);
+    }
+
+    if (strcmp(argv[1], "--check") == 0) {
+        return check_main(argc, argv);
+    }
+
+    // Find the -- separator.
+    int sep_idx = -1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            sep_idx = i;
+            break;
+        }
+    }
+
+    for (int i1 = 1; i1 < sep_idx; i1++) {
+        if (strcmp(argv[i1], "--help") == 0 ||
+            strcmp(argv[i1], "-h") == 0) {
+            show_help(stderr);
+            exit(1);
+        }
+    }
+
+    if (sep_idx == -1) {
+        fatal_error("missing '--' separator in arguments");
+    }
+
+    if (sep_idx == argc - 1) {
+        fatal_error("no command specified after '--'");
+    }
+
+    const int supervise_fd = supervise_spec ? supervise_parse_fd(supervise_spec) : -1;
+    supervise_restart restart = {0};
+    if (restart_spec) {
+        supervise_parse_restart(restart_spec, &restart);
+    }
+
+    if (timing_spec) {
+        timing_init(timing_spec, main_start_ns);
+    }
+
+    __u64 start_ns = timing_start();
+    // Placement, prewarm and listening socket options first, so that a bad
+    // one fails before any sandboxing work; the rest is the policy.
+    placement place = {0};
+    prewarm warm = {0};
+    listen_sockets sockets = {0};
+    int command_exec_deps = 0;
+    char** options = malloc(sizeof(char*) * (size_t)sep_idx);
+    if (!options) {
+        fatal_error_errno("malloc(...) failed.");
+    }
+    size_t option_count = 0;
+    for (int i = 1; i < sep_idx; i++) {
+        if (strcmp(argv[i], "EXEC_DEPS") == 0) {
+            command_exec_deps = 1;
+        } else if (!placement_parse(&place, argv[i]) && !prewarm_parse(&warm, argv[i]) &&
+                   !listen_parse(&sockets, argv[i])) {
+            options[option_count++] = argv[i];
+        }
+    }
+
+    sst_policy* pol = sst_policy_new();
+    if (!pol) {
+        fatal_error_errno("out of memory");
+    }
+    if (sst_policy_add_options(pol, (const char* const*)options, option_count) != 0) {
+        fatal_error("%s", sst_error());
+    }
+    free(options);
+    timing_end("parse", start_ns);
+
+    if (command_exec_deps) {
+        start_ns = timing_start();
+        exec_deps_add_rules(&pol->pol, argv[sep_idx + 1], 1);
+        timing_end("exec_deps", start_ns);
+    }
+
+    start_ns = timing_start();
+    const int command_idx = coalesce_nested(&pol->pol, argc, argv, sep_idx + 1);
+    timing_end("coalesce", start_ns);
+
+    if (supervise_fd >= 0 || restart.enabled) {
+        // From here on, we are the child.
+        supervise_command(supervise_fd, &restart, &argv[command_idx]);
+    }
+
+    prewarm_start(&warm, argv[command_idx]);
+
+    // The command will be this thread (a prewarm thread only reads, and is
+    // gone by exec), so it's the one to restrict; and this way, ABI 5-7
+    // kernels work too.
+    if (sst_policy_apply(pol, SST_APPLY_THIS_THREAD) != 0) {
+        print_deferred_warnings();
+        fatal_error("%s", sst_error());
+    }
+    print_deferred_warnings();
+
+    const char *command = argv[command_idx];
+    char *const *command_args = &argv[command_idx];
+
+    // Before timing_write(), which is the last thing before exec.
+    prewarm_finish(&warm);
+
+    if (sst_timing) {
+        start_ns = timing_now();
+        char* found = path_search(command);
+        timing_end("path_search", start_ns);
+        timing_write(&pol->pol);
+        if (found) {
+            command = found;
+        }
+    }
+
+    placement_apply(&place);
+    char* const* command_envp = listen_apply(&sockets, envp);
+
+    execvpe(command, command_args, command_envp);
+
+    fatal_error_errno("execvpe failed");
+}
+
+#ifdef SST_BAKED_POLICY
+#include SST_BAKED_POLICY
+
+// sst-<name> [--] command arg1 ... argN
+//
+// The policy was parsed and checked by `sst --bake`; all that's left is
+// what has to happen on this machine, at this time.
+int main(int argc, char **argv, char *const *const envp) {
+    const int command_idx = argc > 1 && strcmp(argv[1], "--") == 0 ? 2 : 1;
+    if (command_idx >= argc) {
+        fatal_error("usage: %s [--] command arg1 ... argN", argv[0]);
+    }
+
+    restrict_privileges_for_landlock();
+    apply_policy(&baked_policy);
+    print_deferred_warnings();
+
+    execvpe(argv[command_idx], &argv[command_idx], envp);
+
+    fatal_error_errno("execvpe failed");
+}
+#endif
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// libsst: what `sst` does, for programs that want to sandbox themselves.
+//
+// Build with `make lib` (libsst.a and libsst.so). `sst` itself is built
+// on top of these same functions.
+//
+// A program can load its plugins, open its caches etc. and then lock itself
+// down, with no wrapper exec:
+//
+//   sst_policy* pol = sst_policy_new();
+//   sst_policy_add_option(pol, "ENABLE_FILESYSTEM_SANDBOXING");
+//   sst_policy_add_path_beneath(pol, "/usr", SST_EXEC);
+//   sst_policy_add_path_beneath(pol, "/var/lib/myservice", SST_WRITE);
+//   if (sst_policy_apply(pol, 0) != 0) {
+//       fprintf(stderr, "cannot sandbox: %s\n", sst_error());
+//       abort();
+//   }
+//   sst_policy_free(pol);
+//
+// Functions that return int return 0 on success, and -1 on failure with
+// errno set and a message for sst_error(). Path problems (a path that
+// doesn't exist, a FILE_* rule on a directory...) are only noticed by
+// sst_policy_apply(), as with `sst`.
+//
+// (c) 2025 Mikko Juola
+//
+
+#ifndef SST_H
+#define SST_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sst_policy sst_policy;
+
+// The READ / EXEC / WRITE / EXEC_WRITE of the FILE_* and PATH_BENEATH_*
+// options. EXEC and WRITE include READ.
+typedef enum sst_access {
+    SST_READ,
+    SST_EXEC,
+    SST_WRITE,
+    SST_EXEC_WRITE,
+} sst_access;
+
+// For sst_policy_enable().
+#define SST_FILESYSTEM 1u
+#define SST_NETWORK    2u
+
+// For sst_policy_add_tcp_ports().
+#define SST_INCOMING 1u
+#define SST_OUTGOING 2u
+
+// For sst_policy_apply(): restrict the calling thread only. Without it,
+// every thread of the process is restricted.
+#define SST_APPLY_THIS_THREAD 1u
+
+// Returns NULL (with errno set) if out of memory.
+sst_policy* sst_policy_new(void);
+void sst_policy_free(sst_policy* pol);
+
+// Adds one `sst` command line option, e.g. "FILE_READ:/etc/hosts",
+// "PATH_BENEATH_READ_LIST:/etc/myservice/paths" or "POLICY_FILE:x.policy".
+// The string is copied.
+int sst_policy_add_option(sst_policy* pol, const char* option);
+
+// Adds `count` options, exactly as if they were given to `sst` on the
+// command line (e.g. ENABLE_* may come after the rules that need them).
+int sst_policy_add_options(sst_policy* pol, const char* const* options, size_t count);
+
+// ENABLE_FILESYSTEM_SANDBOXING and/or ENABLE_NETWORK_SANDBOXING.
+int sst_policy_enable(sst_policy* pol, unsigned int what);
+
+// FILE_<access>:<path> and PATH_BENEATH_<access>:<path>. The path is copied.
+int sst_policy_add_file(sst_policy* pol, const char* path, sst_access access);
+int sst_policy_add_path_beneath(sst_policy* pol, const char* path, sst_access access);
+
+// Ports first..last (inclusive) in the given SST_INCOMING / SST_OUTGOING
+// directions.
+int sst_policy_add_tcp_ports(sst_policy* pol, unsigned int first, unsigned int last, unsigned int directions);
+
+// Builds the Landlock ruleset and restricts the process (or with
+// SST_APPLY_THIS_THREAD, the calling thread) with it. This can't be undone.
+//
+// Restricting the other threads of a running process needs a kernel with
+// Landlock ABI 8 or later (LANDLOCK_RESTRICT_SELF_TSYNC). On older kernels
+// this fails if the process already has more than one thread; apply the
+// policy before starting any, or use SST_APPLY_THIS_THREAD.
+//
+// Like `sst`, this sets no_new_privs on the calling thread.
+//
+// The policy can be applied again, e.g. on other threads with
+// SST_APPLY_THIS_THREAD.
+int sst_policy_apply(sst_policy* pol, unsigned int flags);
+
+// Per-thread sandboxing: Landlock restricts threads, not processes, so
+// threads of one process can run under different policies, e.g. a pool of
+// workers parsing untrusted input next to ones doing trusted I/O:
+//
+//   sst_ruleset* parsers = sst_ruleset_new(parser_policy);   // once
+//   ...
+//   // on each parser thread, before it touches any input:
+//   if (sst_ruleset_apply_thread(parsers) != 0) abort();
+//
+// Threads share the address space, so this only protects against what a
+// thread can do with system calls (open files, connect...); it is no
+// defense against a thread that gets to run arbitrary code, as that code
+// can reach into its unrestricted neighbours' memory.
+
+typedef struct sst_ruleset sst_ruleset;
+
+// Builds the Landlock ruleset for `pol` once (paths are opened and checked
+// here). The policy isn't needed afterwards. Returns NULL on failure.
+sst_ruleset* sst_ruleset_new(sst_policy* pol);
+
+// Restricts the calling thread, and the threads it starts afterwards, with
+// `ruleset`: no_new_privs plus one landlock_restrict_self(). Safe to call
+// from many threads at once. Threads can be restricted again with more
+// rulesets, which only ever takes access away.
+int sst_ruleset_apply_thread(const sst_ruleset* ruleset);
+
+// Threads already restricted with it stay restricted.
+void sst_ruleset_free(sst_ruleset* ruleset);
+
+// Starts `path` (no $PATH search) with `argv` and `envp`, restricted with
+// `ruleset`, like posix_spawn(). The child shares our memory until it
+// exec()s (clone() with CLONE_VM | CLONE_VFORK) and only sets no_new_privs,
+// restricts itself and calls execve(), so the cost of starting it doesn't
+// grow with the size of the calling process, unlike with fork().
+//
+// Returns 0 with the child's pid in *pid_out once the child has exec()ed;
+// if anything in the child failed, returns -1 with errno set (the child has
+// been reaped then). Signal handlers are reset to SIG_DFL in the child; the
+// signal mask and file descriptors are inherited as usual.
+int sst_spawn(pid_t* pid_out, const char* path, const sst_ruleset* ruleset,
+              char* const argv[], char* const envp[]);
+
+// The message of the last failure on the calling thread.
+const char* sst_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
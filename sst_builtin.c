@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// `sst` as a bash loadable builtin.
+//
+// Build with `make builtin` (needs bash's loadable builtin headers, e.g.
+// Debian's bash-builtins package), then in bash:
+//
+//   enable -f ./sst_builtin.so sst
+//   sst ENABLE_FILESYSTEM_SANDBOXING PATH_BENEATH_EXEC:/ -- make
+//
+// The builtin takes the same options as `sst` and goes through the same
+// libsst code (sst.c is linked in). Bash forks once, the child applies the
+// policy and exec()s the command directly: compared to running the `sst`
+// executable, that's one execve() and sst's own start-up less per wrapped
+// command. `enable -n sst` goes back to the executable.
+//
+// Only the sandboxing options are understood; --timing and the --modes
+// (--compile, --serve, ...) need the `sst` executable, and nested `sst`s
+// after `--` are not merged into one layer. Of EXEC_DEPS, only
+// EXEC_DEPS:<path> works: bare EXEC_DEPS (rules for the command after `--`)
+// is handled by the executable's main(), not by the policy parser. The
+// same goes for LISTEN_TCP:<addr>:<port>, which the builtin rejects.
+//
+// Needs bash 5.1 or later (make_child() and wait_for() with flags).
+//
+// (c) 2025 Mikko Juola
+//
+
+// bash's config.h may define it too.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <config.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "loadables.h"
+#include "jobs.h"
+#include "trap.h"
+
+#include "sst.h"
+
+extern char** environ;
+
+// Runs in the forked child. Does not return.
+static void sst_builtin_exec(sst_policy* pol, char** command_args) {
+    reset_terminating_signals();
+    restore_original_signals();
+
+    // We are a fork of bash, which has only the one thread.
+    if (sst_policy_apply(pol, SST_APPLY_THIS_THREAD) != 0) {
+        fprintf(stderr, "sst: error: %s\n", sst_error());
+        _exit(1);
+    }
+
+    maybe_make_export_env();
+    // execvpe() searches the PATH of the current environment, and bash's
+    // variables only get there through export_env.
+    environ = export_env;
+    execvpe(command_args[0], command_args, export_env);
+
+    fprintf(stderr, "sst: error: execvpe failed: %s\n", strerror(errno));
+    _exit(1);
+}
+
+int sst_builtin(WORD_LIST* list) {
+    if (!list) {
+        builtin_usage();
+        return EX_USAGE;
+    }
+
+    int argc = 0;
+    char** argv = strvec_from_word_list(list, 0, 0, &argc);
+
+    int sep_idx = -1;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            sep_idx = i;
+            break;
+        }
+    }
+    if (sep_idx == -1) {
+        builtin_error("missing '--' separator in arguments");
+        free(argv);
+        return EX_USAGE;
+    }
+    if (sep_idx == argc - 1) {
+        builtin_error("no command specified after '--'");
+        free(argv);
+        return EX_USAGE;
+    }
+
+    // Parsing (and reading *_LIST and POLICY_FILE files) happens here, so
+    // mistakes are reported without forking; the paths are opened in the
+    // child.
+    sst_policy* pol = sst_policy_new();
+    if (!pol) {
+        builtin_error("out of memory");
+        free(argv);
+        return EXECUTION_FAILURE;
+    }
+    if (sst_policy_add_options(pol, (const char* const*)argv, (size_t)sep_idx) != 0) {
+        builtin_error("%s", sst_error());
+        sst_policy_free(pol);
+        free(argv);
+        return EXECUTION_FAILURE;
+    }
+
+    // The job table owns the command text.
+    const pid_t pid = make_child(string_list(list), FORK_SYNC);
+    if (pid == 0) {
+        sst_builtin_exec(pol, &argv[sep_idx + 1]);
+    }
+    sst_policy_free(pol);
+    free(argv);
+    if (pid < 0) {
+        return EXECUTION_FAILURE;
+    }
+
+    stop_pipeline(0, (COMMAND*)NULL);
+    return wait_for(pid, 0);
+}
+
+char* sst_doc[] = {
+    "Run a command under an sst (Landlock) sandbox.",
+    "",
+    "Takes the same options as the sst executable, e.g.",
+    "",
+    "    sst ENABLE_FILESYSTEM_SANDBOXING PATH_BENEATH_EXEC:/ -- make",
+    "",
+    "The command is run in a single forked child, without executing sst.",
+    "Returns the exit status of the command.",
+    (char*)NULL
+};
+
+struct builtin sst_struct = {
+    "sst",
+    sst_builtin,
+    BUILTIN_ENABLED,
+    sst_doc,
+    "sst option1 option2 ... optionN -- command [arg ...]",
+    0
+};
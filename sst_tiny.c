@@ -0,0 +1,1054 @@
+// SPDX-License-Identifier: GPL-3.0-only
+//
+// sst-tiny: the `sst` command line, without libc.
+//
+// Build with `make tiny`. Most of what `sst` spends before exec()ing the
+// command is libc getting itself ready (static PIE relocations, stdio,
+// locale, TLS...), and the sandboxing itself is a handful of system calls.
+// This is those system calls and nothing else: no allocator, no stdio, no
+// threads, a few KB of static non-PIE code that starts at _start.
+//
+// It takes the same sandboxing options as `sst` and sandboxes exactly the
+// same way; the rules go straight into the ruleset while the arguments are
+// read. What it leaves out:
+//
+//  - the --modes (--compile, --serve, --submit, --ruleset-cache, --bake) and
+//    --timing; SST_TIMING is ignored.
+//  - RESOLVE_THREADS, RULESET_CACHE and OPTIMIZE_RULES are accepted but do
+//    nothing: paths are opened one by one, and rules are not merged (the
+//    ruleset allows the same either way).
+//  - a nested `sst` after `--` is exec()ed, not merged into one layer.
+//  - EXEC_DEPS and EXEC_DEPS:<path> are not recognized; working out an
+//    executable's libraries takes an ELF reader and a cache, not a few
+//    system calls. List the FILE_EXEC rules (`sst --exec-deps`) instead.
+//  - LISTEN_TCP:<addr>:<port> is not recognized; bind the port in the
+//    command (ALLOW_INCOMING_TCP_PORT) instead.
+//
+// x86_64 and aarch64 only.
+//
+// (c) 2025 Mikko Juola
+//
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/fcntl.h>
+#include <linux/landlock.h>
+#include <linux/mman.h>
+#include <linux/prctl.h>
+#include <linux/stat.h>
+#include <asm/unistd.h>
+
+#ifndef LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON
+#define LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON 2
+#endif
+
+/****
+ * SYSTEM CALLS
+ *
+ * Return values are the kernel's: negative errno on failure.
+ ****/
+
+#if defined(__x86_64__)
+
+__asm__(
+    ".text\n"
+    ".global _start\n"
+    "_start:\n"
+    "    xor %ebp, %ebp\n"
+    "    mov %rsp, %rdi\n"
+    "    and $-16, %rsp\n"
+    "    call tiny_main\n"
+    "    hlt\n");
+
+static long sys6(long n, long a, long b, long c, long d, long e, long f) {
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+    long ret;
+    __asm__ volatile ("syscall"
+                      : "=a"(ret)
+                      : "a"(n), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+                      : "rcx", "r11", "memory");
+    return ret;
+}
+
+#elif defined(__aarch64__)
+
+__asm__(
+    ".text\n"
+    ".global _start\n"
+    "_start:\n"
+    "    mov x29, #0\n"
+    "    mov x30, #0\n"
+    "    mov x0, sp\n"
+    "    and sp, x0, #-16\n"
+    "    bl tiny_main\n"
+    "    brk #0\n");
+
+static long sys6(long n, long a, long b, long c, long d, long e, long f) {
+    register long x8 __asm__("x8") = n;
+    register long x0 __asm__("x0") = a;
+    register long x1 __asm__("x1") = b;
+    register long x2 __asm__("x2") = c;
+    register long x3 __asm__("x3") = d;
+    register long x4 __asm__("x4") = e;
+    register long x5 __asm__("x5") = f;
+    __asm__ volatile ("svc 0"
+                      : "+r"(x0)
+                      : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5)
+                      : "memory");
+    return x0;
+}
+
+#else
+#error "sst-tiny only knows how to make system calls on x86_64 and aarch64; build sst instead"
+#endif
+
+static long sys3(long n, long a, long b, long c) {
+    return sys6(n, a, b, c, 0, 0, 0);
+}
+
+__attribute__((noreturn)) static void sys_exit(int status) {
+    for (;;) {
+        sys3(__NR_exit_group, status, 0, 0);
+    }
+}
+
+static long sys_write(int fd, const void* buf, size_t len) {
+    return sys3(__NR_write, fd, (long)buf, (long)len);
+}
+
+static long sys_read(int fd, void* buf, size_t len) {
+    return sys3(__NR_read, fd, (long)buf, (long)len);
+}
+
+static long sys_open(const char* path, int flags) {
+    return sys6(__NR_openat, AT_FDCWD, (long)path, flags, 0, 0, 0);
+}
+
+static long sys_close(int fd) {
+    return sys3(__NR_close, fd, 0, 0);
+}
+
+static long sys_statx_fd(int fd, struct statx* stx) {
+    return sys6(__NR_statx, fd, (long)"", AT_EMPTY_PATH, STATX_TYPE | STATX_SIZE, (long)stx, 0);
+}
+
+static void* sys_mmap(void* addr, size_t len, int prot, int flags, int fd) {
+    return (void*)sys6(__NR_mmap, (long)addr, (long)len, prot, flags, fd, 0);
+}
+
+static int mmap_failed(const void* p) {
+    return (unsigned long)p > -4096UL;
+}
+
+/****
+ * STRINGS
+ ****/
+
+// The compiler may still emit calls to these for struct copies and
+// initializers.
+void* memset(void* dst, int c, size_t n) {
+    unsigned char* d = dst;
+    while (n--) {
+        *d++ = (unsigned char)c;
+    }
+    return dst;
+}
+
+void* memcpy(void* dst, const void* src, size_t n) {
+    unsigned char* d = dst;
+    const unsigned char* s = src;
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dst;
+}
+
+static size_t str_len(const char* s) {
+    size_t n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+static int str_eq(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Returns what follows `prefix` in `s`, or NULL if `s` doesn't start with it.
+static const char* after_prefix(const char* s, const char* prefix) {
+    while (*prefix) {
+        if (*s++ != *prefix++) {
+            return NULL;
+        }
+    }
+    return s;
+}
+
+// Parses a decimal number of at most `max_digits` digits, all of `s`.
+static int parse_decimal(const char* s, size_t max_digits, long* out) {
+    long n = 0;
+    size_t digits = 0;
+    for (; *s; s++, digits++) {
+        if (*s < '0' || *s > '9' || digits == max_digits) {
+            return -1;
+        }
+        n = n * 10 + (*s - '0');
+    }
+    if (digits == 0) {
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+// glibc's messages, for the errors we can expect to hit.
+static const char* error_string(int err) {
+    switch (err) {
+        case EPERM: return "Operation not permitted";
+        case ENOENT: return "No such file or directory";
+        case EIO: return "Input/output error";
+        case E2BIG: return "Argument list too long";
+        case ENOEXEC: return "Exec format error";
+        case EBADF: return "Bad file descriptor";
+        case ENOMEM: return "Cannot allocate memory";
+        case EACCES: return "Permission denied";
+        case EFAULT: return "Bad address";
+        case ENOTDIR: return "Not a directory";
+        case EISDIR: return "Is a directory";
+        case EINVAL: return "Invalid argument";
+        case ENFILE: return "Too many open files in system";
+        case EMFILE: return "Too many open files";
+        case ETXTBSY: return "Text file busy";
+        case ENAMETOOLONG: return "File name too long";
+        case ENOSYS: return "Function not implemented";
+        case ELOOP: return "Too many levels of symbolic links";
+        case ENOMSG: return "No message of desired type";
+        case EOPNOTSUPP: return "Operation not supported";
+        default: return NULL;
+    }
+}
+
+/****
+ * ERRORS
+ *
+ * A formatter with just enough of printf for the messages in this file:
+ * %s, %d, %u and %%.
+ ****/
+
+typedef struct sout_buf {
+    char data[1024];
+    size_t len;
+} out_buf;
+
+static void out_str(out_buf* out, const char* s) {
+    while (*s && out->len < sizeof(out->data)) {
+        out->data[out->len++] = *s++;
+    }
+}
+
+static void out_unsigned(out_buf* out, unsigned long n) {
+    char digits[24];
+    size_t i = sizeof(digits);
+    digits[--i] = '\0';
+    do {
+        digits[--i] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    out_str(out, &digits[i]);
+}
+
+static void out_signed(out_buf* out, long n) {
+    if (n < 0) {
+        out_str(out, "-");
+        out_unsigned(out, -(unsigned long)n);
+    } else {
+        out_unsigned(out, (unsigned long)n);
+    }
+}
+
+static void out_format(out_buf* out, const char* fmt, va_list args) {
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            if (out->len < sizeof(out->data)) {
+                out->data[out->len++] = *fmt;
+            }
+            continue;
+        }
+        switch (*++fmt) {
+            case 's': out_str(out, va_arg(args, const char*)); break;
+            case 'd': out_signed(out, va_arg(args, int)); break;
+            case 'u': out_unsigned(out, va_arg(args, unsigned int)); break;
+            case '%': out_str(out, "%"); break;
+            default: return;
+        }
+    }
+}
+
+static void out_flush(out_buf* out, int fd) {
+    const char* p = out->data;
+    size_t len = out->len;
+    while (len > 0) {
+        const long written = sys_write(fd, p, len);
+        if (written == -EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    out->len = 0;
+}
+
+static void print(int fd, const char* fmt, ...) {
+    out_buf out = { .len = 0 };
+    va_list args;
+    va_start(args, fmt);
+    out_format(&out, fmt, args);
+    va_end(args);
+    out_flush(&out, fd);
+}
+
+__attribute__((noreturn)) static void fatal_error(const char* fmt, ...) {
+    out_buf out = { .len = 0 };
+    out_str(&out, "sst: error: ");
+    va_list args;
+    va_start(args, fmt);
+    out_format(&out, fmt, args);
+    va_end(args);
+    out_str(&out, "\n");
+    out_flush(&out, 2);
+    sys_exit(1);
+}
+
+// There is no errno; `err` is the (positive) error of the failed call.
+__attribute__((noreturn)) static void fatal_error_errno(int err, const char* fmt, ...) {
+    out_buf out = { .len = 0 };
+    out_str(&out, "sst: error: ");
+    va_list args;
+    va_start(args, fmt);
+    out_format(&out, fmt, args);
+    va_end(args);
+    out_str(&out, ": ");
+    const char* msg = error_string(err);
+    if (msg) {
+        out_str(&out, msg);
+    } else {
+        out_str(&out, "Unknown error ");
+        out_signed(&out, err);
+    }
+    out_str(&out, "\n");
+    out_flush(&out, 2);
+    sys_exit(1);
+}
+
+/****
+ * RULES
+ *
+ * The access masks and option names are those of sst.c.
+ ****/
+
+static const __u32 FULL_FS_ACCESS =
+    LANDLOCK_ACCESS_FS_EXECUTE |
+    LANDLOCK_ACCESS_FS_WRITE_FILE |
+    LANDLOCK_ACCESS_FS_READ_FILE |
+    LANDLOCK_ACCESS_FS_READ_DIR |
+    LANDLOCK_ACCESS_FS_REMOVE_DIR |
+    LANDLOCK_ACCESS_FS_REMOVE_FILE |
+    LANDLOCK_ACCESS_FS_MAKE_CHAR |
+    LANDLOCK_ACCESS_FS_MAKE_DIR |
+    LANDLOCK_ACCESS_FS_MAKE_REG |
+    LANDLOCK_ACCESS_FS_MAKE_SOCK |
+    LANDLOCK_ACCESS_FS_MAKE_FIFO |
+    LANDLOCK_ACCESS_FS_MAKE_BLOCK |
+    LANDLOCK_ACCESS_FS_MAKE_SYM |
+    LANDLOCK_ACCESS_FS_REFER |
+    LANDLOCK_ACCESS_FS_TRUNCATE |
+    LANDLOCK_ACCESS_FS_IOCTL_DEV;
+
+#define READ_ACCESS_FILELIKE \
+    (LANDLOCK_ACCESS_FS_READ_FILE)
+#define READ_ACCESS_DIR \
+    (LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_READ_DIR)
+#define READ_EXEC_ACCESS_FILELIKE \
+    (LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_READ_FILE)
+#define READ_EXEC_ACCESS_DIR \
+    (LANDLOCK_ACCESS_FS_EXECUTE | LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_READ_DIR)
+#define READ_WRITE_ACCESS_FILELIKE \
+    (LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_WRITE_FILE | \
+     LANDLOCK_ACCESS_FS_TRUNCATE | LANDLOCK_ACCESS_FS_IOCTL_DEV)
+#define READ_WRITE_ACCESS_DIR \
+    (LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_READ_DIR | LANDLOCK_ACCESS_FS_WRITE_FILE | \
+     LANDLOCK_ACCESS_FS_REMOVE_FILE | LANDLOCK_ACCESS_FS_REMOVE_DIR | LANDLOCK_ACCESS_FS_MAKE_REG | \
+     LANDLOCK_ACCESS_FS_MAKE_DIR | LANDLOCK_ACCESS_FS_MAKE_SYM | LANDLOCK_ACCESS_FS_TRUNCATE | \
+     LANDLOCK_ACCESS_FS_IOCTL_DEV)
+#define EXEC_WRITE_FILE_ACCESS_FILELIKE \
+    (READ_WRITE_ACCESS_FILELIKE | LANDLOCK_ACCESS_FS_EXECUTE)
+#define EXEC_WRITE_FILE_ACCESS_DIR \
+    (READ_WRITE_ACCESS_DIR | LANDLOCK_ACCESS_FS_EXECUTE)
+
+typedef struct sfs_option {
+    const char* prefix;
+    const char* list_prefix;
+    const char* name;
+    int is_directory;
+    __u32 access;
+} fs_option;
+
+static const fs_option FS_OPTIONS[] = {
+    { "FILE_READ:",               "FILE_READ_LIST:",               "FILE_READ",               0, READ_ACCESS_FILELIKE },
+    { "FILE_EXEC:",               "FILE_EXEC_LIST:",               "FILE_EXEC",               0, READ_EXEC_ACCESS_FILELIKE },
+    { "FILE_WRITE:",              "FILE_WRITE_LIST:",              "FILE_WRITE",              0, READ_WRITE_ACCESS_FILELIKE },
+    { "FILE_EXEC_WRITE:",         "FILE_EXEC_WRITE_LIST:",         "FILE_EXEC_WRITE",         0, EXEC_WRITE_FILE_ACCESS_FILELIKE },
+    { "FILE_WRITE_EXEC:",         "FILE_WRITE_EXEC_LIST:",         "FILE_EXEC_WRITE",         0, EXEC_WRITE_FILE_ACCESS_FILELIKE },
+    { "PATH_BENEATH_READ:",       "PATH_BENEATH_READ_LIST:",       "PATH_BENEATH_READ",       1, READ_ACCESS_DIR },
+    { "PATH_BENEATH_EXEC:",       "PATH_BENEATH_EXEC_LIST:",       "PATH_BENEATH_EXEC",       1, READ_EXEC_ACCESS_DIR },
+    { "PATH_BENEATH_WRITE:",      "PATH_BENEATH_WRITE_LIST:",      "PATH_BENEATH_WRITE",      1, READ_WRITE_ACCESS_DIR },
+    { "PATH_BENEATH_EXEC_WRITE:", "PATH_BENEATH_EXEC_WRITE_LIST:", "PATH_BENEATH_EXEC_WRITE", 1, EXEC_WRITE_FILE_ACCESS_DIR },
+    { "PATH_BENEATH_WRITE_EXEC:", "PATH_BENEATH_WRITE_EXEC_LIST:", "PATH_BENEATH_EXEC_WRITE", 1, EXEC_WRITE_FILE_ACCESS_DIR },
+};
+
+typedef struct snet_option {
+    const char* prefix;
+    const char* name;
+    int is_list;
+    __u64 access;
+} net_option;
+
+static const net_option NET_OPTIONS[] = {
+    { "ALLOW_INCOMING_TCP_PORT:",  "ALLOW_INCOMING_TCP_PORT",  0, LANDLOCK_ACCESS_NET_BIND_TCP },
+    { "ALLOW_OUTGOING_TCP_PORT:",  "ALLOW_OUTGOING_TCP_PORT",  0, LANDLOCK_ACCESS_NET_CONNECT_TCP },
+    { "ALLOW_INCOMING_TCP_PORTS:", "ALLOW_INCOMING_TCP_PORTS", 1, LANDLOCK_ACCESS_NET_BIND_TCP },
+    { "ALLOW_OUTGOING_TCP_PORTS:", "ALLOW_OUTGOING_TCP_PORTS", 1, LANDLOCK_ACCESS_NET_CONNECT_TCP },
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct sruleset {
+    int fd;
+    __u64 handled_fs;
+} ruleset;
+
+// Opens `path` and adds a rule for it, checking it the way sst does.
+static void add_fs_rule(const ruleset* rs, const char* path, int is_directory, __u32 access) {
+    // O_PATH is all Landlock needs.
+    const long fd = sys_open(path, O_PATH | O_CLOEXEC);
+    if (fd < 0) {
+        fatal_error_errno((int)-fd, "cannot open '%s' for sandboxing", path);
+    }
+    struct statx stx;
+    const long ret = sys_statx_fd((int)fd, &stx);
+    if (ret < 0) {
+        fatal_error_errno((int)-ret, "Cannot invoke fstat on '%s'", path);
+    }
+    const __u16 mode = stx.stx_mode;
+    if (is_directory) {
+        if (!S_ISDIR(mode)) {
+            fatal_error("PATH_BENEATH_*: '%s' is not a directory", path);
+        }
+    } else {
+        if (!S_ISREG(mode) && !S_ISBLK(mode) && !S_ISCHR(mode)) {
+            fatal_error("FILE_*: '%s' is not a file-like entity.", path);
+        }
+    }
+
+    const struct landlock_path_beneath_attr attr = {
+        .parent_fd = (int)fd,
+        .allowed_access = access & rs->handled_fs,
+    };
+    const long added = sys6(__NR_landlock_add_rule, rs->fd, LANDLOCK_RULE_PATH_BENEATH, (long)&attr, 0, 0, 0);
+    if (added < 0) {
+        fatal_error_errno((int)-added, "failed to add filesystem rule to file '%s'", path);
+    }
+    sys_close((int)fd);
+}
+
+static void add_net_rule(const ruleset* rs, long port, __u64 access) {
+    const struct landlock_net_port_attr attr = {
+        .port = (__u64)port,
+        .allowed_access = access,
+    };
+    const long added = sys6(__NR_landlock_add_rule, rs->fd, LANDLOCK_RULE_NET_PORT, (long)&attr, 0, 0, 0);
+    if (added < 0) {
+        fatal_error_errno((int)-added, "failed to add network rule");
+    }
+}
+
+static int parse_port(const char* str, long* port_out) {
+    return parse_decimal(str, 5, port_out) != 0 || *port_out > 65535 ? -1 : 0;
+}
+
+// "<port>[-<port>][,...]"; returns -1 if malformed. Nothing is added then,
+// and nothing at all if `rs` is NULL (only checking).
+static int add_port_list(const ruleset* rs, const char* str, __u64 access) {
+    for (int pass = 0; pass < (rs ? 2 : 1); pass++) {
+        const char* p = str;
+        for (;;) {
+            // Longest valid item is "65535-65535".
+            char item[12];
+            size_t len = 0;
+            while (p[len] && p[len] != ',') {
+                if (len == sizeof(item) - 1) {
+                    return -1;
+                }
+                item[len] = p[len];
+                len++;
+            }
+            if (len == 0) {
+                return -1;
+            }
+            item[len] = '\0';
+
+            long first, last;
+            char* dash = NULL;
+            for (size_t i = 0; i < len; i++) {
+                if (item[i] == '-') {
+                    dash = &item[i];
+                    break;
+                }
+            }
+            if (dash) {
+                *dash = '\0';
+                if (parse_port(item, &first) != 0 || parse_port(dash + 1, &last) != 0 || first > last) {
+                    return -1;
+                }
+            } else {
+                if (parse_port(item, &first) != 0) {
+                    return -1;
+                }
+                last = first;
+            }
+            // The first pass only checks, like sst, which parses everything
+            // before building anything.
+            if (pass == 1) {
+                for (long port = first; port <= last; port++) {
+                    add_net_rule(rs, port, access);
+                }
+            }
+
+            p += len;
+            if (*p++ != ',') {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+/****
+ * LISTS AND POLICY FILES
+ ****/
+
+// Reads all of `fd` into a fresh mapping (NUL-terminated); its size goes to
+// `size_out` and the mapping's to `map_size_out`. Returns NULL with the
+// error in `*err_out` on failure.
+static char* read_all(int fd, size_t* size_out, size_t* map_size_out, int* err_out) {
+    size_t capacity = 64 * 1024;
+    size_t size = 0;
+    char* buf = sys_mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+    if (mmap_failed(buf)) {
+        *err_out = (int)-(long)buf;
+        return NULL;
+    }
+    for (;;) {
+        if (capacity - size < 4096) {
+            char* bigger = (char*)sys6(__NR_mremap, (long)buf, (long)capacity, (long)capacity * 2,
+                                       MREMAP_MAYMOVE, 0, 0);
+            if (mmap_failed(bigger)) {
+                *err_out = (int)-(long)bigger;
+                return NULL;
+            }
+            buf = bigger;
+            capacity *= 2;
+        }
+        const long got = sys_read(fd, buf + size, capacity - size - 1);
+        if (got == -EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            *err_out = (int)-got;
+            return NULL;
+        }
+        if (got == 0) {
+            break;
+        }
+        size += (size_t)got;
+    }
+    buf[size] = '\0';
+    *size_out = size;
+    *map_size_out = capacity;
+    return buf;
+}
+
+// FILE_READ_LIST:<source> and friends: one rule per path in `source` (a
+// file, or fd:<N>), separated by NULs if there are any, newlines otherwise.
+static void add_fs_rule_list(const ruleset* rs, const fs_option* opt, const char* source) {
+    long fd;
+    const char* fd_str = after_prefix(source, "fd:");
+    if (fd_str) {
+        if (parse_decimal(fd_str, 10, &fd) != 0 || fd > 0x7fffffff) {
+            fatal_error("%s_LIST: invalid file descriptor '%s'", opt->name, source);
+        }
+    } else {
+        fd = sys_open(source, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fatal_error_errno((int)-fd, "%s_LIST: cannot open '%s'", opt->name, source);
+        }
+    }
+
+    size_t size, map_size;
+    int err = 0;
+    char* buf = read_all((int)fd, &size, &map_size, &err);
+    if (!buf) {
+        fatal_error_errno(err, "%s_LIST: cannot read '%s'", opt->name, source);
+    }
+    sys_close((int)fd);
+
+    char separator = '\n';
+    for (size_t i = 0; i < size; i++) {
+        if (buf[i] == '\0') {
+            separator = '\0';
+            break;
+        }
+    }
+    char* p = buf;
+    char* const end = buf + size;
+    while (p < end) {
+        char* sep = p;
+        while (sep < end && *sep != separator) {
+            sep++;
+        }
+        *sep = '\0';
+        if (sep > p) {
+            add_fs_rule(rs, p, opt->is_directory, opt->access);
+        }
+        p = sep + 1;
+    }
+
+    // The rules are in the ruleset; the paths aren't needed any more.
+    sys3(__NR_munmap, (long)buf, (long)map_size, 0);
+}
+
+// Must match the policy file layout in sst.c.
+#define POLICY_FILE_MAGIC "SSTPOLCY"
+#define POLICY_FILE_VERSION 1
+#define POLICY_FILE_FLAG_FS_SANDBOXING  (1U << 0)
+#define POLICY_FILE_FLAG_NET_SANDBOXING (1U << 1)
+
+typedef struct spolicy_file_header {
+    char magic[8];
+    __u32 version;
+    __u32 flags;
+    __u32 fs_rule_count;
+    __u32 net_rule_count;
+    __u32 strings_size;
+    __u32 reserved;
+} policy_file_header;
+
+typedef struct spolicy_file_fs_rule {
+    __u64 access;
+    __u32 path_offset;
+    __u32 is_directory;
+} policy_file_fs_rule;
+
+typedef struct spolicy_file_net_rule {
+    __u32 port;
+    __u32 allow_incoming;
+    __u32 allow_outgoing;
+} policy_file_net_rule;
+
+// POLICY_FILE:<path>. Without a ruleset (rs == NULL) this only checks the
+// file and returns its POLICY_FILE_FLAG_*s; with one, it adds the rules.
+static __u32 load_policy_file(const ruleset* rs, const char* filepath) {
+    const long fd = sys_open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fatal_error_errno((int)-fd, "POLICY_FILE: cannot open '%s'", filepath);
+    }
+    struct statx stx;
+    const long ret = sys_statx_fd((int)fd, &stx);
+    if (ret < 0) {
+        fatal_error_errno((int)-ret, "POLICY_FILE: cannot invoke fstat on '%s'", filepath);
+    }
+    if (!S_ISREG(stx.stx_mode)) {
+        fatal_error("POLICY_FILE: '%s' is not a regular file", filepath);
+    }
+    const size_t file_sz = (size_t)stx.stx_size;
+    if (file_sz < sizeof(policy_file_header)) {
+        fatal_error("POLICY_FILE: '%s' is too small to be a policy file", filepath);
+    }
+    const char* base = sys_mmap(NULL, file_sz, PROT_READ, MAP_PRIVATE, (int)fd);
+    if (mmap_failed(base)) {
+        fatal_error_errno((int)-(long)base, "POLICY_FILE: cannot mmap '%s'", filepath);
+    }
+    sys_close((int)fd);
+
+    policy_file_header hdr;
+    memcpy(&hdr, base, sizeof(hdr));
+    for (size_t i = 0; i < sizeof(hdr.magic); i++) {
+        if (hdr.magic[i] != POLICY_FILE_MAGIC[i]) {
+            fatal_error("POLICY_FILE: '%s' is not an sst policy file", filepath);
+        }
+    }
+    if (hdr.version != POLICY_FILE_VERSION) {
+        fatal_error("POLICY_FILE: '%s' has version %u; this sst understands version %d (recompile it with sst --compile)",
+                    filepath, hdr.version, POLICY_FILE_VERSION);
+    }
+
+    const size_t fs_off = sizeof(policy_file_header);
+    const size_t net_off = fs_off + (size_t)hdr.fs_rule_count * sizeof(policy_file_fs_rule);
+    const size_t str_off = net_off + (size_t)hdr.net_rule_count * sizeof(policy_file_net_rule);
+    if (str_off + hdr.strings_size != file_sz) {
+        fatal_error("POLICY_FILE: '%s' is truncated or corrupt", filepath);
+    }
+    if (hdr.strings_size > 0 && base[file_sz - 1] != '\0') {
+        fatal_error("POLICY_FILE: '%s' is corrupt (unterminated string table)", filepath);
+    }
+
+    const policy_file_fs_rule* fs = (const policy_file_fs_rule*)(base + fs_off);
+    const policy_file_net_rule* net = (const policy_file_net_rule*)(base + net_off);
+    const char* strings = base + str_off;
+
+    for (__u32 i = 0; i < hdr.fs_rule_count; i++) {
+        if (fs[i].path_offset >= hdr.strings_size ||
+            strings[fs[i].path_offset] == '\0' ||
+            fs[i].is_directory > 1 ||
+            (fs[i].access & ~(__u64)FULL_FS_ACCESS) != 0) {
+            fatal_error("POLICY_FILE: '%s' is corrupt (bad filesystem rule #%u)", filepath, i);
+        }
+        if (rs) {
+            add_fs_rule(rs, strings + fs[i].path_offset, (int)fs[i].is_directory, (__u32)fs[i].access);
+        }
+    }
+    for (__u32 i = 0; i < hdr.net_rule_count; i++) {
+        if (net[i].port > 65535 || net[i].allow_incoming > 1 || net[i].allow_outgoing > 1) {
+            fatal_error("POLICY_FILE: '%s' is corrupt (bad network rule #%u)", filepath, i);
+        }
+        if (rs) {
+            add_net_rule(rs, net[i].port,
+                         (net[i].allow_incoming ? LANDLOCK_ACCESS_NET_BIND_TCP : 0) |
+                         (net[i].allow_outgoing ? LANDLOCK_ACCESS_NET_CONNECT_TCP : 0));
+        }
+    }
+
+    sys3(__NR_munmap, (long)base, (long)file_sz, 0);
+    return hdr.flags;
+}
+
+/****
+ * EXEC
+ ****/
+
+static const char* env_get(char** envp, const char* name) {
+    for (; *envp; envp++) {
+        const char* p = *envp;
+        const char* n = name;
+        while (*n && *p == *n) {
+            p++;
+            n++;
+        }
+        if (!*n && *p == '=') {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// execve(), and if `path` turns out to be a script without a #! line, run
+// it with /bin/sh like execvpe() does. args[-1] must be ours to overwrite;
+// it and args[0] are put back if that fails too, for the next candidate in
+// $PATH. Returns the error.
+static int try_exec(const char* path, char** args, char** envp) {
+    long ret = sys3(__NR_execve, (long)path, (long)args, (long)envp);
+    if (ret == -ENOEXEC) {
+        char** sh_args = args - 1;
+        char* const saved[2] = { sh_args[0], sh_args[1] };
+        sh_args[0] = "/bin/sh";
+        sh_args[1] = (char*)path;
+        ret = sys3(__NR_execve, (long)"/bin/sh", (long)sh_args, (long)envp);
+        sh_args[0] = saved[0];
+        sh_args[1] = saved[1];
+    }
+    return (int)-ret;
+}
+
+// execvpe(): $PATH from `envp`, /bin:/usr/bin without it. Does not return.
+__attribute__((noreturn)) static void exec_command(char** args, char** envp) {
+    const char* file = args[0];
+    int has_slash = 0;
+    for (const char* p = file; *p; p++) {
+        has_slash |= *p == '/';
+    }
+    if (has_slash) {
+        fatal_error_errno(try_exec(file, args, envp), "execvpe failed");
+    }
+
+    const char* path = env_get(envp, "PATH");
+    if (!path) {
+        path = "/bin:/usr/bin";
+    }
+    const size_t file_len = str_len(file);
+    int err = ENOENT;
+    int got_eacces = 0;
+    static char candidate[4096];
+    for (;;) {
+        size_t len = 0;
+        while (path[len] && path[len] != ':') {
+            len++;
+        }
+        // An empty entry means the current directory.
+        if (len + 1 + file_len < sizeof(candidate)) {
+            memcpy(candidate, path, len);
+            size_t pos = len;
+            if (len) {
+                candidate[pos++] = '/';
+            }
+            memcpy(candidate + pos, file, file_len + 1);
+
+            err = try_exec(candidate, args, envp);
+            // Keep looking only if it wasn't there (or wasn't for us).
+            if (err == EACCES) {
+                got_eacces = 1;
+            } else if (err != ENOENT && err != ENOTDIR && err != ESTALE &&
+                       err != ENODEV && err != ETIMEDOUT) {
+                break;
+            }
+        } else {
+            err = ENAMETOOLONG;
+        }
+        if (path[len] == '\0') {
+            break;
+        }
+        path += len + 1;
+    }
+    if (got_eacces && (err == ENOENT || err == ENOTDIR)) {
+        err = EACCES;
+    }
+    fatal_error_errno(err, "execvpe failed");
+}
+
+/****
+ * MAIN
+ ****/
+
+static void show_help(int fd) {
+    print(fd, "sst-tiny - Simple Sandboxer Tool, without libc\n"
+              "\n"
+              "Usage:\n"
+              "\n"
+              "    sst-tiny option1 option2 optionN -- command arg1 arg2 argN\n"
+              "\n"
+              "Takes the sandboxing options of sst (see sst --help). The --modes, --timing\n"
+              "and merging nested sst invocations into one layer need sst itself.\n");
+}
+
+__attribute__((noreturn, used)) void tiny_main(long* sp) {
+    const int argc = (int)sp[0];
+    char** argv = (char**)(sp + 1);
+    char** envp = argv + argc + 1;
+
+    // Landlock will fail if this is not set for the calling process.
+    const long nnp = sys6(__NR_prctl, PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0, 0);
+    if (nnp < 0) {
+        fatal_error_errno((int)-nnp, "prctl(PR_SET_NO_NEW_PRIVS) failed");
+    }
+
+    if ((argc == 2 && (str_eq(argv[1], "--help") || str_eq(argv[1], "-h"))) || argc == 1) {
+        show_help(1);
+        sys_exit(0);
+    }
+    if (after_prefix(argv[1], "--") && !str_eq(argv[1], "--")) {
+        fatal_error("%s is not supported by sst-tiny; use sst", argv[1]);
+    }
+
+    int sep_idx = -1;
+    for (int i = 1; i < argc; i++) {
+        if (str_eq(argv[i], "--")) {
+            sep_idx = i;
+            break;
+        }
+    }
+    for (int i = 1; i < sep_idx; i++) {
+        if (str_eq(argv[i], "--help") || str_eq(argv[i], "-h")) {
+            show_help(2);
+            sys_exit(1);
+        }
+    }
+    if (sep_idx == -1) {
+        fatal_error("missing '--' separator in arguments");
+    }
+    if (sep_idx == argc - 1) {
+        fatal_error("no command specified after '--'");
+    }
+
+    // The trigger words first, as they may come after the rules that need
+    // them. Policy files carry their own.
+    int fs_enabled = 0;
+    int net_enabled = 0;
+    for (int i = 1; i < sep_idx; i++) {
+        const char* path;
+        if (str_eq(argv[i], "ENABLE_FILESYSTEM_SANDBOXING")) {
+            fs_enabled = 1;
+        } else if (str_eq(argv[i], "ENABLE_NETWORK_SANDBOXING")) {
+            net_enabled = 1;
+        } else if ((path = after_prefix(argv[i], "POLICY_FILE:"))) {
+            if (!*path) {
+                fatal_error("POLICY_FILE: missing path");
+            }
+            const __u32 flags = load_policy_file(NULL, path);
+            fs_enabled |= (flags & POLICY_FILE_FLAG_FS_SANDBOXING) != 0;
+            net_enabled |= (flags & POLICY_FILE_FLAG_NET_SANDBOXING) != 0;
+        }
+    }
+
+    // Everything that sst would reject while parsing, before any rule is
+    // built.
+    for (int i = 1; i < sep_idx; i++) {
+        const char* arg = argv[i];
+        const char* rest;
+        if (str_eq(arg, "ENABLE_FILESYSTEM_SANDBOXING") || str_eq(arg, "ENABLE_NETWORK_SANDBOXING") ||
+            after_prefix(arg, "POLICY_FILE:")) {
+            continue;
+        }
+        if (!*arg) {
+            fatal_error("There is an empty argument in argument list. strlen(argv[%d]) == 0", i);
+        }
+        if (str_eq(arg, "OPTIMIZE_RULES") || str_eq(arg, "NO_COALESCE")) {
+            continue;
+        }
+        if ((rest = after_prefix(arg, "RESOLVE_THREADS:"))) {
+            long n;
+            if (parse_decimal(rest, 10, &n) != 0 || n > 64) {
+                fatal_error("RESOLVE_THREADS: invalid thread count '%s' (0-%d)", rest, 64);
+            }
+            continue;
+        }
+        if ((rest = after_prefix(arg, "RULESET_CACHE:"))) {
+            if (!*rest) {
+                fatal_error("RULESET_CACHE: missing socket path");
+            }
+            continue;
+        }
+        int known = 0;
+        for (size_t o = 0; o < ARRAY_SIZE(FS_OPTIONS) && !known; o++) {
+            const fs_option* opt = &FS_OPTIONS[o];
+            const int is_list = !after_prefix(arg, opt->prefix) && after_prefix(arg, opt->list_prefix);
+            if (!after_prefix(arg, opt->prefix) && !is_list) {
+                continue;
+            }
+            if (!fs_enabled) {
+                fatal_error("%s requires ENABLE_FILESYSTEM_SANDBOXING", opt->name);
+            }
+            if (!*after_prefix(arg, is_list ? opt->list_prefix : opt->prefix)) {
+                fatal_error(is_list ? "%s_LIST: missing list file" : "%s: missing path", opt->name);
+            }
+            known = 1;
+        }
+        for (size_t o = 0; o < ARRAY_SIZE(NET_OPTIONS) && !known; o++) {
+            const net_option* opt = &NET_OPTIONS[o];
+            if (!(rest = after_prefix(arg, opt->prefix))) {
+                continue;
+            }
+            if (!net_enabled) {
+                fatal_error("%s requires ENABLE_NETWORK_SANDBOXING", opt->name);
+            }
+            long port;
+            if (opt->is_list ? add_port_list(NULL, rest, opt->access) != 0 : parse_port(rest, &port) != 0) {
+                fatal_error(opt->is_list ? "%s: invalid port list '%s'" : "%s: invalid port '%s'", opt->name, rest);
+            }
+            known = 1;
+        }
+        if (!known) {
+            fatal_error("unrecognized option: %s", arg);
+        }
+    }
+
+    if (!fs_enabled && !net_enabled) {
+        fatal_error("no sandboxing options given");
+    }
+
+    const long abi = sys3(__NR_landlock_create_ruleset, 0, 0, LANDLOCK_CREATE_RULESET_VERSION);
+    if (abi == -ENOSYS) {
+        fatal_error("Landlock is not supported by the kernel (ENOSYS)");
+    } else if (abi == -EOPNOTSUPP) {
+        fatal_error("Landlock is disabled in the kernel (EOPNOTSUPP)");
+    } else if (abi < 0) {
+        fatal_error_errno((int)-abi, "landlock_create_ruleset failed");
+    }
+    if (abi < 5) {
+        fatal_error("Landlock ABI version %d is too old; version 5 or later required for this tool", (int)abi);
+    }
+    __u32 restrict_flags = 0;
+    if (abi >= 7) {
+        restrict_flags = LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON;
+    }
+    // The same versions as sst's create_policy_ruleset() knows about.
+    if (abi > 8) {
+        print(2, "sst: warning: Landlock ABI version %d is newer than this tool was designed for. Some restrictions may not work as expected.\n", (int)abi);
+    }
+
+    struct landlock_ruleset_attr attr = {0};
+    if (fs_enabled) {
+        attr.handled_access_fs = FULL_FS_ACCESS;
+    }
+    if (net_enabled) {
+        attr.handled_access_net = LANDLOCK_ACCESS_NET_BIND_TCP | LANDLOCK_ACCESS_NET_CONNECT_TCP;
+    }
+    const long ruleset_fd = sys3(__NR_landlock_create_ruleset, (long)&attr, sizeof(attr), 0);
+    if (ruleset_fd < 0) {
+        fatal_error_errno((int)-ruleset_fd, "failed to create Landlock ruleset");
+    }
+    const ruleset rs = { .fd = (int)ruleset_fd, .handled_fs = attr.handled_access_fs };
+
+    // Now every argument is known to be good; add the rules in order.
+    for (int i = 1; i < sep_idx; i++) {
+        const char* arg = argv[i];
+        const char* rest;
+        if ((rest = after_prefix(arg, "POLICY_FILE:"))) {
+            load_policy_file(&rs, rest);
+            continue;
+        }
+        for (size_t o = 0; o < ARRAY_SIZE(FS_OPTIONS); o++) {
+            const fs_option* opt = &FS_OPTIONS[o];
+            if ((rest = after_prefix(arg, opt->prefix))) {
+                add_fs_rule(&rs, rest, opt->is_directory, opt->access);
+                break;
+            }
+            if ((rest = after_prefix(arg, opt->list_prefix))) {
+                add_fs_rule_list(&rs, opt, rest);
+                break;
+            }
+        }
+        for (size_t o = 0; o < ARRAY_SIZE(NET_OPTIONS); o++) {
+            const net_option* opt = &NET_OPTIONS[o];
+            if (!(rest = after_prefix(arg, opt->prefix))) {
+                continue;
+            }
+            if (opt->is_list) {
+                add_port_list(&rs, rest, opt->access);
+            } else {
+                long port;
+                parse_port(rest, &port);
+                add_net_rule(&rs, port, opt->access);
+            }
+            break;
+        }
+    }
+
+    const long restricted = sys3(__NR_landlock_restrict_self, rs.fd, restrict_flags, 0);
+    if (restricted < 0) {
+        fatal_error_errno((int)-restricted, "failed to apply Landlock ruleset");
+    }
+    sys_close(rs.fd);
+
+    exec_command(&argv[sep_idx + 1], envp);
+}